@@ -7,6 +7,9 @@ use strict;
 use Data::Dumper;
 use Bio::DB::HTS;
 use Getopt::Long;   
+use FindBin;
+use lib $FindBin::Bin;
+use SequenceStore;
 $| = 1;
 
 ## Usage:
@@ -14,6 +17,15 @@ $| = 1;
 ##                  --referenceFasta <path to reference FASTA> 
 ##                  --readsFasta <path to contigs FASTA> 
 ##                  --outputFile <path to text file>
+##                  --BAM2ALIGNMENT_executable <optional: path to the native implementation, src/BAM2ALIGNMENT ('make htslib')>
+##                  --threads <number of threads for the native implementation; default 1>
+##
+## If --BAM2ALIGNMENT_executable is specified, the conversion is carried out by the native implementation,
+## which reads the BAM with multiple threads and sorts internally - the output file is the same
+## (*.sortedWithHeader, sorted in byte order).
+##
+## If <FASTA>.seqstore files (src/BUILD_SEQUENCESTORE) exist for --referenceFasta and --readsFasta, sequences are
+## read from these on demand instead of loading both FASTA files into memory.
 ##
 ## Example command:
 ## ./BAM2ALIGNMENT.pl --BAM /home/data/alignments/SevenGenomesPlusGRCh38Alts.bam 
@@ -27,13 +39,17 @@ my $BAM;
 my $outputFile;
 my $readsFasta;
 my $lenientOrder = 1;
+my $BAM2ALIGNMENT_executable;
+my $threads = 1;
 
 GetOptions (
 	'referenceFasta:s' => \$referenceFasta, 
 	'BAM:s' => \$BAM, 
 	'outputFile:s' => \$outputFile,	
 	'readsFasta:s' => \$readsFasta,	
-	'lenientOrder:s' => \$lenientOrder
+	'lenientOrder:s' => \$lenientOrder,
+	'BAM2ALIGNMENT_executable:s' => \$BAM2ALIGNMENT_executable,
+	'threads:s' => \$threads,
 );
 
 die "Please specify --BAM" unless($BAM);
@@ -44,12 +60,22 @@ die "--BAM $BAM not existing" unless(-e $BAM);
 die "--referenceFasta $referenceFasta not existing" unless(-e $referenceFasta);
 die "--readsFasta $readsFasta not existing" unless(-e $readsFasta);
 
-print "Read $referenceFasta\n";
-my $reference_href = readFASTA($referenceFasta, 0);
+if($BAM2ALIGNMENT_executable)
+{
+	die "--BAM2ALIGNMENT_executable $BAM2ALIGNMENT_executable not existing" unless(-e $BAM2ALIGNMENT_executable);
+	my $cmd_native = qq($BAM2ALIGNMENT_executable --BAM $BAM --referenceFasta $referenceFasta --readsFasta $readsFasta --outputFile $outputFile --threads $threads --lenientOrder $lenientOrder);
+	print "Converting alignments with command:\n\t$cmd_native\n\n";
+	die "Native alignment conversion failed" unless(system($cmd_native) == 0);
+	print "\n\nProduced output file ${outputFile}.sortedWithHeader\n";
+	exit 0;
+}
+
+print "Open $referenceFasta\n";
+my $reference = SequenceStore->open($referenceFasta);
 print "\tdone.\n";
 
-print "Read $readsFasta\n";
-my $reads_href = readFASTA($readsFasta, 0);
+print "Open $readsFasta\n";
+my $reads = SequenceStore->open($readsFasta);
 print "\tdone.\n";
 
 my @out_headerfields = qw/readID chromosome firstPos_reference lastPos_reference firstPos_read lastPos_read strand n_matches n_mismatches n_gaps alignment_reference alignment_read completeReadSequence_plus completeReadSequence_minus/;
@@ -103,9 +129,9 @@ while(my $alignment = $iterator->next_seq)
 		}
 		else
 		{
-			die unless($reads_href->{$readID});
-			$read_href->{completeReadSequence_plus} = $reads_href->{$readID};
-			$read_href->{completeReadSequence_minus} = reverseComplement($reads_href->{$readID});
+			die unless($reads->exists($readID) and $reads->length($readID));
+			$read_href->{completeReadSequence_plus} = $reads->sequence($readID);
+			$read_href->{completeReadSequence_minus} = $reads->sequence($readID, 1);
 			$printed_complete_sequence{$readID}++;
 		}
 		
@@ -289,21 +315,30 @@ sub convertAlignmentToHash
 	
 	$n_gaps = $n_insertions + $n_deletions;
 	
-	die "Missing reference sequence for $chromosome" unless(exists $reference_href->{$chromosome});
-	my $supposed_reference_sequence = substr($reference_href->{$chromosome}, $firstPos_reference, $lastPos_reference - $firstPos_reference + 1);
+	die "Missing reference sequence for $chromosome" unless($reference->exists($chromosome));
+	my $supposed_reference_sequence = $reference->substr($chromosome, $firstPos_reference, $lastPos_reference - $firstPos_reference + 1);
 	
-	unless(exists $reads_href->{$readID})
+	unless($reads->exists($readID))
 	{
 		warn "Missing read sequence for $readID";
 		return undef;
 	}
 	
-	my $read_sequence = $reads_href->{$readID};
-	if($strand eq '-')
+	# substr() of the (possibly reverse-complemented) read - fetch only that interval
+	my $read_length = $reads->length($readID);
+	my $lastPos_read_bounded = ($lastPos_read < $read_length) ? $lastPos_read : ($read_length - 1);
+	my $supposed_read_sequence = '';
+	if($firstPos_read <= $lastPos_read_bounded)
 	{
-		$read_sequence = reverseComplement($read_sequence);
+		if($strand eq '-')
+		{
+			$supposed_read_sequence = $reads->substr($readID, $read_length - 1 - $lastPos_read_bounded, $lastPos_read_bounded - $firstPos_read + 1, 1);
+		}
+		else
+		{
+			$supposed_read_sequence = $reads->substr($readID, $firstPos_read, $lastPos_read_bounded - $firstPos_read + 1);
+		}
 	}
-	my $supposed_read_sequence = substr($read_sequence, $firstPos_read, $lastPos_read - $firstPos_read + 1);
 	
 	my $alignment_reference_noGaps = $alignment_reference;
 	$alignment_reference_noGaps =~ s/\-//g;
@@ -322,7 +357,7 @@ sub convertAlignmentToHash
 			print "\t", $query, "\n";
 			print "\t", "\$inputAlignment->start: ", $inputAlignment->start, "\n";
 			print "\t", "REF: ", $alignment_reference_noGaps, "\n";
-			print "\t", "RE2: ", substr($reference_href->{$chromosome}, $firstPos_reference - 10, 20), "\n";
+			print "\t", "RE2: ", $reference->substr($chromosome, (($firstPos_reference >= 10) ? ($firstPos_reference - 10) : 0), 20), "\n";
 			print "\t", "ALG: ", $supposed_reference_sequence, "\n";
 			print "\t", "strand: ", $strand, "\n";			
 			print "\n";
@@ -365,43 +400,4 @@ sub convertAlignmentToHash
 		alignment_read => $alignment_read,
 	};
 }
- 
-sub readFASTA
-{
-	my $file = shift;	
-	my $keepCompleteIdentier = shift;
-	my %R;
-	
-	open(F, '<', $file) or die "Cannot open $file";
-	my $currentSequence;
-	while(<F>)
-	{	
-		my $line = $_;
-		chomp($line);
-		$line =~ s/[\n\r]//g;
-		if(substr($line, 0, 1) eq '>')
-		{
-			$currentSequence = substr($line, 1);
-			unless($keepCompleteIdentier)
-			{
-				$currentSequence =~ s/\s.+//;
-			}
-		}
-		else
-		{
-			$R{$currentSequence} .= $line;
-		}
-	}	
-	close(F);
-		
-	return \%R;
-}
 
-
-sub reverseComplement
-{
-	my $kMer = shift;
-	$kMer =~ tr/ACGT/TGCA/;
-	return reverse($kMer);
-	return $kMer;
-}
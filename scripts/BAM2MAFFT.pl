@@ -9,6 +9,9 @@ use Getopt::Long;
 use Data::Dumper;
 use Set::IntervalTree;
 use File::Path;
+use FindBin;
+use lib $FindBin::Bin;
+use SequenceStore;
 
 $| = 1;
 
@@ -17,6 +20,21 @@ $| = 1;
 ##                  --readsFasta <path to contigs FASTA>
 ##                  --outputDirectory <path to output directory for MAFFT, e.g. '/forMAFFT'>
 ##                  --inputTruncatedReads <path to output of FIND_GLOBAL_ALIGNMENTS.pl, 'outputTruncatedReads'>
+##                  --BAM2MAFFT_executable <optional: path to the native implementation, src/BAM2MAFFT ('make htslib')>
+##                  --threads <number of BAM decompression threads for the native implementation; default 1>
+##                  --breakpointCost <optional, native implementation only: 'first' (default, same windows as this script) or 'gapRate'>
+##                  --targetCost <optional, native implementation only: estimated MAFFT cost per window; default 0 (fixed window size)>
+##                  --minWindowSize / --maxWindowSize <optional, for --targetCost; defaults 1000 / 50000>
+##
+## If --BAM2MAFFT_executable is specified, coverage and windows are computed by the native implementation,
+## which works on CIGAR operations instead of individual alignment columns - the output files are the same
+## (sequences within a window file are written in a fixed order). The native implementation needs a BAM index
+## and FASTA indices (.fai, created if not present). It also writes the estimated MAFFT cost of each window
+## to _windowsCost, which CALLMAFFT.pl uses to start the most expensive windows first; with --targetCost,
+## window sizes are chosen so that each window has an estimated cost of about --targetCost.
+##
+## If <FASTA>.seqstore files (src/BUILD_SEQUENCESTORE) exist for --referenceFasta and --readsFasta, this script
+## reads sequences from these on demand instead of loading both FASTA files into memory.
 ##
 ## Example command
 ## ./BAM2MAFFT.pl --BAM /data/projects/phillippy/projects/hackathon/intermediate_files/forMAFFT.bam 
@@ -30,6 +48,12 @@ my $BAM;
 my $outputDirectory;
 my $inputTruncatedReads;
 my $readsFasta;
+my $BAM2MAFFT_executable;
+my $threads = 1;
+my $breakpointCost = 'first';
+my $targetCost = 0;
+my $minWindowSize = 1000;
+my $maxWindowSize = 50000;
 
 GetOptions (
 	'referenceFasta:s' => \$referenceFasta, 
@@ -37,6 +61,12 @@ GetOptions (
 	'outputDirectory:s' => \$outputDirectory,	
 	'readsFasta:s' => \$readsFasta,	
 	'inputTruncatedReads:s' => \$inputTruncatedReads,	
+	'BAM2MAFFT_executable:s' => \$BAM2MAFFT_executable,	
+	'threads:s' => \$threads,	
+	'breakpointCost:s' => \$breakpointCost,	
+	'targetCost:s' => \$targetCost,	
+	'minWindowSize:s' => \$minWindowSize,	
+	'maxWindowSize:s' => \$maxWindowSize,	
 );
 
 die "Please specify --BAM" unless($BAM);
@@ -51,6 +81,8 @@ die "--referenceFasta $referenceFasta not existing" unless(-e $referenceFasta);
 
 die "--inputTruncatedReads $inputTruncatedReads not existing" unless(-e $inputTruncatedReads);
 
+die "--targetCost requires --BAM2MAFFT_executable" if($targetCost and not $BAM2MAFFT_executable);
+
 die "Security check - $outputDirectory will be deleted" unless($outputDirectory =~ /mafft/i);
 rmtree($outputDirectory);
 unless((-e $outputDirectory) and (-d $outputDirectory))
@@ -58,9 +90,18 @@ unless((-e $outputDirectory) and (-d $outputDirectory))
 	mkdir($outputDirectory) or die "Cannot mkdir $outputDirectory directory";
 }
 
-my $reads_href = readFASTA($readsFasta, 0);
+if($BAM2MAFFT_executable)
+{
+	die "--BAM2MAFFT_executable $BAM2MAFFT_executable not existing" unless(-e $BAM2MAFFT_executable);
+	my $cmd_native = qq($BAM2MAFFT_executable --BAM $BAM --referenceFasta $referenceFasta --readsFasta $readsFasta --outputDirectory $outputDirectory --inputTruncatedReads $inputTruncatedReads --threads $threads --breakpointCost $breakpointCost --targetCost $targetCost --minWindowSize $minWindowSize --maxWindowSize $maxWindowSize);
+	print "Computing MAFFT windows with command:\n\t$cmd_native\n\n";
+	die "Native window computation failed" unless(system($cmd_native) == 0);
+	exit 0;
+}
+
+my $reads = SequenceStore->open($readsFasta);
 
-my $reference_href = readFASTA($referenceFasta);
+my $reference = SequenceStore->open($referenceFasta);
 my $sam = Bio::DB::HTS->new(-fasta => $referenceFasta, -bam => $BAM);
 
 my %truncatedReads;
@@ -91,25 +132,24 @@ my @sequence_ids = $sam->seq_ids();
 foreach my $referenceSequenceID (@sequence_ids)
 {	
 	next unless($referenceSequenceID =~ /chr[XY\d]+/);
-	unless(exists $reference_href->{$referenceSequenceID})
+	unless($reference->exists($referenceSequenceID))
 	{
 		warn "No reference sequence for $referenceSequenceID";
 		next;
 	}
-	next unless(length($reference_href->{$referenceSequenceID}) > 20000);
+	next unless($reference->length($referenceSequenceID) > 20000);
 	
 	my $chrDir = $referenceSequenceID;
 	$chrDir =~ s/\W//g;
 	die "Duplicate directory $chrDir?" if(exists $saw_ref_IDs{$chrDir});
 	mkdir( $outputDirectory . '/' . $chrDir) or die "Cannot mkdir $chrDir";
 	
-	print "Processing $referenceSequenceID", ", length ", length($reference_href->{$referenceSequenceID}), "\n";
-	die "Length discrepancy between supplied FASTA reference and BAM index: " . $sam->length($referenceSequenceID) . " vs " . length($reference_href->{$referenceSequenceID}) unless($sam->length($referenceSequenceID) == length($reference_href->{$referenceSequenceID}));
-	next unless(defined $reference_href->{$referenceSequenceID});
+	print "Processing $referenceSequenceID", ", length ", $reference->length($referenceSequenceID), "\n";
+	die "Length discrepancy between supplied FASTA reference and BAM index: " . $sam->length($referenceSequenceID) . " vs " . $reference->length($referenceSequenceID) unless($sam->length($referenceSequenceID) == $reference->length($referenceSequenceID));
 	
 	my %sequences_per_window;
 	my @window_positions;
-	my @contig_coverage = ((0) x length($reference_href->{$referenceSequenceID}));
+	my @contig_coverage = ((0) x $reference->length($referenceSequenceID));
 	my @contig_coverage_nonGap = ((0) x scalar(@contig_coverage));
 	
 	my $alignment_iterator = $sam->features(-seq_id => $referenceSequenceID, -iterator => 1);
@@ -224,7 +264,7 @@ foreach my $referenceSequenceID (@sequence_ids)
 	print WINDOWS join("\t", $referenceSequenceID, $chrDir, 0, 0, $firstWindow_lastPos, $contig_coverage[$firstWindow_lastPos], $contig_coverage_nonGap[$firstWindow_lastPos]), "\n";
 	
 	my $first_window_idx_key = 'w0';
-	my $first_window_referenceSequence = substr($reference_href->{$referenceSequenceID}, 0, $window_positions[0]);
+	my $first_window_referenceSequence = $reference->substr($referenceSequenceID, 0, $window_positions[0]);
 	$sequences_per_window{$first_window_idx_key}{ref} = $first_window_referenceSequence;
 	
 	for(my $windowI = 0; $windowI <= $#window_positions; $windowI++)
@@ -264,7 +304,7 @@ foreach my $referenceSequenceID (@sequence_ids)
 		), "\n";
 		
 		my $window_idx_key = 'w' . ($windowI + 1);
-		my $referenceSequence = substr($reference_href->{$referenceSequenceID}, $window_positions[$windowI], $window_lastPos - $window_positions[$windowI] + 1);
+		my $referenceSequence = $reference->substr($referenceSequenceID, $window_positions[$windowI], $window_lastPos - $window_positions[$windowI] + 1);
 		$sequences_per_window{$window_idx_key}{ref} = $referenceSequence;
 	}
 	
@@ -389,15 +429,15 @@ foreach my $referenceSequenceID (@sequence_ids)
 		
 		foreach my $sequenceID (grep {$sequenceID_not_seen{$_}} keys %sequenceID_not_seen)
 		{
-			unless(exists $reads_href->{$sequenceID})
+			unless($reads->exists($sequenceID))
 			{
 				warn "No truth sequence for $sequenceID";
 				delete($runningSequencesForReconstruction{$sequenceID});				
 				next;
 			}
 			
-			my $trueSequence = $reads_href->{$sequenceID};
-			my $trueSequence_revCmp = reverseComplement($trueSequence);
+			my $trueSequence = $reads->sequence($sequenceID);
+			my $trueSequence_revCmp = $reads->sequence($sequenceID, 1);
 			
 			my $supposedSequence = $runningSequencesForReconstruction{$sequenceID};
 			if(($supposedSequence eq $trueSequence) or ($supposedSequence eq $trueSequence_revCmp))
@@ -420,39 +460,3 @@ foreach my $referenceSequenceID (@sequence_ids)
 
 close(WINDOWS);
 close(ALIGNMENTSONLYGAPS);
-												 
-sub readFASTA
-{
-	my $file = shift;	
-	my %R;
-	
-	open(F, '<', $file) or die "Cannot open $file";
-	my $currentSequence;
-	while(<F>)
-	{
-		my $line = $_;
-		chomp($line);
-		$line =~ s/[\n\r]//g;
-		if(substr($line, 0, 1) eq '>')
-		{
-			$currentSequence = substr($line, 1);
-			$currentSequence =~ s/\s.+//;
-		}
-		else
-		{
-			$R{$currentSequence} .= $line;
-		}
-	}	
-	close(F);
-		
-	return \%R;
-}
-
-sub reverseComplement
-{
-	my $kMer = shift;
-	$kMer =~ tr/ACGT/TGCA/;
-	return reverse($kMer);
-	return $kMer;
-}
-
@@ -12,6 +12,8 @@ use File::Copy "cp";
 use FindBin;
 use File::Spec;
 use Cwd;
+use IO::Handle;
+use Digest::SHA;
 my $current_dir = getcwd;
 
 $| = 1;
@@ -25,10 +27,34 @@ $| = 1;
 ##              --fas2bam_path <path to script 'fas2bam.pl', required>
 ##              --samtools_path <path to SAMtools executable for fas2bam.pl, required>
 ##              --bamheader <path to file containing header for BAM file for fas2bam.pl, required>
+##              --fas2bam_executable <optional: path to native FAS2BAM (from /src, 'make htslib') - replaces fas2bam.pl and samtools>
+##              --poa_executable <optional: path to native WINDOWPOA (from /src, 'make all') - MAFFT is then only used for windows that fail its quality checks>
+##              --local <optional: number of parallel local jobs for actions 'kickOff' and 'reprocess' - replaces qsub>
+##              --maxAttempts <only used with --local, number of attempts per window; default 3>
+##              --cacheDir <optional: directory for cached window results, shared between runs>
+##
+## With --local, windows are processed on this machine by a pool of worker processes, largest windows first -
+## by the estimated alignment cost in _windowsCost (written by the native BAM2MAFFT) if present, otherwise by
+## file size.
+## Failed windows are retried, and finished windows are recorded in the journal file _journal in --mafftDirectory.
+## If the journal exists, actions 'check' and 'reprocess' use it instead of scanning the window directories.
+##
+## With --fas2bam_executable, the MSAs are converted into window BAMs in batches (per chunk, or per
+## 500 windows with --local) by a single invocation of the native encoder.
+##
+## With --cacheDir, the MSA and BAM of each processed window are stored in the cache, keyed by a hash of the
+## window FASTA, the MAFFT executable, version and arguments, the native aligner (if used), the BAM conversion
+## tools and --bamheader. Windows with a cache entry are restored instead of being aligned again; the hashes
+## are recorded in <window>.cacheKey, which checkMAFFT_input_and_output.pl verifies.
+##
+## With --poa_executable, the windows are first aligned in-process by the native banded POA aligner (one invocation
+## per chunk, or for all windows with --local, using --local threads); MAFFT is run for the remaining windows only.
 ##
 ## Example command
 ## ./CALLMAFFT.pl --action kickOff --mafftDirectory ../intermediate_files/forMAFFT --qsub 1 
 ##                --mafft_executable /mafft/mafft-7.273-with-extensions/install/bin/mafft --fas2bam_path /intermediate_files/fas2bam.pl --samtools_path /usr/local/bin/samtools --bamheader windowbam.header.txt
+## ./CALLMAFFT.pl --action kickOff --mafftDirectory ../intermediate_files/forMAFFT --local 32
+##                --mafft_executable /mafft/mafft-7.273-with-extensions/install/bin/mafft --fas2bam_path /intermediate_files/fas2bam.pl --samtools_path /usr/local/bin/samtools --bamheader windowbam.header.txt
 ## ./CALLMAFFT.pl --action check --mafftDirectory ../intermediate_files/forMAFFT
 ##                --mafft_executable /mafft/mafft-7.273-with-extensions/install/bin/mafft --fas2bam_path /intermediate_files/fas2bam.pl --samtools_path /usr/local/bin/samtools --bamheader windowbam.header.txt
 ## ./CALLMAFFT.pl --action reprocess --mafftDirectory ../intermediate_files/forMAFFT
@@ -54,6 +80,14 @@ my $mafft_executable;
 my $fas2bam_path;
 my $samtools_path;
 my $bamheader;
+my $local = 0;
+my $maxAttempts = 3;
+my $fas2bam_executable;
+my $fas2bam_batchSize = 500;
+my $poa_executable;
+my $cacheDir;
+my $mafft_arguments = '--retree 1 --maxiterate 0 --quiet';
+my $cache_tools_key;
 
 GetOptions (
 	'action:s' => \$action,
@@ -67,12 +101,26 @@ GetOptions (
 	'fas2bam_path:s' => \$fas2bam_path,
 	'samtools_path:s' => \$samtools_path,
 	'bamheader:s' => \$bamheader,
+	'local:s' => \$local,
+	'maxAttempts:s' => \$maxAttempts,
+	'fas2bam_executable:s' => \$fas2bam_executable,
+	'poa_executable:s' => \$poa_executable,
+	'cacheDir:s' => \$cacheDir,
 );
 
 die unless($mafft_executable);
-die unless($fas2bam_path);
-die unless($samtools_path);
+unless($fas2bam_executable)
+{
+	die unless($fas2bam_path);
+	die unless($samtools_path);
+}
 die unless($bamheader);
+if($cacheDir)
+{
+	mkpath($cacheDir) unless(-d $cacheDir);
+	die "Cannot create --cacheDir $cacheDir" unless(-d $cacheDir);
+	$cacheDir = File::Spec->rel2abs($cacheDir);
+}
 
 unless($action)
 {
@@ -80,7 +128,45 @@ unless($action)
 }
 my $fn_files_to_process = $mafftDirectory . '/files_to_process';
 my $fn_files_to_reprocess = $mafftDirectory . '/files_to_reprocess';
-if($action eq 'reprocess')
+my $fn_journal = $mafftDirectory . '/_journal';
+if(($action eq 'reprocess') and (-e $fn_journal) and (-e $fn_files_to_process))
+{
+	print "Reprocess (journal)....\n\n";
+	
+	my @files_missing = files_not_in_journal();
+	open(REPROCESS, '>', $fn_files_to_reprocess) or die "Cannot open $fn_files_to_reprocess";
+	print REPROCESS map {$_ . "\n"} @files_missing;
+	close(REPROCESS);
+	
+	print "Now redo: ", scalar(@files_missing), " \n";
+	
+	if($local)
+	{
+		process_local(\@files_missing, 0);
+	}
+	elsif(scalar(@files_missing))
+	{
+		invoke_self_array(ceil(scalar(@files_missing) / $chunkSize) - 1, 1);
+	}
+}
+elsif(($action eq 'check') and (-e $fn_journal) and (-e $fn_files_to_process))
+{
+	print "Check (journal)....\n\n";
+	
+	my @files_missing = files_not_in_journal();
+	my $n_files_found = 0;
+	open(FILES_TO_PROCESS, '<', $fn_files_to_process) or die "Cannot open $fn_files_to_process";
+	while(<FILES_TO_PROCESS>)
+	{
+		$n_files_found++ if($_ =~ /\S/);
+	}
+	close(FILES_TO_PROCESS);
+	
+	print "Total found files: $n_files_found\n";
+	print "Completed according to journal: ", ($n_files_found - scalar(@files_missing)), "\n\n";
+	print "Would now redo: ", scalar(@files_missing), " \n";
+}
+elsif($action eq 'reprocess')
 {
 	print "Reprocess....\n\n";
 	
@@ -148,9 +234,16 @@ if($action eq 'reprocess')
 	print "With BAM: $n_files_found_withBAM \n\n";
 	print "Now redo: $n_files \n";
 	
-	my $n_chunks = ceil($n_files / $chunkSize);
-	
-	invoke_self_array($n_chunks-1, 1);
+	if($local)
+	{
+		process_local(read_file_list($fn_files_to_reprocess), 0);
+	}
+	else
+	{
+		my $n_chunks = ceil($n_files / $chunkSize);
+		
+		invoke_self_array($n_chunks-1, 1);
+	}
 	
 }
 elsif($action eq 'check')
@@ -269,7 +362,14 @@ elsif($action eq 'kickOff')
 	my $n_chunks = ceil($n_files / $chunkSize);
 	close(FILES_TO_PROCESS);
 	
-	invoke_self_array($n_chunks-1);
+	if($local)
+	{
+		process_local(read_file_list($fn_files_to_process), 1);
+	}
+	else
+	{
+		invoke_self_array($n_chunks-1);
+	}
 }
 elsif($action eq 'processChunk')
 {
@@ -297,21 +397,24 @@ elsif($action eq 'processChunk')
 	}
 	close(FILES_TO_PROCESS);
 	
+	@files_to_process = restore_windows_from_cache(\@files_to_process) if($cacheDir);
+	makeMSAs_POA(\@files_to_process, 1) if($poa_executable);
 	foreach my $file (@files_to_process)
 	{
-		print "Processing $file \n";
-		die "File weird name: $file" unless($file=~ /\.fa$/);
-		my $msaFile = $file;
-		$msaFile=~ s/\.fa$/.mfa/;
-		
-		my $bamFile = $file;
-		$bamFile=~ s/\.fa$/.bam/;
-		
-		makeMSA($file, $msaFile);
-		makeBAM($msaFile, $bamFile);
+		process_window($file, $fas2bam_executable);
 		# todo
 		#unlink($msaFile);
 	}
+	
+	if($fas2bam_executable)
+	{
+		my @failed = makeBAMs(\@files_to_process);
+		if(scalar(@failed))
+		{
+			die "Could not create BAMs for windows:\n" . join("\n", map {' - '.$_} @failed);
+		}
+	}
+	store_windows_in_cache(\@files_to_process) if($cacheDir);
 }
 else
 {
@@ -353,12 +456,391 @@ sub makeBAM
 	}
 }
 
+sub makeBAMs
+{
+	my $files_aref = shift;
+	return () unless(scalar(@$files_aref));
+	
+	my $fn_list = $mafftDirectory . '/_fas2bam_' . $$;
+	open(LIST, '>', $fn_list) or die "Cannot open $fn_list";
+	foreach my $file (@$files_aref)
+	{
+		die "File weird name: $file" unless($file=~ /\.fa$/);
+		my $msaFile = $file;
+		$msaFile=~ s/\.fa$/.mfa/;
+		my $bamFile = $file;
+		$bamFile=~ s/\.fa$/.bam/;
+		unlink($bamFile);
+		print LIST $msaFile, "\t", $bamFile, "\n";
+	}
+	close(LIST);
+	
+	my $cmd_makeBAMs = qq($fas2bam_executable --inputList $fn_list --ref "ref" --bamheader $bamheader);
+	if(system($cmd_makeBAMs))
+	{
+		print "Command $cmd_makeBAMs reported failed windows.\n";
+	}
+	unlink($fn_list);
+	
+	return grep {my $bamFile = $_; $bamFile =~ s/\.fa$/.bam/; not -e $bamFile} @$files_aref;
+}
+
+sub makeMSAs_POA
+{
+	my $files_aref = shift;
+	my $threads = shift;
+	return unless(scalar(@$files_aref));
+	
+	my $fn_list = $mafftDirectory . '/_poa_' . $$;
+	my $fn_failed = $fn_list . '.failed';
+	open(LIST, '>', $fn_list) or die "Cannot open $fn_list";
+	print LIST map {$_ . "\n"} @$files_aref;
+	close(LIST);
+	
+	my $cmd_POA = qq($poa_executable --inputList $fn_list --failedList $fn_failed --threads $threads);
+	print "Executing $cmd_POA \n";
+	if(system($cmd_POA))
+	{
+		die "Command $cmd_POA failed";
+	}
+	
+	my $n_failed = 0;
+	open(FAILED, '<', $fn_failed) or die "Cannot open $fn_failed";
+	while(<FAILED>)
+	{
+		$n_failed++ if($_ =~ /\S/);
+	}
+	close(FAILED);
+	print "Native alignment: ", (scalar(@$files_aref) - $n_failed), " windows aligned, $n_failed left for MAFFT.\n";
+	
+	unlink($fn_list);
+	unlink($fn_failed);
+}
+
+sub process_local
+{
+	my $files_aref = shift;
+	my $resetJournal = shift;
+	
+	die "Please specify a positive number for --local" unless($local =~ /^\d+$/ and ($local > 0));
+	die "Please specify a positive number for --maxAttempts" unless($maxAttempts =~ /^\d+$/ and ($maxAttempts > 0));
+	
+	# largest windows first, so that the long MAFFT runs don't end up at the end of the queue
+	my $windows_cost_href = read_windows_cost();
+	my %file_size = map {my $window_key = join('/', (File::Spec->splitdir($_))[-2, -1]); $_ => $windows_cost_href->{$window_key}} @$files_aref;
+	if(grep {not defined $file_size{$_}} @$files_aref)
+	{
+		# costs and file sizes are not comparable
+		%file_size = map {$_ => (-s $_)} @$files_aref;
+	}
+	my @queue = sort {($file_size{$b} <=> $file_size{$a}) or ($a cmp $b)} @$files_aref;
+	my %attempts;
+	my %running;
+	my $n_done = 0;
+	my @failed;
+	my @pending_BAM;
+	
+	open(JOURNAL, ($resetJournal ? '>' : '>>'), $fn_journal) or die "Cannot open $fn_journal";
+	JOURNAL->autoflush(1);
+	
+	my $finish_window = sub {
+		my $file = shift;
+		my $ok = shift;
+		my $startTime = shift;
+		if($ok)
+		{
+			print JOURNAL join("\t", 'done', $file, $attempts{$file}, time() - $startTime), "\n";
+			$n_done++;
+			store_windows_in_cache([$file]) if($cacheDir);
+		}
+		elsif($attempts{$file} < $maxAttempts)
+		{
+			print "Window $file failed (attempt $attempts{$file}), will retry.\n";
+			push(@queue, $file);
+		}
+		else
+		{
+			print JOURNAL join("\t", 'failed', $file, $attempts{$file}, time() - $startTime), "\n";
+			push(@failed, $file);
+		}
+	};
+	
+	# windows restored from the cache are journaled with 0 attempts
+	if($cacheDir)
+	{
+		my %not_restored = map {$_ => 1} restore_windows_from_cache(\@queue);
+		foreach my $file (grep {not $not_restored{$_}} @queue)
+		{
+			print JOURNAL join("\t", 'done', $file, 0, 0), "\n";
+			$n_done++;
+		}
+		@queue = grep {$not_restored{$_}} @queue;
+	}
+	
+	makeMSAs_POA(\@queue, $local) if($poa_executable);
+	
+	print "Process ", scalar(@queue), " windows locally with $local parallel jobs.\n";
+	while(scalar(@queue) or scalar(keys %running))
+	{
+		while(scalar(@queue) and (scalar(keys %running) < $local))
+		{
+			my $file = shift(@queue);
+			$attempts{$file}++;
+			my $pid = fork();
+			die "Cannot fork" unless(defined $pid);
+			if($pid == 0)
+			{
+				close(JOURNAL);
+				my $ok = eval {
+					process_window($file, $fas2bam_executable);
+					1;
+				};
+				unless($ok)
+				{
+					print STDERR "Window $file failed: $@\n";
+				}
+				POSIX::_exit($ok ? 0 : 1);
+			}
+			$running{$pid} = [$file, time()];
+		}
+		
+		my $pid = waitpid(-1, 0);
+		last if($pid == -1);
+		next unless(exists $running{$pid});
+		my $exitStatus = $?;
+		my ($file, $startTime) = @{$running{$pid}};
+		delete $running{$pid};
+		
+		my $bamFile = $file;
+		$bamFile =~ s/\.fa$/.bam/;
+		if($fas2bam_executable and ($exitStatus == 0))
+		{
+			push(@pending_BAM, [$file, $startTime]);
+		}
+		else
+		{
+			$finish_window->($file, (($exitStatus == 0) and (-e $bamFile)), $startTime);
+		}
+		
+		# the MSAs of finished windows are converted together, once a batch is full or no MAFFT job is running anymore
+		if(scalar(@pending_BAM) and ((scalar(@pending_BAM) >= $fas2bam_batchSize) or (not scalar(keys %running))))
+		{
+			my %failed_BAM = map {$_ => 1} makeBAMs([map {$_->[0]} @pending_BAM]);
+			foreach my $pending (@pending_BAM)
+			{
+				$finish_window->($pending->[0], (not $failed_BAM{$pending->[0]}), $pending->[1]);
+			}
+			@pending_BAM = ();
+		}
+	}
+	close(JOURNAL);
+	
+	print "Processed $n_done windows, ", scalar(@failed), " failed.\n";
+	if(scalar(@failed))
+	{
+		die "Failed windows (after $maxAttempts attempts each):\n" . join("\n", map {' - '.$_} @failed) . "\nRe-run with --action reprocess.\n";
+	}
+}
+
+sub process_window
+{
+	my $file = shift;
+	my $skipBAM = shift;
+	
+	print "Processing $file \n";
+	die "File weird name: $file" unless($file=~ /\.fa$/);
+	my $msaFile = $file;
+	$msaFile=~ s/\.fa$/.mfa/;
+	
+	my $bamFile = $file;
+	$bamFile=~ s/\.fa$/.bam/;
+	
+	my $cacheKeyFile = $file;
+	$cacheKeyFile =~ s/\.fa$/.cacheKey/;
+	unlink($cacheKeyFile);
+	
+	# windows aligned by the native aligner already have their MSA
+	makeMSA($file, $msaFile) unless($poa_executable and (-e $msaFile));
+	makeBAM($msaFile, $bamFile) unless($skipBAM);
+}
+
+sub read_windows_cost
+{
+	# chrDir/<referenceContigID>_<windowI>.fa -> estimated cost
+	my %cost;
+	my $fn = $mafftDirectory . '/_windowsCost';
+	return \%cost unless(-e $fn);
+	open(COST, '<', $fn) or die "Cannot open $fn";
+	my $header_line = <COST>;
+	chomp($header_line);
+	my @header_fields = split(/\t/, $header_line);
+	my %header_index = map {$header_fields[$_] => $_} (0 .. $#header_fields);
+	while(<COST>)
+	{
+		my $line = $_;
+		chomp($line);
+		next unless($line);
+		my @line_fields = split(/\t/, $line);
+		die "Weird number of fields in $fn" unless($#line_fields == $#header_fields);
+		my ($chrDir, $referenceContigID, $windowI, $estimatedCost) = @line_fields[@header_index{qw/chrDir referenceContigID windowI estimatedCost/}];
+		$cost{$chrDir . '/' . $referenceContigID . '_' . $windowI . '.fa'} = $estimatedCost;
+	}
+	close(COST);
+	return \%cost;
+}
+
+sub file_digest
+{
+	my $fn = shift;
+	die "File $fn not existing" unless(-e $fn);
+	return Digest::SHA->new(256)->addfile($fn, 'b')->hexdigest;
+}
+
+sub window_cache_key
+{
+	my $fastaDigest = shift;
+	
+	# everything apart from the window FASTA that determines the MSA and the BAM made from it
+	unless(defined $cache_tools_key)
+	{
+		my $mafft_version = qx($mafft_executable --version 2>&1 < /dev/null);
+		my @tools = ('mafft', file_digest($mafft_executable), $mafft_version, $mafft_arguments, 'bamheader', file_digest($bamheader));
+		push(@tools, 'poa', file_digest($poa_executable)) if($poa_executable);
+		if($fas2bam_executable)
+		{
+			push(@tools, 'fas2bam', file_digest($fas2bam_executable));
+		}
+		else
+		{
+			push(@tools, 'fas2bam.pl', file_digest($fas2bam_path), 'samtools', file_digest($samtools_path));
+		}
+		$cache_tools_key = Digest::SHA::sha256_hex(join("\n", @tools));
+	}
+	
+	return Digest::SHA::sha256_hex($cache_tools_key . "\n" . $fastaDigest);
+}
+
+sub restore_windows_from_cache
+{
+	my $files_aref = shift;
+	
+	# returns the windows that are not in the cache
+	my @not_restored;
+	foreach my $file (@$files_aref)
+	{
+		die "File weird name: $file" unless($file=~ /\.fa$/);
+		my $msaFile = $file;
+		$msaFile =~ s/\.fa$/.mfa/;
+		my $bamFile = $file;
+		$bamFile =~ s/\.fa$/.bam/;
+		my $cacheKeyFile = $file;
+		$cacheKeyFile =~ s/\.fa$/.cacheKey/;
+		
+		my $key = window_cache_key(file_digest($file));
+		my $entry = $cacheDir . '/' . substr($key, 0, 2) . '/' . $key;
+		unless(-e $entry . '/window.cacheKey')
+		{
+			push(@not_restored, $file);
+			next;
+		}
+		
+		# the BAM marks a window as done, so it is moved into place last
+		cp($entry . '/window.mfa', $msaFile) or die "Cannot copy $entry/window.mfa";
+		cp($entry . '/window.cacheKey', $cacheKeyFile) or die "Cannot copy $entry/window.cacheKey";
+		cp($entry . '/window.bam', $bamFile . '.tmp_cache') or die "Cannot copy $entry/window.bam";
+		rename($bamFile . '.tmp_cache', $bamFile) or die "Cannot rename $bamFile.tmp_cache";
+	}
+	
+	print "Restored ", (scalar(@$files_aref) - scalar(@not_restored)), " of ", scalar(@$files_aref), " windows from --cacheDir $cacheDir.\n";
+	return @not_restored;
+}
+
+sub store_windows_in_cache
+{
+	my $files_aref = shift;
+	
+	foreach my $file (@$files_aref)
+	{
+		my $msaFile = $file;
+		$msaFile =~ s/\.fa$/.mfa/;
+		my $bamFile = $file;
+		$bamFile =~ s/\.fa$/.bam/;
+		my $cacheKeyFile = $file;
+		$cacheKeyFile =~ s/\.fa$/.cacheKey/;
+		next unless((-e $msaFile) and (-e $bamFile));
+		
+		my $fastaDigest = file_digest($file);
+		my $key = window_cache_key($fastaDigest);
+		open(CACHEKEY, '>', $cacheKeyFile) or die "Cannot open $cacheKeyFile";
+		print CACHEKEY join("\t", $key, $fastaDigest, file_digest($msaFile), file_digest($bamFile)), "\n";
+		close(CACHEKEY);
+		
+		# entries are written under a temporary name, so that concurrent jobs never see incomplete entries
+		my $entry = $cacheDir . '/' . substr($key, 0, 2) . '/' . $key;
+		next if(-e $entry);
+		my $entry_temp = $entry . '.tmp_' . $$;
+		mkpath($entry_temp);
+		cp($msaFile, $entry_temp . '/window.mfa') or die "Cannot copy $msaFile into $entry_temp";
+		cp($bamFile, $entry_temp . '/window.bam') or die "Cannot copy $bamFile into $entry_temp";
+		cp($cacheKeyFile, $entry_temp . '/window.cacheKey') or die "Cannot copy $cacheKeyFile into $entry_temp";
+		rmtree($entry_temp) unless(rename($entry_temp, $entry));
+	}
+}
+
+sub read_file_list
+{
+	my $fn = shift;
+	my @files;
+	open(FILELIST, '<', $fn) or die "Cannot open $fn";
+	while(<FILELIST>)
+	{
+		my $file = $_;
+		chomp($file);
+		next unless($file);
+		die "File $file not existing" unless(-e $file);
+		push(@files, $file);
+	}
+	close(FILELIST);
+	return \@files;
+}
+
+sub files_not_in_journal
+{
+	my %done;
+	open(JOURNAL, '<', $fn_journal) or die "Cannot open $fn_journal";
+	while(<JOURNAL>)
+	{
+		my $line = $_;
+		chomp($line);
+		my @fields = split(/\t/, $line);
+		next unless(scalar(@fields) >= 2);
+		if($fields[0] eq 'done')
+		{
+			$done{$fields[1]} = 1;
+		}
+		else
+		{
+			delete $done{$fields[1]};
+		}
+	}
+	close(JOURNAL);
+	
+	# windows processed outside of the local executor (qsub) are not in the journal
+	return grep {my $bamFile = $_; $bamFile =~ s/\.fa$/.bam/; (not $done{$_}) and (not -e $bamFile)} @{read_file_list($fn_files_to_process)};
+}
+
 sub invoke_self_array
 {
 	my $maxChunk_0based = shift;
 	my $reprocess = shift;
 	
 	my $reprocess_string = ($reprocess) ? " --reprocess 1 " : '';
+	my $tools_string = "--mafft_executable $mafft_executable --bamheader $bamheader";
+	$tools_string .= " --fas2bam_path $fas2bam_path" if($fas2bam_path);
+	$tools_string .= " --samtools_path $samtools_path" if($samtools_path);
+	$tools_string .= " --fas2bam_executable $fas2bam_executable" if($fas2bam_executable);
+	$tools_string .= " --poa_executable $poa_executable" if($poa_executable);
+	$tools_string .= " --cacheDir $cacheDir" if($cacheDir);
 	my $mafftDirectory_abs = File::Spec->rel2abs($mafftDirectory);
 	if($qsub)
 	{	
@@ -374,7 +856,7 @@ sub invoke_self_array
 #\$ -N 'CALLMAFFT'
 jobID=\$(expr \$SGE_TASK_ID - 1)
 cd $current_dir
-perl $path_to_script --mafftDirectory $mafftDirectory_abs --action processChunk --chunkI \$jobID --chunkSize $chunkSize $reprocess_string
+perl $path_to_script --mafftDirectory $mafftDirectory_abs --action processChunk --chunkI \$jobID --chunkSize $chunkSize $reprocess_string $tools_string
 );
 		close(QSUB);
 		my $qsub_cmd = "qsub $temp_qsub";
@@ -388,7 +870,7 @@ perl $path_to_script --mafftDirectory $mafftDirectory_abs --action processChunk
 		for(my $chunkI = 0; $chunkI <= $maxChunk_0based; $chunkI++)
 		{
 			print "Call myself for chunk $chunkI\n";
-			my $cmd = qq(perl $path_to_script --mafftDirectory $mafftDirectory_abs --action processChunk --chunkI $chunkI --chunkSize $chunkSize $reprocess_string);
+			my $cmd = qq(perl $path_to_script --mafftDirectory $mafftDirectory_abs --action processChunk --chunkI $chunkI --chunkSize $chunkSize $reprocess_string $tools_string);
 			if(system($cmd))
 			{
 				die "Command $cmd failed";
@@ -436,7 +918,7 @@ sub makeMSA
 	if(scalar(keys %$input_href) >= 2)
 	{
 		writeFASTA($temp_file_in, $input_href);
-		my $cmd_mafft = qq($mafft_executable --retree 1 --maxiterate 0 --quiet $temp_file_in > $temp_file_out);
+		my $cmd_mafft = qq($mafft_executable $mafft_arguments $temp_file_in > $temp_file_out);
 		print "Executing $cmd_mafft \n";
 		
 		my $ret = system($cmd_mafft);
@@ -10,6 +10,10 @@ use Getopt::Long;
 use List::Util qw/max all/;
 use List::MoreUtils qw/mesh/;
 use Bio::DB::HTS;
+use Compress::Raw::Zlib;
+use FindBin;
+use lib $FindBin::Bin;
+use SequenceStore;
 
 $| = 1;
 
@@ -18,6 +22,12 @@ $| = 1;
 ##             --referenceFasta <path to reference FASTA> 
 ##             --output <path to output VCF> 
 ##             --contigLengths <path to text file output from FIND_GLOBAL_ALIGNMENTS.pl, 'outputReadLengths'>
+##             --embedReference <0/1> (optional, default 1; if 0, the reference sequence is not copied into the .part files
+##                                     and CRAM2VCF reads it from the indexed --referenceFasta instead)
+##             --symbolicDeletionLength <N> (optional, default 0 = off; deletions of at least N reference bases are written
+##                                           as symbolic <DEL> alleles instead of explicit REF sequence)
+##             --compressPartFiles <0/1> (optional, default 0; if 1, the .part files are written BGZF-compressed -
+##                                        CRAM2VCF detects this and decompresses them on several threads)
 ##
 ## Example command:
 ## ./CRAM2VCF.pl --CRAM /intermediate_files/combined.cram
@@ -31,13 +41,19 @@ my $referenceFasta;
 my $output;
 my $bin_CRAM2VCF;
 my $contigLengths;
+my $embedReference = 1;
+my $symbolicDeletionLength = 0;
+my $compressPartFiles = 0;
 
 GetOptions (
 	'CRAM:s' => \$CRAM, 
 	'referenceFasta:s' => \$referenceFasta, 
 	'output:s' => \$output,
 	'contigLengths:s' => \$contigLengths, 
-	'CRAM2VCF_executable:s' => \$bin_CRAM2VCF
+	'CRAM2VCF_executable:s' => \$bin_CRAM2VCF,
+	'embedReference:s' => \$embedReference,
+	'symbolicDeletionLength:s' => \$symbolicDeletionLength,
+	'compressPartFiles:s' => \$compressPartFiles
 );
 	
 die "Please specify --CRAM" unless($CRAM);
@@ -47,6 +63,11 @@ die "Please specify --output" unless($output);
 die "--CRAM $CRAM not existing" unless(-e $CRAM);
 die "--referenceFasta $referenceFasta not existing" unless(-e $referenceFasta);
 die "--CRAM2VCF_executable $bin_CRAM2VCF not present; Please run 'make' in the directory /src." unless(-e $bin_CRAM2VCF);
+die "--embedReference 0 requires a FASTA index ${referenceFasta}.fai; please run 'samtools faidx $referenceFasta'" unless($embedReference or (-e $referenceFasta . '.fai'));
+
+# see print_part
+my $part_buffer = '';
+my $bgzf_block_size = 65280;
 
 my %expectedLengths;
 if($contigLengths)
@@ -66,10 +87,8 @@ my $sam = Bio::DB::HTS->new(-fasta => $referenceFasta, -bam => $CRAM);
 
 my @sequence_ids = $sam->seq_ids();
 
-my $reference_href;
-
-print "Reading $referenceFasta\n";
-$reference_href = readFASTA($referenceFasta);
+print "Opening $referenceFasta\n";
+my $reference = SequenceStore->open($referenceFasta);
 print "\t...done.\n";
 
 my %targetPos_printAlignments;
@@ -77,7 +96,12 @@ open(OUT, ">", $output) or die "Cannot open $output";
 print OUT qq(##fileformat=VCFv4.2
 ##fileDate=20161026
 ##source=CRAM2VCF.pl
-##reference=file://$referenceFasta), "\n";
+##reference=file://$referenceFasta
+##ALT=<ID=DEL,Description="Deletion (CRAM2VCF --symbolicDeletionLength)">
+##INFO=<ID=SVTYPE,Number=1,Type=String,Description="Type of structural variant">
+##INFO=<ID=END,Number=1,Type=Integer,Description="End position of the variant described in this record">
+##INFO=<ID=SVLEN,Number=1,Type=Integer,Description="Difference in length between REF and ALT alleles">
+##INFO=<ID=NALIGNMENTS,Number=1,Type=Integer,Description="Number of input alignments supporting the symbolic allele">), "\n";
 print OUT "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO", "\n";
 
 my @referenceSequenceIDs = @sequence_ids;
@@ -98,9 +122,9 @@ print CMDSCAT 'cat ';
 foreach my $referenceSequenceID (@referenceSequenceIDs)
 {
 	print "Processing $referenceSequenceID .. \n";
-	die "Sequence ID $referenceSequenceID not defined in $referenceFasta" unless(exists $reference_href->{$referenceSequenceID});
+	die "Sequence ID $referenceSequenceID not defined in $referenceFasta" unless($reference->exists($referenceSequenceID));
 
-	my $l_ref_sequence = length($reference_href->{$referenceSequenceID});
+	my $l_ref_sequence = $reference->length($referenceSequenceID);
 	my @gap_structure;
 	$#gap_structure = ($l_ref_sequence - 1);
 
@@ -110,9 +134,17 @@ foreach my $referenceSequenceID (@referenceSequenceIDs)
 	my $fn_for_CRAM2VCF_SNPs = $output . '.part_'. $referenceSequenceID . '.SNPs';
 	
 	open(D, '>', $fn_for_CRAM2VCF) or die "Cannot open $fn_for_CRAM2VCF";
+	binmode(D) if($compressPartFiles);
 	open(D2, '>', $fn_for_CRAM2VCF_SNPs) or die "Cannot open $fn_for_CRAM2VCF_SNPs";
 	
-	print D $reference_href->{$referenceSequenceID}, "\n";
+	if($embedReference)
+	{
+		print_part($reference->sequence($referenceSequenceID), "\n");
+	}
+	else
+	{
+		print_part("\n");
+	}
 	my $n_alignments = 0;
 	my %alignments_starting_at;
 	
@@ -244,7 +276,7 @@ foreach my $referenceSequenceID (@referenceSequenceIDs)
 		my $alignment_info_aref = [$ref, $query, $alignment->query->name, $alignment_start_pos, $alignment_last_pos];
 		push(@{$alignments_starting_at{$alignment_start_pos}}, $alignment_info_aref);
 		
-		print D join("\t", $ref, $query, $alignment->query->name, $alignment_start_pos, $alignment_last_pos), "\n";
+		print_part(join("\t", $ref, $query, $alignment->query->name, $alignment_start_pos, $alignment_last_pos), "\n");
 		
 		$alignments_per_referenceSequenceID{$referenceSequenceID}[0]++;
 		(my $query_nonGap = $query) =~ s/[\-_\*]//g;
@@ -295,7 +327,13 @@ foreach my $referenceSequenceID (@referenceSequenceIDs)
 		}
 	}
 			
-	close(D);
+	close_part();
+	
+	# used by launch_CRAM2VCF_C++.pl to predict memory requirements
+	my $fn_for_CRAM2VCF_n_alignments = $fn_for_CRAM2VCF . '.n_alignments';
+	open(NALIGNMENTS, '>', $fn_for_CRAM2VCF_n_alignments) or die "Cannot open $fn_for_CRAM2VCF_n_alignments";
+	print NALIGNMENTS $n_alignments, "\n";
+	close(NALIGNMENTS);
 	
 	$total_alignments += $n_alignments;
 	print "Have loaded $n_alignments alignments -- $fn_for_CRAM2VCF.\n";
@@ -308,7 +346,9 @@ foreach my $referenceSequenceID (@referenceSequenceIDs)
 			print GAPSTRUCTURE join("\t", $referenceSequenceID, $refPos, $n_gaps), "\n";
 		}
 	}	
-	my $cmd = qq($bin_CRAM2VCF --input $fn_for_CRAM2VCF --referenceSequenceID $referenceSequenceID &> VCF/output_${referenceSequenceID}.txt &);
+	my $referenceArgument = ($embedReference) ? '' : qq( --referenceFasta $referenceFasta);
+	my $symbolicDeletionArgument = ($symbolicDeletionLength) ? qq( --symbolicDeletionLength $symbolicDeletionLength) : '';
+	my $cmd = qq($bin_CRAM2VCF --input $fn_for_CRAM2VCF --referenceSequenceID $referenceSequenceID${referenceArgument}${symbolicDeletionArgument} &> VCF/output_${referenceSequenceID}.txt &);
 	
 	my $output_file = $fn_for_CRAM2VCF . '.VCF';
 	
@@ -350,33 +390,6 @@ print "\nOK\n\n";
 close(CMDS);
 close(GAPSTRUCTURE);
 
-sub readFASTA
-{
-	my $file = shift;	
-	my %R;
-	
-	open(F, '<', $file) or die "Cannot open $file";
-	my $currentSequence;
-	while(<F>)
-	{
-		my $line = $_;
-		chomp($line);
-		$line =~ s/[\n\r]//g;
-		if(substr($line, 0, 1) eq '>')
-		{
-			$currentSequence = substr($line, 1);
-			$currentSequence =~ s/\s.+//;
-		}
-		else
-		{
-			$R{$currentSequence} .= $line;
-		}
-	}	
-	close(F);
-		
-	return \%R;
-}
-
 sub outputMSAInto
 {
 	my $posI = shift;
@@ -533,3 +546,48 @@ sub outputMSAInto
 	}
 	close(OUT);
 }
+
+# Output to the .part file (handle D), either plain or as BGZF: blocks of at most 65280 bytes that are compressed
+# independently (raw deflate in a gzip member with a 'BC' extra field holding the block size), followed by the
+# standard empty EOF block - the format written by bgzip.
+
+sub print_part
+{
+	my $data = join('', @_);
+	if($compressPartFiles)
+	{
+		$part_buffer .= $data;
+		while(length($part_buffer) >= $bgzf_block_size)
+		{
+			print D bgzf_block(substr($part_buffer, 0, $bgzf_block_size, ''));
+		}
+	}
+	else
+	{
+		print D $data;
+	}
+}
+
+sub close_part
+{
+	if($compressPartFiles)
+	{
+		print D bgzf_block($part_buffer) if(length($part_buffer));
+		$part_buffer = '';
+		print D pack('H*', '1f8b08040000000000ff0600424302001b0003000000000000000000');
+	}
+	close(D);
+}
+
+sub bgzf_block
+{
+	my $data = shift;
+	my ($deflate, $status) = Compress::Raw::Zlib::Deflate->new(-WindowBits => -MAX_WBITS(), -AppendOutput => 1);
+	die "Cannot initialize zlib: $status" unless($status == Z_OK);
+	my $compressed = '';
+	die "deflate failed" unless($deflate->deflate($data, $compressed) == Z_OK);
+	die "deflate failed" unless($deflate->flush($compressed) == Z_OK);
+	my $block_size = 18 + length($compressed) + 8;
+	die "BGZF block too large" unless($block_size <= 65536);
+	return pack('C4 V C2 v A2 v v', 31, 139, 8, 4, 0, 0, 255, 6, 'BC', 2, $block_size - 1) . $compressed . pack('V V', crc32($data), length($data));
+}
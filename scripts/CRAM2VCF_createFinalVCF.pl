@@ -49,7 +49,12 @@ open(OUT, ">", $output) or die "Cannot open $output";
 print OUT qq(##fileformat=VCFv4.2
 ##fileDate=20161026
 ##source=CRAM2VCF.pl
-##reference=file://$referenceFasta), "\n";
+##reference=file://$referenceFasta
+##ALT=<ID=DEL,Description="Deletion (CRAM2VCF --symbolicDeletionLength)">
+##INFO=<ID=SVTYPE,Number=1,Type=String,Description="Type of structural variant">
+##INFO=<ID=END,Number=1,Type=Integer,Description="End position of the variant described in this record">
+##INFO=<ID=SVLEN,Number=1,Type=Integer,Description="Difference in length between REF and ALT alleles">
+##INFO=<ID=NALIGNMENTS,Number=1,Type=Integer,Description="Number of input alignments supporting the symbolic allele">), "\n";
 print OUT "#CHROM\tPOS\tID\tREF\tALT\tQUAL\tFILTER\tINFO", "\n";
 #foreach my $referenceSequenceID (@sequence_ids)
 my @referenceSequenceIDs = @sequence_ids;
@@ -19,6 +19,12 @@ $| = 1;
 ##                           --outputTruncatedReads <name of text outfile, e.g. 'truncatedReads'> 
 ##                           --outputReadLengths <name of text outfile, e.g. 'postGlobalAlignment_readLengths'>
 ##                           --CIGARscript_path <path to script dealWithTooManyCIGAROperations.pl>
+##                           --FIND_GLOBAL_ALIGNMENTS_executable <optional: path to the native implementation, src/FIND_GLOBAL_ALIGNMENTS>
+##                           --threads <number of threads for the native implementation; default 1>
+##
+## If --FIND_GLOBAL_ALIGNMENTS_executable is specified, chain scoring and traversal are carried out by the
+## native implementation (same scores and output, sub-quadratic predecessor search, parallel over reads);
+## filtering, BAM conversion, sorting and indexing are still carried out by this script.
 ##
 ## Example command:
 ## ./FIND_GLOBAL_ALIGNMENTS.pl --alignmentsFile /intermediate_files/AartiInput.sortedWithHeader 
@@ -27,6 +33,8 @@ $| = 1;
 ##                             --outputTruncatedReads intermediate_files/truncatedReads 
 ##                             --outputReadLengths /intermediate_files/postGlobalAlignment_readLengths
 ##                             --CIGARscript_path dealWithTooManyCIGAROperations.pl
+##                             --FIND_GLOBAL_ALIGNMENTS_executable ../src/FIND_GLOBAL_ALIGNMENTS
+##                             --threads 8
 ##
 
 my $alignmentsFile;
@@ -37,6 +45,8 @@ my $outputTruncatedReads;
 my $outputReadLengths;
 my $endsFree_reference = 1;
 my $CIGARscript_path; 
+my $FIND_GLOBAL_ALIGNMENTS_executable;
+my $threads = 1;
 
 my $S_match = 1;
 my $S_mismatch = -1;
@@ -48,7 +58,9 @@ GetOptions (
 	'outputFile:s' => \$outputFile,	
 	'outputTruncatedReads:s' => \$outputTruncatedReads,
 	'outputReadLengths:s' => \$outputReadLengths,
-	'CIGARscript_path:s' => \$CIGARscript_path
+	'CIGARscript_path:s' => \$CIGARscript_path,
+	'FIND_GLOBAL_ALIGNMENTS_executable:s' => \$FIND_GLOBAL_ALIGNMENTS_executable,
+	'threads:s' => \$threads,
 );
 
 die "Please specify --alignmentsFile" unless($alignmentsFile);
@@ -64,11 +76,23 @@ die "Please specify --outputReadLengths" unless($outputReadLengths);
 
 die "Please specify path to script dealWithTooManyCIGAROperations.pl --CIGARscript_path" unless($CIGARscript_path);
 
+my $outputFile_sam = $outputFile . '.sam.unfiltered';
+
+if($FIND_GLOBAL_ALIGNMENTS_executable)
+{
+	die "--FIND_GLOBAL_ALIGNMENTS_executable $FIND_GLOBAL_ALIGNMENTS_executable not existing" unless(-e $FIND_GLOBAL_ALIGNMENTS_executable);
+	my $cmd_native = qq($FIND_GLOBAL_ALIGNMENTS_executable --alignmentsFile $alignmentsFile --referenceFasta $referenceFasta --outputFile $outputFile --outputTruncatedReads $outputTruncatedReads --outputReadLengths $outputReadLengths --threads $threads --S_match $S_match --S_mismatch $S_mismatch --S_gap $S_gap --endsFreeReference $endsFree_reference);
+	print "Finding global alignments with command:\n\t$cmd_native\n\n";
+	die "Native global alignment search failed" unless(system($cmd_native) == 0);
+	
+	filterAndConvertSAM($outputFile_sam);
+	exit 0;
+}
+
 print "Read $referenceFasta\n";
 my $reference_href = readFASTA($referenceFasta, 0);
 print "\tdone.\n";
 
-my $outputFile_sam = $outputFile . '.sam.unfiltered';
 
 open(SAMOUTPUT, '>', $outputFile_sam) or die "Cannot open $outputFile_sam";
 print SAMOUTPUT "\@HD\tVN:1.5", "\n";
@@ -646,22 +670,29 @@ print "\tAlignments with right end trimmed: ", $n_alignments_rightGapsRemoved, "
 
 print "\n\nDone. Produced SAM file $outputFile_sam\n\n";
 
-my $outputFile_sam_filtered = $outputFile_sam . ".filtered";
-my $cmd_filter = qq(perl $CIGARscript_path --input ${outputFile_sam} --output ${outputFile_sam_filtered});
-print "Filtering SAM with command: $cmd_filter\n";
-die "Filtering failed" unless(system($cmd_filter) == 0);
+filterAndConvertSAM($outputFile_sam);
+
+sub filterAndConvertSAM
+{
+	my $outputFile_sam = shift;
+	
+	my $outputFile_sam_filtered = $outputFile_sam . ".filtered";
+	my $cmd_filter = qq(perl $CIGARscript_path --input ${outputFile_sam} --output ${outputFile_sam_filtered});
+	print "Filtering SAM with command: $cmd_filter\n";
+	die "Filtering failed" unless(system($cmd_filter) == 0);
 
-my $bam_unsorted = $outputFile_sam_filtered . '.bam';
-my $cmd_bam_conversion = qq(samtools view -S -b -o${bam_unsorted} $outputFile_sam_filtered);
+	my $bam_unsorted = $outputFile_sam_filtered . '.bam';
+	my $cmd_bam_conversion = qq(samtools view -S -b -o${bam_unsorted} $outputFile_sam_filtered);
 
-print "Converting to BAM with command:\n\t$cmd_bam_conversion\n\n";
-die "BAM conversion failed" unless(system($cmd_bam_conversion) == 0);
+	print "Converting to BAM with command:\n\t$cmd_bam_conversion\n\n";
+	die "BAM conversion failed" unless(system($cmd_bam_conversion) == 0);
 
-my $cmd_bam_sort = qq(samtools sort -o${outputFile} $bam_unsorted; samtools index $outputFile);
-print "Sorting and indexing BAM with command:\n\t$cmd_bam_sort\n\n";
-die "BAM sorting/indexing failed" unless(system($cmd_bam_sort) == 0);
+	my $cmd_bam_sort = qq(samtools sort -o${outputFile} $bam_unsorted; samtools index $outputFile);
+	print "Sorting and indexing BAM with command:\n\t$cmd_bam_sort\n\n";
+	die "BAM sorting/indexing failed" unless(system($cmd_bam_sort) == 0);
 
-print "Produced BAM file $outputFile\n\n";
+	print "Produced BAM file $outputFile\n\n";
+}
 
 sub which_max
 {
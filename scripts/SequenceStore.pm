@@ -0,0 +1,327 @@
+package SequenceStore;
+
+## Author: Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+## License: The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes/blob/master/LICENSE
+
+## Random access to the sequences of a FASTA file.
+##
+## If <FASTA>.seqstore exists (built by src/BUILD_SEQUENCESTORE, format described in src/SequenceStore.h), only
+## its index is loaded; sequences and intervals are decoded from the packed store when they are requested.
+## Otherwise the complete FASTA is loaded into memory, as the scripts used to do.
+##
+## Usage:
+## use FindBin;
+## use lib $FindBin::Bin;
+## use SequenceStore;
+##
+## my $reference = SequenceStore->open($referenceFasta);
+## $reference->exists($id); $reference->length($id); $reference->ids();
+## $reference->substr($id, $start, $length);          # 0-based, like substr()
+## $reference->substr($id, $start, $length, 1);       # reverse complement of that interval
+## $reference->sequence($id, $reverseComplement);
+
+use strict;
+use warnings;
+
+my @decode_byte;
+{
+	my @bases = qw/A C G T/;
+	for(my $byte = 0; $byte < 256; $byte++)
+	{
+		$decode_byte[$byte] = join('', map {$bases[($byte >> (6 - 2 * $_)) & 3]} (0 .. 3));
+	}
+}
+
+sub storeFilename
+{
+	my $FASTA = shift;
+	return $FASTA . '.seqstore';
+}
+
+sub open
+{
+	my $class = shift;
+	my $FASTA = shift;
+
+	my $storeFn = storeFilename($FASTA);
+	if(-e $storeFn)
+	{
+		if((-e $FASTA) and ((-M $storeFn) > (-M $FASTA)))
+		{
+			warn "Sequence store $storeFn is older than $FASTA - ignoring it; please re-run BUILD_SEQUENCESTORE --input $FASTA";
+		}
+		else
+		{
+			return $class->openStore($storeFn);
+		}
+	}
+
+	print "No sequence store $storeFn - loading complete $FASTA (run BUILD_SEQUENCESTORE --input $FASTA to avoid this)\n";
+	my $self = {
+		FASTA => $FASTA,
+		inMemory => readFASTA($FASTA),
+	};
+	return bless($self, $class);
+}
+
+sub openStore
+{
+	my $class = shift;
+	my $storeFn = shift;
+
+	my $fh;
+	CORE::open($fh, '<:raw', $storeFn) or die "Cannot open sequence store $storeFn";
+	my $header = readBytes($fh, 0, 24, $storeFn);
+	die "$storeFn is not a sequence store - please (re-)build it with BUILD_SEQUENCESTORE" unless(CORE::substr($header, 0, 8) eq 'NGSTORE1');
+	my ($n_sequences, $indexOffset) = unpack('Q<Q<', CORE::substr($header, 8, 16));
+
+	my $indexLength = (-s $storeFn) - $indexOffset;
+	die "Sequence store $storeFn is truncated" unless($indexLength >= 0);
+	my $index = readBytes($fh, $indexOffset, $indexLength, $storeFn);
+
+	# ID -> packed (length, record offset)
+	my %index;
+	my @ids;
+	my $p = 0;
+	for(my $sequenceI = 0; $sequenceI < $n_sequences; $sequenceI++)
+	{
+		die "Sequence store $storeFn is truncated" unless(($p + 4) <= $indexLength);
+		my $ID_length = unpack('V', CORE::substr($index, $p, 4));
+		die "Sequence store $storeFn is truncated" unless(($p + 4 + $ID_length + 16) <= $indexLength);
+		my $ID = CORE::substr($index, $p + 4, $ID_length);
+		$index{$ID} = CORE::substr($index, $p + 4 + $ID_length, 16);
+		push(@ids, $ID);
+		$p += (4 + $ID_length + 16);
+	}
+
+	my $self = {
+		storeFn => $storeFn,
+		fh => $fh,
+		index => \%index,
+		ids => \@ids,
+		cachedRecordID => undef,
+		cachedRecord => undef,
+	};
+	return bless($self, $class);
+}
+
+sub ids
+{
+	my $self = shift;
+	return ($self->{inMemory}) ? (keys %{$self->{inMemory}}) : @{$self->{ids}};
+}
+
+sub exists
+{
+	my $self = shift;
+	my $id = shift;
+	return ($self->{inMemory}) ? (exists $self->{inMemory}{$id}) : (exists $self->{index}{$id});
+}
+
+sub length
+{
+	my $self = shift;
+	my $id = shift;
+	if($self->{inMemory})
+	{
+		die "Sequence $id not in $self->{FASTA}" unless(exists $self->{inMemory}{$id});
+		return CORE::length($self->{inMemory}{$id});
+	}
+	die "Sequence $id not in sequence store $self->{storeFn}" unless(exists $self->{index}{$id});
+	my ($length, $recordOffset) = unpack('Q<Q<', $self->{index}{$id});
+	return $length;
+}
+
+sub sequence
+{
+	my $self = shift;
+	my $id = shift;
+	my $reverseComplement = shift;
+	return $self->substr($id, 0, $self->length($id), $reverseComplement);
+}
+
+sub substr
+{
+	my $self = shift;
+	my $id = shift;
+	my $start = shift;
+	my $length = shift;
+	my $reverseComplement = shift;
+
+	my $sequence_length = $self->length($id);
+	die "Start position $start outside of $id (length $sequence_length)" unless($start >= 0);
+
+	# like substr(), intervals are truncated at the end of the sequence; an interval that starts at or after the end is
+	# empty (BAM2MAFFT.pl can place the last window start up to 99 bp past the end of a chromosome)
+	return '' if($start >= $sequence_length);
+	$length = $sequence_length - $start if((not defined $length) or (($start + $length) > $sequence_length));
+	die "Negative length for $id" if($length < 0);
+
+	my $S;
+	if($self->{inMemory})
+	{
+		$S = CORE::substr($self->{inMemory}{$id}, $start, $length);
+	}
+	else
+	{
+		$S = $self->decode($id, $start, $length);
+	}
+
+	if($reverseComplement)
+	{
+		$S = reverse($S);
+		$S =~ tr/ACGT/TGCA/;
+	}
+	return $S;
+}
+
+# run and exception tables of the most recently used record - consecutive requests tend to hit the same sequence
+sub getRecord
+{
+	my $self = shift;
+	my $id = shift;
+
+	if((defined $self->{cachedRecordID}) and ($self->{cachedRecordID} eq $id))
+	{
+		return $self->{cachedRecord};
+	}
+
+	my ($length, $p) = unpack('Q<Q<', $self->{index}{$id});
+	my %record = (length => $length);
+	foreach my $table (qw/NRuns lowerCaseRuns exceptions/)
+	{
+		my $n = unpack('Q<', readBytes($self->{fh}, $p, 8, $self->{storeFn}));
+		$record{$table} = ($n) ? [unpack('Q<*', readBytes($self->{fh}, $p + 8, 16 * $n, $self->{storeFn}))] : [];
+		$p += (8 + 16 * $n);
+	}
+	$record{packedOffset} = $p;
+
+	$self->{cachedRecordID} = $id;
+	$self->{cachedRecord} = \%record;
+	return \%record;
+}
+
+sub decode
+{
+	my $self = shift;
+	my $id = shift;
+	my $start = shift;
+	my $length = shift;
+
+	return '' if($length == 0);
+	my $record = $self->getRecord($id);
+	my $end = $start + $length;
+
+	my $firstByte = int($start / 4);
+	my $lastByte = int(($end - 1) / 4);
+	my $S = '';
+	my $chunkSize = 1048576;
+	for(my $byteI = $firstByte; $byteI <= $lastByte; $byteI += $chunkSize)
+	{
+		my $n = ($lastByte - $byteI + 1);
+		$n = $chunkSize if($n > $chunkSize);
+		my $bytes = readBytes($self->{fh}, $record->{packedOffset} + $byteI, $n, $self->{storeFn});
+		$S .= join('', @decode_byte[unpack('C*', $bytes)]);
+	}
+	$S = CORE::substr($S, $start - 4 * $firstByte, $length);
+
+	my $runs = $record->{NRuns};
+	for(my $runI = firstRunEndingAfter($runs, $start); ($runI < (scalar(@$runs) / 2)) and ($runs->[2*$runI] < $end); $runI++)
+	{
+		my $runStart = ($runs->[2*$runI] > $start) ? $runs->[2*$runI] : $start;
+		my $runEnd = $runs->[2*$runI] + $runs->[2*$runI+1];
+		$runEnd = $end if($runEnd > $end);
+		CORE::substr($S, $runStart - $start, $runEnd - $runStart) = ('N' x ($runEnd - $runStart));
+	}
+
+	# exceptions are (position, character) pairs, i.e. runs of length 1 in this respect
+	my $exceptions = $record->{exceptions};
+	for(my $exceptionI = firstRunEndingAfter($exceptions, $start, 1); ($exceptionI < (scalar(@$exceptions) / 2)) and ($exceptions->[2*$exceptionI] < $end); $exceptionI++)
+	{
+		CORE::substr($S, $exceptions->[2*$exceptionI] - $start, 1) = chr($exceptions->[2*$exceptionI+1]);
+	}
+
+	$runs = $record->{lowerCaseRuns};
+	for(my $runI = firstRunEndingAfter($runs, $start); ($runI < (scalar(@$runs) / 2)) and ($runs->[2*$runI] < $end); $runI++)
+	{
+		my $runStart = ($runs->[2*$runI] > $start) ? $runs->[2*$runI] : $start;
+		my $runEnd = $runs->[2*$runI] + $runs->[2*$runI+1];
+		$runEnd = $end if($runEnd > $end);
+		CORE::substr($S, $runStart - $start, $runEnd - $runStart) = lc(CORE::substr($S, $runStart - $start, $runEnd - $runStart));
+	}
+
+	return $S;
+}
+
+# index of the first (start, length) pair that ends after $pos - with $fixedLength, the second value is not a length
+sub firstRunEndingAfter
+{
+	my $runs = shift;
+	my $pos = shift;
+	my $fixedLength = shift;
+
+	my $lo = 0;
+	my $hi = scalar(@$runs) / 2;
+	while($lo < $hi)
+	{
+		my $mid = int(($lo + $hi) / 2);
+		my $runEnd = $runs->[2*$mid] + (($fixedLength) ? $fixedLength : $runs->[2*$mid+1]);
+		if($runEnd > $pos)
+		{
+			$hi = $mid;
+		}
+		else
+		{
+			$lo = $mid + 1;
+		}
+	}
+	return $lo;
+}
+
+sub readBytes
+{
+	my $fh = shift;
+	my $offset = shift;
+	my $length = shift;
+	my $storeFn = shift;
+
+	sysseek($fh, $offset, 0) or die "Cannot seek in $storeFn";
+	my $buffer = '';
+	while(CORE::length($buffer) < $length)
+	{
+		my $read = sysread($fh, $buffer, $length - CORE::length($buffer), CORE::length($buffer));
+		die "Cannot read from $storeFn" unless(defined $read);
+		die "Sequence store $storeFn is truncated" if($read == 0);
+	}
+	return $buffer;
+}
+
+sub readFASTA
+{
+	my $file = shift;
+	my %R;
+
+	CORE::open(F, '<', $file) or die "Cannot open $file";
+	my $currentSequence;
+	while(<F>)
+	{
+		my $line = $_;
+		chomp($line);
+		$line =~ s/[\n\r]//g;
+		if(CORE::substr($line, 0, 1) eq '>')
+		{
+			$currentSequence = CORE::substr($line, 1);
+			$currentSequence =~ s/\s.+//;
+			$R{$currentSequence} = '' unless(exists $R{$currentSequence});
+		}
+		else
+		{
+			$R{$currentSequence} .= $line;
+		}
+	}
+	close(F);
+
+	return \%R;
+}
+
+1;
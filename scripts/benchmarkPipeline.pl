@@ -0,0 +1,409 @@
+#!/usr/bin/perl
+
+## Author: Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+## License: The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes/blob/master/LICENSE
+
+use strict;
+use Getopt::Long;
+use Data::Dumper;
+use File::Path;
+use File::Spec;
+use FindBin;
+use Time::HiRes qw/time/;
+use POSIX qw/WIFEXITED WEXITSTATUS/;
+
+$| = 1;
+
+## Usage:
+## benchmarkPipeline.pl --outputDirectory <path to working directory, will be deleted and re-created>
+##                      --nAssemblies <number of simulated assemblies; default 4>
+##                      --nChromosomes <number of simulated reference chromosomes; default 1>
+##                      --referenceLength <length of each reference chromosome; default 100000>
+##                      --SNPrate <SNPs per reference base; default 0.001>
+##                      --indelRate <short insertions/deletions per reference base; default 0.0001>
+##                      --maxIndelLength <maximum length of short insertions/deletions; default 10>
+##                      --SVrate <structural variants (insertions/deletions) per reference base; default 0.00002>
+##                      --SVlength <mean length of structural variants; default 1000>
+##                      --contigLength <mean contig length - assemblies are fragmented into contigs of 0.5 - 1.5 x this length; default 20000>
+##                      --seed <random seed for the simulation; default 1>
+##                      --native <1: use the native implementations from /src for all stages that have one; default 0>
+##                      --threads <threads / parallel jobs for the stages that support it; default 4>
+##                      --stageArguments <optional, repeatable: STAGE='additional arguments' for the pipeline script / executable of a stage (BWA for 'mapping'), e.g. BAM2MAFFT='--targetCost 1e9'>
+##                      --label <label for the results table; default: git commit and engine mode>
+##                      --table <path to the results table; rows are appended; default benchmark.txt in the current directory>
+##                      --bwa_path <path to BWA; default 'bwa'>
+##                      --samtools_path <path to SAMtools; default 'samtools'>
+##                      --mafft_executable <path to MAFFT; default 'mafft'>
+##
+## Simulates a reference genome and --nAssemblies assemblies from it, and runs all stages of the pipeline in the
+## README on these (mapping, BAM2ALIGNMENT, FIND_GLOBAL_ALIGNMENTS, BAM2MAFFT, CALLMAFFT, globalize, CRAM2VCF,
+## launch_CRAM2VCF, createFinalVCF). Each variant of the simulation is carried by each assembly with a
+## variant-specific probability (uniform in [0, 1]); contigs are reverse-complemented with probability 0.5. The
+## simulated variants are written to simulatedVariants.txt.
+##
+## Each stage runs in a separate process; one row per stage is appended to --table, with wall time, CPU time
+## (user/system), peak RSS (of the largest process of the stage) and bytes read/written by all processes of the
+## stage (/proc/<pid>/io rchar/wchar, i.e. including the page cache, but not memory-mapped files). Peak RSS and I/O
+## are Linux-only and reported as NA elsewhere; peak RSS values below the RSS of this script (~20MB) are not resolved. Stage output is written to <outputDirectory>/logs/<stage>.log.
+## The pipeline stops after the first failing stage.
+##
+## Rows from different commits and engine modes (--native, --stageArguments) can be compared in the same table;
+## the simulation parameters are part of each row.
+##
+## Example command:
+## ./benchmarkPipeline.pl --outputDirectory /tmp/benchmark --nAssemblies 8 --native 1
+
+my $outputDirectory;
+my $nAssemblies = 4;
+my $nChromosomes = 1;
+my $referenceLength = 100000;
+my $SNPrate = 0.001;
+my $indelRate = 0.0001;
+my $maxIndelLength = 10;
+my $SVrate = 0.00002;
+my $SVlength = 1000;
+my $contigLength = 20000;
+my $seed = 1;
+my $native = 0;
+my $threads = 4;
+my %stageArguments;
+my $label;
+my $table = 'benchmark.txt';
+my $bwa_path = 'bwa';
+my $samtools_path = 'samtools';
+my $mafft_executable = 'mafft';
+
+GetOptions (
+	'outputDirectory:s' => \$outputDirectory,
+	'nAssemblies:s' => \$nAssemblies,
+	'nChromosomes:s' => \$nChromosomes,
+	'referenceLength:s' => \$referenceLength,
+	'SNPrate:s' => \$SNPrate,
+	'indelRate:s' => \$indelRate,
+	'maxIndelLength:s' => \$maxIndelLength,
+	'SVrate:s' => \$SVrate,
+	'SVlength:s' => \$SVlength,
+	'contigLength:s' => \$contigLength,
+	'seed:s' => \$seed,
+	'native:s' => \$native,
+	'threads:s' => \$threads,
+	'stageArguments=s' => \%stageArguments,
+	'label:s' => \$label,
+	'table:s' => \$table,
+	'bwa_path:s' => \$bwa_path,
+	'samtools_path:s' => \$samtools_path,
+	'mafft_executable:s' => \$mafft_executable,
+);
+
+die "Please specify --outputDirectory" unless($outputDirectory);
+die "Please specify a positive number for --nAssemblies" unless(($nAssemblies =~ /^\d+$/) and ($nAssemblies > 0));
+die "Please specify a positive number for --nChromosomes" unless(($nChromosomes =~ /^\d+$/) and ($nChromosomes > 0));
+# BAM2MAFFT only processes chromosomes longer than 20kb
+die "--referenceLength must be larger than 20000" unless(($referenceLength =~ /^\d+$/) and ($referenceLength > 20000));
+die "Please specify a positive number for --threads" unless(($threads =~ /^\d+$/) and ($threads > 0));
+die "Please specify a positive --contigLength" unless($contigLength > 0);
+die "Please specify a positive --maxIndelLength" unless(($maxIndelLength =~ /^\d+$/) and ($maxIndelLength > 0));
+
+my @stages = qw/mapping BAM2ALIGNMENT FIND_GLOBAL_ALIGNMENTS BAM2MAFFT CALLMAFFT globalize CRAM2VCF launch_CRAM2VCF createFinalVCF/;
+my %stages = map {$_ => 1} @stages;
+foreach my $stage (keys %stageArguments)
+{
+	die "Unknown stage $stage in --stageArguments; known stages: @stages" unless($stages{$stage});
+}
+
+my $scriptsDir = $FindBin::Bin;
+my $srcDir = File::Spec->rel2abs($FindBin::Bin . '/../src');
+my %native_executables = map {$_ => $srcDir . '/' . $_} qw/BAM2ALIGNMENT FIND_GLOBAL_ALIGNMENTS BAM2MAFFT FAS2BAM WINDOWPOA GLOBALIZE_WINDOWBAMS/;
+my $CRAM2VCF_executable = $srcDir . '/CRAM2VCF';
+die "$CRAM2VCF_executable not present; please run 'make all' in $srcDir" unless(-e $CRAM2VCF_executable);
+if($native)
+{
+	foreach my $executable (values %native_executables)
+	{
+		die "$executable not present; please run 'make all' and 'make htslib' in $srcDir" unless(-e $executable);
+	}
+}
+
+unless(defined $label)
+{
+	my $commit = `git -C $scriptsDir rev-parse --short HEAD 2>/dev/null`;
+	chomp($commit);
+	$label = ($commit ? $commit : 'unknown') . '_' . ($native ? 'native' : 'perl');
+}
+$table = File::Spec->rel2abs($table);
+
+die "Security check - $outputDirectory will be deleted" unless($outputDirectory =~ /benchmark/i);
+rmtree($outputDirectory);
+mkpath($outputDirectory . '/logs');
+chdir($outputDirectory) or die "Cannot chdir into $outputDirectory";
+
+simulate('reference.fa', 'AllContigs.fa', 'simulatedVariants.txt');
+
+my %extra = map {$_ => ((exists $stageArguments{$_}) ? (' ' . $stageArguments{$_}) : '')} @stages;
+my %commands = (
+	mapping => [
+		qq($bwa_path index reference.fa),
+		qq($samtools_path faidx reference.fa),
+		qq($bwa_path mem -t $threads$extra{mapping} reference.fa AllContigs.fa | $samtools_path view -F 0x4 -Sb - > AllContigs_unsorted.bam),
+		qq($samtools_path sort -o AllContigs.bam AllContigs_unsorted.bam),
+		qq($samtools_path index AllContigs.bam),
+	],
+	BAM2ALIGNMENT => [
+		qq(perl $scriptsDir/BAM2ALIGNMENT.pl --BAM AllContigs.bam --referenceFasta reference.fa --readsFasta AllContigs.fa --outputFile AlignmentInput.txt$extra{BAM2ALIGNMENT}) .
+			($native ? qq( --BAM2ALIGNMENT_executable $native_executables{BAM2ALIGNMENT} --threads $threads) : ''),
+	],
+	FIND_GLOBAL_ALIGNMENTS => [
+		qq(perl $scriptsDir/FIND_GLOBAL_ALIGNMENTS.pl --alignmentsFile AlignmentInput.txt.sortedWithHeader --referenceFasta reference.fa --outputFile forMAFFT.bam --outputTruncatedReads truncatedReads --outputReadLengths postGlobalAlignment_readLengths --CIGARscript_path $scriptsDir/dealWithTooManyCIGAROperations.pl$extra{FIND_GLOBAL_ALIGNMENTS}) .
+			($native ? qq( --FIND_GLOBAL_ALIGNMENTS_executable $native_executables{FIND_GLOBAL_ALIGNMENTS} --threads $threads) : ''),
+	],
+	BAM2MAFFT => [
+		qq(perl $scriptsDir/BAM2MAFFT.pl --BAM forMAFFT.bam --referenceFasta reference.fa --readsFasta AllContigs.fa --outputDirectory forMAFFT --inputTruncatedReads truncatedReads$extra{BAM2MAFFT}) .
+			($native ? qq( --BAM2MAFFT_executable $native_executables{BAM2MAFFT} --threads $threads) : ''),
+	],
+	CALLMAFFT => [
+		qq(perl $scriptsDir/CALLMAFFT.pl --action kickOff --mafftDirectory forMAFFT --local $threads --mafft_executable $mafft_executable --bamheader $scriptsDir/../windowbam.header.txt$extra{CALLMAFFT}) .
+			($native ? qq( --fas2bam_executable $native_executables{FAS2BAM} --poa_executable $native_executables{WINDOWPOA}) : qq( --fas2bam_path $scriptsDir/fas2bam.pl --samtools_path $samtools_path)),
+	],
+	globalize => ($native ? [
+		qq($native_executables{GLOBALIZE_WINDOWBAMS} --fastadir forMAFFT/ --msadir forMAFFT/ --contigs postGlobalAlignment_readLengths --referenceFasta reference.fa --output combined.cram --threads $threads$extra{globalize}),
+	] : [
+		qq(perl $scriptsDir/globalize_windowbams.pl --fastadir forMAFFT/ --msadir forMAFFT/ --contigs postGlobalAlignment_readLengths --output combined.sam$extra{globalize}),
+		qq($samtools_path view -h -t reference.fa.fai combined.sam > combined_with_header.sam),
+		qq($samtools_path sort combined_with_header.sam -o combined_with_header_sorted.sam),
+		qq($samtools_path view -C -T reference.fa combined_with_header_sorted.sam > combined.cram),
+		qq($samtools_path index combined.cram),
+	]),
+	CRAM2VCF => [
+		qq(perl $scriptsDir/CRAM2VCF.pl --CRAM combined.cram --referenceFasta reference.fa --output VCF/graph.vcf --contigLengths postGlobalAlignment_readLengths --CRAM2VCF_executable $CRAM2VCF_executable$extra{CRAM2VCF}),
+	],
+	launch_CRAM2VCF => [
+		qq(perl $scriptsDir/launch_CRAM2VCF_C++.pl --output VCF/graph.vcf --cores $threads$extra{launch_CRAM2VCF}),
+	],
+	createFinalVCF => [
+		qq(perl $scriptsDir/CRAM2VCF_createFinalVCF.pl --CRAM combined.cram --referenceFasta reference.fa --output VCF/graph.vcf$extra{createFinalVCF}),
+	],
+);
+mkdir('VCF') or die "Cannot mkdir VCF";
+
+my @tableFields = qw/label stage nAssemblies nChromosomes referenceLength SNPrate indelRate SVrate SVlength contigLength seed threads stageArguments wallSeconds userSeconds systemSeconds peakRSS_MB readMB writtenMB exitStatus/;
+my @results;
+foreach my $stage (@stages)
+{
+	print "Stage $stage ...\n";
+	my $result = run_stage($stage, $commands{$stage});
+	$result->{stage} = $stage;
+	$result->{stageArguments} = (exists $stageArguments{$stage}) ? $stageArguments{$stage} : '';
+	push(@results, $result);
+	printf("\t%.1fs wall, %.1fs user, %.1fs system, peak RSS %s MB - exit status %d\n", @{$result}{qw/wallSeconds userSeconds systemSeconds peakRSS_MB exitStatus/});
+	last if($result->{exitStatus});
+}
+
+my $table_exists = (-e $table);
+open(TABLE, '>>', $table) or die "Cannot open $table";
+print TABLE join("\t", @tableFields), "\n" unless($table_exists);
+foreach my $result (@results)
+{
+	my %row = (
+		label => $label,
+		nAssemblies => $nAssemblies,
+		nChromosomes => $nChromosomes,
+		referenceLength => $referenceLength,
+		SNPrate => $SNPrate,
+		indelRate => $indelRate,
+		SVrate => $SVrate,
+		SVlength => $SVlength,
+		contigLength => $contigLength,
+		seed => $seed,
+		threads => $threads,
+		%$result,
+	);
+	print TABLE join("\t", map {$row{$_}} @tableFields), "\n";
+}
+close(TABLE);
+
+print "\nAppended ", scalar(@results), " rows to $table\n";
+if($results[-1]{exitStatus})
+{
+	die "Stage $results[-1]{stage} failed, see $outputDirectory/logs/$results[-1]{stage}.log";
+}
+
+sub run_stage
+{
+	my $stage = shift;
+	my $commands_aref = shift;
+
+	my $fn_log = 'logs/' . $stage . '.log';
+
+	# the commands run in a child process, so that its children's resource usage covers exactly this stage
+	pipe(MEASUREMENT_READ, MEASUREMENT_WRITE) or die "Cannot create pipe";
+	my $startTime = time();
+	my $pid = fork();
+	die "Cannot fork" unless(defined $pid);
+	if($pid == 0)
+	{
+		close(MEASUREMENT_READ);
+		my $exitStatus = 0;
+		foreach my $command (@$commands_aref)
+		{
+			open(LOG, '>>', $fn_log) or die "Cannot open $fn_log";
+			print LOG "Executing $command\n";
+			close(LOG);
+			my $ret = system(qq(($command) >> $fn_log 2>&1));
+			if($ret)
+			{
+				$exitStatus = (WIFEXITED($ret) and WEXITSTATUS($ret)) ? WEXITSTATUS($ret) : 1;
+				last;
+			}
+		}
+
+		my (undef, undef, $userSeconds, $systemSeconds) = times();
+		my $peakRSS_kB = children_peakRSS();
+		my %io;
+		if(open(IO, '<', '/proc/self/io'))
+		{
+			while(<IO>)
+			{
+				$io{$1} = $2 if($_ =~ /^(\w+):\s+(\d+)/);
+			}
+			close(IO);
+		}
+		print MEASUREMENT_WRITE join("\t", $exitStatus, $userSeconds, $systemSeconds,
+			((defined $peakRSS_kB) ? sprintf("%.1f", $peakRSS_kB / 1024) : 'NA'),
+			((defined $io{rchar}) ? sprintf("%.1f", $io{rchar} / 1024**2) : 'NA'),
+			((defined $io{wchar}) ? sprintf("%.1f", $io{wchar} / 1024**2) : 'NA')), "\n";
+		close(MEASUREMENT_WRITE);
+		POSIX::_exit(0);
+	}
+	close(MEASUREMENT_WRITE);
+	my $measurement = <MEASUREMENT_READ>;
+	close(MEASUREMENT_READ);
+	waitpid($pid, 0);
+	my $wallSeconds = time() - $startTime;
+
+	die "No measurement for stage $stage" unless(defined $measurement);
+	chomp($measurement);
+	my %result;
+	@result{qw/exitStatus userSeconds systemSeconds peakRSS_MB readMB writtenMB/} = split(/\t/, $measurement);
+	$result{wallSeconds} = sprintf("%.2f", $wallSeconds);
+	return \%result;
+}
+
+sub children_peakRSS
+{
+	# ru_maxrss (kB) of getrusage(RUSAGE_CHILDREN) - the struct layout is that of 64-bit Linux
+	my $peakRSS_kB;
+	eval {
+		require 'syscall.ph';
+		my $rusage = "\0" x 144;
+		if(syscall(&SYS_getrusage(), -1, $rusage) == 0)
+		{
+			$peakRSS_kB = (unpack('q18', $rusage))[4];
+		}
+	};
+	return $peakRSS_kB;
+}
+
+sub simulate
+{
+	my $fn_reference = shift;
+	my $fn_contigs = shift;
+	my $fn_variants = shift;
+
+	srand($seed);
+	my @bases = qw/A C G T/;
+	my $randomSequence = sub {
+		my $length = shift;
+		return join('', map {$bases[int(rand(4))]} (1 .. $length));
+	};
+
+	open(REFERENCE, '>', $fn_reference) or die "Cannot open $fn_reference";
+	open(CONTIGS, '>', $fn_contigs) or die "Cannot open $fn_contigs";
+	open(VARIANTS, '>', $fn_variants) or die "Cannot open $fn_variants";
+	print VARIANTS join("\t", qw/chromosome position type referenceLength alternativeLength carriers/), "\n";
+
+	my $totalRate = $SNPrate + $indelRate + $SVrate;
+	my $n_contigs = 0;
+	my $n_variants = 0;
+	for(my $chromosomeI = 1; $chromosomeI <= $nChromosomes; $chromosomeI++)
+	{
+		my $chromosome = 'chr' . $chromosomeI;
+		my $reference = $randomSequence->($referenceLength);
+		print REFERENCE '>', $chromosome, "\n", $reference, "\n";
+
+		# non-overlapping variants, at exponentially distributed distances
+		my @variants;
+		my $position = 0;
+		while($totalRate > 0)
+		{
+			$position += 1 + int(-log(1 - rand()) / $totalRate);
+			last if($position >= ($referenceLength - 1));
+			my $type = rand($totalRate);
+			my ($referenceAllele_length, $alternativeAllele);
+			if($type < $SNPrate)
+			{
+				my $referenceBase = substr($reference, $position, 1);
+				my @alternatives = grep {$_ ne $referenceBase} @bases;
+				($referenceAllele_length, $alternativeAllele) = (1, $alternatives[int(rand(3))]);
+			}
+			else
+			{
+				my $length = ($type < ($SNPrate + $indelRate)) ? (1 + int(rand($maxIndelLength))) : (int($SVlength / 2) + int(rand($SVlength)));
+				$length = 1 if($length < 1);
+				if(rand() < 0.5)
+				{
+					($referenceAllele_length, $alternativeAllele) = (1, substr($reference, $position, 1) . $randomSequence->($length));
+				}
+				else
+				{
+					$length = $referenceLength - $position - 1 if(($position + $length) >= $referenceLength);
+					($referenceAllele_length, $alternativeAllele) = (1 + $length, substr($reference, $position, 1));
+				}
+			}
+			my $alleleFrequency = rand();
+			my @carriers = grep {rand() < $alleleFrequency} (1 .. $nAssemblies);
+			push(@variants, [$position, $referenceAllele_length, $alternativeAllele, {map {$_ => 1} @carriers}]);
+			print VARIANTS join("\t", $chromosome, $position + 1, (($type < $SNPrate) ? 'SNP' : (($type < ($SNPrate + $indelRate)) ? 'INDEL' : 'SV')), $referenceAllele_length, length($alternativeAllele), join(',', @carriers)), "\n";
+			$n_variants++;
+			$position += $referenceAllele_length;
+		}
+
+		for(my $assemblyI = 1; $assemblyI <= $nAssemblies; $assemblyI++)
+		{
+			my $haplotype = '';
+			my $referencePosition = 0;
+			foreach my $variant (@variants)
+			{
+				my ($variantPosition, $referenceAllele_length, $alternativeAllele, $carriers_href) = @$variant;
+				next unless($carriers_href->{$assemblyI});
+				$haplotype .= substr($reference, $referencePosition, $variantPosition - $referencePosition) . $alternativeAllele;
+				$referencePosition = $variantPosition + $referenceAllele_length;
+			}
+			$haplotype .= substr($reference, $referencePosition);
+
+			# fragment into contigs; a short remainder is added to the last contig
+			my $contigStart = 0;
+			my $contigI = 0;
+			while($contigStart < length($haplotype))
+			{
+				my $length = int($contigLength * (0.5 + rand()));
+				$length = 1 if($length < 1);
+				$length = length($haplotype) - $contigStart if(($contigStart + $length + ($contigLength / 4)) > length($haplotype));
+				my $contig = substr($haplotype, $contigStart, $length);
+				if(rand() < 0.5)
+				{
+					$contig = reverse($contig);
+					$contig =~ tr/ACGT/TGCA/;
+				}
+				print CONTIGS '>assembly', $assemblyI, '_', $chromosome, '_', $contigI, "\n", $contig, "\n";
+				$contigStart += $length;
+				$contigI++;
+				$n_contigs++;
+			}
+		}
+	}
+	close(REFERENCE);
+	close(CONTIGS);
+	close(VARIANTS);
+
+	print "Simulated $nChromosomes chromosomes of length $referenceLength, $n_variants variants, $n_contigs contigs from $nAssemblies assemblies.\n";
+}
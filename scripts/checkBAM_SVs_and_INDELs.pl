@@ -7,6 +7,9 @@ use strict;
 use Data::Dumper;
 use Bio::DB::HTS;
 use Getopt::Long;   
+use FindBin;
+use lib $FindBin::Bin;
+use SequenceStore;
 $| = 1;
 
 ## Usage:
@@ -14,6 +17,8 @@ $| = 1;
 ##                            --referenceFasta <path to reference FASTA>
 ##                            --readsFasta <path to FASTA of all contigs>
 ##
+## If <FASTA>.seqstore files (src/BUILD_SEQUENCESTORE) exist, sequences are read from these on demand.
+##
 ## Example command: 
 ## 	./checkBAM_SVs_and_INDELs.pl --BAM /data/projects/phillippy/projects/hackathon/shared/alignments/SevenGenomesPlusGRCh38Alts.bam --referenceFasta /data/projects/phillippy/projects/hackathon/shared/reference/GRCh38_full_plus_hs38d1_analysis_set_minus_alts.fa --readsFasta /data/projects/phillippy/projects/hackathon/shared/contigs/AllContigs.fa
 
@@ -41,19 +46,19 @@ die "--readsFasta $readsFasta not existing" unless(-e $readsFasta);
 
 my $outputFile2 = 'fromBAM_lengthStatistics.txt.individualAlignments';
 
-my $reference_href;
-my $reads_href;
+my $reference;
+my $reads;
 
 my %read_reference_positions;
 my %read_got_primary_alignment;
 
 
-print "Read $referenceFasta\n";
-$reference_href = readFASTA($referenceFasta, 0);
+print "Open $referenceFasta\n";
+$reference = SequenceStore->open($referenceFasta);
 print "\tdone.\n";
 
-print "Read $readsFasta\n";
-$reads_href = readFASTA($readsFasta, 0);
+print "Open $readsFasta\n";
+$reads = SequenceStore->open($readsFasta);
 print "\tdone.\n";
 
 my $sam = Bio::DB::HTS->new(-fasta => $referenceFasta, -bam => $BAM, -expand_flags => 1);
@@ -83,10 +88,10 @@ while(my $alignment = $iterator->next_seq)
 		if(not defined $read_reference_positions{$readID})
 		{
 			$read_reference_positions{$readID} = [];
-			$#{$read_reference_positions{$readID}} = (length($reads_href->{$readID})-1);
+			$#{$read_reference_positions{$readID}} = ($reads->length($readID)-1);
 		}
 			
-		die unless($#{$read_reference_positions{$readID}} == (length($reads_href->{$readID})-1));	
+		die unless($#{$read_reference_positions{$readID}} == ($reads->length($readID)-1));	
 		
 		my $runningRefPos = $read_href->{firstPos_reference};
 		my $runningReadPos = $read_href->{firstPos_read};
@@ -151,7 +156,7 @@ foreach my $readID (keys %read_reference_positions)
 {
 	print "Analyzing alignments for $readID ... \n";
 
-	die unless(scalar(@{$read_reference_positions{$readID}}) == length($reads_href->{$readID}));
+	die unless(scalar(@{$read_reference_positions{$readID}}) == $reads->length($readID));
 	for(my $posI = 0; $posI <= $#{$read_reference_positions{$readID}}; $posI++)
 	{
 		$read_reference_positions{$readID}[$posI] = -1 unless(defined $read_reference_positions{$readID}[$posI]);
@@ -422,21 +427,30 @@ sub convertAlignmentToHash
 	
 	$n_gaps = $n_insertions + $n_deletions;
 	
-	die "Missing reference sequence for $chromosome" unless(exists $reference_href->{$chromosome});
-	my $supposed_reference_sequence = substr($reference_href->{$chromosome}, $firstPos_reference, $lastPos_reference - $firstPos_reference + 1);
+	die "Missing reference sequence for $chromosome" unless($reference->exists($chromosome));
+	my $supposed_reference_sequence = $reference->substr($chromosome, $firstPos_reference, $lastPos_reference - $firstPos_reference + 1);
 	
-	unless(exists $reads_href->{$readID})
+	unless($reads->exists($readID))
 	{
 		warn "Missing read sequence for $readID";
 		return undef;
 	}
 	
-	my $read_sequence = $reads_href->{$readID};
-	if($strand eq '-')
+	# substr() of the (possibly reverse-complemented) read - fetch only that interval
+	my $read_length = $reads->length($readID);
+	my $lastPos_read_bounded = ($lastPos_read < $read_length) ? $lastPos_read : ($read_length - 1);
+	my $supposed_read_sequence = '';
+	if($firstPos_read <= $lastPos_read_bounded)
 	{
-		$read_sequence = reverseComplement($read_sequence);
+		if($strand eq '-')
+		{
+			$supposed_read_sequence = $reads->substr($readID, $read_length - 1 - $lastPos_read_bounded, $lastPos_read_bounded - $firstPos_read + 1, 1);
+		}
+		else
+		{
+			$supposed_read_sequence = $reads->substr($readID, $firstPos_read, $lastPos_read_bounded - $firstPos_read + 1);
+		}
 	}
-	my $supposed_read_sequence = substr($read_sequence, $firstPos_read, $lastPos_read - $firstPos_read + 1);
 	
 	my $alignment_reference_noGaps = $alignment_reference;
 	$alignment_reference_noGaps =~ s/\-//g;
@@ -455,7 +469,7 @@ sub convertAlignmentToHash
 			print "\t", $query, "\n";
 			print "\t", "\$inputAlignment->start: ", $inputAlignment->start, "\n";
 			print "\t", "REF: ", $alignment_reference_noGaps, "\n";
-			print "\t", "RE2: ", substr($reference_href->{$chromosome}, $firstPos_reference - 10, 20), "\n";
+			print "\t", "RE2: ", $reference->substr($chromosome, (($firstPos_reference >= 10) ? ($firstPos_reference - 10) : 0), 20), "\n";
 			print "\t", "ALG: ", $supposed_reference_sequence, "\n";
 			print "\t", "strand: ", $strand, "\n";			
 			print "\n";
@@ -499,47 +513,4 @@ sub convertAlignmentToHash
 	};
 }
 
- 
-sub readFASTA
-{
-	my $file = shift;	
-	my $keepCompleteIdentier = shift;
-	my %R;
-	
-	open(F, '<', $file) or die "Cannot open $file";
-	my $currentSequence;
-	while(<F>)
-	{
-		if(($. % 1000000) == 0)
-		{
-		# 	print "\r", $.;
-		}
-		
-		my $line = $_;
-		chomp($line);
-		$line =~ s/[\n\r]//g;
-		if(substr($line, 0, 1) eq '>')
-		{
-			$currentSequence = substr($line, 1);
-			unless($keepCompleteIdentier)
-			{
-				$currentSequence =~ s/\s.+//;
-			}
-		}
-		else
-		{
-			$R{$currentSequence} .= $line;
-		}
-	}	
-	close(F);
-		
-	return \%R;
-}
 
-sub reverseComplement
-{
-	my $kMer = shift;
-	$kMer =~ tr/ACGT/TGCA/;
-	return reverse($kMer);
-	return $kMer;
-}
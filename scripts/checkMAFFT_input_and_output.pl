@@ -10,6 +10,7 @@ use Getopt::Long;
 use List::Util qw/max all/;
 use List::MoreUtils qw/mesh/;
 use Bio::DB::HTS;
+use Digest::SHA;
 
 $| = 1;
 
@@ -22,6 +23,8 @@ $| = 1;
 ##                                --samtools_path <path to SAMtools executable for fas2bam.pl>
 ##                                --bamheader <path to file containing header for BAM file for fas2bam.pl>
 ##
+## Windows with a <window>.cacheKey file (CALLMAFFT.pl --cacheDir) are also checked against the hashes
+## recorded there - the MSA and BAM must be the ones computed or restored for this window FASTA.
 ##
 ## Example command:
 ## ./checkMAFFT_input_and_output.pl --MAFFTdir /intermediate_files/forMAFFT/
@@ -60,6 +63,7 @@ die unless($bamheader);
 
 ## Keep track of all errors
 my $number_total_errors = 0;
+my $number_windows_cacheKey = 0;
 
 my $readWindowsInfo = read_windowbams_info($MAFFTdir);
 
@@ -94,6 +98,24 @@ foreach my $chr (keys %$readWindowsInfo)
 		my $mfaFile = $window->{mfa};
 		die unless($faFile);
 		die unless($mfaFile);
+		
+		my $cacheKeyFile = $faFile;
+		$cacheKeyFile =~ s/\.fa$/.cacheKey/;
+		if(-e $cacheKeyFile)
+		{
+			$number_windows_cacheKey++;
+			open(CACHEKEY, '<', $cacheKeyFile) or die "Cannot open $cacheKeyFile";
+			my $cacheKey_line = <CACHEKEY>;
+			close(CACHEKEY);
+			chomp($cacheKey_line);
+			my ($key, @expected_digests) = split(/\t/, $cacheKey_line);
+			my @observed_digests = map {Digest::SHA->new(256)->addfile($_, 'b')->hexdigest} ($faFile, $mfaFile, $window->{bam});
+			unless((scalar(@expected_digests) == 3) and (all {$expected_digests[$_] eq $observed_digests[$_]} 0 .. 2))
+			{
+				warn Dumper("Window files don't match the hashes in $cacheKeyFile", $window);
+				$number_total_errors++; ## keep record of total number of errors
+			}
+		}
 		my $fa_href = readFASTA($faFile);
 		my %fa_href_seq2;
 		my %lengths_fa;
@@ -203,6 +225,8 @@ foreach my $chr (keys %$readWindowsInfo)
 	}
 }
 
+print "Checked $number_windows_cacheKey windows against their cache hashes.\n";
+
 my %preMAFFT_BAM_lengths;
 my %preMAFFT_BAM_sequence;
 open(PREMAFFT, $samtools_path, " view $preMAFFTBAM |") or die "Cannot view $preMAFFTBAM";
@@ -288,7 +312,7 @@ foreach my $k (keys %combinedKeys)
 	}
 }
 
-if($n_printed_errors)
+if($number_total_errors)
 {
 	die "A total of $number_total_errors issues were detected. Please see output above.";
 }
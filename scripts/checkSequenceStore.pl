@@ -0,0 +1,117 @@
+#!/usr/bin/perl
+
+## Author: Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+## License: The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes/blob/master/LICENSE
+
+use strict;
+use warnings;
+use Getopt::Long;
+use File::Temp qw/tempdir/;
+use File::Copy;
+use FindBin;
+use lib $FindBin::Bin;
+use SequenceStore;
+
+$| = 1;
+
+## Usage:
+## checkSequenceStore.pl --BUILD_SEQUENCESTORE <path to BUILD_SEQUENCESTORE; default ../src/BUILD_SEQUENCESTORE>
+##
+## Checks that SequenceStore.pm returns the same intervals from a .seqstore (built with BUILD_SEQUENCESTORE) as from
+## the in-memory FASTA, and that both behave like substr() at the ends of the sequences: intervals are truncated,
+## and intervals that start at or after the end of a sequence are empty. Dies on the first difference.
+##
+## Example command:
+## ./checkSequenceStore.pl --BUILD_SEQUENCESTORE ../src/BUILD_SEQUENCESTORE
+
+my $BUILD_SEQUENCESTORE = $FindBin::Bin . '/../src/BUILD_SEQUENCESTORE';
+
+GetOptions (
+	'BUILD_SEQUENCESTORE:s' => \$BUILD_SEQUENCESTORE,
+);
+
+die "BUILD_SEQUENCESTORE not found at $BUILD_SEQUENCESTORE - please run 'make all' in /src or specify --BUILD_SEQUENCESTORE" unless(-x $BUILD_SEQUENCESTORE);
+
+# N runs, lower-case runs and non-ACGTN characters exercise all tables of the store
+my %sequences = (
+	'chr1' => 'ACGTACGTAC',
+	'chr2' => 'NNNNACGTacgtRYACGTNNNN',
+	'chr3' => 'acgTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTTNnG',
+	'empty' => '',
+);
+
+my $dir = tempdir(CLEANUP => 1);
+my $storeFasta = $dir . '/store.fa';
+my $plainFasta = $dir . '/plain.fa';
+open(FASTA, '>', $storeFasta) or die "Cannot open $storeFasta";
+foreach my $id (sort keys %sequences)
+{
+	print FASTA '>', $id, "\n", $sequences{$id}, "\n";
+}
+close(FASTA);
+copy($storeFasta, $plainFasta) or die "Cannot copy $storeFasta to $plainFasta";
+
+system($BUILD_SEQUENCESTORE, '--input', $storeFasta) and die "Could not execute $BUILD_SEQUENCESTORE --input $storeFasta";
+die "BUILD_SEQUENCESTORE did not create " . SequenceStore::storeFilename($storeFasta) unless(-e SequenceStore::storeFilename($storeFasta));
+die "Unexpected sequence store for $plainFasta" if(-e SequenceStore::storeFilename($plainFasta));
+
+my %references = (
+	'store' => SequenceStore->open($storeFasta),
+	'FASTA' => SequenceStore->open($plainFasta),
+);
+
+my $n_checks = 0;
+foreach my $id (sort keys %sequences)
+{
+	my $sequence = $sequences{$id};
+	my $sequence_length = length($sequence);
+	my $expected_reverseComplement = reverse($sequence);
+	$expected_reverseComplement =~ tr/ACGT/TGCA/;
+
+	foreach my $backend (sort keys %references)
+	{
+		my $reference = $references{$backend};
+		die "Length of $id from $backend: " . $reference->length($id) . ", expected $sequence_length" unless($reference->length($id) == $sequence_length);
+		check($backend, "sequence($id)", $reference->sequence($id), $sequence);
+		check($backend, "sequence($id, 1)", $reference->sequence($id, 1), $expected_reverseComplement);
+	}
+
+	# all intervals, including those that extend past the end or start at or after it (up to 99 bp, as in BAM2MAFFT.pl)
+	for(my $start = 0; $start <= ($sequence_length + 99); $start++)
+	{
+		foreach my $length (0, 1, 3, 4, 5, 17, 99, $sequence_length - $start, $sequence_length + 100)
+		{
+			next if($length < 0);
+			my $expected = ($start >= $sequence_length) ? '' : substr($sequence, $start, $length);
+			my $expected_RC = reverse($expected);
+			$expected_RC =~ tr/ACGT/TGCA/;
+			foreach my $backend (sort keys %references)
+			{
+				check($backend, "substr($id, $start, $length)", $references{$backend}->substr($id, $start, $length), $expected);
+				check($backend, "substr($id, $start, $length, 1)", $references{$backend}->substr($id, $start, $length, 1), $expected_RC);
+			}
+		}
+		foreach my $backend (sort keys %references)
+		{
+			check($backend, "substr($id, $start)", $references{$backend}->substr($id, $start), (($start >= $sequence_length) ? '' : substr($sequence, $start)));
+		}
+	}
+}
+
+foreach my $backend (sort keys %references)
+{
+	die "Negative start accepted by $backend" if(defined eval { $references{$backend}->substr('chr1', -1, 2); 1 });
+}
+
+print "All $n_checks checks passed.\n";
+
+sub check
+{
+	my $backend = shift;
+	my $call = shift;
+	my $got = shift;
+	my $expected = shift;
+	die "$call from $backend returned undef, expected '$expected'" unless(defined $got);
+	die "$call from $backend returned '$got', expected '$expected'" unless($got eq $expected);
+	$n_checks++;
+}
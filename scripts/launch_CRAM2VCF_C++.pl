@@ -1,111 +1,847 @@
-#!/usr/bin/env perl
-
-## Author: Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
-## License: The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes/blob/master/LICENSE
-
-use strict;
-use warnings;
-use Data::Dumper;
-use Getopt::Long;   
-use List::Util qw/max all/;
-use List::MoreUtils qw/mesh/;
-use Bio::DB::HTS;
-
-## Usage:
-## launch_CRAM2VCF_C++.pl --output <path to VCF created by CRAM2VCF.pl>
-##
-## Example command:
-## ./launch_CRAM2VCF_C++.pl --output VCF/graph_v2.vcf
-
-$| = 1;
-
-my $output;
-
-GetOptions (
-	'output:s' => \$output,
-);
-
-my $files_done = 0;
-my @commands;
-my @inputFiles;
-my $fn_cmds = $output . '_CRAM2VCF_commands.txt';
-open(CMDS, '<', $fn_cmds) or die "Cannot open $fn_cmds";
-while(<CMDS>)
-{
-	my $line = $_;
-	chomp($line);
-	next unless($line);
-	$line =~ s/\&//g;
-	
-	die unless($line =~ /--input (\S+?) --referenceSequenceID/);	
-	my $inputFile = $1;
-	
-	my $VCF = $inputFile . '.VCF';
-	my $doneFile = $VCF . '.done';
-	if(-e $doneFile)
-	{
-		open(DONE, '<', $doneFile) or die "Cannot open $doneFile";
-		my $done = <DONE>;
-		chomp($done);
-		$done = (length($done) > 0) ? substr($done, 0, 1) : 0;
-		close(DONE);
-		
-		if($done)
-		{
-			$files_done++;
-			next;
-		} 
-		else 
-		{
-			unlink($doneFile) or die "Cannot delete $doneFile";		
-		}
-	}
-	
-	push(@inputFiles, $inputFile);
-	push(@commands, $line);
-	
-	
-}
-close(CMDS);
-
-print "Files done already: $files_done -- delete $output*.done if you want to redo these!\n";
-
-my @command_batches = ([]);
-my $runningSize = 0;
-my $runningCommands = 0;
-my $totalCommands = 0;
-for(my $i = 0; $i <= $#commands; $i++)
-{
-	if(($runningCommands >= 20) or ($runningSize >= 1e6))
-	{
-		push(@command_batches, []);	
-		$runningCommands = 0;
-		$runningSize = 0;
-	}
-	push(@{$command_batches[$#command_batches]}, $commands[$i]);
-	$runningCommands++;
-	$totalCommands++;
-	$runningSize += (-s $inputFiles[$i]);
-}	
-
-if($totalCommands == 0)
-{
-	print "\nAll done.\n\n";
-}
-else
-{
-	print "\nTotal command batches: ", scalar(@command_batches), "\n\n";
-
-	foreach my $command_batch (@command_batches)
-	{
-		my $combined_command = join(';', @$command_batch);
-		my $pid = fork;
-		die "fork failed" unless defined $pid;
-		if ($pid == 0) {
-			system($combined_command) and die "Could not execute command: $combined_command";
-			exit;
-		}	
-	}
-
-	print "\n\nProcesses launched.\n";
-}
+#!/usr/bin/env perl
+
+## Author: Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+## License: The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes/blob/master/LICENSE
+
+use strict;
+use warnings;
+use Data::Dumper;
+use Getopt::Long;   
+use List::Util qw/max min all sum/;
+use List::MoreUtils qw/mesh/;
+use Bio::DB::HTS;
+use Digest::SHA;
+use File::Copy;
+use File::Path qw/make_path remove_tree/;
+use POSIX qw/:sys_wait_h/;
+
+## Usage:
+## launch_CRAM2VCF_C++.pl --output <path to VCF created by CRAM2VCF.pl>
+##                        --estimateComplexity <1/0; default 0>
+##                        --complexityWindow <window length for the complexity pre-pass; default 10000>
+##                        --hotWindowBudget <max. running haplotypes in the most expensive windows; default 0 (off)>
+##                        --hotWindowFraction <fraction of windows treated as expensive; default 0.01>
+##                        --memoryGB <memory budget for concurrently running jobs; default 80% of MemTotal>
+##                        --cores <max. number of concurrently running jobs; default number of processors>
+##                        --resourcesHistory <file with peak memory of earlier jobs; default <output>_CRAM2VCF_resources.txt>
+##                        --cacheDir <directory for cached CRAM2VCF results; optional, can be shared between output directories>
+##                        --statusInterval <seconds between updates of the cohort status file; default 60>
+##                        --stuckMinutes <flag running jobs whose position has not changed for this long; default 30>
+##
+## The commands are run by a scheduler that stays in the foreground until all jobs have finished. A job is
+## started when its predicted peak memory fits into the remaining memory budget and a core is free, longest
+## jobs first. Peak memory is predicted from the part file size and its number of alignments, calibrated by
+## the peak memory of recent jobs (CRAM2VCF writes <input>.VCF.resources; the launcher appends these to
+## --resourcesHistory). A job reuses its own recorded peak only if its part file has the same size and
+## modification time as in the earlier run.
+##
+## With --estimateComplexity 1, each CRAM2VCF command is first run in pre-pass mode (which writes
+## <input>.complexity.bed), and the estimated cost determines which jobs are started first. The pre-passes run
+## concurrently within --cores and --memoryGB, and are skipped for part files whose <input>.complexity.bed is
+## newer than the part file and the CRAM2VCF executable (and has the same --complexityWindow).
+## With --hotWindowBudget N, the most expensive windows (across all inputs) are assigned a budget of
+## N open haplotypes (see CRAM2VCF --regionBudgets), written to <input>.complexity.budgets.bed.
+##
+## With --cacheDir, a job is identified by a hash of what determines its output: the contents of the part file,
+## the reference sequence (if it is not embedded in the part file), the region budgets, the other CRAM2VCF
+## options and the CRAM2VCF executable itself (which covers max_gap_length, max_running_haplotypes_before_add
+## and all other compiled-in parameters). Jobs whose hash is in the cache are not run; the VCF and its sidecar
+## files are copied from the cache instead. The .done files are not used to skip jobs in this mode.
+##
+## While the jobs run, the <input>.VCF.status files written by CRAM2VCF (position, fraction done, open haplotypes,
+## records, throughput, ETA, memory) are collected into <output>_CRAM2VCF_status.txt, one line per job, every
+## --statusInterval seconds, and a summary line is printed. Jobs are flagged as 'stale' if their status file has not
+## been updated for 5 minutes, as 'stuck' if their position has not changed for --stuckMinutes, and as 'memory'
+## if they use more memory than predicted.
+##
+## Example command:
+## ./launch_CRAM2VCF_C++.pl --output VCF/graph_v2.vcf
+## ./launch_CRAM2VCF_C++.pl --output VCF/graph_v2.vcf --estimateComplexity 1 --hotWindowBudget 1000
+## ./launch_CRAM2VCF_C++.pl --output VCF/graph_v2.vcf --cacheDir /data/CRAM2VCF_cache
+
+$| = 1;
+
+my $output;
+my $estimateComplexity = 0;
+my $complexityWindow = 10000;
+my $hotWindowBudget = 0;
+my $hotWindowFraction = 0.01;
+my $memoryGB;
+my $cores;
+my $resourcesHistory;
+my $cacheDir;
+my $statusInterval = 60;
+my $stuckMinutes = 30;
+
+GetOptions (
+	'output:s' => \$output,
+	'estimateComplexity:s' => \$estimateComplexity,
+	'complexityWindow:s' => \$complexityWindow,
+	'hotWindowBudget:s' => \$hotWindowBudget,
+	'hotWindowFraction:s' => \$hotWindowFraction,
+	'memoryGB:s' => \$memoryGB,
+	'cores:s' => \$cores,
+	'resourcesHistory:s' => \$resourcesHistory,
+	'cacheDir:s' => \$cacheDir,
+	'statusInterval:s' => \$statusInterval,
+	'stuckMinutes:s' => \$stuckMinutes,
+);
+
+die "Please specify --output" unless($output);
+die "--hotWindowBudget requires --estimateComplexity 1" if($hotWindowBudget and not $estimateComplexity);
+die "--hotWindowFraction must be in (0, 1]" unless(($hotWindowFraction > 0) and ($hotWindowFraction <= 1));
+
+$memoryGB = default_memoryGB() unless(defined $memoryGB);
+$cores = default_cores() unless(defined $cores);
+$resourcesHistory = $output . '_CRAM2VCF_resources.txt' unless(defined $resourcesHistory);
+die "--memoryGB must be positive" unless($memoryGB > 0);
+die "--cores must be a positive integer" unless(($cores =~ /^\d+$/) and ($cores > 0));
+die "--statusInterval must be a positive integer" unless(($statusInterval =~ /^\d+$/) and ($statusInterval > 0));
+die "--stuckMinutes must be positive" unless($stuckMinutes > 0);
+if($cacheDir)
+{
+	make_path($cacheDir) unless(-d $cacheDir);
+	die "--cacheDir $cacheDir is not a directory" unless(-d $cacheDir);
+}
+
+# files written by CRAM2VCF that are stored in, and restored from, the cache; the optional ones (e.g. the
+# --profileHaplotypes and --pathAnnotation output) only exist if the options that produce them are part of the command,
+# and thus of the key
+my @cachedSuffixes = ('.VCF', '.VCF.expectedSNPs', '.VCF.resources', '.VCF.profile.bed', '.VCF.profile.txt', '.VCF.paths');
+my %cache_key;
+my %file_digest_cache;
+
+my $files_done = 0;
+my @commands;
+my @inputFiles;
+my $fn_cmds = $output . '_CRAM2VCF_commands.txt';
+open(CMDS, '<', $fn_cmds) or die "Cannot open $fn_cmds";
+while(<CMDS>)
+{
+	my $line = $_;
+	chomp($line);
+	next unless($line);
+	$line =~ s/\&//g;
+	$line =~ s/\s+$//;
+	
+	die unless($line =~ /--input (\S+?) --referenceSequenceID/);	
+	my $inputFile = $1;
+	
+	my $VCF = $inputFile . '.VCF';
+	my $doneFile = $VCF . '.done';
+	if((not $cacheDir) and (-e $doneFile))
+	{
+		open(DONE, '<', $doneFile) or die "Cannot open $doneFile";
+		my $done = <DONE>;
+		chomp($done);
+		$done = (length($done) > 0) ? substr($done, 0, 1) : 0;
+		close(DONE);
+		
+		if($done)
+		{
+			$files_done++;
+			next;
+		} 
+		else 
+		{
+			unlink($doneFile) or die "Cannot delete $doneFile";		
+		}
+	}
+	
+	push(@inputFiles, $inputFile);
+	push(@commands, $line);
+	
+	
+}
+close(CMDS);
+
+if($cacheDir)
+{
+	# the region budgets are part of the cache key, and with --hotWindowBudget they are only known after the pre-pass
+	restore_from_cache() unless($hotWindowBudget);
+}
+else
+{
+	print "Files done already: $files_done -- delete $output*.done if you want to redo these!\n";
+}
+
+# memory model: peak RSS = base + bytes_factor * (part file size) + alignment_factor * (number of alignments);
+# bytes_factor is the 90th percentile of the values observed in the most recent $memory_history_window history
+# entries (if that is larger than the default), so that a single outlier does not inflate all later predictions and
+# old runs age out. Jobs that ran before on the same part file (path, size and modification time) use their own
+# most recent recorded peak. The complexity pre-pass loads all alignments as well, and is scheduled with the same prediction.
+my $memory_base_kB = 200 * 1024;
+my $memory_per_alignment_kB = 0.5;
+my $memory_per_byte = 6;
+my $memory_safety_factor = 1.2;
+my $memory_history_window = 50;
+
+my %history_peak_kB;
+my %history_seconds;
+my @observed_per_byte;
+if(-e $resourcesHistory)
+{
+	open(HISTORY, '<', $resourcesHistory) or die "Cannot open $resourcesHistory";
+	while(<HISTORY>)
+	{
+		my $line = $_;
+		chomp($line);
+		next unless($line);
+		next if(substr($line, 0, 1) eq '#');
+		my ($h_inputFile, $h_size, $h_n_alignments, $h_peak_kB, $h_seconds, $h_mtime) = split(/\t/, $line);
+		die "Weird line in $resourcesHistory: $line" unless(defined $h_seconds);
+		
+		# lines written before the modification time was recorded cannot be matched to a part file
+		if(defined $h_mtime)
+		{
+			my $identity = join("\t", $h_inputFile, $h_size, $h_mtime);
+			$history_peak_kB{$identity} = $h_peak_kB;
+			$history_seconds{$identity} = $h_seconds;
+		}
+		if($h_size > 0)
+		{
+			push(@observed_per_byte, ($h_peak_kB - $memory_base_kB - $memory_per_alignment_kB * $h_n_alignments) * 1024 / $h_size);
+		}
+	}
+	close(HISTORY);
+	
+	if(scalar(@observed_per_byte))
+	{
+		my @recent = sort {$a <=> $b} @observed_per_byte[max(0, scalar(@observed_per_byte) - $memory_history_window) .. $#observed_per_byte];
+		my $percentile_90 = $recent[int(0.9 * $#recent)];
+		$memory_per_byte = $percentile_90 if($percentile_90 > $memory_per_byte);
+	}
+}
+
+my %job_size;
+my %job_mtime;
+my %job_n_alignments;
+my %job_memory_kB;
+foreach my $inputFile (@inputFiles)
+{
+	$job_size{$inputFile} = part_file_size($inputFile);
+	$job_mtime{$inputFile} = (-e $inputFile) ? (stat($inputFile))[9] : 0;
+	$job_n_alignments{$inputFile} = n_alignments_for_part($inputFile);
+	my $predicted_kB = $memory_base_kB + $memory_per_alignment_kB * $job_n_alignments{$inputFile} + $memory_per_byte * $job_size{$inputFile} / 1024;
+	my $identity = join("\t", $inputFile, $job_size{$inputFile}, $job_mtime{$inputFile});
+	$predicted_kB = $history_peak_kB{$identity} if(exists $history_peak_kB{$identity});
+	$job_memory_kB{$inputFile} = $predicted_kB * $memory_safety_factor;
+}
+my $memory_budget_kB = $memoryGB * 1024 * 1024;
+
+
+my %estimated_cost;
+if($estimateComplexity and scalar(@commands))
+{
+	# pre-passes run concurrently, within --cores and --memoryGB; an <input>.complexity.bed that is newer than the part
+	# file and the CRAM2VCF executable and has the same window length is reused
+	my @prepass_commands;
+	my @prepass_inputFiles;
+	for(my $i = 0; $i <= $#commands; $i++)
+	{
+		my $inputFile = $inputFiles[$i];
+		next if(complexity_up_to_date($inputFile, $commands[$i]));
+		push(@prepass_commands, $commands[$i] . ' --estimateComplexity 1 --complexityWindow ' . $complexityWindow . ' > ' . $inputFile . '.complexity.log 2>&1');
+		push(@prepass_inputFiles, $inputFile);
+	}
+	print "Complexity pre-pass: ", scalar(@prepass_commands), " to run, ", (scalar(@commands) - scalar(@prepass_commands)), " up to date.\n";
+	my @failed_prepasses = run_concurrently(\@prepass_commands, [map {$job_memory_kB{$_}} @prepass_inputFiles]);
+	die "Could not execute complexity pre-pass:\n" . join("\n", map {' - '.$_} @failed_prepasses) . "\n" if(scalar(@failed_prepasses));
+	
+	my %windows_per_input;
+	for(my $i = 0; $i <= $#commands; $i++)
+	{
+		my $inputFile = $inputFiles[$i];
+		my $complexityFile = $inputFile . '.complexity.bed';
+		$estimated_cost{$inputFile} = 0;
+		$windows_per_input{$inputFile} = [];
+		open(COMPLEXITY, '<', $complexityFile) or die "Cannot open $complexityFile";
+		while(<COMPLEXITY>)
+		{
+			my $line = $_;
+			chomp($line);
+			next unless($line);
+			next if(substr($line, 0, 1) eq '#');
+			my @fields = split(/\t/, $line);
+			die "Weird line in $complexityFile: $line" unless(scalar(@fields) >= 4);
+			$estimated_cost{$inputFile} += $fields[3];
+			push(@{$windows_per_input{$inputFile}}, [@fields[0 .. 3]]);
+		}
+		close(COMPLEXITY);
+	}
+	
+	if($hotWindowBudget)
+	{
+		my @all_costs = sort {$b <=> $a} map {$_->[3]} map {@$_} values %windows_per_input;
+		my $n_hot = int(scalar(@all_costs) * $hotWindowFraction + 0.5);
+		$n_hot = 1 if($n_hot < 1);
+		my $hot_threshold = $all_costs[$n_hot - 1];
+		
+		my $n_hot_windows = 0;
+		for(my $i = 0; $i <= $#commands; $i++)
+		{
+			my $inputFile = $inputFiles[$i];
+			my $budgetsFile = $inputFile . '.complexity.budgets.bed';
+			my @hot_windows = grep {($_->[3] > 0) and ($_->[3] >= $hot_threshold)} @{$windows_per_input{$inputFile}};
+			if(scalar(@hot_windows))
+			{
+				open(BUDGETS, '>', $budgetsFile) or die "Cannot open $budgetsFile";
+				foreach my $window (@hot_windows)
+				{
+					print BUDGETS join("\t", @{$window}[0 .. 2], $hotWindowBudget), "\n";
+				}
+				close(BUDGETS);
+				$commands[$i] .= ' --regionBudgets ' . $budgetsFile;
+				$n_hot_windows += scalar(@hot_windows);
+			}
+			elsif(-e $budgetsFile)
+			{
+				unlink($budgetsFile) or die "Cannot delete $budgetsFile";
+			}
+		}
+		print "Assigned budget $hotWindowBudget to $n_hot_windows windows with estimated cost >= $hot_threshold.\n";
+	}
+	
+	restore_from_cache() if($cacheDir and $hotWindowBudget);
+	
+	my @sorted_indices = sort {($estimated_cost{$inputFiles[$b]} <=> $estimated_cost{$inputFiles[$a]}) or ($a <=> $b)} (0 .. $#commands);
+	@commands = @commands[@sorted_indices];
+	@inputFiles = @inputFiles[@sorted_indices];
+}
+
+# the complexity estimate if there is one, otherwise the part file size
+my %job_length;
+foreach my $inputFile (@inputFiles)
+{
+	$job_length{$inputFile} = ($estimateComplexity) ? $estimated_cost{$inputFile} : $job_size{$inputFile};
+}
+
+
+my @queue = sort {($job_length{$inputFiles[$b]} <=> $job_length{$inputFiles[$a]}) or ($a <=> $b)} (0 .. $#commands);
+my $totalCommands = scalar(@queue);
+
+if($totalCommands == 0)
+{
+	print "\nAll done.\n\n";
+}
+else
+{
+	printf("\nSchedule %d jobs -- memory budget %.1f GB, %d cores, predicted peak memory per job %.1f - %.1f GB.\n\n", $totalCommands, $memoryGB, $cores, (min(map {$job_memory_kB{$_}} @inputFiles) / 1024**2), (max(map {$job_memory_kB{$_}} @inputFiles) / 1024**2));
+	
+	open(HISTORY, '>>', $resourcesHistory) or die "Cannot open $resourcesHistory";
+	
+	my %running;
+	my $used_memory_kB = 0;
+	my @failed;
+	my $n_finished = 0;
+	my %job_state = map {$inputFiles[$_] => 'queued'} @queue;
+	my %job_start;
+	my %last_position;
+	my $last_status_time = 0;
+	
+	# one line per job in <output>_CRAM2VCF_status.txt, from the <input>.VCF.status files of CRAM2VCF
+	my $fn_status = $output . '_CRAM2VCF_status.txt';
+	my @status_fields = qw/phase fraction_done position open_haplotypes records positions_per_second eta_seconds rss_kB peak_rss_kB/;
+	my $write_status = sub {
+		my $now = time();
+		my @flagged;
+		my @fractions_running;
+		my $max_eta = 0;
+		open(STATUS, '>', $fn_status . '.tmp') or die "Cannot open ${fn_status}.tmp";
+		print STATUS join("\t", '#inputFile', 'state', @status_fields, 'predicted_kB', 'seconds_since_update', 'flags'), "\n";
+		foreach my $inputFile (@inputFiles)
+		{
+			next unless(exists $job_state{$inputFile});
+			my $state = $job_state{$inputFile};
+			my $status_href = ($state eq 'queued') ? {} : read_resources($inputFile . '.VCF.status');
+			my $since_update = (exists $status_href->{updated}) ? ($now - $status_href->{updated}) : 'NA';
+			
+			my @flags;
+			if($state eq 'running')
+			{
+				if(exists $status_href->{position})
+				{
+					if((not exists $last_position{$inputFile}) or ($last_position{$inputFile}[0] != $status_href->{position}) or ($status_href->{phase} ne 'sweep'))
+					{
+						$last_position{$inputFile} = [$status_href->{position}, $now];
+					}
+					push(@flags, 'stuck') if(($now - $last_position{$inputFile}[1]) >= ($stuckMinutes * 60));
+					push(@fractions_running, $status_href->{fraction_done});
+					$max_eta = $status_href->{eta_seconds} if(($status_href->{eta_seconds} ne 'NA') and ($status_href->{eta_seconds} > $max_eta));
+				}
+				my $seconds_without_update = ($since_update eq 'NA') ? ($now - $job_start{$inputFile}) : $since_update;
+				push(@flags, 'stale') if($seconds_without_update > 300);
+			}
+			push(@flags, 'memory') if((exists $status_href->{rss_kB}) and ($status_href->{rss_kB} > $job_memory_kB{$inputFile}));
+			push(@flagged, $inputFile . ' (' . join(',', @flags) . ')') if(scalar(@flags) and ($state eq 'running'));
+			
+			print STATUS join("\t", $inputFile, $state, (map {$status_href->{$_} // 'NA'} @status_fields), int($job_memory_kB{$inputFile}), $since_update, (scalar(@flags) ? join(',', @flags) : '.')), "\n";
+		}
+		close(STATUS);
+		rename($fn_status . '.tmp', $fn_status) or die "Cannot rename ${fn_status}.tmp to $fn_status";
+		
+		printf("Status: %d running (avg. %.1f%% done, max. ETA %ds), %d finished, %d queued, %.1f GB predicted in use%s -- see %s\n", scalar(@fractions_running), (scalar(@fractions_running) ? (100 * sum(@fractions_running) / scalar(@fractions_running)) : 0), $max_eta, $n_finished, scalar(@queue), $used_memory_kB / 1024**2, (scalar(@flagged) ? ('; flagged: ' . join(', ', @flagged)) : ''), $fn_status);
+		$last_status_time = $now;
+	};
+	
+	while(scalar(@queue) or scalar(keys %running))
+	{
+		# start the longest jobs that fit; a job that is larger than the whole budget runs on its own
+		my $started_job = 1;
+		while($started_job and scalar(@queue) and (scalar(keys %running) < $cores))
+		{
+			$started_job = 0;
+			for(my $qI = 0; $qI <= $#queue; $qI++)
+			{
+				my $inputFile = $inputFiles[$queue[$qI]];
+				my $fits = (($used_memory_kB + $job_memory_kB{$inputFile}) <= $memory_budget_kB);
+				next unless($fits or (scalar(keys %running) == 0));
+				
+				my $commandI = splice(@queue, $qI, 1);
+				my $command = $commands[$commandI];
+				unlink($inputFile . '.VCF.resources');
+				unlink($inputFile . '.VCF.status');
+				my $pid = fork;
+				die "fork failed" unless defined $pid;
+				if ($pid == 0) {
+					exec('/bin/sh', '-c', $command) or die "Could not execute command: $command";
+				}
+				$running{$pid} = [$commandI, time()];
+				$job_state{$inputFile} = 'running';
+				$job_start{$inputFile} = time();
+				$used_memory_kB += $job_memory_kB{$inputFile};
+				printf("Started %s (predicted %.1f GB; now using %.1f GB, %d jobs running, %d queued)\n", $inputFile, $job_memory_kB{$inputFile} / 1024**2, $used_memory_kB / 1024**2, scalar(keys %running), scalar(@queue));
+				$started_job = 1;
+				last;
+			}
+		}
+		
+		# poll for finished jobs, so that the status file can be updated in the meantime
+		my $pid = waitpid(-1, WNOHANG);
+		last if($pid == -1);
+		if($pid == 0)
+		{
+			$write_status->() if((time() - $last_status_time) >= $statusInterval);
+			sleep(1);
+			next;
+		}
+		next unless(exists $running{$pid});
+		my $exitStatus = $?;
+		my ($commandI, $startTime) = @{$running{$pid}};
+		delete $running{$pid};
+		my $inputFile = $inputFiles[$commandI];
+		$used_memory_kB -= $job_memory_kB{$inputFile};
+		$n_finished++;
+		
+		if($exitStatus != 0)
+		{
+			print "Job failed (exit status $exitStatus): $commands[$commandI]\n";
+			push(@failed, $commands[$commandI]);
+			$job_state{$inputFile} = 'failed';
+			next;
+		}
+		
+		$job_state{$inputFile} = 'done';
+		
+		my $resources_href = read_resources($inputFile . '.VCF.resources');
+		if(exists $resources_href->{peak_rss_kB})
+		{
+			print HISTORY join("\t", $inputFile, $job_size{$inputFile}, $job_n_alignments{$inputFile}, $resources_href->{peak_rss_kB}, time() - $startTime, $job_mtime{$inputFile}), "\n";
+			HISTORY->flush();
+			printf("Finished %s (%d/%d) -- peak memory %.1f GB, predicted %.1f GB.\n", $inputFile, $n_finished, $totalCommands, $resources_href->{peak_rss_kB} / 1024**2, $job_memory_kB{$inputFile} / 1024**2);
+		}
+		else
+		{
+			print "Finished $inputFile ($n_finished/$totalCommands) -- no resource usage recorded.\n";
+		}
+		
+		store_in_cache($inputFile) if($cacheDir);
+	}
+	close(HISTORY);
+	$write_status->();
+	
+	if(scalar(@failed))
+	{
+		die "\n" . scalar(@failed) . " jobs failed:\n" . join("\n", map {' - '.$_} @failed) . "\n";
+	}
+	print "\n\nAll jobs finished.\n";
+}
+
+# Removes all jobs whose results are in the cache from @commands / @inputFiles, and puts the cached results in place.
+# A job is also skipped if its outputs are complete and were produced for the same key (<input>.VCF.cacheKey).
+sub restore_from_cache
+{
+	my @commands_to_run;
+	my @inputFiles_to_run;
+	my $n_current = 0;
+	my $n_restored = 0;
+	for(my $i = 0; $i <= $#commands; $i++)
+	{
+		my $inputFile = $inputFiles[$i];
+		my $VCF = $inputFile . '.VCF';
+		my $key = cache_key($commands[$i]);
+		$cache_key{$inputFile} = $key;
+		
+		my $entry = cache_entry($key);
+		if(get_done($VCF . '.done') and (read_first_line($VCF . '.cacheKey') eq $key))
+		{
+			$n_current++;
+		}
+		elsif(-d $entry)
+		{
+			unlink($VCF . '.done');
+			foreach my $suffix (@cachedSuffixes)
+			{
+				my $cachedFile = $entry . '/output' . $suffix;
+				if(-e $cachedFile)
+				{
+					copy($cachedFile, $inputFile . $suffix) or die "Cannot copy $cachedFile to ${inputFile}${suffix}";
+				}
+				elsif(-e $inputFile . $suffix)
+				{
+					# left over from an earlier run with different options
+					unlink($inputFile . $suffix) or die "Cannot delete ${inputFile}${suffix}";
+				}
+			}
+			write_first_line($VCF . '.cacheKey', $key);
+			write_first_line($VCF . '.done', 1);
+			$n_restored++;
+			print "Restored $VCF from cache entry $entry\n";
+		}
+		else
+		{
+			unlink($VCF . '.done');
+			push(@commands_to_run, $commands[$i]);
+			push(@inputFiles_to_run, $inputFile);
+		}
+	}
+	@commands = @commands_to_run;
+	@inputFiles = @inputFiles_to_run;
+	print "Cache $cacheDir: $n_current results up to date, $n_restored restored from the cache, ", scalar(@commands), " to compute.\n";
+}
+
+sub store_in_cache
+{
+	my $inputFile = shift;
+	my $key = $cache_key{$inputFile};
+	die "No cache key for $inputFile" unless(defined $key);
+	return unless(get_done($inputFile . '.VCF.done'));
+	
+	write_first_line($inputFile . '.VCF.cacheKey', $key);
+	
+	my $entry = cache_entry($key);
+	return if(-d $entry);
+	
+	# copy into a temporary directory first, so that concurrent or interrupted runs never see a partial entry
+	my $entry_temp = $entry . '.temp.' . $$;
+	make_path($entry_temp);
+	foreach my $suffix (@cachedSuffixes)
+	{
+		next unless(-e $inputFile . $suffix);
+		copy($inputFile . $suffix, $entry_temp . '/output' . $suffix) or die "Cannot copy ${inputFile}${suffix} to $entry_temp";
+	}
+	unless(rename($entry_temp, $entry))
+	{
+		# somebody else has stored the same result in the meantime
+		remove_tree($entry_temp);
+	}
+}
+
+sub cache_entry
+{
+	my $key = shift;
+	return $cacheDir . '/' . substr($key, 0, 2) . '/' . $key;
+}
+
+sub cache_key
+{
+	my $command = shift;
+	
+	my @tokens = split(/\s+/, $command);
+	my $executable = shift(@tokens);
+	my %parameters;
+	while(scalar(@tokens))
+	{
+		my $token = shift(@tokens);
+		
+		# redirections of the log output
+		if($token =~ /^\d*>>?$/)
+		{
+			shift(@tokens);
+			next;
+		}
+		next if($token =~ /^\d*>/);
+		
+		die "Cannot parse CRAM2VCF command for --cacheDir: $command" unless(($token =~ /^--(\S+)$/) and scalar(@tokens));
+		$parameters{$1} = shift(@tokens);
+	}
+	die "Cannot parse CRAM2VCF command for --cacheDir: $command" unless(exists $parameters{input} and exists $parameters{referenceSequenceID});
+	
+	my $sha = Digest::SHA->new(256);
+	$sha->add("CRAM2VCF result v2\n");
+	$sha->add(join("\t", 'executable', file_digest($executable)), "\n");
+	foreach my $name (sort keys %parameters)
+	{
+		my $value = $parameters{$name};
+		if(($name eq 'input') or ($name eq 'regionBudgets'))
+		{
+			$value = file_digest($value);
+		}
+		elsif($name eq 'referenceFasta')
+		{
+			$value = reference_digest($value, $parameters{referenceSequenceID});
+		}
+		$sha->add(join("\t", $name, $value), "\n");
+	}
+	return $sha->hexdigest;
+}
+
+sub file_digest
+{
+	my $fn = shift;
+	die "File $fn not existing" unless(-e $fn);
+	unless(exists $file_digest_cache{$fn})
+	{
+		$file_digest_cache{$fn} = Digest::SHA->new(256)->addfile($fn, 'b')->hexdigest;
+	}
+	return $file_digest_cache{$fn};
+}
+
+# digest of one sequence of an indexed FASTA, independent of the line length of the file
+sub reference_digest
+{
+	my $referenceFasta = shift;
+	my $referenceSequenceID = shift;
+	
+	my $fn_fai = $referenceFasta . '.fai';
+	my ($length, $offset, $lineBases, $lineWidth);
+	open(FAI, '<', $fn_fai) or die "Cannot open $fn_fai";
+	while(<FAI>)
+	{
+		my $line = $_;
+		chomp($line);
+		my @fields = split(/\t/, $line);
+		if($fields[0] eq $referenceSequenceID)
+		{
+			($length, $offset, $lineBases, $lineWidth) = @fields[1 .. 4];
+			last;
+		}
+	}
+	close(FAI);
+	die "Sequence $referenceSequenceID not in $fn_fai" unless(defined $lineWidth);
+	
+	my $sha = Digest::SHA->new(256);
+	my $bytes = int($length / $lineBases) * $lineWidth + ($length % $lineBases);
+	open(FASTA, '<:raw', $referenceFasta) or die "Cannot open $referenceFasta";
+	seek(FASTA, $offset, 0) or die "Cannot seek in $referenceFasta";
+	my $buffer;
+	while($bytes > 0)
+	{
+		my $read = read(FASTA, $buffer, ($bytes > (1 << 24)) ? (1 << 24) : $bytes);
+		die "Cannot read $referenceSequenceID from $referenceFasta" unless($read);
+		$bytes -= $read;
+		$buffer =~ s/[\r\n]//g;
+		$sha->add($buffer);
+	}
+	close(FASTA);
+	return join(':', $length, $sha->hexdigest);
+}
+
+sub get_done
+{
+	my $fn = shift;
+	my $done = read_first_line($fn);
+	return (length($done) > 0) ? substr($done, 0, 1) : 0;
+}
+
+sub read_first_line
+{
+	my $fn = shift;
+	return '' unless(-e $fn);
+	open(F, '<', $fn) or die "Cannot open $fn";
+	my $line = <F>;
+	close(F);
+	$line = '' unless(defined $line);
+	chomp($line);
+	return $line;
+}
+
+sub write_first_line
+{
+	my $fn = shift;
+	my $line = shift;
+	open(F, '>', $fn) or die "Cannot open $fn";
+	print F $line, "\n";
+	close(F);
+}
+
+# <input>.complexity.bed can be reused if it is newer than the part file and the executable, and was computed
+# with the current --complexityWindow (the length of its first window)
+sub complexity_up_to_date
+{
+	my $inputFile = shift;
+	my $command = shift;
+	
+	my $complexityFile = $inputFile . '.complexity.bed';
+	return 0 unless(-e $complexityFile);
+	my ($executable) = split(/\s+/, $command);
+	my $complexity_mtime = (stat($complexityFile))[9];
+	return 0 unless($complexity_mtime >= (stat($inputFile))[9]);
+	return 0 unless((-e $executable) and ($complexity_mtime >= (stat($executable))[9]));
+	
+	open(COMPLEXITY, '<', $complexityFile) or die "Cannot open $complexityFile";
+	my $window_length;
+	while(<COMPLEXITY>)
+	{
+		my $line = $_;
+		chomp($line);
+		next unless($line);
+		next if(substr($line, 0, 1) eq '#');
+		my @fields = split(/\t/, $line);
+		$window_length = $fields[2] - $fields[1] if(scalar(@fields) >= 4);
+		last;
+	}
+	close(COMPLEXITY);
+	return ((defined $window_length) and ($window_length == $complexityWindow));
+}
+
+# runs the commands with at most --cores at a time and within --memoryGB (a command larger than the whole budget
+# runs on its own), in the given order; returns the commands that failed
+sub run_concurrently
+{
+	my $commands_aref = shift;
+	my $memory_kB_aref = shift;
+	
+	my @pending = (0 .. $#{$commands_aref});
+	my %running;
+	my $used_memory_kB = 0;
+	my @failed;
+	while(scalar(@pending) or scalar(keys %running))
+	{
+		while(scalar(@pending) and (scalar(keys %running) < $cores) and ((($used_memory_kB + $memory_kB_aref->[$pending[0]]) <= $memory_budget_kB) or (scalar(keys %running) == 0)))
+		{
+			my $commandI = shift(@pending);
+			my $pid = fork;
+			die "fork failed" unless defined $pid;
+			if ($pid == 0) {
+				exec('/bin/sh', '-c', $commands_aref->[$commandI]) or die "Could not execute command: $commands_aref->[$commandI]";
+			}
+			$running{$pid} = $commandI;
+			$used_memory_kB += $memory_kB_aref->[$commandI];
+		}
+		
+		my $pid = waitpid(-1, 0);
+		last if($pid == -1);
+		next unless(exists $running{$pid});
+		my $commandI = $running{$pid};
+		delete $running{$pid};
+		$used_memory_kB -= $memory_kB_aref->[$commandI];
+		push(@failed, $commands_aref->[$commandI]) if($? != 0);
+	}
+	return @failed;
+}
+
+sub n_alignments_for_part
+{
+	my $inputFile = shift;
+	my $fn_n_alignments = $inputFile . '.n_alignments';
+	if(-e $fn_n_alignments)
+	{
+		open(N, '<', $fn_n_alignments) or die "Cannot open $fn_n_alignments";
+		my $n = <N>;
+		close(N);
+		chomp($n);
+		return $n;
+	}
+	
+	# part files from older versions of CRAM2VCF.pl: count lines (the first line is the reference sequence)
+	my $n_lines = 0;
+	open(PART, '<', $inputFile) or die "Cannot open $inputFile";
+	my $buffer;
+	while(read(PART, $buffer, 1 << 20))
+	{
+		$n_lines += ($buffer =~ tr/\n//);
+	}
+	close(PART);
+	return ($n_lines > 0) ? ($n_lines - 1) : 0;
+}
+
+# size of the (uncompressed) contents of a part file; part files written with CRAM2VCF.pl --compressPartFiles 1
+# are BGZF, where the last 4 bytes of each block hold its uncompressed size
+sub part_file_size
+{
+	my $inputFile = shift;
+	return 0 unless(-e $inputFile);
+	open(PART, '<:raw', $inputFile) or die "Cannot open $inputFile";
+	my $header;
+	my $size = 0;
+	if((read(PART, $header, 18) == 18) and (substr($header, 0, 2) eq "\x1f\x8b"))
+	{
+		my $blockStart = 0;
+		while(1)
+		{
+			seek(PART, $blockStart, 0) or die "Cannot seek in $inputFile";
+			last unless(read(PART, $header, 18) == 18);
+			my ($xlen, $subfield_id, $block_size) = unpack('x10 v A2 x2 v', $header);
+			die "$inputFile is not in BGZF format" unless($subfield_id eq 'BC');
+			seek(PART, $blockStart + $block_size + 1 - 4, 0) or die "Cannot seek in $inputFile";
+			my $isize;
+			die "Truncated BGZF block in $inputFile" unless(read(PART, $isize, 4) == 4);
+			$size += unpack('V', $isize);
+			$blockStart += $block_size + 1;
+		}
+	}
+	else
+	{
+		$size = (-s $inputFile);
+	}
+	close(PART);
+	return $size;
+}
+
+sub read_resources
+{
+	my $fn = shift;
+	my %resources;
+	return \%resources unless(-e $fn);
+	open(RESOURCES, '<', $fn) or die "Cannot open $fn";
+	while(<RESOURCES>)
+	{
+		my $line = $_;
+		chomp($line);
+		my ($key, $value) = split(/\t/, $line);
+		$resources{$key} = $value if(defined $value);
+	}
+	close(RESOURCES);
+	return \%resources;
+}
+
+sub default_memoryGB
+{
+	open(MEMINFO, '<', '/proc/meminfo') or die "Cannot open /proc/meminfo - please specify --memoryGB";
+	my $memTotal_kB;
+	while(<MEMINFO>)
+	{
+		if($_ =~ /^MemTotal:\s+(\d+)\s+kB/)
+		{
+			$memTotal_kB = $1;
+		}
+	}
+	close(MEMINFO);
+	die "Cannot determine MemTotal - please specify --memoryGB" unless($memTotal_kB);
+	return 0.8 * $memTotal_kB / 1024**2;
+}
+
+sub default_cores
+{
+	my $n_processors = 0;
+	if(open(CPUINFO, '<', '/proc/cpuinfo'))
+	{
+		while(<CPUINFO>)
+		{
+			$n_processors++ if($_ =~ /^processor\s*:/);
+		}
+		close(CPUINFO);
+	}
+	return ($n_processors > 0) ? $n_processors : 1;
+}
@@ -0,0 +1,706 @@
+//============================================================================
+// Name        : BAM2ALIGNMENT.cpp
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+/*
+
+   Native implementation of scripts/BAM2ALIGNMENT.pl (requires htslib - build with 'make htslib HTSLIB_DIR=...').
+
+   Reads the contigs BAM with multiple decompression threads, converts records into the tab-separated alignment
+   format (same fields and checks as convertAlignmentToHash() in the Perl implementation) on a pool of worker
+   threads, and writes <outputFile>.sortedWithHeader directly. Sorting is done internally (in-memory runs of
+   --sortBufferMB, merged from temporary files if necessary) in byte order, i.e. like 'LC_ALL=C sort'.
+
+   Reference and contig sequences are accessed through faidx (one handle per thread), so neither FASTA file
+   has to be held in memory.
+
+*/
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <assert.h>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+#include <queue>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+
+#include <htslib/sam.h>
+#include <htslib/faidx.h>
+
+#include "Utilities.h"
+
+class sequenceFetcher
+{
+	// thin wrapper around a faidx handle - faidx handles must not be shared between threads
+	faidx_t* fai;
+	std::string fn;
+
+public:
+	sequenceFetcher(std::string FASTA) : fn(FASTA)
+	{
+		fai = fai_load(FASTA.c_str());
+		if(fai == 0)
+		{
+			throw std::runtime_error("Cannot load FASTA index for " + FASTA);
+		}
+	}
+	~sequenceFetcher()
+	{
+		fai_destroy(fai);
+	}
+	sequenceFetcher(const sequenceFetcher&) = delete;
+	sequenceFetcher& operator=(const sequenceFetcher&) = delete;
+
+	bool has(const std::string& sequenceID) const
+	{
+		return faidx_has_seq(fai, sequenceID.c_str());
+	}
+
+	long long length(const std::string& sequenceID) const
+	{
+		return faidx_seq_len(fai, sequenceID.c_str());
+	}
+
+	// 0-based, inclusive - truncated at the end of the sequence (like Perl's substr)
+	std::string fetch(const std::string& sequenceID, long long first, long long last) const
+	{
+		if(last < first)
+			return "";
+		int len = 0;
+		char* s = faidx_fetch_seq(fai, sequenceID.c_str(), first, last, &len);
+		if(s == 0)
+		{
+			throw std::runtime_error("Cannot fetch " + sequenceID + " from " + fn);
+		}
+		std::string forReturn;
+		if(len > 0)
+		{
+			forReturn.assign(s, len);
+		}
+		free(s);
+		return forReturn;
+	}
+};
+
+class conversionResult
+{
+public:
+	bool haveLine;
+	std::string line; // all fields apart from completeReadSequence_plus / completeReadSequence_minus
+	std::string messages;
+
+	conversionResult() : haveLine(false) {}
+};
+
+class externalSorter
+{
+	/*
+	   Collects lines, sorts them in byte order in runs of (approximately) maxBufferBytes and writes the runs
+	   to temporary files; finish() merges the runs (or just the in-memory buffer if there was only one).
+	*/
+
+	std::string tempPrefix;
+	size_t maxBufferBytes;
+	size_t bufferBytes;
+	std::vector<std::string> buffer;
+	std::vector<std::string> runFiles;
+
+	void writeRun()
+	{
+		std::sort(buffer.begin(), buffer.end());
+		std::string runFn = tempPrefix + ".sortRun." + ItoStr(runFiles.size());
+		std::ofstream runStream;
+		runStream.open(runFn.c_str());
+		if(! runStream.is_open())
+		{
+			throw std::runtime_error("Cannot open " + runFn + " for writing!");
+		}
+		for(const std::string& line : buffer)
+		{
+			runStream << line << "\n";
+		}
+		runStream.close();
+		runFiles.push_back(runFn);
+		std::cout << "\tWrote sort run " << runFn << " (" << buffer.size() << " lines)\n" << std::flush;
+
+		buffer.clear();
+		bufferBytes = 0;
+	}
+
+public:
+	externalSorter(std::string tempPrefix_, size_t maxBufferBytes_) : tempPrefix(tempPrefix_), maxBufferBytes(maxBufferBytes_), bufferBytes(0) {}
+
+	void add(std::string& line)
+	{
+		bufferBytes += line.size() + sizeof(std::string);
+		buffer.push_back(std::string());
+		buffer.back().swap(line);
+		if(bufferBytes >= maxBufferBytes)
+		{
+			writeRun();
+		}
+	}
+
+	void finish(std::string outputFn, std::string headerLine)
+	{
+		std::ofstream outputStream;
+		outputStream.open(outputFn.c_str());
+		if(! outputStream.is_open())
+		{
+			throw std::runtime_error("Cannot open " + outputFn + " for writing!");
+		}
+		outputStream << headerLine << "\n";
+
+		if(runFiles.size() == 0)
+		{
+			std::sort(buffer.begin(), buffer.end());
+			for(const std::string& line : buffer)
+			{
+				outputStream << line << "\n";
+			}
+			buffer.clear();
+		}
+		else
+		{
+			if(buffer.size())
+			{
+				writeRun();
+			}
+
+			std::vector<std::ifstream*> runStreams;
+			typedef std::pair<std::string, size_t> runHead;
+			std::priority_queue<runHead, std::vector<runHead>, std::greater<runHead>> heads;
+			for(size_t runI = 0; runI < runFiles.size(); runI++)
+			{
+				runStreams.push_back(new std::ifstream(runFiles.at(runI).c_str()));
+				if(! runStreams.back()->is_open())
+				{
+					throw std::runtime_error("Cannot open " + runFiles.at(runI));
+				}
+				std::string line;
+				if(std::getline(*runStreams.back(), line))
+				{
+					heads.push(std::make_pair(line, runI));
+				}
+			}
+
+			std::string line;
+			while(heads.size())
+			{
+				size_t runI = heads.top().second;
+				outputStream << heads.top().first << "\n";
+				heads.pop();
+				if(std::getline(*runStreams.at(runI), line))
+				{
+					heads.push(std::make_pair(line, runI));
+				}
+			}
+
+			for(size_t runI = 0; runI < runFiles.size(); runI++)
+			{
+				delete(runStreams.at(runI));
+				std::remove(runFiles.at(runI).c_str());
+			}
+			runFiles.clear();
+		}
+
+		outputStream.close();
+	}
+};
+
+conversionResult convertAlignment(const bam1_t* alignment, const bam_hdr_t* header, const sequenceFetcher& reference, const sequenceFetcher& reads);
+
+int main(int argc, char *argv[]) {
+	std::vector<std::string> ARG (argv + 1, argv + argc + !argc);
+	std::map<std::string, std::string> arguments;
+
+	for(unsigned int i = 0; i < ARG.size(); i++)
+	{
+		if((ARG.at(i).length() > 2) && (ARG.at(i).substr(0, 2) == "--"))
+		{
+			std::string argname = ARG.at(i).substr(2);
+			std::string argvalue = ARG.at(i+1);
+			arguments[argname] = argvalue;
+		}
+	}
+
+	if(!(arguments.count("BAM") && arguments.count("referenceFasta") && arguments.count("readsFasta") && arguments.count("outputFile")))
+	{
+		std::cerr << "Usage: BAM2ALIGNMENT --BAM <contigs BAM> --referenceFasta <FASTA> --readsFasta <contigs FASTA> --outputFile <output prefix; writes <output prefix>.sortedWithHeader> [--threads N] [--sortBufferMB 2048] [--lenientOrder 1]\n";
+		return 1;
+	}
+
+	int threads = 1;
+	if(arguments.count("threads"))
+	{
+		threads = StrtoI(arguments.at("threads"));
+		assert(threads > 0);
+	}
+	size_t sortBufferMB = 2048;
+	if(arguments.count("sortBufferMB"))
+	{
+		sortBufferMB = StrtoI(arguments.at("sortBufferMB"));
+		assert(sortBufferMB > 0);
+	}
+	bool lenientOrder = true;
+	if(arguments.count("lenientOrder"))
+	{
+		lenientOrder = (StrtoI(arguments.at("lenientOrder")) != 0);
+	}
+
+	std::vector<std::string> out_headerfields = {"readID", "chromosome", "firstPos_reference", "lastPos_reference", "firstPos_read", "lastPos_read", "strand", "n_matches", "n_mismatches", "n_gaps", "alignment_reference", "alignment_read", "completeReadSequence_plus", "completeReadSequence_minus"};
+
+	std::vector<sequenceFetcher*> references;
+	std::vector<sequenceFetcher*> reads;
+	for(int threadI = 0; threadI < threads; threadI++)
+	{
+		references.push_back(new sequenceFetcher(arguments.at("referenceFasta")));
+		reads.push_back(new sequenceFetcher(arguments.at("readsFasta")));
+	}
+
+	samFile* BAM = sam_open(arguments.at("BAM").c_str(), "r");
+	if(BAM == 0)
+	{
+		throw std::runtime_error("Cannot open " + arguments.at("BAM"));
+	}
+	if(threads > 1)
+	{
+		hts_set_threads(BAM, threads);
+	}
+	bam_hdr_t* header = sam_hdr_read(BAM);
+	if(header == 0)
+	{
+		throw std::runtime_error("Cannot read header of " + arguments.at("BAM"));
+	}
+
+	std::string outputFn = arguments.at("outputFile") + ".sortedWithHeader";
+	externalSorter sorter(arguments.at("outputFile"), sortBufferMB * 1024 * 1024);
+
+	size_t records_per_batch = 10000 * threads;
+	std::vector<bam1_t*> batch;
+	for(size_t recordI = 0; recordI < records_per_batch; recordI++)
+	{
+		batch.push_back(bam_init1());
+	}
+
+	bool warnedAboutOrder = false;
+	std::set<std::string> processedReadIDs;
+	std::string runningReadID;
+	std::set<std::string> printed_complete_sequence;
+
+	long long n_records = 0;
+	long long n_lines = 0;
+	bool BAM_done = false;
+	while(! BAM_done)
+	{
+		size_t batch_size = 0;
+		while(batch_size < records_per_batch)
+		{
+			int ret = sam_read1(BAM, header, batch.at(batch_size));
+			if(ret < -1)
+			{
+				throw std::runtime_error("Error reading from " + arguments.at("BAM"));
+			}
+			if(ret == -1)
+			{
+				BAM_done = true;
+				break;
+			}
+			batch_size++;
+		}
+
+		std::vector<conversionResult> results(batch_size);
+		std::vector<std::exception_ptr> exceptions(threads);
+		std::vector<std::thread> workers;
+		for(int threadI = 0; threadI < threads; threadI++)
+		{
+			workers.push_back(std::thread([&, threadI]() {
+				try
+				{
+					for(size_t recordI = threadI; recordI < batch_size; recordI += threads)
+					{
+						results.at(recordI) = convertAlignment(batch.at(recordI), header, *(references.at(threadI)), *(reads.at(threadI)));
+					}
+				}
+				catch(...)
+				{
+					exceptions.at(threadI) = std::current_exception();
+				}
+			}));
+		}
+		for(auto& worker : workers)
+		{
+			worker.join();
+		}
+		for(auto e : exceptions)
+		{
+			if(e)
+			{
+				std::rethrow_exception(e);
+			}
+		}
+
+		// sequential part, in BAM order: read ID ordering checks, complete read sequences for the first line of each read
+		for(size_t recordI = 0; recordI < batch_size; recordI++)
+		{
+			std::string readID = bam_get_qname(batch.at(recordI));
+			if(runningReadID != readID)
+			{
+				if(runningReadID.length())
+				{
+					if((! lenientOrder) || (! warnedAboutOrder))
+					{
+						if(processedReadIDs.count(readID))
+						{
+							throw std::runtime_error("Ordering constrains violated - we want a BAM ordered by read ID - violating read ID " + readID);
+						}
+						warnedAboutOrder = true;
+					}
+					processedReadIDs.insert(runningReadID);
+				}
+				runningReadID = readID;
+			}
+
+			conversionResult& result = results.at(recordI);
+			std::cout << result.messages;
+			if(! result.haveLine)
+				continue;
+
+			if(printed_complete_sequence.count(readID))
+			{
+				result.line.append("\t\t");
+			}
+			else
+			{
+				if(! reads.at(0)->has(readID))
+				{
+					throw std::runtime_error("Missing read sequence for " + readID);
+				}
+				std::string completeReadSequence_plus = reads.at(0)->fetch(readID, 0, reads.at(0)->length(readID) - 1);
+				result.line.append("\t");
+				result.line.append(completeReadSequence_plus);
+				result.line.append("\t");
+				result.line.append(reverseComplement(completeReadSequence_plus));
+				printed_complete_sequence.insert(readID);
+			}
+
+			sorter.add(result.line);
+			n_lines++;
+		}
+
+		n_records += batch_size;
+		std::cout << "Processed " << n_records << " BAM records, " << n_lines << " output lines.\n" << std::flush;
+	}
+
+	for(bam1_t* b : batch)
+	{
+		bam_destroy1(b);
+	}
+	bam_hdr_destroy(header);
+	sam_close(BAM);
+	for(int threadI = 0; threadI < threads; threadI++)
+	{
+		delete(references.at(threadI));
+		delete(reads.at(threadI));
+	}
+
+	sorter.finish(outputFn, join(out_headerfields, "\t"));
+
+	std::cout << "\n\nProduced output file " << outputFn << "\n" << std::flush;
+
+	return 0;
+}
+
+conversionResult convertAlignment(const bam1_t* alignment, const bam_hdr_t* header, const sequenceFetcher& reference, const sequenceFetcher& reads)
+{
+	conversionResult forReturn;
+
+	if((alignment->core.flag & BAM_FUNMAP) || (alignment->core.tid < 0))
+		return forReturn;
+
+	std::string readID = bam_get_qname(alignment);
+	std::string chromosome = header->target_name[alignment->core.tid];
+	long long firstPos_reference = alignment->core.pos;
+	if(!(firstPos_reference >= 0))
+	{
+		throw std::runtime_error("Negative alignment start position for read " + readID);
+	}
+
+	std::string strand = (bam_is_rev(alignment)) ? "-" : "+";
+
+	const uint32_t* cigar = bam_get_cigar(alignment);
+	int n_cigar = alignment->core.n_cigar;
+
+	long long firstPos_read = 0;
+	int remove_softclipping_front = 0;
+	int remove_softclipping_back = 0;
+	for(int cigarI = 0; cigarI < n_cigar; cigarI++)
+	{
+		char op = bam_cigar_opchr(cigar[cigarI]);
+		if((op == 'H') || (op == 'S'))
+		{
+			firstPos_read += bam_cigar_oplen(cigar[cigarI]);
+			if(op == 'S')
+			{
+				remove_softclipping_front += bam_cigar_oplen(cigar[cigarI]);
+			}
+		}
+		else
+		{
+			break;
+		}
+	}
+	for(int cigarI = n_cigar - 1; cigarI >= 0; cigarI--)
+	{
+		char op = bam_cigar_opchr(cigar[cigarI]);
+		if((op == 'H') || (op == 'S'))
+		{
+			if(op == 'S')
+			{
+				remove_softclipping_back += bam_cigar_oplen(cigar[cigarI]);
+			}
+		}
+		else
+		{
+			break;
+		}
+	}
+
+	if(! reference.has(chromosome))
+	{
+		forReturn.messages = "No reference sequence for " + chromosome + "?\n";
+		return forReturn;
+	}
+
+	// padded alignment, like Bio::DB::HTS::Alignment::padded_alignment
+	std::string reference_dna = reference.fetch(chromosome, firstPos_reference, bam_endpos(alignment) - 1);
+	std::string query_dna;
+	query_dna.reserve(alignment->core.l_qseq);
+	const uint8_t* seq = bam_get_seq(alignment);
+	for(int i = 0; i < alignment->core.l_qseq; i++)
+	{
+		query_dna.push_back(seq_nt16_str[bam_seqi(seq, i)]);
+	}
+
+	std::string ref;
+	std::string query;
+	ref.reserve(reference_dna.length() + query_dna.length());
+	query.reserve(reference_dna.length() + query_dna.length());
+	size_t reference_dna_pos = 0;
+	size_t query_dna_pos = 0;
+	auto take = [](const std::string& from, size_t& pos, size_t n) -> std::string {
+		std::string s = (pos < from.length()) ? from.substr(pos, n) : "";
+		pos += s.length();
+		return s;
+	};
+	for(int cigarI = 0; cigarI < n_cigar; cigarI++)
+	{
+		char op = bam_cigar_opchr(cigar[cigarI]);
+		size_t count = bam_cigar_oplen(cigar[cigarI]);
+		if((op == 'I') || (op == 'S'))
+		{
+			ref.append(count, '-');
+			query.append(take(query_dna, query_dna_pos, count));
+		}
+		else if((op == 'D') || (op == 'N'))
+		{
+			ref.append(take(reference_dna, reference_dna_pos, count));
+			query.append(count, '-');
+		}
+		else if(op == 'P')
+		{
+			ref.append(count, '*');
+			query.append(count, '*');
+		}
+		else if(op == 'H')
+		{
+			// nothing
+		}
+		else
+		{
+			ref.append(take(reference_dna, reference_dna_pos, count));
+			query.append(take(query_dna, query_dna_pos, count));
+		}
+	}
+
+	if(remove_softclipping_front)
+	{
+		std::string softclip_remove_ref = ref.substr(0, remove_softclipping_front);
+		if((softclip_remove_ref.length() != (size_t)remove_softclipping_front) || (softclip_remove_ref.find_first_not_of('-') != std::string::npos))
+		{
+			throw std::runtime_error("Weird softclipping for read " + readID);
+		}
+		ref.erase(0, remove_softclipping_front);
+		query.erase(0, remove_softclipping_front);
+	}
+	if(remove_softclipping_back)
+	{
+		if(ref.length() < (size_t)remove_softclipping_back)
+		{
+			throw std::runtime_error("Weird softclipping for read " + readID);
+		}
+		std::string softclip_remove_ref = ref.substr(ref.length() - remove_softclipping_back);
+		if(softclip_remove_ref.find_first_not_of('-') != std::string::npos)
+		{
+			throw std::runtime_error("Weird softclipping for read " + readID);
+		}
+		ref.erase(ref.length() - remove_softclipping_back);
+		query.erase(query.length() - remove_softclipping_back);
+	}
+
+	if(ref.length() != query.length())
+	{
+		throw std::runtime_error("Padded alignment strings of different length for read " + readID);
+	}
+
+	int n_matches = 0;
+	int n_mismatches = 0;
+	int n_insertions = 0;
+	int n_deletions = 0;
+	long long runningPos_reference = firstPos_reference - 1;
+	long long runningPos_read = firstPos_read;
+	bool defined_lastPos = false;
+	long long lastPos_reference = 0;
+	long long lastPos_read = 0;
+	for(size_t alignmentPosI = 0; alignmentPosI < ref.length(); alignmentPosI++)
+	{
+		char c_ref = ref.at(alignmentPosI);
+		char c_query = query.at(alignmentPosI);
+		if((c_ref == '-') && (c_query == '-'))
+		{
+			throw std::runtime_error("Double-gap column in alignment for read " + readID);
+		}
+		if(c_ref == '-')
+		{
+			n_insertions++;
+			runningPos_read++;
+		}
+		else if(c_query == '-')
+		{
+			n_deletions++;
+			runningPos_reference++;
+		}
+		else
+		{
+			runningPos_reference++;
+			runningPos_read++;
+			if(c_ref == c_query)
+			{
+				n_matches++;
+			}
+			else
+			{
+				n_mismatches++;
+			}
+		}
+
+		lastPos_reference = runningPos_reference;
+		lastPos_read = runningPos_read;
+		defined_lastPos = true;
+	}
+
+	if(! defined_lastPos)
+	{
+		throw std::runtime_error("Empty alignment for read " + readID);
+	}
+	lastPos_read--;
+	if(!(lastPos_read >= firstPos_read))
+	{
+		throw std::runtime_error("Alignment without read characters for read " + readID);
+	}
+
+	int n_gaps = n_insertions + n_deletions;
+
+	if(! reads.has(readID))
+	{
+		forReturn.messages = "Missing read sequence for " + readID + "\n";
+		return forReturn;
+	}
+
+	std::string supposed_reference_sequence = reference.fetch(chromosome, firstPos_reference, lastPos_reference);
+
+	// substr($read_sequence, $firstPos_read, ...) on the (possibly reverse-complemented) read - fetch only that slice
+	long long read_length = reads.length(readID);
+	long long lastPos_read_bounded = std::min(lastPos_read, read_length - 1);
+	std::string supposed_read_sequence;
+	if(firstPos_read <= lastPos_read_bounded)
+	{
+		if(strand == "+")
+		{
+			supposed_read_sequence = reads.fetch(readID, firstPos_read, lastPos_read_bounded);
+		}
+		else
+		{
+			supposed_read_sequence = reverseComplement(reads.fetch(readID, read_length - 1 - lastPos_read_bounded, read_length - 1 - firstPos_read));
+		}
+	}
+
+	std::string alignment_reference_noGaps = ref;
+	alignment_reference_noGaps.erase(std::remove(alignment_reference_noGaps.begin(), alignment_reference_noGaps.end(), '-'), alignment_reference_noGaps.end());
+	std::string alignment_read_noGaps = query;
+	alignment_read_noGaps.erase(std::remove(alignment_read_noGaps.begin(), alignment_read_noGaps.end(), '-'), alignment_read_noGaps.end());
+
+	if(supposed_reference_sequence.find('N') == std::string::npos)
+	{
+		if(alignment_reference_noGaps != supposed_reference_sequence)
+		{
+			std::stringstream messages;
+			messages << "Reference mismatch for read " << readID << "\n";
+			messages << "\t" << "Softclip remove: " << remove_softclipping_front << "\t" << remove_softclipping_back << "\n";
+			messages << "\t" << "REF: " << alignment_reference_noGaps << "\n";
+			messages << "\t" << "ALG: " << supposed_reference_sequence << "\n";
+			messages << "\t" << "strand: " << strand << "\n\n";
+			forReturn.messages = messages.str();
+			return forReturn;
+		}
+
+		if(alignment_read_noGaps != supposed_read_sequence)
+		{
+			std::stringstream messages;
+			messages << "Sequence mismatch for read " << readID << "\n";
+			messages << "\t" << "Softclip remove: " << remove_softclipping_front << "\t" << remove_softclipping_back << "\n";
+			messages << "\t" << "lastPos_read: " << lastPos_read << "\n";
+			messages << "\t" << "firstPos_read: " << firstPos_read << "\n";
+			messages << "\t" << "alignment_read_noGaps : " << alignment_read_noGaps << "\n";
+			messages << "\t" << "supposed_read_sequence: " << supposed_read_sequence << "\n";
+			messages << "\t" << "strand: " << strand << "\n\n";
+			forReturn.messages = messages.str();
+			return forReturn;
+		}
+	}
+
+	if(alignment_read_noGaps != supposed_read_sequence)
+	{
+		throw std::runtime_error("Mismatch query for read " + readID);
+	}
+
+	std::stringstream line;
+	line <<
+		readID << "\t" <<
+		chromosome << "\t" <<
+		firstPos_reference << "\t" <<
+		lastPos_reference << "\t" <<
+		firstPos_read << "\t" <<
+		lastPos_read << "\t" <<
+		strand << "\t" <<
+		n_matches << "\t" <<
+		n_mismatches << "\t" <<
+		n_gaps << "\t" <<
+		ref << "\t" <<
+		query;
+
+	forReturn.haveLine = true;
+	forReturn.line = line.str();
+	return forReturn;
+}
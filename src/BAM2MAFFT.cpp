@@ -0,0 +1,851 @@
+//============================================================================
+// Name        : BAM2MAFFT.cpp
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+/*
+
+   Native window planner for scripts/BAM2MAFFT.pl (requires htslib - build with 'make htslib HTSLIB_DIR=...').
+
+   Produces the same output as the Perl implementation: _windowsInfo, _alignments, _alignments_inWindow_onlyGaps
+   and one <chromosome>_<windowI>.fa file per window.
+
+   Instead of per-base coverage arrays, coverage is computed from a sorted list of events generated per CIGAR
+   operation (difference array: +1/-1 at the ends of the reference span of each alignment and of each deletion,
+   point additions for insertions), which is evaluated in a single forward sweep at the positions that are
+   actually needed. Window sequences are built per CIGAR operation and written as soon as no further alignment
+   can contribute to a window, so memory is bounded by the number of CIGAR operations per chromosome plus the
+   currently open windows.
+
+   Coordinates and window assignment follow the Perl implementation exactly - coverage values are indexed by
+   1-based reference position (index i is reference position i - 1, 0-based), insertion columns count towards
+   the preceding reference position, and alignment positions are assigned to windows in the same 1-based system.
+
+   Window breakpoints (--breakpointCost):
+     first   - like the Perl implementation: the first position with coverage in [target - 100, target + 100],
+               or the target position itself if there is none (default).
+     gapRate - among the covered positions in [target - 100, target + 100], the one with the smallest fraction
+               of gap columns (leftmost on ties) - this is what the rate_missing computation in the Perl
+               implementation was meant to do.
+
+   Window sizes (--targetCost):
+     0 (default) - windows of ~targetWindowSize positions, like the Perl implementation.
+     C > 0       - each window is extended until its estimated MAFFT cost reaches C, within [--minWindowSize,
+                   --maxWindowSize]; breakpoints are then selected around that position as above. Windows in deep
+                   or SV-rich regions become shorter, windows in simple regions longer.
+   The estimated cost of a window is the sum of d * (d + indelCostWeight * (deleted + inserted bases)) over its
+   positions, with d the number of alignments spanning the position - the number of MSA cells, weighted by
+   depth for the pairwise stages of MAFFT and by the indel content. It is written to _windowsCost for every
+   window (also with fixed windows); CALLMAFFT.pl --local starts the most expensive windows first.
+
+   Sequences within a window file are written in a fixed order (reference first, then in order of appearance in
+   the BAM) - the Perl implementation uses hash order.
+
+*/
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <assert.h>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+#include <climits>
+#include <cstdlib>
+#include <deque>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <htslib/sam.h>
+#include <htslib/faidx.h>
+
+#include "Utilities.h"
+
+int scanTarget = 100;
+int targetWindowSize = 10000;
+double indelCostWeight = 4;
+
+class coverageEvent
+{
+public:
+	int position;
+	int delta_coverage; // run of reference columns (1 at start, -1 after the end)
+	int delta_deletions; // run of deletion columns
+	int point_coverage; // insertion columns, only at 'position'
+
+	bool operator<(const coverageEvent& other) const
+	{
+		return position < other.position;
+	}
+};
+
+class coverageSweep
+{
+	// evaluates coverage / non-gap coverage at non-decreasing positions from sorted events
+	const std::vector<coverageEvent>& events;
+	size_t next_event;
+	long long running_coverage;
+	long long running_deletions;
+	int last_position;
+
+public:
+	coverageSweep(const std::vector<coverageEvent>& events_) : events(events_), next_event(0), running_coverage(0), running_deletions(0), last_position(INT_MIN) {}
+
+	void get(int position, long long& coverage, long long& coverage_nonGap)
+	{
+		long long spanning, deletions, inserted;
+		getComponents(position, spanning, deletions, inserted);
+		coverage = spanning + inserted;
+		coverage_nonGap = coverage - deletions;
+		assert(coverage_nonGap >= 0);
+	}
+
+	// spanning: alignments with reference columns at 'position' (including deletions); deletions: those with a deletion
+	// at 'position'; inserted: inserted bases attributed to 'position'
+	void getComponents(int position, long long& spanning, long long& deletions, long long& inserted)
+	{
+		if(position < last_position)
+		{
+			next_event = 0;
+			running_coverage = 0;
+			running_deletions = 0;
+		}
+		last_position = position;
+
+		while((next_event < events.size()) && (events.at(next_event).position < position))
+		{
+			running_coverage += events.at(next_event).delta_coverage;
+			running_deletions += events.at(next_event).delta_deletions;
+			next_event++;
+		}
+
+		long long point_coverage = 0;
+		long long position_delta_coverage = 0;
+		long long position_delta_deletions = 0;
+		for(size_t eventI = next_event; (eventI < events.size()) && (events.at(eventI).position == position); eventI++)
+		{
+			position_delta_coverage += events.at(eventI).delta_coverage;
+			position_delta_deletions += events.at(eventI).delta_deletions;
+			point_coverage += events.at(eventI).point_coverage;
+		}
+
+		spanning = running_coverage + position_delta_coverage;
+		deletions = running_deletions + position_delta_deletions;
+		inserted = point_coverage;
+	}
+};
+
+class cumulativeCost
+{
+	// F(position) = estimated cost of the positions 0 .. position (see top of file), evaluated at non-decreasing
+	// positions; F of the last 'history' evaluated positions remains available.
+	coverageSweep coverage;
+	int position;
+	double total;
+	std::deque<double> recent;
+	size_t history;
+
+public:
+	cumulativeCost(const std::vector<coverageEvent>& events, size_t history_) : coverage(events), position(-1), total(0), history(history_) {}
+
+	double at(int p)
+	{
+		if(p < 0)
+			return 0;
+		while(position < p)
+		{
+			position++;
+			long long spanning, deletions, inserted;
+			coverage.getComponents(position, spanning, deletions, inserted);
+			total += (double)spanning * ((double)spanning + indelCostWeight * (double)(deletions + inserted));
+			recent.push_back(total);
+			if(recent.size() > history)
+				recent.pop_front();
+		}
+		assert((position - p) < (int)recent.size());
+		return recent.at(recent.size() - 1 - (position - p));
+	}
+};
+
+class windowContents
+{
+public:
+	std::vector<std::string> sequenceIDs;
+	std::map<std::string, std::string> sequences;
+
+	std::string& sequence(const std::string& sequenceID)
+	{
+		if(! sequences.count(sequenceID))
+		{
+			sequenceIDs.push_back(sequenceID);
+		}
+		return sequences[sequenceID];
+	}
+};
+
+std::string fetchSequence(const faidx_t* fai, const std::string& sequenceID, long long first, long long last);
+std::vector<int> selectWindowPositions(const std::vector<coverageEvent>& events, int max_pos, std::string breakpointCost, double targetCost, int minWindowSize, int maxWindowSize);
+
+int main(int argc, char *argv[]) {
+	std::vector<std::string> ARG (argv + 1, argv + argc + !argc);
+	std::map<std::string, std::string> arguments;
+
+	for(unsigned int i = 0; i < ARG.size(); i++)
+	{
+		if((ARG.at(i).length() > 2) && (ARG.at(i).substr(0, 2) == "--"))
+		{
+			std::string argname = ARG.at(i).substr(2);
+			std::string argvalue = ARG.at(i+1);
+			arguments[argname] = argvalue;
+		}
+	}
+
+	if(!(arguments.count("BAM") && arguments.count("referenceFasta") && arguments.count("readsFasta") && arguments.count("outputDirectory") && arguments.count("inputTruncatedReads")))
+	{
+		std::cerr << "Usage: BAM2MAFFT --BAM <BAM from FIND_GLOBAL_ALIGNMENTS.pl> --referenceFasta <FASTA> --readsFasta <contigs FASTA> --outputDirectory <existing directory> --inputTruncatedReads <truncatedReads> [--threads N] [--breakpointCost first|gapRate] [--targetCost C [--minWindowSize 1000] [--maxWindowSize 50000]]\n";
+		return 1;
+	}
+
+	int threads = 1;
+	if(arguments.count("threads"))
+	{
+		threads = StrtoI(arguments.at("threads"));
+		assert(threads > 0);
+	}
+	std::string breakpointCost = "first";
+	if(arguments.count("breakpointCost"))
+	{
+		breakpointCost = arguments.at("breakpointCost");
+		if(!((breakpointCost == "first") || (breakpointCost == "gapRate")))
+		{
+			throw std::runtime_error("Unknown --breakpointCost " + breakpointCost);
+		}
+	}
+	double targetCost = 0;
+	int minWindowSize = 1000;
+	int maxWindowSize = 50000;
+	if(arguments.count("targetCost"))
+	{
+		targetCost = atof(arguments.at("targetCost").c_str());
+		assert(targetCost >= 0);
+	}
+	if(arguments.count("minWindowSize"))
+	{
+		minWindowSize = StrtoI(arguments.at("minWindowSize"));
+	}
+	if(arguments.count("maxWindowSize"))
+	{
+		maxWindowSize = StrtoI(arguments.at("maxWindowSize"));
+	}
+	if(targetCost > 0)
+	{
+		// consecutive breakpoint candidate ranges must not overlap (see selectWindowPositions)
+		if(minWindowSize < (3 * scanTarget))
+		{
+			throw std::runtime_error("--minWindowSize must be at least " + ItoStr(3 * scanTarget));
+		}
+		if(maxWindowSize < minWindowSize)
+		{
+			throw std::runtime_error("--maxWindowSize must not be smaller than --minWindowSize");
+		}
+	}
+
+	std::string outputDirectory = arguments.at("outputDirectory");
+
+	faidx_t* reference = fai_load(arguments.at("referenceFasta").c_str());
+	if(reference == 0)
+	{
+		throw std::runtime_error("Cannot load FASTA index for " + arguments.at("referenceFasta"));
+	}
+	faidx_t* reads = fai_load(arguments.at("readsFasta").c_str());
+	if(reads == 0)
+	{
+		throw std::runtime_error("Cannot load FASTA index for " + arguments.at("readsFasta"));
+	}
+
+	std::set<std::string> truncatedReads;
+	{
+		std::ifstream truncatedStream;
+		truncatedStream.open(arguments.at("inputTruncatedReads").c_str());
+		if(! truncatedStream.is_open())
+		{
+			throw std::runtime_error("Cannot open " + arguments.at("inputTruncatedReads"));
+		}
+		std::string line;
+		while(std::getline(truncatedStream, line))
+		{
+			eraseNL(line);
+			truncatedReads.insert(line);
+		}
+	}
+
+	samFile* BAM = sam_open(arguments.at("BAM").c_str(), "r");
+	if(BAM == 0)
+	{
+		throw std::runtime_error("Cannot open " + arguments.at("BAM"));
+	}
+	if(threads > 1)
+	{
+		hts_set_threads(BAM, threads);
+	}
+	bam_hdr_t* header = sam_hdr_read(BAM);
+	if(header == 0)
+	{
+		throw std::runtime_error("Cannot read header of " + arguments.at("BAM"));
+	}
+	hts_idx_t* BAM_index = sam_index_load(BAM, arguments.at("BAM").c_str());
+	if(BAM_index == 0)
+	{
+		throw std::runtime_error("Cannot load index for " + arguments.at("BAM"));
+	}
+
+	std::string windows_info_fn = outputDirectory + "/_windowsInfo";
+	std::ofstream windowsStream;
+	windowsStream.open(windows_info_fn.c_str());
+	if(! windowsStream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + windows_info_fn);
+	}
+	windowsStream << join({"referenceContigID", "chrDir", "windowI", "firstPos_relative_to_ref", "lastPos_relative_to_ref", "lastPos_BAMcoverage", "lastPos_BAMcoverage_nonGap"}, "\t") << "\n";
+
+	std::string alignments_info_fn = outputDirectory + "/_alignments";
+	std::ofstream alignmentsStream;
+	alignmentsStream.open(alignments_info_fn.c_str());
+	if(! alignmentsStream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + alignments_info_fn);
+	}
+	alignmentsStream << join({"alignedSequenceID", "referenceContigID", "chrDir", "firstPositions_reference", "lastPosition_reference"}, "\t") << "\n";
+
+	std::string alignments_gaps_info_fn = outputDirectory + "/_alignments_inWindow_onlyGaps";
+	std::ofstream alignmentsOnlyGapsStream;
+	alignmentsOnlyGapsStream.open(alignments_gaps_info_fn.c_str());
+	if(! alignmentsOnlyGapsStream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + alignments_gaps_info_fn);
+	}
+	alignmentsOnlyGapsStream << join({"alignedSequenceID", "referenceContigID", "chrDir", "windowI"}, "\t") << "\n";
+
+	std::string windows_cost_fn = outputDirectory + "/_windowsCost";
+	std::ofstream windowsCostStream;
+	windowsCostStream.open(windows_cost_fn.c_str());
+	if(! windowsCostStream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + windows_cost_fn);
+	}
+	windowsCostStream << join({"referenceContigID", "chrDir", "windowI", "firstPos_relative_to_ref", "lastPos_relative_to_ref", "estimatedCost"}, "\t") << "\n";
+
+	std::set<std::string> saw_read_IDs;
+	bam1_t* alignment = bam_init1();
+	for(int tid = 0; tid < header->n_targets; tid++)
+	{
+		std::string referenceSequenceID = header->target_name[tid];
+
+		// like /chr[XY\d]+/ (unanchored)
+		bool chromosomeName = false;
+		for(size_t pos = referenceSequenceID.find("chr"); pos != std::string::npos; pos = referenceSequenceID.find("chr", pos + 1))
+		{
+			if((pos + 3 < referenceSequenceID.length()) && ((referenceSequenceID.at(pos + 3) == 'X') || (referenceSequenceID.at(pos + 3) == 'Y') || isdigit(referenceSequenceID.at(pos + 3))))
+			{
+				chromosomeName = true;
+				break;
+			}
+		}
+		if(! chromosomeName)
+			continue;
+
+		if(! faidx_has_seq(reference, referenceSequenceID.c_str()))
+		{
+			std::cerr << "No reference sequence for " << referenceSequenceID << "\n";
+			continue;
+		}
+		long long referenceSequence_length = faidx_seq_len(reference, referenceSequenceID.c_str());
+		if(!(referenceSequence_length > 20000))
+			continue;
+
+		std::string chrDir;
+		for(char c : referenceSequenceID)
+		{
+			if(isalnum(c) || (c == '_'))
+				chrDir.push_back(c);
+		}
+		std::string chrDir_path = outputDirectory + "/" + chrDir;
+		if(mkdir(chrDir_path.c_str(), 0755) != 0)
+		{
+			throw std::runtime_error("Cannot mkdir " + chrDir_path);
+		}
+
+		std::cout << "Processing " << referenceSequenceID << ", length " << referenceSequence_length << "\n" << std::flush;
+		if((long long)header->target_len[tid] != referenceSequence_length)
+		{
+			throw std::runtime_error("Length discrepancy between supplied FASTA reference and BAM index: " + ItoStr(header->target_len[tid]) + " vs " + ItoStr(referenceSequence_length));
+		}
+
+		// pass 1: coverage events
+		std::vector<coverageEvent> events;
+		int max_index = referenceSequence_length - 1;
+		long long n_alignment = 0;
+		{
+			hts_itr_t* iterator = sam_itr_queryi(BAM_index, tid, 0, INT_MAX);
+			if(iterator == 0)
+			{
+				throw std::runtime_error("Cannot iterate over " + referenceSequenceID);
+			}
+			while(sam_itr_next(BAM, iterator, alignment) >= 0)
+			{
+				if(alignment->core.flag & BAM_FUNMAP)
+					continue;
+				n_alignment++;
+
+				const uint32_t* cigar = bam_get_cigar(alignment);
+				int position = alignment->core.pos; // 1-based start - 1
+				bool started = false;
+				for(unsigned int cigarI = 0; cigarI < alignment->core.n_cigar; cigarI++)
+				{
+					char op = bam_cigar_opchr(cigar[cigarI]);
+					int length = bam_cigar_oplen(cigar[cigarI]);
+					if((op == 'H') || (op == 'S'))
+					{
+						throw std::runtime_error("BAM " + arguments.at("BAM") + " contains H or S in CIGAR string - illegal, we want global, non-clipped alignments.");
+					}
+					if(op == 'I')
+					{
+						if(started && length)
+						{
+							events.push_back({position, 0, 0, length});
+						}
+					}
+					else if(length)
+					{
+						if(! started)
+						{
+							events.push_back({position + 1, 1, 0, 0});
+							started = true;
+						}
+						if((op == 'D') || (op == 'N'))
+						{
+							events.push_back({position + 1, 0, 1, 0});
+							events.push_back({position + length + 1, 0, -1, 0});
+						}
+						position += length;
+					}
+				}
+				if(started)
+				{
+					events.push_back({position + 1, -1, 0, 0});
+					if(position > max_index)
+					{
+						max_index = position;
+					}
+				}
+			}
+			hts_itr_destroy(iterator);
+		}
+		std::stable_sort(events.begin(), events.end());
+		std::cout << "\t\tProcessed " << n_alignment << " alignments, " << events.size() << " coverage events.\n" << std::flush;
+
+		int max_pos = max_index;
+		std::vector<int> window_positions = selectWindowPositions(events, max_pos, breakpointCost, targetCost, minWindowSize, maxWindowSize);
+		std::cout << "\tRegion " << referenceSequenceID << ", have " << window_positions.size() << " windows.\n" << std::flush;
+		if(window_positions.size() == 0)
+		{
+			throw std::runtime_error("No windows for " + referenceSequenceID);
+		}
+		for(size_t windowI = 1; windowI < window_positions.size(); windowI++)
+		{
+			assert(window_positions.at(windowI) > window_positions.at(windowI-1));
+			assert((window_positions.at(windowI) - window_positions.at(windowI-1)) > 1);
+		}
+
+		// window w covers [windowStart(w), windowStart(w+1)) in alignment (1-based) positions
+		int n_windows = window_positions.size() + 1;
+		auto windowStart = [&](int windowID) -> int {
+			return (windowID == 0) ? 0 : window_positions.at(windowID - 1);
+		};
+		auto windowLastPos = [&](int windowID) -> int {
+			return (windowID < (int)window_positions.size()) ? (window_positions.at(windowID) - 1) : max_pos;
+		};
+		auto windowForPosition = [&](int position) -> int {
+			return std::upper_bound(window_positions.begin(), window_positions.end(), position) - window_positions.begin();
+		};
+
+		{
+			coverageSweep coverage(events);
+			for(int windowID = 0; windowID < n_windows; windowID++)
+			{
+				int window_lastPos = windowLastPos(windowID);
+				std::string lastPos_coverage;
+				std::string lastPos_coverage_nonGap;
+				if(window_lastPos <= max_pos)
+				{
+					long long c, c_nonGap;
+					coverage.get(window_lastPos, c, c_nonGap);
+					lastPos_coverage = std::to_string(c);
+					lastPos_coverage_nonGap = std::to_string(c_nonGap);
+				}
+				windowsStream << referenceSequenceID << "\t" << chrDir << "\t" << windowID << "\t" << windowStart(windowID) << "\t" << window_lastPos << "\t" << lastPos_coverage << "\t" << lastPos_coverage_nonGap << "\n";
+			}
+		}
+		{
+			cumulativeCost cost(events, 1);
+			double totalCost = 0;
+			double maxWindowCost = 0;
+			for(int windowID = 0; windowID < n_windows; windowID++)
+			{
+				// the last window may start after max_pos
+				int window_lastPos = std::max(windowLastPos(windowID), windowStart(windowID) - 1);
+				double cost_before = cost.at(windowStart(windowID) - 1);
+				double windowCost = cost.at(window_lastPos) - cost_before;
+				totalCost += windowCost;
+				if(windowCost > maxWindowCost)
+					maxWindowCost = windowCost;
+				windowsCostStream << referenceSequenceID << "\t" << chrDir << "\t" << windowID << "\t" << windowStart(windowID) << "\t" << windowLastPos(windowID) << "\t" << (long long)windowCost << "\n";
+			}
+			std::cout << "\tEstimated total cost " << (long long)totalCost << ", max. per window " << (long long)maxWindowCost << (targetCost ? (" (target " + std::to_string((long long)targetCost) + ")") : std::string("")) << "\n" << std::flush;
+		}
+		std::vector<coverageEvent>().swap(events);
+
+		// pass 2: per-window sequences, written as soon as a window is complete
+		std::map<int, windowContents> open_windows;
+		int next_window_to_write = 0;
+		std::set<std::string> saw_sequence_already;
+		std::map<std::string, std::string> runningSequencesForReconstruction;
+
+		auto writeWindow = [&](int windowID) {
+			windowContents& contents = open_windows[windowID];
+			std::string referenceSequence = fetchSequence(reference, referenceSequenceID, windowStart(windowID), windowLastPos(windowID));
+			std::vector<std::string> sequenceIDs = {"ref"};
+			for(const std::string& sequenceID : contents.sequenceIDs)
+			{
+				sequenceIDs.push_back(sequenceID);
+			}
+
+			std::set<std::string> sequenceID_seen;
+			std::string output_fn = chrDir_path + "/" + referenceSequenceID + "_" + ItoStr(windowID) + ".fa";
+			std::ofstream MAFFTout;
+			for(const std::string& sequenceID : sequenceIDs)
+			{
+				const std::string& sequence_for_emission = (sequenceID == "ref") ? referenceSequence : contents.sequences.at(sequenceID);
+				sequenceID_seen.insert(sequenceID);
+
+				std::string sequence_for_emission_noGaps;
+				sequence_for_emission_noGaps.reserve(sequence_for_emission.length());
+				for(char c : sequence_for_emission)
+				{
+					if((c != '-') && (c != '_'))
+						sequence_for_emission_noGaps.push_back(c);
+				}
+				if(sequenceID != "ref")
+				{
+					runningSequencesForReconstruction[sequenceID].append(sequence_for_emission_noGaps);
+				}
+
+				std::string sequenceID_for_print = sequenceID;
+				if(! saw_sequence_already.count(sequenceID))
+				{
+					if(sequence_for_emission_noGaps.length() == 0)
+					{
+						throw std::runtime_error("First window sequence for " + sequenceID + " consists only of gaps");
+					}
+					saw_sequence_already.insert(sequenceID);
+					sequenceID_for_print += "_FIRST";
+				}
+
+				if(sequence_for_emission.length())
+				{
+					if(! MAFFTout.is_open())
+					{
+						MAFFTout.open(output_fn.c_str());
+						if(! MAFFTout.is_open())
+						{
+							throw std::runtime_error("Cannot open " + output_fn);
+						}
+					}
+					MAFFTout << ">" << sequenceID_for_print << "\n" << sequence_for_emission << "\n";
+				}
+				else
+				{
+					alignmentsOnlyGapsStream << sequenceID << "\t" << referenceSequenceID << "\t" << chrDir << "\t" << windowID << "\n";
+				}
+			}
+			if(MAFFTout.is_open())
+			{
+				MAFFTout.close();
+			}
+
+			// sequences that are not continued in this window are complete - compare against the input contigs
+			std::vector<std::string> completed;
+			for(auto& running : runningSequencesForReconstruction)
+			{
+				if(! sequenceID_seen.count(running.first))
+					completed.push_back(running.first);
+			}
+			for(const std::string& sequenceID : completed)
+			{
+				if(! faidx_has_seq(reads, sequenceID.c_str()))
+				{
+					std::cerr << "No truth sequence for " << sequenceID << "\n";
+					runningSequencesForReconstruction.erase(sequenceID);
+					continue;
+				}
+				std::string trueSequence = fetchSequence(reads, sequenceID, 0, faidx_seq_len(reads, sequenceID.c_str()) - 1);
+				const std::string& supposedSequence = runningSequencesForReconstruction.at(sequenceID);
+				if(!((supposedSequence == trueSequence) || (supposedSequence == reverseComplement(trueSequence))))
+				{
+					if(! truncatedReads.count(sequenceID))
+					{
+						std::cout << "Disagreement for " << sequenceID << "\n";
+						std::cout << "\t" << "length($trueSequence)" << ": " << trueSequence.length() << "\n";
+						std::cout << "\t" << "length($supposedSequence)" << ": " << supposedSequence.length() << ", " << supposedSequence.substr(0, 10) << "\n";
+					}
+				}
+				runningSequencesForReconstruction.erase(sequenceID);
+			}
+
+			open_windows.erase(windowID);
+		};
+
+		hts_itr_t* iterator = sam_itr_queryi(BAM_index, tid, 0, INT_MAX);
+		if(iterator == 0)
+		{
+			throw std::runtime_error("Cannot iterate over " + referenceSequenceID);
+		}
+		n_alignment = 0;
+		while(sam_itr_next(BAM, iterator, alignment) >= 0)
+		{
+			if(alignment->core.flag & BAM_FUNMAP)
+				continue;
+			n_alignment++;
+
+			std::string readID = bam_get_qname(alignment);
+			if(saw_read_IDs.count(readID))
+			{
+				throw std::runtime_error("Observed more than one alignment for read ID " + readID + " - this should not happen!");
+			}
+			saw_read_IDs.insert(readID);
+
+			int alignment_start_pos = alignment->core.pos + 1;
+
+			// all windows before the one containing this alignment's start are complete
+			int startWindow = windowForPosition(alignment_start_pos);
+			while(next_window_to_write < startWindow)
+			{
+				writeWindow(next_window_to_write);
+				next_window_to_write++;
+			}
+
+			const uint32_t* cigar = bam_get_cigar(alignment);
+			const uint8_t* seq = bam_get_seq(alignment);
+			int query_pos = 0;
+			int position = alignment_start_pos - 1;
+			bool started = false;
+			int currentWindow = -1;
+			std::string unaccountedSequence;
+			int firstPosition_reference = -1;
+
+			for(unsigned int cigarI = 0; cigarI < alignment->core.n_cigar; cigarI++)
+			{
+				char op = bam_cigar_opchr(cigar[cigarI]);
+				int length = bam_cigar_oplen(cigar[cigarI]);
+
+				if(op == 'I')
+				{
+					std::string inserted;
+					inserted.reserve(length);
+					for(int i = 0; i < length; i++)
+					{
+						inserted.push_back(seq_nt16_str[bam_seqi(seq, query_pos + i)]);
+					}
+					query_pos += length;
+					if(started)
+					{
+						open_windows[currentWindow].sequence(readID).append(inserted);
+					}
+					else
+					{
+						unaccountedSequence.append(inserted);
+					}
+					continue;
+				}
+
+				bool consumesQuery = ((op == 'M') || (op == '=') || (op == 'X'));
+				int opI = 0;
+				while(opI < length)
+				{
+					// positions position + 1 ... - split at window switches
+					int first_position = position + 1;
+					if(! started)
+					{
+						currentWindow = windowForPosition(first_position);
+						firstPosition_reference = first_position;
+						started = true;
+					}
+					else if((currentWindow < (int)window_positions.size()) && (first_position == window_positions.at(currentWindow)))
+					{
+						currentWindow++;
+					}
+					int chunk = length - opI;
+					if(currentWindow < (int)window_positions.size())
+					{
+						chunk = std::min(chunk, window_positions.at(currentWindow) - first_position);
+						assert(chunk > 0);
+					}
+
+					std::string& windowSequence = open_windows[currentWindow].sequence(readID);
+					if(unaccountedSequence.length())
+					{
+						windowSequence.append(unaccountedSequence);
+						unaccountedSequence.clear();
+					}
+					if(consumesQuery)
+					{
+						for(int i = 0; i < chunk; i++)
+						{
+							windowSequence.push_back(seq_nt16_str[bam_seqi(seq, query_pos + i)]);
+						}
+						query_pos += chunk;
+					}
+					else if(op == 'P')
+					{
+						windowSequence.append(chunk, '*');
+					}
+					else
+					{
+						windowSequence.append(chunk, '-');
+					}
+
+					position += chunk;
+					opI += chunk;
+				}
+			}
+
+			if(! started)
+			{
+				throw std::runtime_error("Alignment without reference positions for read " + readID);
+			}
+			alignmentsStream << readID << "\t" << referenceSequenceID << "\t" << chrDir << "\t" << firstPosition_reference << "\t" << position << "\n";
+		}
+		hts_itr_destroy(iterator);
+
+		while(next_window_to_write < n_windows)
+		{
+			writeWindow(next_window_to_write);
+			next_window_to_write++;
+		}
+		std::cout << "\t\tWrote " << n_windows << " windows for " << n_alignment << " alignments.\n" << std::flush;
+	}
+
+	bam_destroy1(alignment);
+	hts_idx_destroy(BAM_index);
+	bam_hdr_destroy(header);
+	sam_close(BAM);
+	fai_destroy(reference);
+	fai_destroy(reads);
+
+	windowsStream.close();
+	alignmentsStream.close();
+	alignmentsOnlyGapsStream.close();
+	windowsCostStream.close();
+
+	return 0;
+}
+
+std::vector<int> selectWindowPositions(const std::vector<coverageEvent>& events, int max_pos, std::string breakpointCost, double targetCost, int minWindowSize, int maxWindowSize)
+{
+	/*
+	   Windows are ~targetWindowSize long, or (targetCost > 0) as long as needed to reach an estimated cost of
+	   targetCost, within [minWindowSize, maxWindowSize]; each breakpoint is chosen among the positions within
+	   scanTarget of the target position. The candidate ranges of consecutive breakpoints do not overlap, so the
+	   coverage sweeps only move forward.
+	*/
+	std::vector<int> window_positions;
+	coverageSweep coverage(events);
+	cumulativeCost cost(events, 2 * scanTarget + 2);
+
+	for(int potentialWindowPos = 0; potentialWindowPos <= max_pos; potentialWindowPos++)
+	{
+		int middleWindowPos = potentialWindowPos + targetWindowSize;
+		if(targetCost > 0)
+		{
+			double cost_before = cost.at(potentialWindowPos - 1);
+			middleWindowPos = potentialWindowPos + minWindowSize;
+			while((middleWindowPos < (potentialWindowPos + maxWindowSize)) && (middleWindowPos <= max_pos) && ((cost.at(middleWindowPos) - cost_before) < targetCost))
+			{
+				middleWindowPos++;
+			}
+		}
+		int minWindowsPos = middleWindowPos - scanTarget;
+		int maxWindowsPos = middleWindowPos + scanTarget;
+		if(minWindowsPos >= max_pos)
+			break;
+
+		if(minWindowsPos < 0)
+			minWindowsPos = 0;
+		if(maxWindowsPos > max_pos)
+			maxWindowsPos = max_pos;
+		assert(minWindowsPos <= maxWindowsPos);
+
+		int selectedWindowPos = -1;
+		long long selected_gaps = 0;
+		long long selected_coverage = 0;
+		for(int actualWindowPos = minWindowsPos; actualWindowPos <= maxWindowsPos; actualWindowPos++)
+		{
+			long long c, c_nonGap;
+			coverage.get(actualWindowPos, c, c_nonGap);
+			if(c > 0)
+			{
+				assert(c_nonGap <= c);
+				if(breakpointCost == "first")
+				{
+					selectedWindowPos = actualWindowPos;
+					break;
+				}
+
+				// gap rate (c - c_nonGap) / c, compared without division
+				long long gaps = c - c_nonGap;
+				if((selectedWindowPos == -1) || ((gaps * selected_coverage) < (selected_gaps * c)))
+				{
+					selectedWindowPos = actualWindowPos;
+					selected_gaps = gaps;
+					selected_coverage = c;
+				}
+			}
+		}
+
+		if(selectedWindowPos == -1)
+		{
+			selectedWindowPos = middleWindowPos;
+		}
+
+		window_positions.push_back(selectedWindowPos);
+		potentialWindowPos = selectedWindowPos;
+	}
+
+	return window_positions;
+}
+
+std::string fetchSequence(const faidx_t* fai, const std::string& sequenceID, long long first, long long last)
+{
+	// 0-based, inclusive - truncated at the end of the sequence (like Perl's substr)
+	if(last < first)
+		return "";
+	int len = 0;
+	char* s = faidx_fetch_seq(fai, sequenceID.c_str(), first, last, &len);
+	if(s == 0)
+	{
+		throw std::runtime_error("Cannot fetch " + sequenceID);
+	}
+	std::string forReturn;
+	if(len > 0)
+	{
+		forReturn.assign(s, len);
+	}
+	free(s);
+	return forReturn;
+}
@@ -0,0 +1,153 @@
+//============================================================================
+// Name        : BUILD_SEQUENCESTORE.cpp
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+/*
+
+   Builds the packed sequence store <FASTA>.seqstore (format: see SequenceStore.h) for a FASTA file, e.g. for
+   AllContigs.fa and the reference. The Perl scripts (via scripts/SequenceStore.pm) use the store when it exists
+   instead of loading the complete FASTA into memory.
+
+   The FASTA is streamed, i.e. only one sequence is held in memory at a time. With --verify 1, the store is
+   re-opened after writing and every sequence is compared against the FASTA.
+
+*/
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <assert.h>
+#include <string>
+#include <fstream>
+#include <exception>
+#include <stdexcept>
+#include <cstdio>
+
+#include "Utilities.h"
+#include "SequenceStore.h"
+
+// calls processSequence(ID, sequence) for each sequence of the FASTA, in file order
+template<typename F>
+void streamFASTA(const std::string& FASTAfn, F processSequence)
+{
+	std::ifstream FASTAstream;
+	FASTAstream.open(FASTAfn.c_str());
+	if(! FASTAstream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + FASTAfn);
+	}
+
+	std::string line;
+	std::string currentID;
+	std::string currentSequence;
+	bool haveSequence = false;
+	while(FASTAstream.good())
+	{
+		std::getline(FASTAstream, line);
+		eraseNL(line);
+		if(line.length() && (line.at(0) == '>'))
+		{
+			if(haveSequence)
+			{
+				processSequence(currentID, currentSequence);
+			}
+			currentID = line.substr(1);
+			size_t whitespace_pos = currentID.find_first_of(" \t");
+			if(whitespace_pos != std::string::npos)
+			{
+				currentID = currentID.substr(0, whitespace_pos);
+			}
+			currentSequence.clear();
+			haveSequence = true;
+		}
+		else if(line.length())
+		{
+			if(! haveSequence)
+			{
+				throw std::runtime_error("FASTA file " + FASTAfn + " does not start with a header line");
+			}
+			currentSequence.append(line);
+		}
+	}
+	if(haveSequence)
+	{
+		processSequence(currentID, currentSequence);
+	}
+}
+
+int main(int argc, char *argv[]) {
+
+	std::vector<std::string> ARG (argv + 1, argv + argc + !argc);
+	std::map<std::string, std::string> arguments;
+
+	for(unsigned int i = 0; i < ARG.size(); i++)
+	{
+		if((ARG.at(i).length() > 2) && (ARG.at(i).substr(0, 2) == "--"))
+		{
+			if(i == (ARG.size() - 1))
+				throw std::runtime_error("Command-line option " + ARG.at(i) + " does not have a value.");
+			if((ARG.at(i+1).length() > 2) && (ARG.at(i+1).substr(0, 2) == "--"))
+				throw std::runtime_error("Command-line option " + ARG.at(i) + " does not have a value.");
+			std::string argname = ARG.at(i).substr(2);
+			std::string argvalue = ARG.at(i+1);
+			arguments[argname] = argvalue;
+		}
+	}
+
+	if(! arguments.count("input"))
+	{
+		std::cerr << "Usage: BUILD_SEQUENCESTORE --input <FASTA> [--output <store; default <FASTA>.seqstore>] [--verify 0/1]\n";
+		return 1;
+	}
+
+	std::string FASTAfn = arguments.at("input");
+	std::string storeFn = (arguments.count("output")) ? arguments.at("output") : SequenceStore::storeFilename(FASTAfn);
+	bool verify = (arguments.count("verify") && StrtoI(arguments.at("verify")));
+
+	// write to a temporary file first, so that an interrupted run does not leave a store that looks valid
+	std::string storeFn_temp = storeFn + ".temp";
+	size_t n_sequences = 0;
+	long long n_bases = 0;
+	{
+		SequenceStoreWriter writer(storeFn_temp);
+		std::set<std::string> seenIDs;
+		streamFASTA(FASTAfn, [&](const std::string& ID, const std::string& sequence) {
+			if(seenIDs.count(ID))
+			{
+				throw std::runtime_error("Sequence ID " + ID + " occurs more than once in " + FASTAfn);
+			}
+			seenIDs.insert(ID);
+			writer.addSequence(ID, sequence);
+			n_sequences++;
+			n_bases += sequence.length();
+		});
+		writer.close();
+	}
+
+	if(verify)
+	{
+		SequenceStore store(storeFn_temp);
+		size_t n_verified = 0;
+		streamFASTA(FASTAfn, [&](const std::string& ID, const std::string& sequence) {
+			if(store.sequence(ID) != sequence)
+			{
+				throw std::runtime_error("Verification of sequence " + ID + " in " + storeFn_temp + " failed");
+			}
+			n_verified++;
+		});
+		assert(n_verified == n_sequences);
+		assert(store.sequenceIDs().size() == n_sequences);
+	}
+
+	if(std::rename(storeFn_temp.c_str(), storeFn.c_str()) != 0)
+	{
+		throw std::runtime_error("Cannot rename " + storeFn_temp + " to " + storeFn);
+	}
+
+	std::cout << "Wrote " << n_sequences << " sequences (" << n_bases << " characters) from " << FASTAfn << " into " << storeFn << (verify ? " (verified)" : "") << "\n";
+
+	return 0;
+}
@@ -17,23 +17,52 @@
 #include <tuple>
 #include <utility>
 #include <algorithm>
+#include <limits>
+#include <ctime>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <chrono>
+#include <cstdio>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "Utilities.h"
+#include "ReferenceSequence.h"
+#include "PartFileReader.h"
 
 using namespace std;
 
-std::vector<std::string> split(std::string input, std::string delimiter);
-std::string join(std::vector<std::string> parts, std::string delim);
-void eraseNL(std::string& s);
-int StrtoI(std::string s);
-std::string ItoStr(int i);
-unsigned int StrtoUI(std::string s);
-std::string removeGaps(std::string in);
-
 class startingHaplotype;
-void produceVCF(const std::string referenceSequenceID, const std::string& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, std::string outputFn);
-void printHaplotypesAroundPosition(const std::string& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, int posI);
+class engineParameters;
+class loadedAlignments;
+class sweepStatistics;
+class progressStatus;
+template<typename checkPolicy> sweepStatistics produceVCF(const std::string referenceSequenceID, const ReferenceSequence& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, std::string outputFn, std::string regionBudgetsFn, bool eventDriven, const std::map<std::pair<long long, long long>, int>& symbolicDeletions, bool pipeline, const engineParameters& parameters, std::ostream& logStream, progressStatus* progress);
+void normalizeAlignmentStart(startingHaplotype* h);
+void storeAlignment(startingHaplotype* h, bool shared, bool deduplicateAlignments, loadedAlignments& loaded);
+template<typename checkPolicy> void loadAlignment(startingHaplotype* h, bool shared, const engineParameters& parameters, bool deduplicateAlignments, long long symbolicDeletionLength, loadedAlignments& loaded);
+std::vector<engineParameters> readParameterSweep(std::string parameterSweepFn);
+void runParameterSweep(const std::vector<engineParameters>& sweepParameters, std::vector<startingHaplotype*>& rawAlignments, const std::string referenceSequenceID, const ReferenceSequence& referenceSequence, std::string outputFn, std::string regionBudgetsFn, bool eventDriven, bool deduplicateAlignments, long long symbolicDeletionLength, bool pipeline);
+template<typename checkPolicy> void computeGapStructure(const ReferenceSequence& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, std::vector<int>& gap_structure, std::vector<int>& coverage_structure);
+void estimateComplexity(const std::string referenceSequenceID, const ReferenceSequence& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, std::string outputFn);
+std::vector<std::tuple<unsigned int, unsigned int, int>> readRegionBudgets(const std::string referenceSequenceID, std::string regionBudgetsFn);
+void printHaplotypesAroundPosition(const ReferenceSequence& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, int posI);
 
 int max_gap_length = 5000;
 int max_running_haplotypes_before_add = 5000;
+int complexity_window_length = 10000;
+unsigned int pipeline_batch_size = 1000; // parsed alignments per batch handed from the reader thread to the loader
+unsigned int pipeline_queue_capacity = 64; // batches / output buffers held between pipeline threads
+unsigned int pipeline_output_buffer_size = 1 << 20; // bytes of formatted VCF records per buffer handed to the writer thread
+unsigned int decompression_threads = 4; // threads inflating BGZF-compressed input (--decompressionThreads)
+int status_interval_seconds = 10; // interval at which <input>.VCF.status is rewritten (0 = no status file)
+long long profile_haplotypes_threshold = 0; // --profileHaplotypes: profile segments with more open haplotypes than this (0 = off)
+long long profile_bytes_threshold = 0; // --profileBytes: profile segments whose open haplotypes hold more sequence bytes than this (0 = off)
+bool annotate_paths = false; // --pathAnnotation 1: write the alleles supported by each input alignment to <output>.paths
 
 	
 class startingHaplotype
@@ -42,12 +71,15 @@ public:
 	std::string ref;
 	std::string query;
 	std::string query_name;
+	std::string contig_name; // the input contig - query_name without the _partN suffix of split alignments
+	std::vector<std::string> query_names; // all input alignments collapsed into this one (identical start, ref and query)
+	std::vector<std::string> contig_names; // contig_name of each entry of query_names
 	long long aligment_start_pos;
 	long long alignment_last_pos;
 	
 	void print()
 	{
-		std::cerr << "Alignment data " << query_name << "\n";
+		std::cerr << "Alignment data " << query_name << " (multiplicity " << query_names.size() << ")\n";
 		std::cerr << "\t Reference: " << ref << "\n";
 		std::cerr << "\t Query    : " << query << "\n";
 		std::cerr << "\t Ref_start: " << aligment_start_pos << "\n";
@@ -56,1238 +88,2503 @@ public:
 	}
 };
 
-int main(int argc, char *argv[]) {
-	std::vector<std::string> ARG (argv + 1, argv + argc + !argc);
-	std::map<std::string, std::string> arguments;
-
-	// arguments["input"] = "C:\\Users\\diltheyat\\Desktop\\Temp\\chr21";
-	// arguments["referenceSequenceID"] = "chr21";
+// the parameters of the split (loadAlignment) and of the sweep (produceVCF); several sets can be compared in one run (--parameterSweep)
+class engineParameters
+{
+public:
+	std::string label;
+	int max_gap_length;
+	int max_running_haplotypes_before_add;
+};
 
-	std::map<std::string, std::map<long long, std::set<std::string>>> expectedAlleles;
+// the alignments for one set of engine parameters, after splitting and deduplication
+class loadedAlignments
+{
+public:
+	std::map<unsigned int, std::vector<startingHaplotype*>> alignments_starting_at;
 	
-	for(unsigned int i = 0; i < ARG.size(); i++)
-	{
-		if((ARG.at(i).length() > 2) && (ARG.at(i).substr(0, 2) == "--"))
-		{
-			std::string argname = ARG.at(i).substr(2);
-			std::string argvalue = ARG.at(i+1);
-			arguments[argname] = argvalue;
-		}
-	}
+	// (last reference position before the deletion, last deleted reference position), both 0-based -> number of supporting alignments
+	std::map<std::pair<long long, long long>, int> symbolicDeletions;
 
-	assert(arguments.count("input"));
-	assert(arguments.count("referenceSequenceID"));
+	// alignments in alignments_starting_at that belong to the read-only input of a parameter sweep (which is shared
+	// between all parameter sets); all others are owned by this object
+	std::set<const startingHaplotype*> shared;
 
-	std::string outputFn = arguments.at("input") + ".VCF";
-	std::string doneFn = outputFn + ".done";
-	std::ofstream doneStream;
-	doneStream.open(doneFn.c_str());
-	if(! doneStream.is_open())
+	int n_alignments_loaded;
+	int n_alignments_split;
+	int n_alignments_sub;
+	int n_alignments_collapsed;
+	int n_deletions_symbolic;
+
+	loadedAlignments() : n_alignments_loaded(0), n_alignments_split(0), n_alignments_sub(0), n_alignments_collapsed(0), n_deletions_symbolic(0)
 	{
-		throw std::runtime_error("Cannot open " + doneFn + " for writing!");
 	}
-	doneStream << 0 << "\n";
-	doneStream.close();
-	
-	
-	std::ifstream inputStream;
-	inputStream.open(arguments.at("input").c_str());
-	if(! inputStream.is_open())
+
+	void printStatistics(std::ostream& logStream, const engineParameters& parameters, bool deduplicateAlignments, long long symbolicDeletionLength) const
 	{
-		throw std::runtime_error("Could not open file "+arguments.at("input"));
+		logStream << "For max. gap length " << parameters.max_gap_length << "\n";
+		logStream << "\t" << "n_alignments_loaded" << ": " << n_alignments_loaded << "\n";
+		logStream << "\t" << "n_alignments_split" << ": " << n_alignments_split << " (into " << n_alignments_sub << " subalignments.)\n";
+		logStream << "\t" << "n_deletions_symbolic" << ": " << n_deletions_symbolic << " (" << symbolicDeletions.size() << " distinct; min. length " << symbolicDeletionLength << ")\n";
+		logStream << "\t" << "n_alignments_collapsed" << ": " << n_alignments_collapsed << " (identical to an alignment loaded before" << (deduplicateAlignments ? "" : "; deduplication disabled") << ")\n";
+		logStream << std::flush;
 	}
-	assert(inputStream.good());
-	std::string referenceSequence;
-	std::getline(inputStream, referenceSequence);
-	eraseNL(referenceSequence);
+};
 
-	int n_alignments_loaded = 0;
-	int n_alignments_split = 0;
-	int n_alignments_sub = 0;
-	std::map<unsigned int, std::vector<startingHaplotype*>> alignments_starting_at;
-	std::string line;
+// Validation policies for the engine (loadAlignment, computeGapStructure, produceVCF): with cheapChecks, only the O(1)
+// assertions run; fullChecks adds the expensive invariant checks (reconstructing each input alignment from its parts,
+// comparing each alignment to the reference, re-checking all open haplotypes at each position). CRAM2VCF uses
+// cheapChecks; CRAM2VCF_debug ('make debug') is built from the same source with -DCRAM2VCF_FULL_CHECKS.
+class cheapChecks
+{
+public:
+	static const bool full = false;
+};
 
-	/* 
+class fullChecks
+{
+public:
+	static const bool full = true;
+};
 
-       We read in the data produced by the CRAM2VCF script.
+#ifdef CRAM2VCF_FULL_CHECKS
+typedef fullChecks engineChecks;
+#else
+typedef cheapChecks engineChecks;
+#endif
 
-       These are basically pairwise sequence alignments between reference and input contigs in a simple text format.
+// summary of one produceVCF run
+class sweepStatistics
+{
+public:
+	long long n_records;
+	long long n_symbolic_records;
+	long long n_haplotypes_skipped; // haplotypes not entered because of max_running_haplotypes_before_add / region budgets
+	size_t max_open_haplotypes;
+	long long skipped_positions;
 
-       By definition, at any given reference position, we have to be able to reconstitute a valid multiple sequence alignment of the reference
-       and the contigs from the pairwise reference<->contig alignments. One crucial requirement for this is that we sometimes have to encode
-       'double-gap' columns in the pairwise alignments that specify gaps for both the sequence and the reference.
+	sweepStatistics() : n_records(0), n_symbolic_records(0), n_haplotypes_skipped(0), max_open_haplotypes(0), skipped_positions(0)
+	{
+	}
+};
 
-       Also the following algorithms become more complex when there are large deletions relative to the reference. Therefore we apply a filter for maximum
-       gap region length:
+// records the segments between two closings of the sweep in produceVCF in which the number of open haplotypes or the
+// bytes of running haplotype sequence exceed a threshold; written as <output>.profile.bed and <output>.profile.txt
+class sweepProfiler
+{
+public:
+	sweepProfiler(std::string referenceSequenceID, long long haplotypes_threshold, long long bytes_threshold) : referenceSequenceID(referenceSequenceID), haplotypes_threshold(haplotypes_threshold), bytes_threshold(bytes_threshold), n_segments(0)
+	{
+		sweepStartTime = std::chrono::steady_clock::now();
+		begin(0);
+	}
 
-           (max_running_gap_length <= max_gap_length)
-       
-       This parameter can be played around with!
+	bool enabled() const
+	{
+		return (haplotypes_threshold > 0) || (bytes_threshold > 0);
+	}
 
-     */
-	   
+	// a new segment starts at (0-based) reference position pos, after a closing or a jump of the event-driven sweep
+	void begin(long long pos)
+	{
+		current = profiledSegment();
+		current.start = pos;
+		current.involved.clear();
+		segmentStartTime = std::chrono::steady_clock::now();
+	}
 
-	while(inputStream.good())
+	void enter(const startingHaplotype* h)
 	{
-		std::getline(inputStream, line);
-		eraseNL(line);
-		if(line.length())
-		{
-			std::vector<std::string> line_fields = split(line, "\t");
-			assert(line_fields.size() == 5);
-			startingHaplotype* h = new startingHaplotype();
-			h->ref = line_fields.at(0);
-			h->query = line_fields.at(1);
-			h->query_name = line_fields.at(2);
-			h->aligment_start_pos = StrtoUI(line_fields.at(3));
-			h->alignment_last_pos = StrtoUI(line_fields.at(4))+1;
-			
-			// determine alleles expected to be found
-			{
-				long long runningRefC_0based = (h->aligment_start_pos - 1);
-				std::string runningRefAllele;
-				std::string runningQueryAllele;
-				
-				for(unsigned int i = 0; i < h->ref.length(); i++)
-				{
-					unsigned char c_ref = h->ref.at(i);
-					unsigned char c_query = h->query.at(i);
+		current.n_entered++;
+		current.involved.push_back(h);
+	}
 
-					if((c_ref != '-') && (c_ref != '*'))
-					{
-						// empty alleles
-						if((runningRefAllele.length() == 1) && (runningQueryAllele.length() == 1) && (runningRefAllele != runningQueryAllele))
-						{
-							if((runningRefAllele != "-") && (runningRefAllele != "*") && (runningQueryAllele != "-") && (runningQueryAllele != "*"))
-							{
-								expectedAlleles[arguments.at("referenceSequenceID")][runningRefC_0based].insert(runningQueryAllele);
-							}
-						}
-						runningRefAllele = "";
-						runningQueryAllele = "";
-					}
-					
-					if((c_ref != '-') && (c_ref != '*'))
-					{
-						runningRefC_0based++;
-					}
-					
-					runningRefAllele.push_back(c_ref);
-					runningQueryAllele.push_back(c_query);
-				}	
-			}
-			
-			// this is a hack - if this is ever violated, carry out proper scan for the first match in the alignment
-			if(h->aligment_start_pos == 0)
+	void skip(const startingHaplotype* h)
+	{
+		current.n_skipped++;
+		current.involved.push_back(h);
+	}
+
+	void exit(const startingHaplotype* h)
+	{
+		current.n_exited++;
+		current.involved.push_back(h);
+	}
+
+	template<typename haplotypeT>
+	void observe(const std::vector<haplotypeT>& open_haplotypes)
+	{
+		long long bytes = 0;
+		for(const haplotypeT& haplotype : open_haplotypes)
+		{
+			bytes += std::get<0>(haplotype).length();
+		}
+		current.peak_open_haplotypes = std::max(current.peak_open_haplotypes, (long long)open_haplotypes.size());
+		current.peak_bytes = std::max(current.peak_bytes, bytes);
+	}
+
+	// the segment is closed at reference position pos (the VCF record covers [start, pos)); the next one starts at pos
+	void close(long long pos)
+	{
+		n_segments++;
+		bool exceeds = ((haplotypes_threshold > 0) && (current.peak_open_haplotypes > haplotypes_threshold)) || ((bytes_threshold > 0) && (current.peak_bytes > bytes_threshold));
+		if(exceeds)
+		{
+			current.end = pos;
+			current.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - segmentStartTime).count();
+			std::set<std::string> names;
+			for(const startingHaplotype* h : current.involved)
 			{
-				assert(h->ref.at(1) != '-');
-				assert(h->query.at(1) != '-');
-				h->aligment_start_pos = 1;
-				h->ref = h->ref.substr(1);
-				h->query = h->query.substr(1);
+				names.insert(h->query_names.begin(), h->query_names.end());
 			}
-			
-			long long lastPos_control = (long long)h->aligment_start_pos - 1;
-			long long firstMatchPos_reference = -1;
-			long long lastMatchPos_reference = -1;
-			
-			std::string running_ref;
-			std::string running_query;
-			
-			long long runningNonMatchPositions = 0;
-			long long runningRefGapCharacters = 0;
-			long long runningQueryGapCharacters = 0;
-			long long runningRefPos = (long long)h->aligment_start_pos - 1;
-			//long long total_removedGappyRegions = 0;
-			std::vector<startingHaplotype*> haplotype_parts;
-			
-			std::string reconstituted_ref;
-			std::string reconstituted_query;
-			
-			for(unsigned int i = 0; i < h->ref.length(); i++)
+			current.involved.clear();
+			current.query_names.assign(names.begin(), names.end());
+			segments.push_back(current);
+		}
+		begin(pos);
+	}
+
+	void write(std::string outputFn, long long reference_length, std::ostream& logStream) const
+	{
+		double sweep_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - sweepStartTime).count();
+
+		std::string bedFn = outputFn + ".profile.bed";
+		std::ofstream bedStream;
+		bedStream.open(bedFn.c_str());
+		if(! bedStream.is_open())
+		{
+			throw std::runtime_error("Cannot open " + bedFn + " for writing!");
+		}
+		bedStream << "#chrom\tstart\tend\tseconds\tpeak_open_haplotypes\tpeak_bytes\talignments_entered\talignments_exited\talignments_skipped\tquery_names\n";
+		double profiled_seconds = 0;
+		long long profiled_positions = 0;
+		std::map<std::string, std::pair<int, double>> per_query_name;
+		for(const profiledSegment& segment : segments)
+		{
+			bedStream <<
+				referenceSequenceID << "\t" <<
+				segment.start << "\t" <<
+				segment.end << "\t" <<
+				segment.seconds << "\t" <<
+				segment.peak_open_haplotypes << "\t" <<
+				segment.peak_bytes << "\t" <<
+				segment.n_entered << "\t" <<
+				segment.n_exited << "\t" <<
+				segment.n_skipped << "\t" <<
+				(segment.query_names.size() ? join(segment.query_names, ",") : ".") << "\n";
+
+			profiled_seconds += segment.seconds;
+			profiled_positions += (segment.end - segment.start);
+			for(const std::string& query_name : segment.query_names)
 			{
-				unsigned char c_ref = h->ref.at(i);	
-				unsigned char c_query = h->query.at(i);	
-				
-				if((c_ref != '-') && (c_ref != '*'))
-				{
-					runningRefPos++;
-				}
-				
-				bool isMatchOrMismatch = ((c_ref != '-') && (c_ref != '*') && (c_query != '-') && (c_query != '*'));
-				bool isRefGap = ((c_ref == '-') || (c_ref == '*'));  
-				bool isQueryGap = ((c_query == '-') || (c_query == '*'));
-				
-				if((i == 0) || (i == (h->ref.length() - 1)))
-				{
-					assert(isMatchOrMismatch);					
-				}
-			
-				if(isMatchOrMismatch)
-				{
-					if(runningQueryGapCharacters > max_gap_length)
-					{
-						// we have a match, but too many gaps, so we want to close!
-						
-						assert(firstMatchPos_reference != -1);
-						long long remainingCharacters = running_ref.length() - runningNonMatchPositions;
-						assert(remainingCharacters >= 0);
-						std::string removeRef;
-						std::string removeQuery;
-						if(runningNonMatchPositions > 0)
-						{
-								assert(running_ref.length() > remainingCharacters);
-								removeRef = running_ref.substr(remainingCharacters);
-								removeQuery = running_query.substr(remainingCharacters);
-						}
-						running_ref = running_ref.substr(0, remainingCharacters);
-						running_query = running_query.substr(0, remainingCharacters);
-						assert(running_ref.length() == remainingCharacters);
-						assert(running_query.length() == remainingCharacters);
-						//total_removedGappyRegions += runningNonMatchPositions;
-						
-						reconstituted_ref.append(running_ref);
-						reconstituted_query.append(running_query);
-						
-						reconstituted_ref.append(removeRef);
-						reconstituted_query.append(removeQuery);
-
-						if(running_ref.length())
-						{
-							startingHaplotype* h_part = new startingHaplotype();
-							h_part->ref = running_ref;
-							h_part->query = running_query;
-							h_part->query_name = h->query_name + "_part" + std::to_string(haplotype_parts.size());
-							h_part->aligment_start_pos = firstMatchPos_reference;
-							h_part->alignment_last_pos = lastMatchPos_reference;
-							haplotype_parts.push_back(h_part);
-							/*
-							std::cerr << "New alignment from " << h->query_name << "\n";
-							std::cerr << "\tLength: " << running_ref.length() << "\n";
-							std::cerr << "\tR Start : " << h_part->aligment_start_pos << "\n";
-							std::cerr << "\tR Stop  : " << h_part->alignment_last_pos << "\n";
-							std::cerr << "\trunningRefGapCharacters  : " << runningRefGapCharacters << "\n";
-							std::cerr << "\trunningNonMatchPositions  : " << runningNonMatchPositions << "\n";
-							std::cerr << "\trunningQueryGapCharacters  : " << runningQueryGapCharacters << "\n";
-							
-							//std::cerr << "\tC Start : " << h_part->aligment_start_pos << "\n";
-							//std::cerr << "\tC Stop  : " << h_part->alignment_last_pos << "\n";
-							//std::cerr << "\tRef    : " << running_ref << "\n";
-							//std::cerr << "\tQuery  : " << running_query << "\n";
-							std::cerr << std::flush;
-							*/
-
-							assert(!((h_part->aligment_start_pos == 46398487) && (h_part->alignment_last_pos == 46398489)));
-						}
-						
-						running_ref.clear();
-						running_query.clear();
-						firstMatchPos_reference = -1;
-					}		
-					
-					if(firstMatchPos_reference == -1)
-					{
-						firstMatchPos_reference = runningRefPos;
-					}
-					
-					lastMatchPos_reference = runningRefPos;
-					
-					runningNonMatchPositions = 0;
-					runningRefGapCharacters = 0;
-					runningQueryGapCharacters = 0;
-				}
-				else
-				{
-					runningNonMatchPositions++;
-					if(isRefGap && !isQueryGap)
-						runningRefGapCharacters++;
-					if(isQueryGap && !isRefGap)
-						runningQueryGapCharacters++;					
-				}
-				
-				running_ref.push_back(c_ref);
-				running_query.push_back(c_query);
-				
-				if((c_ref != '-') and (c_ref != '*'))
-				{
-					lastPos_control++;
-				}
+				per_query_name[query_name].first++;
+				per_query_name[query_name].second += segment.seconds;
 			}
-			//std::cerr << "lastPos_control: " << lastPos_control << "\n";
-			//std::cerr << "h->alignment_last_pos: " << h->alignment_last_pos << "\n" << std::flush;
-			if(lastPos_control != ((long long)h->alignment_last_pos))
-			{
-				std::cerr << "h->aligment_start_pos: " << h->aligment_start_pos << "\n";
-				std::cerr << "lastPos_control: " << lastPos_control << "\n";
-				std::cerr << "h->alignment_last_pos: " << h->alignment_last_pos << "\n";
-				std::cerr << std::flush;
-			}
-			assert(lastPos_control == ((long long)h->alignment_last_pos));
-			if(lastPos_control != (lastMatchPos_reference))
-			{
-				std::cerr << "h->aligment_start_pos: " << h->aligment_start_pos << "\n";
-				std::cerr << "lastPos_control: " << lastPos_control << "\n";
-				std::cerr << "h->alignment_last_pos: " << h->alignment_last_pos << "\n";
-				std::cerr << "lastMatchPos_reference: " << lastMatchPos_reference << "\n";
-				std::cerr << std::flush;
-			}
-			assert(lastPos_control == lastMatchPos_reference);
-			assert(runningNonMatchPositions <= max_gap_length);
-
-			if(running_ref.length())
-			{
-				startingHaplotype* h_part = new startingHaplotype();
-				h_part->ref = running_ref;
-				h_part->query = running_query;
-				h_part->query_name = h_part->query_name + "_part" + std::to_string(haplotype_parts.size());
-				h_part->aligment_start_pos = firstMatchPos_reference;
-				h_part->alignment_last_pos = lastMatchPos_reference;
-				reconstituted_ref.append(running_ref);
-				reconstituted_query.append(running_query);				
-				haplotype_parts.push_back(h_part);
-			}
-						
-			assert(reconstituted_ref == h->ref);
-			assert(reconstituted_query == h->query);
-									
-			if(haplotype_parts.size() > 1)
+		}
+		bedStream.close();
+
+		std::string summaryFn = outputFn + ".profile.txt";
+		std::ofstream summaryStream;
+		summaryStream.open(summaryFn.c_str());
+		if(! summaryStream.is_open())
+		{
+			throw std::runtime_error("Cannot open " + summaryFn + " for writing!");
+		}
+		summaryStream << "thresholds" << "\t" << "open_haplotypes > " << haplotypes_threshold << " or sequence bytes > " << bytes_threshold << " (0 = not used)\n";
+		summaryStream << "profiled_segments" << "\t" << segments.size() << " of " << n_segments << " closed segments\n";
+		summaryStream << "profiled_positions" << "\t" << profiled_positions << " of " << reference_length << "\n";
+		summaryStream << "profiled_seconds" << "\t" << profiled_seconds << " of " << sweep_seconds << " seconds in the sweep (" << ((sweep_seconds > 0) ? (100 * profiled_seconds / sweep_seconds) : 0) << "%)\n";
+
+		std::vector<size_t> by_time;
+		for(size_t segmentI = 0; segmentI < segments.size(); segmentI++)
+		{
+			by_time.push_back(segmentI);
+		}
+		std::stable_sort(by_time.begin(), by_time.end(), [&](size_t a, size_t b){ return segments.at(a).seconds > segments.at(b).seconds; });
+		summaryStream << "\n" << "Most expensive segments:\n";
+		summaryStream << "#chrom\tstart\tend\tseconds\tpeak_open_haplotypes\tpeak_bytes\talignments_entered\talignments_exited\talignments_skipped\n";
+		for(size_t i = 0; (i < by_time.size()) && (i < 20); i++)
+		{
+			const profiledSegment& segment = segments.at(by_time.at(i));
+			summaryStream << referenceSequenceID << "\t" << segment.start << "\t" << segment.end << "\t" << segment.seconds << "\t" << segment.peak_open_haplotypes << "\t" << segment.peak_bytes << "\t" << segment.n_entered << "\t" << segment.n_exited << "\t" << segment.n_skipped << "\n";
+		}
+
+		std::vector<std::pair<std::string, std::pair<int, double>>> query_names(per_query_name.begin(), per_query_name.end());
+		std::stable_sort(query_names.begin(), query_names.end(), [](const std::pair<std::string, std::pair<int, double>>& a, const std::pair<std::string, std::pair<int, double>>& b){ return a.second.second > b.second.second; });
+		summaryStream << "\n" << "Alignments involved in the most expensive segments:\n";
+		summaryStream << "#query_name\tsegments\tseconds\n";
+		for(size_t i = 0; (i < query_names.size()) && (i < 20); i++)
+		{
+			summaryStream << query_names.at(i).first << "\t" << query_names.at(i).second.first << "\t" << query_names.at(i).second.second << "\n";
+		}
+		summaryStream.close();
+
+		logStream << "Profiler: " << segments.size() << " segments above the thresholds (" << profiled_seconds << " of " << sweep_seconds << " seconds) - written to " << bedFn << " and " << summaryFn << "\n" << std::flush;
+	}
+
+private:
+	class profiledSegment
+	{
+	public:
+		long long start;
+		long long end;
+		long long peak_open_haplotypes;
+		long long peak_bytes;
+		long long n_entered;
+		long long n_exited;
+		long long n_skipped;
+		double seconds;
+		std::vector<const startingHaplotype*> involved;
+		std::vector<std::string> query_names;
+
+		profiledSegment() : start(0), end(0), peak_open_haplotypes(0), peak_bytes(0), n_entered(0), n_exited(0), n_skipped(0), seconds(0)
+		{
+		}
+	};
+
+	std::string referenceSequenceID;
+	long long haplotypes_threshold;
+	long long bytes_threshold;
+	long long n_segments;
+	profiledSegment current;
+	std::vector<profiledSegment> segments;
+	std::chrono::steady_clock::time_point sweepStartTime;
+	std::chrono::steady_clock::time_point segmentStartTime;
+};
+
+// records which allele of each emitted record (0 = REF, 1.. = ALT) the input alignments support, for --pathAnnotation.
+// An alignment supports a record if it is open over the whole record, i.e. at the closing before the record and at the
+// closing that emits it; its allele is its own query sequence between the MSA columns consumed at these two closings.
+// Consecutive supported records form a run, written to <output>.paths when the alignment ends:
+// input contig, chromosome, POS of the first and last record, number of records, the allele indices with run-length
+// encoding ("0*12,1,0*5,2": REF for 12 records, then ALT 1, REF for 5 records, ALT 2), and the alignment (the contig
+// name with a _partN suffix if the contig was split at long gaps, so a contig can have several runs per part). The records
+// of a run are the consecutive non-symbolic records of the chromosome between the two positions.
+class pathAnnotator
+{
+public:
+	pathAnnotator(std::string referenceSequenceID) : referenceSequenceID(referenceSequenceID), n_runs(0), n_unresolved(0)
+	{
+	}
+
+	void open(std::string fn)
+	{
+		pathsFn = fn;
+		pathsStream.open(fn.c_str());
+		if(! pathsStream.is_open())
+		{
+			throw std::runtime_error("Cannot open " + fn + " for writing!");
+		}
+		pathsStream << "#contig\tchrom\tfirst_POS\tlast_POS\tn_records\talleles\talignment\n";
+	}
+
+	// at a closing, after open_haplotypes has been reduced to the last character; if a record was emitted, POS > 0 and
+	// alleles holds its REF and ALT sequences (without gaps). Returns false if an alignment's sequence is not among the alleles.
+	template<typename haplotypeT>
+	bool close(const std::vector<haplotypeT>& open_haplotypes, long long POS, const std::vector<std::string>& alleles)
+	{
+		std::map<std::string, int> allele_index;
+		for(unsigned int alleleI = 0; alleleI < alleles.size(); alleleI++)
+		{
+			allele_index[alleles.at(alleleI)] = alleleI;
+		}
+
+		bool allResolved = true;
+		std::map<const startingHaplotype*, pathState> still_open;
+		for(const haplotypeT& haplotype : open_haplotypes)
+		{
+			const startingHaplotype* template_alignment = std::get<1>(haplotype);
+			if((template_alignment == 0) || still_open.count(template_alignment))
 			{
-				/*
-				std::cerr << "Split " << h->query_name << " into multiple parts -- removed " << total_removedGappyRegions << "gaps.\n";		
-				h->print();
-				for(unsigned int pI = 0; pI < haplotype_parts.size(); pI++)
-				{
-					std::cerr << "Part " << pI << " ";
-					haplotype_parts.at(pI)->print();
-				}
-				assert(1 == 0);
-				*/
-				n_alignments_split++;
-				delete(h);
-				for(auto hP : haplotype_parts)
-				{
-					alignments_starting_at[hP->aligment_start_pos].push_back(hP);
-					n_alignments_sub++;
-				}
-				// std::cerr << "\t\tSubalignments: " << n_alignments_sub << "\n" << std::flush;
+				continue;
 			}
-			else
+
+			int columnI = std::get<2>(haplotype);
+			auto previous = open_templates.find(template_alignment);
+			if(previous == open_templates.end())
 			{
-				alignments_starting_at[h->aligment_start_pos].push_back(h);
-				delete(haplotype_parts.at(0));
-				n_alignments_loaded++;					
+				still_open[template_alignment].lastColumn = columnI;
+				continue;
 			}
-			
 
-			
-			/*
-			int running_gap_length = 0;
-			int max_running_gap_length = 0;
-			std::vector<std::string>
-			for(unsigned int i = 0; i < h->ref.length(); i++)
+			pathState& state = previous->second;
+			if(POS > 0)
 			{
-				unsigned char c_ref = h->ref.at(i);
-				unsigned char c_q = h->query.at(i);
-				if((c_ref == '-') or (c_ref == '*'))
+				std::string allele = removeGaps(template_alignment->query.substr(state.lastColumn, columnI - state.lastColumn));
+				auto alleleIt = allele_index.find(allele);
+				if(alleleIt == allele_index.end())
 				{
-					running_gap_length++;
+					// the alignment is not on a path of the record - end its run here
+					allResolved = false;
+					n_unresolved++;
+					writeRun(template_alignment, state);
+					state = pathState();
 				}
 				else
 				{
-					if(running_gap_length)
-					{
-						if(running_gap_length > max_running_gap_length)
-							max_running_gap_length = running_gap_length;
-						
-						if(max_running_gap_length > max_gap_length)
-						{
-							
-						}
-					}
-					running_gap_length = 0;
+					state.add(POS, alleleIt->second);
 				}
 			}
-			assert(running_gap_length == 0);
+			state.lastColumn = columnI;
+			still_open[template_alignment] = std::move(state);
+		}
 
-			if(max_running_gap_length <= max_gap_length)
+		// alignments that have ended
+		for(auto& templateAndState : open_templates)
+		{
+			if(! still_open.count(templateAndState.first))
 			{
-				alignments_starting_at[h->aligment_start_pos].push_back(h);
-				n_alignments_loaded++;
+				writeRun(templateAndState.first, templateAndState.second);
 			}
-			else
+		}
+		open_templates.swap(still_open);
+		return allResolved;
+	}
+
+	// after a jump of the event-driven sweep, which advances the template columns without a closing
+	template<typename haplotypeT>
+	void advance(const std::vector<haplotypeT>& open_haplotypes)
+	{
+		for(const haplotypeT& haplotype : open_haplotypes)
+		{
+			if(std::get<1>(haplotype) != 0)
 			{
-				
+				assert(open_templates.count(std::get<1>(haplotype)));
+				open_templates.at(std::get<1>(haplotype)).lastColumn = std::get<2>(haplotype);
 			}
-			*/
 		}
 	}
-	std::cout << "For max. gap length " << max_gap_length << "\n";
-	std::cout << "\t" << "n_alignments_loaded" << ": " << n_alignments_loaded << "\n";
-	std::cout << "\t" << "n_alignments_split" << ": " << n_alignments_split << " (into " << n_alignments_sub << " subalignments.)\n";
-	std::cout << std::flush;
 
-	std::string fn_files_SNPs = arguments.at("input")+".VCF.expectedSNPs";
-	std::ofstream SNPsstream;
-	SNPsstream.open(fn_files_SNPs.c_str());
-	assert(SNPsstream.is_open());
-	
-	produceVCF(arguments.at("referenceSequenceID"), referenceSequence, alignments_starting_at, outputFn);
+	void finish(std::ostream& logStream)
+	{
+		for(auto& templateAndState : open_templates)
+		{
+			writeRun(templateAndState.first, templateAndState.second);
+		}
+		open_templates.clear();
+		pathsStream.close();
+		if(! pathsStream)
+		{
+			throw std::runtime_error("Error writing " + pathsFn);
+		}
+		logStream << "Path annotation: " << n_runs << " runs written to " << pathsFn << " (" << n_unresolved << " unresolved alignment alleles)\n" << std::flush;
+	}
 
-	for(auto SNPsPerRefID : expectedAlleles)
+private:
+	class pathState
 	{
-		for(auto refPos : SNPsPerRefID.second)
+	public:
+		int lastColumn;
+		long long first_POS;
+		long long last_POS;
+		long long n_records;
+		std::string alleles;
+		int last_allele;
+		long long last_allele_count;
+
+		pathState() : lastColumn(-1), first_POS(-1), last_POS(-1), n_records(0), last_allele(-1), last_allele_count(0)
+		{
+		}
+
+		void add(long long POS, int allele)
 		{
-			for(auto allele : refPos.second)
+			if(n_records == 0)
 			{
-				SNPsstream << SNPsPerRefID.first << "\t" << (refPos.first+1) << "\t" << allele << "\n";
+				first_POS = POS;
+			}
+			last_POS = POS;
+			n_records++;
+			if(allele == last_allele)
+			{
+				last_allele_count++;
+			}
+			else
+			{
+				flush();
+				last_allele = allele;
+				last_allele_count = 1;
 			}
 		}
-	}
 
-	doneStream.open(doneFn.c_str());
-	if(! doneStream.is_open())
+		void flush()
+		{
+			if(last_allele_count == 0)
+			{
+				return;
+			}
+			if(alleles.length())
+			{
+				alleles.push_back(',');
+			}
+			alleles += std::to_string(last_allele);
+			if(last_allele_count > 1)
+			{
+				alleles += "*" + std::to_string(last_allele_count);
+			}
+			last_allele_count = 0;
+		}
+	};
+
+	void writeRun(const startingHaplotype* template_alignment, pathState& state)
 	{
-		throw std::runtime_error("Cannot open " + doneFn + " for writing!");
+		if(state.n_records == 0)
+		{
+			return;
+		}
+		state.flush();
+		assert(template_alignment->contig_names.size() == template_alignment->query_names.size());
+		for(unsigned int nameI = 0; nameI < template_alignment->query_names.size(); nameI++)
+		{
+			pathsStream << template_alignment->contig_names.at(nameI) << "\t" << referenceSequenceID << "\t" << state.first_POS << "\t" << state.last_POS << "\t" << state.n_records << "\t" << state.alleles << "\t" << template_alignment->query_names.at(nameI) << "\n";
+			n_runs++;
+		}
 	}
-	doneStream << 1 << "\n";
-	doneStream.close();	
 
-	return 0;
-}
+	std::string referenceSequenceID;
+	std::string pathsFn;
+	std::ofstream pathsStream;
+	std::map<const startingHaplotype*, pathState> open_templates;
+	long long n_runs;
+	long long n_unresolved;
+};
 
-void produceVCF(const std::string referenceSequenceID, const std::string& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, std::string outputFn)
+// FIFO between two threads that blocks the producer while it holds 'capacity' items. pop() returns false once
+// the queue has been closed and is empty.
+template<typename T>
+class boundedQueue
 {
-	std::ofstream outputStream;
-	outputStream.open(outputFn.c_str());
-	if(! outputStream.is_open())
+public:
+	boundedQueue(size_t capacity) : capacity(capacity), closed(false)
 	{
-		throw std::runtime_error("Cannot open " + outputFn + " for writing!");
+		assert(capacity > 0);
 	}
 
-	int n_alignments = 0;
-	for(auto startPos : alignments_starting_at)
+	void push(T item)
 	{
-			n_alignments += startPos.second.size();
+		std::unique_lock<std::mutex> lock(m);
+		notFull.wait(lock, [&](){ return items.size() < capacity; });
+		assert(! closed);
+		items.push_back(std::move(item));
+		notEmpty.notify_one();
 	}
 
-    // STEP 1: Gap structure
-	// first step: count how many gaps we have in the underlying MSA-like structure at each reference position
-	// gap_structure.at(i) counts the number of gaps that occur between reference position i - 1 and i (0-based).
-	// this needs to be consistent for all input alignments
-    // coverage_structure.at(i) is calculated for output/debug purposes.
-
-	std::vector<int> gap_structure;
-	std::vector<int> coverage_structure;
-	gap_structure.resize(referenceSequence.length(), -1);
-	coverage_structure.resize(referenceSequence.length(), 0);
-	int examine_gaps_n_alignment = 0;
-	for(auto startPos : alignments_starting_at)
+	bool pop(T& item)
 	{
-		for(startingHaplotype* alignment : startPos.second)
+		std::unique_lock<std::mutex> lock(m);
+		notEmpty.wait(lock, [&](){ return (items.size() > 0) || closed; });
+		if(items.size() == 0)
 		{
-			assert(startPos.first == alignment->aligment_start_pos);
+			return false;
+		}
+		item = std::move(items.front());
+		items.pop_front();
+		notFull.notify_one();
+		return true;
+	}
 
-			long long start_pos = (int)startPos.first - 1;
-			long long ref_pos = start_pos;
-			int running_gaps = 0;
+	void close()
+	{
+		std::unique_lock<std::mutex> lock(m);
+		closed = true;
+		notEmpty.notify_all();
+	}
 
-			for(unsigned int i = 0; i < alignment->ref.length(); i++)
-			{
-				unsigned char c_ref = alignment->ref.at(i);
-				if((c_ref == '-') or (c_ref == '*'))
-				{
-					running_gaps++;
-				}
-				else
-				{
-					if(ref_pos != start_pos)
-					{
-						if(gap_structure.at(ref_pos) == -1)
-						{
-							gap_structure.at(ref_pos) = running_gaps;
-						}
-						else
-						{
-							if(gap_structure.at(ref_pos) != running_gaps)
-							{
-								std::cerr << "Gap structure mismatch at position " << ref_pos << " - this is alignment " << examine_gaps_n_alignment << " / " << alignment->query_name << ", have existing value " << gap_structure.at(ref_pos) << ", want to set " << running_gaps << "\n" << std::flush;
-								std::cerr << "Alignment start " << alignment->aligment_start_pos << "\n";
-								std::cerr << "Alignment stop " << alignment->alignment_last_pos << "\n";
-								std::cerr << std::flush;
-								throw std::runtime_error("Gap structure mismatch");
-							}
+private:
+	size_t capacity;
+	bool closed;
+	std::deque<T> items;
+	std::mutex m;
+	std::condition_variable notFull;
+	std::condition_variable notEmpty;
+};
 
-						}
-					}
-					
-					ref_pos++;
-					running_gaps = 0;
-					coverage_structure.at(ref_pos)++; 
-					
-					assert(c_ref == referenceSequence.at(ref_pos));					
-				}
+// progress of one CRAM2VCF run, updated by the loading loop and the sweep and read by statusReporter
+class progressStatus
+{
+public:
+	enum phaseT {loading = 0, sweep = 1, done = 2};
+
+	std::atomic<int> phase;
+	std::atomic<long long> n_alignments_loaded;
+	std::atomic<long long> position;
+	std::atomic<long long> open_haplotypes;
+	std::atomic<long long> n_records;
+
+	progressStatus() : phase(loading), n_alignments_loaded(0), position(0), open_haplotypes(0), n_records(0)
+	{
+	}
+};
+
+// rewrites a status file every 'interval' seconds (write to <fn>.tmp, then rename, so that readers never see a partial file);
+// a last status is written by stop(). Lines are "key\tvalue", see write() for the keys.
+class statusReporter
+{
+public:
+	statusReporter(std::string fn, const progressStatus& progress, long long reference_length, int interval) : fn(fn), progress(progress), reference_length(reference_length), interval(interval), stopped(false)
+	{
+		assert(interval > 0);
+		startTime = std::chrono::steady_clock::now();
+		lastTime = startTime;
+		lastPosition = 0;
+		sweepStartPosition = -1;
+		write();
+		reporterThread = std::thread([&]() {
+			std::unique_lock<std::mutex> lock(m);
+			while(! cv.wait_for(lock, std::chrono::seconds(this->interval), [&](){ return stopped; }))
+			{
+				write();
 			}
+		});
+	}
 
-			examine_gaps_n_alignment++;
-			assert(ref_pos == alignment->alignment_last_pos);
+	void stop()
+	{
+		{
+			std::unique_lock<std::mutex> lock(m);
+			stopped = true;
+			cv.notify_all();
 		}
+		reporterThread.join();
+		write();
 	}
 
-    // STEP 2: Output some stuff
-	// printHaplotypesAroundPosition(referenceSequence, alignments_starting_at, 10014331);
-	// assert( 3==5 );
+private:
+	std::string fn;
+	const progressStatus& progress;
+	long long reference_length;
+	int interval;
+	bool stopped;
+	std::mutex m;
+	std::condition_variable cv;
+	std::thread reporterThread;
+
+	std::chrono::steady_clock::time_point startTime;
+	std::chrono::steady_clock::time_point lastTime;
+	long long lastPosition;
+	std::chrono::steady_clock::time_point sweepStartTime;
+	long long sweepStartPosition;
+
+	void write()
+	{
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		int phase = progress.phase.load(std::memory_order_relaxed);
+		long long position = progress.position.load(std::memory_order_relaxed);
+		if(phase == progressStatus::done)
+		{
+			position = reference_length;
+		}
+
+		double elapsed = std::chrono::duration<double>(now - startTime).count();
+		double interval_seconds = std::chrono::duration<double>(now - lastTime).count();
+		double positions_per_second = ((phase != progressStatus::loading) && (interval_seconds > 0)) ? ((position - lastPosition) / interval_seconds) : 0;
+
+		// the ETA uses the average rate since the sweep was first observed, which is less noisy than the last interval
+		std::string eta = "NA";
+		if((phase == progressStatus::sweep) && (sweepStartPosition == -1))
+		{
+			sweepStartTime = lastTime;
+			sweepStartPosition = lastPosition;
+		}
+		if(phase == progressStatus::done)
+		{
+			eta = "0";
+		}
+		else if((phase == progressStatus::sweep) && (position > sweepStartPosition))
+		{
+			double sweep_seconds = std::chrono::duration<double>(now - sweepStartTime).count();
+			eta = ItoStr((int)((reference_length - position) * sweep_seconds / (position - sweepStartPosition)));
+		}
+
+		long long rss_kB = 0;
+		std::ifstream statmStream("/proc/self/statm");
+		long long size_pages, resident_pages;
+		if(statmStream >> size_pages >> resident_pages)
+		{
+			rss_kB = resident_pages * (sysconf(_SC_PAGESIZE) / 1024);
+		}
+		struct rusage usage;
+		long long peak_rss_kB = (getrusage(RUSAGE_SELF, &usage) == 0) ? std::max((long long)usage.ru_maxrss, rss_kB) : rss_kB;
+
+		const char* phaseNames[] = {"loading", "sweep", "done"};
+		std::string tmpFn = fn + ".tmp";
+		std::ofstream statusStream(tmpFn.c_str());
+		if(! statusStream.is_open())
+		{
+			throw std::runtime_error("Cannot open " + tmpFn + " for writing!");
+		}
+		statusStream << "phase" << "\t" << phaseNames[phase] << "\n";
+		statusStream << "position" << "\t" << position << "\n";
+		statusStream << "reference_length" << "\t" << reference_length << "\n";
+		statusStream << "fraction_done" << "\t" << ((reference_length > 0) ? ((double)position / reference_length) : 1) << "\n";
+		statusStream << "open_haplotypes" << "\t" << progress.open_haplotypes.load(std::memory_order_relaxed) << "\n";
+		statusStream << "records" << "\t" << progress.n_records.load(std::memory_order_relaxed) << "\n";
+		statusStream << "alignments_loaded" << "\t" << progress.n_alignments_loaded.load(std::memory_order_relaxed) << "\n";
+		statusStream << "positions_per_second" << "\t" << (long long)positions_per_second << "\n";
+		statusStream << "eta_seconds" << "\t" << eta << "\n";
+		statusStream << "elapsed_seconds" << "\t" << (long long)elapsed << "\n";
+		statusStream << "rss_kB" << "\t" << rss_kB << "\n";
+		statusStream << "peak_rss_kB" << "\t" << peak_rss_kB << "\n";
+		statusStream << "updated" << "\t" << time(NULL) << "\n";
+		statusStream.close();
+		if(std::rename(tmpFn.c_str(), fn.c_str()) != 0)
+		{
+			throw std::runtime_error("Cannot rename " + tmpFn + " to " + fn);
+		}
+
+		lastTime = now;
+		lastPosition = position;
+	}
+};
+
+int main(int argc, char *argv[]) {
+	std::vector<std::string> ARG (argv + 1, argv + argc + !argc);
+	std::map<std::string, std::string> arguments;
+
+	// arguments["input"] = "C:\\Users\\diltheyat\\Desktop\\Temp\\chr21";
+	// arguments["referenceSequenceID"] = "chr21";
 
-	std::cout << "Loaded " << examine_gaps_n_alignment << " alignments.\n";
+	std::map<std::string, std::map<long long, std::set<std::string>>> expectedAlleles;
+	time_t startTime = time(NULL);
 	
-	std::cout << "Coverage structure:\n";
-	int coverage_window_length = 10000;
-	for(unsigned int pI = 0; pI < coverage_structure.size(); pI += coverage_window_length)
+	for(unsigned int i = 0; i < ARG.size(); i++)
 	{
-		int coverage_in_window = 0;
-		unsigned int last_window_pos = (pI+coverage_window_length) - 1;
-		if(last_window_pos > (coverage_structure.size() - 1))
-			last_window_pos = coverage_structure.size() - 1;
+		if((ARG.at(i).length() > 2) && (ARG.at(i).substr(0, 2) == "--"))
+		{
+			std::string argname = ARG.at(i).substr(2);
+			std::string argvalue = ARG.at(i+1);
+			arguments[argname] = argvalue;
+		}
+	}
 
-		for(unsigned int j = pI; j <= last_window_pos; j++)
+	assert(arguments.count("input"));
+	assert(arguments.count("referenceSequenceID"));
+
+	// --estimateComplexity 1 only runs the pre-pass: load the alignments, write <input>.complexity.bed and exit before STEP 3
+	bool estimateComplexityOnly = (arguments.count("estimateComplexity") && (arguments.at("estimateComplexity") == "1"));
+	if(arguments.count("complexityWindow"))
+	{
+		complexity_window_length = StrtoI(arguments.at("complexityWindow"));
+		assert(complexity_window_length > 0);
+	}
+	std::string regionBudgetsFn = (arguments.count("regionBudgets")) ? arguments.at("regionBudgets") : "";
+
+	// --deduplicateAlignments 0 keeps identical alignments (e.g. shared alleles of several assemblies) as separate haplotypes
+	bool deduplicateAlignments = (! (arguments.count("deduplicateAlignments") && (arguments.at("deduplicateAlignments") == "0")));
+
+	// --symbolicDeletionLength N: deletions (query gap runs without inserted bases) of at least N reference bases are cut out of
+	// the alignments and written as symbolic <DEL> alleles, so that the sweep in produceVCF can close inside them (0 = off)
+	long long symbolicDeletionLength = 0;
+	if(arguments.count("symbolicDeletionLength"))
+	{
+		symbolicDeletionLength = StrtoI(arguments.at("symbolicDeletionLength"));
+		assert(symbolicDeletionLength >= 0);
+	}
+
+	// --eventDriven 0 visits every reference position in STEP 3 of produceVCF, instead of jumping over stretches without events
+	bool eventDriven = (! (arguments.count("eventDriven") && (arguments.at("eventDriven") == "0")));
+
+	// --pipeline 0 runs parsing, loading, the sweep and all output strictly one after another on a single thread; by default,
+	// input parsing, VCF output and the .expectedSNPs file run in their own threads (the output is identical)
+	bool pipeline = (! (arguments.count("pipeline") && (arguments.at("pipeline") == "0")));
+
+	// --profileHaplotypes N / --profileBytes N: write the segments between closings of the sweep in which the number of open
+	// haplotypes / the bytes of running haplotype sequence exceed N to <input>.VCF.profile.bed, with a summary in <input>.VCF.profile.txt
+	if(arguments.count("profileHaplotypes"))
+	{
+		profile_haplotypes_threshold = StrtoI(arguments.at("profileHaplotypes"));
+		assert(profile_haplotypes_threshold >= 0);
+	}
+	if(arguments.count("profileBytes"))
+	{
+		profile_bytes_threshold = std::stoll(arguments.at("profileBytes"));
+		assert(profile_bytes_threshold >= 0);
+	}
+
+	// --pathAnnotation 1: for each input contig, write which allele of each record it supports to <input>.VCF.paths
+	annotate_paths = (arguments.count("pathAnnotation") && (arguments.at("pathAnnotation") == "1"));
+
+	if(arguments.count("decompressionThreads"))
+	{
+		decompression_threads = StrtoUI(arguments.at("decompressionThreads"));
+	}
+
+	// --statusInterval N: rewrite <input>.VCF.status (position, open haplotypes, throughput, ETA, memory) every N seconds (0 = off)
+	if(arguments.count("statusInterval"))
+	{
+		status_interval_seconds = StrtoI(arguments.at("statusInterval"));
+		assert(status_interval_seconds >= 0);
+	}
+
+	engineParameters defaultParameters;
+	defaultParameters.max_gap_length = max_gap_length;
+	defaultParameters.max_running_haplotypes_before_add = max_running_haplotypes_before_add;
+
+	// --parameterSweep <file>: read the input once and run the split and sweep for each listed parameter set (concurrently),
+	// writing <input>.VCF.<label> per set and a comparison to <input>.VCF.parameterSweep; <input>.VCF is not written
+	std::vector<engineParameters> sweepParameters;
+	if(arguments.count("parameterSweep"))
+	{
+		sweepParameters = readParameterSweep(arguments.at("parameterSweep"));
+		if(estimateComplexityOnly)
 		{
-			assert(j < coverage_structure.size());
-			coverage_in_window += coverage_structure.at(j);
+			throw std::runtime_error("--parameterSweep cannot be combined with --estimateComplexity 1");
 		}
-		double avg_coverage = (double) coverage_in_window / (double)(last_window_pos - pI + 1);
+	}
+	std::vector<startingHaplotype*> rawAlignments;
 
-		if((pI >= 15000000) && (pI <= 17000000))
-			std::cout << "\t" << "Window starting at pI = " << pI << " => avg. coverage " << avg_coverage << "\n";
+	std::string outputFn = arguments.at("input") + ".VCF";
+	std::string doneFn = outputFn + ".done";
+	std::ofstream doneStream;
+	if((! estimateComplexityOnly) && (sweepParameters.size() == 0))
+	{
+		doneStream.open(doneFn.c_str());
+		if(! doneStream.is_open())
+		{
+			throw std::runtime_error("Cannot open " + doneFn + " for writing!");
+		}
+		doneStream << 0 << "\n";
+		doneStream.close();
+	}
+	
+	
+	// the input can be plain text or BGZF-compressed (CRAM2VCF.pl --compressPartFiles 1); BGZF blocks are inflated by
+	// --decompressionThreads threads ahead of the parser (in the calling thread with --pipeline 0)
+	PartFileReader inputStream;
+	inputStream.open(arguments.at("input"), (pipeline ? decompression_threads : 0));
+
+	// the first line of the input is the embedded reference sequence (empty if CRAM2VCF.pl was run with --embedReference 0);
+	// with --referenceFasta, the sequence is read through a memory mapping of the indexed FASTA instead
+	ReferenceSequence referenceSequence;
+	if(arguments.count("referenceFasta"))
+	{
+		std::string skippedLine;
+		inputStream.getline(skippedLine);
+		referenceSequence.fromFASTA(arguments.at("referenceFasta"), arguments.at("referenceSequenceID"));
+	}
+	else
+	{
+		std::string embeddedReferenceSequence;
+		inputStream.getline(embeddedReferenceSequence);
+		eraseNL(embeddedReferenceSequence);
+		if(embeddedReferenceSequence.length() == 0)
+		{
+			throw std::runtime_error("No reference sequence embedded in " + arguments.at("input") + " - please specify --referenceFasta");
+		}
+		referenceSequence.fromString(embeddedReferenceSequence);
 	}
-	std::cout << std::flush;
 
-	std::set<const startingHaplotype*> known_haplotype_pointers;
-	for(auto startingPos : alignments_starting_at)
+	loadedAlignments loaded;
+
+	progressStatus progress;
+	std::unique_ptr<statusReporter> reporter;
+	std::string statusFn = outputFn + ".status";
+	if((! estimateComplexityOnly) && (sweepParameters.size() == 0))
 	{
-		for(startingHaplotype* sH :  startingPos.second)
+		std::remove(statusFn.c_str());
+		if(status_interval_seconds > 0)
 		{
-			known_haplotype_pointers.insert(sH);
+			reporter.reset(new statusReporter(statusFn, progress, referenceSequence.length(), status_interval_seconds));
 		}
 	}
 
-	// openHaplotype data structure:
-	// (1) running haplotype sequence (string)
-    // (2) pointer to input alignment we're copying from - 0 means reference
-    // (3) position within the input alignment - the (inclusive) position up to which we've copied stuff already into the first element. (I think this is ignored and can be -1 if (2) == 0, i.e. reference)
+	/* 
 
-	using openHaplotype = std::tuple<std::string, const startingHaplotype*, int>;
-	std::vector<openHaplotype> open_haplotypes;
+       We read in the data produced by the CRAM2VCF script.
 
-	// we init with an empty running haplotype that copies the reference
-	openHaplotype initH = std::make_tuple("", (const startingHaplotype*)0, -1);
-	open_haplotypes.push_back(initH);
+       These are basically pairwise sequence alignments between reference and input contigs in a simple text format.
 
-	int start_open_haplotypes = 0;
-	int opened_alignments = 0;
+       By definition, at any given reference position, we have to be able to reconstitute a valid multiple sequence alignment of the reference
+       and the contigs from the pairwise reference<->contig alignments. One crucial requirement for this is that we sometimes have to encode
+       'double-gap' columns in the pairwise alignments that specify gaps for both the sequence and the reference.
 
-    // STEP 3: Build the graph / VCF
-	//
-	// We do this in a stepwise fashion, reference position by reference position
-	//
-	// As we go along the reference, we keep track of possible haplotypes (we say that this is a list of 'running' or 'open' haplotypes)
-	// that consist of the input contigs (to be precise, their alignments) and potential recombination events between the input contigs.
-	//
-	// We recombine promiscuously: whenever a new alignment starts, it can recombine into all existing haplotypes,
-	// and whenever it ends, it can recombine back into other running haplotypes.
-	//
-	// Whenever the VCF format allows us to empty the list of possible haplotypes, we do so (i.e. when there's a position at which all haplotypes are REF); when this happens,
-    // we write all open haplotypes as variants into the VCF, and shorten the possible haplotypes to the last position.
-	// If any running haplotypes (and their associated data, see the openHaplotype structure) are identical at this point, we combine them.
-	// 	
-	// !! An important corollary is that, at any point in time, all open haplotypes start at the same reference position.
-	// !! This information is stored in the variable start_open_haplotypes
-	// !! I.e. everything up to start_open_haplotypes has been processed already / stored in the output VCF.
-	//
-	// The 'state space' of our graph builder increases as new alignments appear and disappear as we walk along the reference,
-    // and it becomes smaller each time we dump some variant positions into VCF. If one of the running alignments represents a
-    // long-running gap that hasn't been closed yet, this prevents us from the VCF output stage; therefore big gaps
-	// lead to decreased performance and alignments containing them are sometimes filtered (see above).
-	//
-	// While doing all of this, we need to do some data gymnastics to make sure that the MSA structure of the
-    // input alignments is maintained and respected.
-	//
+       Also the following algorithms become more complex when there are large deletions relative to the reference. Therefore we apply a filter for maximum
+       gap region length:
 
-	bool modifiedLastPos = false;
-	for(int posI = 0; posI < (int)referenceSequence.length(); posI++)
+           (max_running_gap_length <= max_gap_length)
+       
+       This parameter can be played around with!
+
+     */
+	   
+
+	// parse the alignment lines into startingHaplotype objects; with --pipeline 1 this runs in a reader thread,
+	// ahead of the splitting and deduplication below
+	auto parseAlignment = [](const std::string& line) -> startingHaplotype* {
+		std::vector<std::string> line_fields = split(line, "\t");
+		assert(line_fields.size() == 5);
+		startingHaplotype* h = new startingHaplotype();
+		h->ref = line_fields.at(0);
+		h->query = line_fields.at(1);
+		h->query_name = line_fields.at(2);
+		h->contig_name = h->query_name;
+		h->aligment_start_pos = StrtoUI(line_fields.at(3));
+		h->alignment_last_pos = StrtoUI(line_fields.at(4))+1;
+		return h;
+	};
+
+	boundedQueue<std::vector<startingHaplotype*>> parsedAlignments(pipeline_queue_capacity);
+	std::thread readerThread;
+	if(pipeline)
 	{
+		readerThread = std::thread([&]() {
+			std::string line;
+			std::vector<startingHaplotype*> batch;
+			while(inputStream.getline(line))
+			{
+				eraseNL(line);
+				if(line.length())
+				{
+					batch.push_back(parseAlignment(line));
+					if(batch.size() == pipeline_batch_size)
+					{
+						parsedAlignments.push(std::move(batch));
+						batch.clear();
+					}
+				}
+			}
+			if(batch.size())
+			{
+				parsedAlignments.push(std::move(batch));
+			}
+			parsedAlignments.close();
+		});
+	}
 
-		/*
-		if((posI >= 10014327) && (posI <= 10014332))
+	std::vector<startingHaplotype*> currentBatch;
+	size_t currentBatch_i = 0;
+	auto nextAlignment = [&](startingHaplotype*& h) -> bool {
+		if(pipeline)
 		{
-			std::cout << "Position " << posI << " open positions:\n";
-			for(unsigned int hI = 0; hI < open_haplotypes.size(); hI++)
+			while(currentBatch_i == currentBatch.size())
 			{
-				std::cout << "\tOpen haplotype " << hI << "\n";
-				std::cout << "\t\tSequence: " << std::get<0>(open_haplotypes.at(hI)) << "\n";
-				std::cout << "\t\tCopying from: " << ((std::get<1>(open_haplotypes.at(hI)) == 0) ? "REF" : std::get<1>(open_haplotypes.at(hI))->query_name) << "\n";
-				std::cout << "\t\tPosition: " << std::get<2>(open_haplotypes.at(hI)) << "\n";
-				std::cout << std::flush;
+				if(! parsedAlignments.pop(currentBatch))
+				{
+					return false;
+				}
+				currentBatch_i = 0;
 			}
-			if(posI == 10014332)
+			h = currentBatch.at(currentBatch_i++);
+			return true;
+		}
+		else
+		{
+			std::string line;
+			while(inputStream.getline(line))
 			{
-				assert(3 == 5);
+				eraseNL(line);
+				if(line.length())
+				{
+					h = parseAlignment(line);
+					return true;
+				}
 			}
+			return false;
 		}
-		*/
-		
-		// make sure that all open haplotypes really 'extend' up to reference position posI in MSA space
-		// therefore: consume (for each open haplotype) all gaps "before" the current reference position
-		
-		size_t haplotype_length = 0;
-		for(const openHaplotype& haplotype : open_haplotypes)
+	};
+
+	startingHaplotype* h;
+	while(nextAlignment(h))
+	{
+		// determine alleles expected to be found
 		{
-			haplotype_length = std::get<0>(haplotype).length();
-			break;
-		}			
+			long long runningRefC_0based = (h->aligment_start_pos - 1);
+			std::string runningRefAllele;
+			std::string runningQueryAllele;
 			
-		long long duplicated = -1;
-
-		if(modifiedLastPos)
-		{
-			duplicated = 0;
-			std::set<std::string> open_haplotypes_keys;
-			for(const openHaplotype& haplotype : open_haplotypes)
-			{
-				std::stringstream haplotype_key_str;
-				haplotype_key_str << 	std::get<0>(haplotype) << ";" <<
-									std::get<1>(haplotype) << ";" <<
-									std::get<2>(haplotype);
-				std::string haplotype_key = haplotype_key_str.str();
-				if(open_haplotypes_keys.count(haplotype_key) != 0)
-				{
-					duplicated++;
-				}
-				open_haplotypes_keys.insert(haplotype_key);
-			}			
-			
-			if(duplicated)
+			for(unsigned int i = 0; i < h->ref.length(); i++)
 			{
-				std::vector<openHaplotype> new_open_haplotypes;
-				open_haplotypes_keys.clear();
-				for(const openHaplotype& haplotype : open_haplotypes)
+				unsigned char c_ref = h->ref.at(i);
+				unsigned char c_query = h->query.at(i);
+
+				if((c_ref != '-') && (c_ref != '*'))
 				{
-					std::stringstream haplotype_key_str;
-					haplotype_key_str << 	std::get<0>(haplotype) << ";" <<
-										std::get<1>(haplotype) << ";" <<
-										std::get<2>(haplotype);
-					std::string haplotype_key = haplotype_key_str.str();
-					if(open_haplotypes_keys.count(haplotype_key) == 0)
+					// empty alleles
+					if((runningRefAllele.length() == 1) && (runningQueryAllele.length() == 1) && (runningRefAllele != runningQueryAllele))
 					{
-						new_open_haplotypes.push_back(haplotype);
+						if((runningRefAllele != "-") && (runningRefAllele != "*") && (runningQueryAllele != "-") && (runningQueryAllele != "*"))
+						{
+							expectedAlleles[arguments.at("referenceSequenceID")][runningRefC_0based].insert(runningQueryAllele);
+						}
 					}
-					open_haplotypes_keys.insert(haplotype_key);
-				}	
-				open_haplotypes = new_open_haplotypes;
-				std::cout << "\tRemoved " << duplicated << " haplotypes.\n" << std::flush;
-			}
-			
-			modifiedLastPos = false;
+					runningRefAllele = "";
+					runningQueryAllele = "";
+				}
+				
+				if((c_ref != '-') && (c_ref != '*'))
+				{
+					runningRefC_0based++;
+				}
+				
+				runningRefAllele.push_back(c_ref);
+				runningQueryAllele.push_back(c_query);
+			}	
 		}
 		
-		if(((posI % 1000) == 0) or (0 && open_haplotypes.size() > 100))
+		if(sweepParameters.size())
 		{
-			std::cout << posI << ", open haplotypes: " << open_haplotypes.size() << " -- duplicated: " << duplicated << " -- length: " << haplotype_length << "\n";
+			normalizeAlignmentStart(h);
+			h->query_names.push_back(h->query_name);
+			h->contig_names.push_back(h->contig_name);
+			rawAlignments.push_back(h);
 		}
-		
-		for(openHaplotype& haplotype : open_haplotypes)
+		else
 		{
-			if(std::get<1>(haplotype) != 0)
-			{
-				if(std::get<2>(haplotype) == ((int)std::get<1>(haplotype)->ref.length() - 1)) // if we're at the end of the alignment already, we may need to copy in gaps, as final gaps wouldn't be part of the alignment
-				{
-					int n_gaps = gap_structure.at(posI-1);
-					if(n_gaps == -1)
-						n_gaps = 0;
+			loadAlignment<engineChecks>(h, false, defaultParameters, deduplicateAlignments, symbolicDeletionLength, loaded);
+		}
+		progress.n_alignments_loaded.fetch_add(1, std::memory_order_relaxed);
+	}
+	if(pipeline)
+	{
+		readerThread.join();
+	}
+	if(sweepParameters.size() == 0)
+	{
+		loaded.printStatistics(std::cout, defaultParameters, deduplicateAlignments, symbolicDeletionLength);
+	}
 
-					std::string gaps;
-					gaps.resize(n_gaps, '-');
-					assert((int)gaps.length() == n_gaps);
-					std::get<0>(haplotype) += gaps;
-				}
-				else
-				{
-					if(((std::get<1>(haplotype)->ref.at(std::get<2>(haplotype))) == '-') || (std::get<1>(haplotype)->ref.at(std::get<2>(haplotype)) == '*'))
-					{
-						// not sure what this is to tell us
-						std::cerr << "Position " << std::get<2>(haplotype) << " is gap in one of our haplotypes!";
-					}
+	if(estimateComplexityOnly)
+	{
+		estimateComplexity(arguments.at("referenceSequenceID"), referenceSequence, loaded.alignments_starting_at, arguments.at("input") + ".complexity.bed");
+		return 0;
+	}
 
-					
-					int nextPos = std::get<2>(haplotype)+1;
-					std::string additionalExtension;
-					while((nextPos < (int)std::get<1>(haplotype)->ref.length()) && ((std::get<1>(haplotype)->ref.at(nextPos) == '-') || (std::get<1>(haplotype)->ref.at(nextPos) == '*')))
-					{
-						additionalExtension += std::get<1>(haplotype)->query.substr(nextPos, 1);
-						nextPos++;
-					}
-					int consumedUntil = nextPos - 1;
+	std::string fn_files_SNPs = arguments.at("input")+".VCF.expectedSNPs";
+	std::ofstream SNPsstream;
+	SNPsstream.open(fn_files_SNPs.c_str());
+	assert(SNPsstream.is_open());
 
-					std::get<0>(haplotype).append(additionalExtension);
-					std::get<2>(haplotype) = consumedUntil;
-				}
-			}
-			else // even if we're copying from the reference, we might have to put in some gaps if this is required by the MSA
+	// expectedAlleles is complete after loading and not used by produceVCF
+	auto writeExpectedSNPs = [&]() -> void {
+		for(auto SNPsPerRefID : expectedAlleles)
+		{
+			for(auto refPos : SNPsPerRefID.second)
 			{
-				if(posI > 0)
+				for(auto allele : refPos.second)
 				{
-
-					int n_gaps = gap_structure.at(posI-1);
-					if(n_gaps == -1)
-						n_gaps = 0;
-
-					std::string gaps;
-					gaps.resize(n_gaps, '-');
-					assert((int)gaps.length() == n_gaps);
-					std::get<0>(haplotype) += gaps;
+					SNPsstream << SNPsPerRefID.first << "\t" << (refPos.first+1) << "\t" << allele << "\n";
 				}
 			}
 		}
+	};
+	std::thread SNPsThread;
+	if(pipeline)
+	{
+		SNPsThread = std::thread(writeExpectedSNPs);
+	}
 
-		// check that all open haplotypes - i.e. up to the current reference position - have the same length
-		// this is required because we're dealing with an MSA-like structure here, and we want all open
-		// haplotypes to have reached the same 'column' in the MSA
-		int assembled_h_length = -1;
-		for(openHaplotype haplotype : open_haplotypes)
+	if(sweepParameters.size())
+	{
+		try
 		{
-			if(assembled_h_length == -1)
-			{
-				assembled_h_length = std::get<0>(haplotype).length();
-			}
-
-			if(assembled_h_length != (int)std::get<0>(haplotype).length())
-			{
-				std::cerr << "Initial II length mismatch " << posI << " " << assembled_h_length << "\n"; // [@gap_structure[(posI-3) .. (posI+1)]]
-				for(openHaplotype oH2 : open_haplotypes)
-				{
-					std::cerr << "\t" << std::get<0>(oH2).length() << "\tconsumed until: " << std::get<2>(oH2) << ", of length " << ((std::get<1>(oH2) == 0) ? "REF" : ("nonRef " + std::get<1>(oH2)->query_name + " / length " + ItoStr(std::get<1>(oH2)->ref.length()))) << "\n";
-				}
-				printHaplotypesAroundPosition(referenceSequence, alignments_starting_at, posI);
-				assert(2 == 4);
-			}
+			runParameterSweep(sweepParameters, rawAlignments, arguments.at("referenceSequenceID"), referenceSequence, outputFn, regionBudgetsFn, eventDriven, deduplicateAlignments, symbolicDeletionLength, pipeline);
 		}
-
-		// it might be that we have additional alignments starting at posI
-		// if so, we make a list of these to be integrated into the openHaplotypes set	
-		// when we integrate a new alignment, we assume that the new alignment can 'recombine'
-		// into each of the open haplotypes.
-		unsigned char refC = referenceSequence.at(posI);
-		std::vector<const startingHaplotype*> new_haplotypes;
-		if(alignments_starting_at.count(posI))
+		catch(std::exception& e)
 		{
-			for(startingHaplotype* sH :  alignments_starting_at.at(posI))
+			if(pipeline)
 			{
-				assert(known_haplotype_pointers.count(sH));
-				new_haplotypes.push_back(sH);
+				SNPsThread.join();
 			}
+			std::cerr << "Parameter sweep failed: " << e.what() << "\n" << std::flush;
+			return 1;
 		}
+	}
+	else
+	{
+		progress.phase.store(progressStatus::sweep, std::memory_order_relaxed);
+		produceVCF<engineChecks>(arguments.at("referenceSequenceID"), referenceSequence, loaded.alignments_starting_at, outputFn, regionBudgetsFn, eventDriven, loaded.symbolicDeletions, pipeline, defaultParameters, std::cout, &progress);
+	}
 
-		// the following block represents the 'recombining into' step ...
-		unsigned int open_haplotypes_size = open_haplotypes.size();
-		for(const startingHaplotype* new_haplotype : new_haplotypes)
-		{
-			if(open_haplotypes.size() <= max_running_haplotypes_before_add)
-			{			
-				if(open_haplotypes_size > 0) // not quite sure why this should ever be < 1, but might be condition reached towards the end of a chromosome
-				{
-					opened_alignments++;
+	if(pipeline)
+	{
+		SNPsThread.join();
+	}
+	else
+	{
+		writeExpectedSNPs();
+	}
 
-					for(int existingHaploI = 0; existingHaploI < (int)open_haplotypes_size; existingHaploI++)
-					{
-						// ... we take the sequence of an existing open haplotype, but stipulate that from now onwards we copy from the new alignment (new_haplotype)
-						openHaplotype new_haplotype_copy_this = std::make_tuple(std::get<0>(open_haplotypes.at(existingHaploI)), new_haplotype, -1);
-						open_haplotypes.push_back(new_haplotype_copy_this);
-						modifiedLastPos = true;
-					}
+	if(sweepParameters.size())
+	{
+		return 0;
+	}
 
-					// in addition to recombining into an existing variant haplotype, we can also
-					// recombine into the reference - which we need to copy from position start_open_haplotypes onwards.
-					int open_span = posI - start_open_haplotypes;
-					int start_reference_extraction = start_open_haplotypes;
-					int stop_reference_extraction = posI - 1;
-					if(!(stop_reference_extraction >= start_reference_extraction))
-					{
-						std::cerr << "stop_reference_extraction" << ": " << stop_reference_extraction << "\n";
-						std::cerr << "start_reference_extraction" << ": " << start_reference_extraction << "\n";
-						std::cerr << std::flush;
-					}
-					assert(stop_reference_extraction >= start_reference_extraction); // die Dumper("Weird", start_reference_extraction, stop_reference_extraction) unless(stop_reference_extraction >= start_reference_extraction);
-					std::string referenceExtraction;
-					referenceExtraction.reserve(stop_reference_extraction - start_reference_extraction + 1);
-					for(int refI = start_reference_extraction; refI <= stop_reference_extraction; refI++)
-					{
-						referenceExtraction.push_back(referenceSequence.at(refI));
+	doneStream.open(doneFn.c_str());
+	if(! doneStream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + doneFn + " for writing!");
+	}
+	doneStream << 1 << "\n";
+	doneStream.close();	
 
-						int n_gaps = gap_structure.at(refI);
-						if(n_gaps == -1)
-							n_gaps = 0;
-						std::string gaps;
-						gaps.resize(n_gaps, '-');
-						assert((int)gaps.length() == n_gaps);
-						referenceExtraction.append(gaps);
-					}
+	progress.phase.store(progressStatus::done, std::memory_order_relaxed);
+	if(reporter)
+	{
+		reporter->stop();
+	}
 
-					//new_haplotype_referenceSequence = [substr(referenceSequence, start_open_haplotypes, open_span), new_haplotype, -1];
-					openHaplotype new_haplotype_referenceSequence = std::make_tuple(referenceExtraction, new_haplotype, -1);
+	// peak memory and runtime, used by launch_CRAM2VCF_C++.pl to predict the requirements of later runs
+	struct rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) == 0)
+	{
+		std::string resourcesFn = outputFn + ".resources";
+		std::ofstream resourcesStream;
+		resourcesStream.open(resourcesFn.c_str());
+		if(! resourcesStream.is_open())
+		{
+			throw std::runtime_error("Cannot open " + resourcesFn + " for writing!");
+		}
+		resourcesStream << "peak_rss_kB" << "\t" << usage.ru_maxrss << "\n";
+		resourcesStream << "seconds" << "\t" << (time(NULL) - startTime) << "\n";
+		resourcesStream << "n_alignments" << "\t" << loaded.n_alignments_loaded << "\n";
+		resourcesStream.close();
+	}
 
-					//missing = assembled_h_length - open_span;
-					//die Dumper(posI, start_open_haplotypes, missing, open_span, assembled_h_length) unless(missing >= 0);
-					//missingStr = '*' x missing;
-					//die unless(length(missingStr) == missing);
-					//new_haplotype_referenceSequence->[0] .= missingStr;
+	return 0;
+}
 
-					open_haplotypes.push_back(new_haplotype_referenceSequence);
+template<typename checkPolicy>
+sweepStatistics produceVCF(const std::string referenceSequenceID, const ReferenceSequence& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, std::string outputFn, std::string regionBudgetsFn, bool eventDriven, const std::map<std::pair<long long, long long>, int>& symbolicDeletions, bool pipeline, const engineParameters& parameters, std::ostream& logStream, progressStatus* progress)
+{
+	sweepStatistics statistics;
 
-					std::cout << "Position " << posI << ", enter new haplotype " << new_haplotype->query_name << " --> " << open_haplotypes.size() << " haplotypes.\n" << std::flush;
+	std::ofstream outputFileStream;
+	outputFileStream.open(outputFn.c_str());
+	if(! outputFileStream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + outputFn + " for writing!");
+	}
 
-				}
-			}
-			else
+	// VCF records are formatted into outputStream; full buffers are written to the file by a writer thread (--pipeline 1),
+	// so that the sweep does not wait for the file system
+	std::ostringstream outputStream;
+	boundedQueue<std::string> outputBuffers(pipeline_queue_capacity);
+	std::thread writerThread;
+	if(pipeline)
+	{
+		writerThread = std::thread([&]() {
+			std::string buffer;
+			while(outputBuffers.pop(buffer))
 			{
-				std::cout  << "Position " << posI << ", would have new haplotype " << new_haplotype->query_name << ", but have " << open_haplotypes_size << " open pairs already, so skip.\n" << std::flush;
-			}				
-		}
-		
-
-		// some debug information
-		if(posI == 7652900)
+				outputFileStream << buffer;
+			}
+		});
+	}
+	auto passOutput = [&](bool force) -> void {
+		if(force || (outputStream.tellp() >= (std::streampos)pipeline_output_buffer_size))
 		{
-			std::cerr << "Pre-exit haplotype lengths " << posI << "\n"; // [@gap_structure[(posI-3) .. (posI+1)]]
-			for(openHaplotype oH2 : open_haplotypes)
+			if(pipeline)
 			{
-				std::cerr << "\t" << std::get<0>(oH2).length() << "\tconsumed until: " << std::get<2>(oH2) << ", of length " << ((std::get<1>(oH2) == 0) ? "REF" : ("nonRef " + std::get<1>(oH2)->query_name + " / length " + ItoStr(std::get<1>(oH2)->ref.length()))) << "\n";
+				outputBuffers.push(outputStream.str());
 			}
+			else
+			{
+				outputFileStream << outputStream.str();
+			}
+			outputStream.str("");
 		}
+	};
 
-		// whenever we've exhausted an input alignment, we recombine back into all other running haplotypes
-		// that is, we switch the template alignment for these running haplotypes to ref / another, non-exhausted running haplotype (all options)
-		// 
-		// NB: This step doesn't remove any elements from open_haplotypes - on the contrary, it can add elements (by recombination into other open haplotypes)
-		//
+	int n_alignments = 0;
+	for(auto startPos : alignments_starting_at)
+	{
+			n_alignments += startPos.second.size();
+	}
 
-		std::set<std::string> inner_open_haplotypes_keys;
+	// optional per-region values for max_running_haplotypes_before_add (see estimateComplexity)
+	std::vector<std::tuple<unsigned int, unsigned int, int>> region_budgets;
+	if(regionBudgetsFn.length())
+	{
+		region_budgets = readRegionBudgets(referenceSequenceID, regionBudgetsFn);
+		logStream << "Read " << region_budgets.size() << " region budgets from " << regionBudgetsFn << "\n" << std::flush;
+	}
+	size_t region_budgets_i = 0;
 
-		open_haplotypes_size = open_haplotypes.size();
-		std::set<unsigned int> exitedHaplotype;
-		for(unsigned int outer_haplotype_I = 0; outer_haplotype_I < open_haplotypes_size; outer_haplotype_I++)
-		{
-			openHaplotype& haplotype = open_haplotypes.at(outer_haplotype_I);
+    // STEP 1: Gap structure
+	// first step: count how many gaps we have in the underlying MSA-like structure at each reference position
+	// gap_structure.at(i) counts the number of gaps that occur between reference position i - 1 and i (0-based).
+	// this needs to be consistent for all input alignments
+    // coverage_structure.at(i) is calculated for output/debug purposes.
 
-			if(std::get<1>(haplotype) != 0) // i.e. non-ref
-			{
-				if(std::get<2>(haplotype) == ((int)std::get<1>(haplotype)->ref.length() - 1)) // i.e. we're done with this input alignment
-				{
-					if(inner_open_haplotypes_keys.size() == 0)
-					{
-						for(const openHaplotype& haplotype : open_haplotypes)
-						{
-							std::stringstream haplotype_key_str;
-							haplotype_key_str << 	std::get<0>(haplotype) << ";" <<
+	std::vector<int> gap_structure;
+	std::vector<int> coverage_structure;
+	computeGapStructure<checkPolicy>(referenceSequence, alignments_starting_at, gap_structure, coverage_structure);
+	int examine_gaps_n_alignment = n_alignments;
+
+    // STEP 2: Output some stuff
+	// printHaplotypesAroundPosition(referenceSequence, alignments_starting_at, 10014331);
+	// assert( 3==5 );
+
+	logStream << "Loaded " << examine_gaps_n_alignment << " alignments.\n";
+	
+	logStream << "Coverage structure:\n";
+	int coverage_window_length = 10000;
+	for(unsigned int pI = 0; pI < coverage_structure.size(); pI += coverage_window_length)
+	{
+		int coverage_in_window = 0;
+		unsigned int last_window_pos = (pI+coverage_window_length) - 1;
+		if(last_window_pos > (coverage_structure.size() - 1))
+			last_window_pos = coverage_structure.size() - 1;
+
+		for(unsigned int j = pI; j <= last_window_pos; j++)
+		{
+			assert(j < coverage_structure.size());
+			coverage_in_window += coverage_structure.at(j);
+		}
+		double avg_coverage = (double) coverage_in_window / (double)(last_window_pos - pI + 1);
+
+		if((pI >= 15000000) && (pI <= 17000000))
+			logStream << "\t" << "Window starting at pI = " << pI << " => avg. coverage " << avg_coverage << "\n";
+	}
+	logStream << std::flush;
+
+	std::set<const startingHaplotype*> known_haplotype_pointers;
+	if(checkPolicy::full)
+	{
+		for(auto startingPos : alignments_starting_at)
+		{
+			for(startingHaplotype* sH :  startingPos.second)
+			{
+				known_haplotype_pointers.insert(sH);
+			}
+		}
+	}
+
+	// openHaplotype data structure:
+	// (1) running haplotype sequence (string)
+    // (2) pointer to input alignment we're copying from - 0 means reference
+    // (3) position within the input alignment - the (inclusive) position up to which we've copied stuff already into the first element. (I think this is ignored and can be -1 if (2) == 0, i.e. reference)
+
+	using openHaplotype = std::tuple<std::string, const startingHaplotype*, int>;
+	std::vector<openHaplotype> open_haplotypes;
+
+	// we init with an empty running haplotype that copies the reference
+	openHaplotype initH = std::make_tuple("", (const startingHaplotype*)0, -1);
+	open_haplotypes.push_back(initH);
+
+	int start_open_haplotypes = 0;
+	int opened_alignments = 0;
+
+	// for the event-driven sweep: positions i with gaps between reference positions i - 1 and i
+	std::vector<int> gap_positions;
+	if(eventDriven)
+	{
+		for(int posI = 1; posI < (int)gap_structure.size(); posI++)
+		{
+			if(gap_structure.at(posI-1) > 0)
+			{
+				gap_positions.push_back(posI);
+			}
+		}
+	}
+	long long skipped_positions = 0;
+
+	sweepProfiler profiler(referenceSequenceID, profile_haplotypes_threshold, profile_bytes_threshold);
+	bool profiling = profiler.enabled();
+
+	pathAnnotator paths(referenceSequenceID);
+	if(annotate_paths)
+	{
+		paths.open(outputFn + ".paths");
+	}
+
+	// symbolic deletions are written when the sweep has passed their anchor (first VCF position), keeping the output sorted
+	std::map<std::pair<long long, long long>, int>::const_iterator nextSymbolicDeletion = symbolicDeletions.begin();
+	auto writeSymbolicDeletions = [&](long long upToAnchor) -> void {
+		while((nextSymbolicDeletion != symbolicDeletions.end()) && (nextSymbolicDeletion->first.first <= upToAnchor))
+		{
+			long long anchor = nextSymbolicDeletion->first.first;
+			long long lastDeleted = nextSymbolicDeletion->first.second;
+			outputStream <<
+					referenceSequenceID << "\t" <<
+					anchor+1 << "\t" <<
+					"." << "\t" <<
+					referenceSequence.at(anchor) << "\t" <<
+					"<DEL>" << "\t" <<
+					'.' << "\t" <<
+					"PASS" << "\t" <<
+					"SVTYPE=DEL;END=" << lastDeleted+1 << ";SVLEN=-" << (lastDeleted - anchor) << ";NALIGNMENTS=" << nextSymbolicDeletion->second
+			<< "\n";
+			nextSymbolicDeletion++;
+			statistics.n_symbolic_records++;
+		}
+	};
+
+    // STEP 3: Build the graph / VCF
+	//
+	// We do this in a stepwise fashion, reference position by reference position
+	//
+	// As we go along the reference, we keep track of possible haplotypes (we say that this is a list of 'running' or 'open' haplotypes)
+	// that consist of the input contigs (to be precise, their alignments) and potential recombination events between the input contigs.
+	//
+	// We recombine promiscuously: whenever a new alignment starts, it can recombine into all existing haplotypes,
+	// and whenever it ends, it can recombine back into other running haplotypes.
+	//
+	// Whenever the VCF format allows us to empty the list of possible haplotypes, we do so (i.e. when there's a position at which all haplotypes are REF); when this happens,
+    // we write all open haplotypes as variants into the VCF, and shorten the possible haplotypes to the last position.
+	// If any running haplotypes (and their associated data, see the openHaplotype structure) are identical at this point, we combine them.
+	// 	
+	// !! An important corollary is that, at any point in time, all open haplotypes start at the same reference position.
+	// !! This information is stored in the variable start_open_haplotypes
+	// !! I.e. everything up to start_open_haplotypes has been processed already / stored in the output VCF.
+	//
+	// The 'state space' of our graph builder increases as new alignments appear and disappear as we walk along the reference,
+    // and it becomes smaller each time we dump some variant positions into VCF. If one of the running alignments represents a
+    // long-running gap that hasn't been closed yet, this prevents us from the VCF output stage; therefore big gaps
+	// lead to decreased performance and alignments containing them are sometimes filtered (see above).
+	//
+	// While doing all of this, we need to do some data gymnastics to make sure that the MSA structure of the
+    // input alignments is maintained and respected.
+	//
+
+	bool modifiedLastPos = false;
+	for(int posI = 0; posI < (int)referenceSequence.length(); posI++)
+	{
+		if(progress)
+		{
+			progress->position.store(posI, std::memory_order_relaxed);
+			progress->open_haplotypes.store(open_haplotypes.size(), std::memory_order_relaxed);
+			progress->n_records.store(statistics.n_records + statistics.n_symbolic_records, std::memory_order_relaxed);
+		}
+
+		// Event-driven mode: directly after a close at posI - 1 without pending recombinations, all open haplotypes
+		// are the single character referenceSequence[posI - 1] and unique. Until the next 'event' - an alignment start,
+		// MSA gap columns, the end of a template or a template column that is not a match to the reference - each
+		// position would extend all haplotypes with the reference character and close again without VCF output, so we
+		// jump to the event and advance the template offsets in bulk.
+		if(eventDriven && (posI > 0) && (! modifiedLastPos) && (start_open_haplotypes == (posI - 1)))
+		{
+			int nextEvent = referenceSequence.length();
+
+			auto nextStart = alignments_starting_at.lower_bound(posI);
+			if(nextStart != alignments_starting_at.end())
+			{
+				nextEvent = std::min(nextEvent, (int)nextStart->first);
+			}
+
+			std::vector<int>::const_iterator nextGap = std::lower_bound(gap_positions.begin(), gap_positions.end(), posI);
+			if(nextGap != gap_positions.end())
+			{
+				nextEvent = std::min(nextEvent, *nextGap);
+			}
+
+			for(const openHaplotype& haplotype : open_haplotypes)
+			{
+				assert(std::get<0>(haplotype).length() == 1);
+				const startingHaplotype* template_alignment = std::get<1>(haplotype);
+				if(template_alignment == 0)
+				{
+					continue;
+				}
+
+				// column std::get<2>(haplotype) + 1 + k is consumed at reference position posI + k
+				int columnI = std::get<2>(haplotype) + 1;
+				int refPos = posI;
+				while((refPos < nextEvent) && (columnI < (int)template_alignment->ref.length()))
+				{
+					char c_ref = template_alignment->ref.at(columnI);
+					if((c_ref == '-') || (c_ref == '*') || (template_alignment->query.at(columnI) != referenceSequence.at(refPos)))
+					{
+						break;
+					}
+					columnI++;
+					refPos++;
+				}
+				nextEvent = std::min(nextEvent, refPos);
+				if(nextEvent == posI)
+				{
+					break;
+				}
+			}
+
+			if(nextEvent > posI)
+			{
+				int advance = nextEvent - posI;
+				std::string lastCharacter = {(char)referenceSequence.at(nextEvent - 1)};
+				for(openHaplotype& haplotype : open_haplotypes)
+				{
+					std::get<0>(haplotype) = lastCharacter;
+					if(std::get<1>(haplotype) != 0)
+					{
+						std::get<2>(haplotype) += advance;
+					}
+				}
+				start_open_haplotypes = nextEvent - 1;
+				skipped_positions += advance;
+				if(profiling)
+				{
+					profiler.begin(start_open_haplotypes);
+				}
+				if(annotate_paths)
+				{
+					paths.advance(open_haplotypes);
+				}
+				if((posI / 1000) != (nextEvent / 1000))
+				{
+					logStream << nextEvent << ", open haplotypes: " << open_haplotypes.size() << " -- skipped " << advance << " positions without events\n";
+				}
+
+				posI = nextEvent - 1;
+				continue;
+			}
+		}
+
+		int running_haplotypes_limit = parameters.max_running_haplotypes_before_add;
+		if(region_budgets.size())
+		{
+			while((region_budgets_i < region_budgets.size()) && ((int)std::get<1>(region_budgets.at(region_budgets_i)) <= posI))
+			{
+				region_budgets_i++;
+			}
+			if((region_budgets_i < region_budgets.size()) && ((int)std::get<0>(region_budgets.at(region_budgets_i)) <= posI))
+			{
+				running_haplotypes_limit = std::get<2>(region_budgets.at(region_budgets_i));
+			}
+		}
+
+		/*
+		if((posI >= 10014327) && (posI <= 10014332))
+		{
+			logStream << "Position " << posI << " open positions:\n";
+			for(unsigned int hI = 0; hI < open_haplotypes.size(); hI++)
+			{
+				logStream << "\tOpen haplotype " << hI << "\n";
+				logStream << "\t\tSequence: " << std::get<0>(open_haplotypes.at(hI)) << "\n";
+				logStream << "\t\tCopying from: " << ((std::get<1>(open_haplotypes.at(hI)) == 0) ? "REF" : std::get<1>(open_haplotypes.at(hI))->query_name) << "\n";
+				logStream << "\t\tPosition: " << std::get<2>(open_haplotypes.at(hI)) << "\n";
+				logStream << std::flush;
+			}
+			if(posI == 10014332)
+			{
+				assert(3 == 5);
+			}
+		}
+		*/
+		
+		// make sure that all open haplotypes really 'extend' up to reference position posI in MSA space
+		// therefore: consume (for each open haplotype) all gaps "before" the current reference position
+		
+		size_t haplotype_length = 0;
+		for(const openHaplotype& haplotype : open_haplotypes)
+		{
+			haplotype_length = std::get<0>(haplotype).length();
+			break;
+		}			
+			
+		long long duplicated = -1;
+
+		if(modifiedLastPos)
+		{
+			duplicated = 0;
+			std::set<std::string> open_haplotypes_keys;
+			for(const openHaplotype& haplotype : open_haplotypes)
+			{
+				std::stringstream haplotype_key_str;
+				haplotype_key_str << 	std::get<0>(haplotype) << ";" <<
+									std::get<1>(haplotype) << ";" <<
+									std::get<2>(haplotype);
+				std::string haplotype_key = haplotype_key_str.str();
+				if(open_haplotypes_keys.count(haplotype_key) != 0)
+				{
+					duplicated++;
+				}
+				open_haplotypes_keys.insert(haplotype_key);
+			}			
+			
+			if(duplicated)
+			{
+				std::vector<openHaplotype> new_open_haplotypes;
+				open_haplotypes_keys.clear();
+				for(const openHaplotype& haplotype : open_haplotypes)
+				{
+					std::stringstream haplotype_key_str;
+					haplotype_key_str << 	std::get<0>(haplotype) << ";" <<
+										std::get<1>(haplotype) << ";" <<
+										std::get<2>(haplotype);
+					std::string haplotype_key = haplotype_key_str.str();
+					if(open_haplotypes_keys.count(haplotype_key) == 0)
+					{
+						new_open_haplotypes.push_back(haplotype);
+					}
+					open_haplotypes_keys.insert(haplotype_key);
+				}	
+				open_haplotypes = new_open_haplotypes;
+				logStream << "\tRemoved " << duplicated << " haplotypes.\n" << std::flush;
+			}
+			
+			modifiedLastPos = false;
+		}
+		
+		if(open_haplotypes.size() > statistics.max_open_haplotypes)
+		{
+			statistics.max_open_haplotypes = open_haplotypes.size();
+		}
+
+		if(((posI % 1000) == 0) or (0 && open_haplotypes.size() > 100))
+		{
+			logStream << posI << ", open haplotypes: " << open_haplotypes.size() << " -- duplicated: " << duplicated << " -- length: " << haplotype_length << "\n";
+		}
+		
+		for(openHaplotype& haplotype : open_haplotypes)
+		{
+			if(std::get<1>(haplotype) != 0)
+			{
+				if(std::get<2>(haplotype) == ((int)std::get<1>(haplotype)->ref.length() - 1)) // if we're at the end of the alignment already, we may need to copy in gaps, as final gaps wouldn't be part of the alignment
+				{
+					int n_gaps = gap_structure.at(posI-1);
+					if(n_gaps == -1)
+						n_gaps = 0;
+
+					std::string gaps;
+					gaps.resize(n_gaps, '-');
+					assert((int)gaps.length() == n_gaps);
+					std::get<0>(haplotype) += gaps;
+				}
+				else
+				{
+					if(((std::get<1>(haplotype)->ref.at(std::get<2>(haplotype))) == '-') || (std::get<1>(haplotype)->ref.at(std::get<2>(haplotype)) == '*'))
+					{
+						// not sure what this is to tell us
+						std::cerr << "Position " << std::get<2>(haplotype) << " is gap in one of our haplotypes!";
+					}
+
+					
+					int nextPos = std::get<2>(haplotype)+1;
+					std::string additionalExtension;
+					while((nextPos < (int)std::get<1>(haplotype)->ref.length()) && ((std::get<1>(haplotype)->ref.at(nextPos) == '-') || (std::get<1>(haplotype)->ref.at(nextPos) == '*')))
+					{
+						additionalExtension += std::get<1>(haplotype)->query.substr(nextPos, 1);
+						nextPos++;
+					}
+					int consumedUntil = nextPos - 1;
+
+					std::get<0>(haplotype).append(additionalExtension);
+					std::get<2>(haplotype) = consumedUntil;
+				}
+			}
+			else // even if we're copying from the reference, we might have to put in some gaps if this is required by the MSA
+			{
+				if(posI > 0)
+				{
+
+					int n_gaps = gap_structure.at(posI-1);
+					if(n_gaps == -1)
+						n_gaps = 0;
+
+					std::string gaps;
+					gaps.resize(n_gaps, '-');
+					assert((int)gaps.length() == n_gaps);
+					std::get<0>(haplotype) += gaps;
+				}
+			}
+		}
+
+		// check that all open haplotypes - i.e. up to the current reference position - have the same length
+		// this is required because we're dealing with an MSA-like structure here, and we want all open
+		// haplotypes to have reached the same 'column' in the MSA
+		if(checkPolicy::full)
+		{
+			int assembled_h_length = -1;
+			for(openHaplotype haplotype : open_haplotypes)
+			{
+				if(assembled_h_length == -1)
+				{
+					assembled_h_length = std::get<0>(haplotype).length();
+				}
+
+				if(assembled_h_length != (int)std::get<0>(haplotype).length())
+				{
+					std::cerr << "Initial II length mismatch " << posI << " " << assembled_h_length << "\n"; // [@gap_structure[(posI-3) .. (posI+1)]]
+					for(openHaplotype oH2 : open_haplotypes)
+					{
+						std::cerr << "\t" << std::get<0>(oH2).length() << "\tconsumed until: " << std::get<2>(oH2) << ", of length " << ((std::get<1>(oH2) == 0) ? "REF" : ("nonRef " + std::get<1>(oH2)->query_name + " / length " + ItoStr(std::get<1>(oH2)->ref.length()))) << "\n";
+					}
+					printHaplotypesAroundPosition(referenceSequence, alignments_starting_at, posI);
+					assert(2 == 4);
+				}
+			}
+		}
+
+		// it might be that we have additional alignments starting at posI
+		// if so, we make a list of these to be integrated into the openHaplotypes set	
+		// when we integrate a new alignment, we assume that the new alignment can 'recombine'
+		// into each of the open haplotypes.
+		unsigned char refC = referenceSequence.at(posI);
+		std::vector<const startingHaplotype*> new_haplotypes;
+		if(alignments_starting_at.count(posI))
+		{
+			for(startingHaplotype* sH :  alignments_starting_at.at(posI))
+			{
+				assert((! checkPolicy::full) || known_haplotype_pointers.count(sH));
+				new_haplotypes.push_back(sH);
+			}
+		}
+
+		// the following block represents the 'recombining into' step ...
+		unsigned int open_haplotypes_size = open_haplotypes.size();
+		for(const startingHaplotype* new_haplotype : new_haplotypes)
+		{
+			if(open_haplotypes.size() <= running_haplotypes_limit)
+			{			
+				if(open_haplotypes_size > 0) // not quite sure why this should ever be < 1, but might be condition reached towards the end of a chromosome
+				{
+					opened_alignments++;
+					if(profiling)
+					{
+						profiler.enter(new_haplotype);
+					}
+
+					for(int existingHaploI = 0; existingHaploI < (int)open_haplotypes_size; existingHaploI++)
+					{
+						// ... we take the sequence of an existing open haplotype, but stipulate that from now onwards we copy from the new alignment (new_haplotype)
+						openHaplotype new_haplotype_copy_this = std::make_tuple(std::get<0>(open_haplotypes.at(existingHaploI)), new_haplotype, -1);
+						open_haplotypes.push_back(new_haplotype_copy_this);
+						modifiedLastPos = true;
+					}
+
+					// in addition to recombining into an existing variant haplotype, we can also
+					// recombine into the reference - which we need to copy from position start_open_haplotypes onwards.
+					int open_span = posI - start_open_haplotypes;
+					int start_reference_extraction = start_open_haplotypes;
+					int stop_reference_extraction = posI - 1;
+					if(!(stop_reference_extraction >= start_reference_extraction))
+					{
+						std::cerr << "stop_reference_extraction" << ": " << stop_reference_extraction << "\n";
+						std::cerr << "start_reference_extraction" << ": " << start_reference_extraction << "\n";
+						std::cerr << std::flush;
+					}
+					assert(stop_reference_extraction >= start_reference_extraction); // die Dumper("Weird", start_reference_extraction, stop_reference_extraction) unless(stop_reference_extraction >= start_reference_extraction);
+					std::string referenceExtraction;
+					referenceExtraction.reserve(stop_reference_extraction - start_reference_extraction + 1);
+					for(int refI = start_reference_extraction; refI <= stop_reference_extraction; refI++)
+					{
+						referenceExtraction.push_back(referenceSequence.at(refI));
+
+						int n_gaps = gap_structure.at(refI);
+						if(n_gaps == -1)
+							n_gaps = 0;
+						std::string gaps;
+						gaps.resize(n_gaps, '-');
+						assert((int)gaps.length() == n_gaps);
+						referenceExtraction.append(gaps);
+					}
+
+					//new_haplotype_referenceSequence = [substr(referenceSequence, start_open_haplotypes, open_span), new_haplotype, -1];
+					openHaplotype new_haplotype_referenceSequence = std::make_tuple(referenceExtraction, new_haplotype, -1);
+
+					//missing = assembled_h_length - open_span;
+					//die Dumper(posI, start_open_haplotypes, missing, open_span, assembled_h_length) unless(missing >= 0);
+					//missingStr = '*' x missing;
+					//die unless(length(missingStr) == missing);
+					//new_haplotype_referenceSequence->[0] .= missingStr;
+
+					open_haplotypes.push_back(new_haplotype_referenceSequence);
+
+					logStream << "Position " << posI << ", enter new haplotype " << new_haplotype->query_name << " --> " << open_haplotypes.size() << " haplotypes.\n" << std::flush;
+
+				}
+			}
+			else
+			{
+				logStream  << "Position " << posI << ", would have new haplotype " << new_haplotype->query_name << ", but have " << open_haplotypes_size << " open pairs already, so skip.\n" << std::flush;
+				statistics.n_haplotypes_skipped++;
+				if(profiling)
+				{
+					profiler.skip(new_haplotype);
+				}
+			}				
+		}
+		
+
+		// whenever we've exhausted an input alignment, we recombine back into all other running haplotypes
+		// that is, we switch the template alignment for these running haplotypes to ref / another, non-exhausted running haplotype (all options)
+		// 
+		// NB: This step doesn't remove any elements from open_haplotypes - on the contrary, it can add elements (by recombination into other open haplotypes)
+		//
+
+		std::set<std::string> inner_open_haplotypes_keys;
+
+		open_haplotypes_size = open_haplotypes.size();
+		std::set<unsigned int> exitedHaplotype;
+		for(unsigned int outer_haplotype_I = 0; outer_haplotype_I < open_haplotypes_size; outer_haplotype_I++)
+		{
+			openHaplotype& haplotype = open_haplotypes.at(outer_haplotype_I);
+
+			if(std::get<1>(haplotype) != 0) // i.e. non-ref
+			{
+				if(std::get<2>(haplotype) == ((int)std::get<1>(haplotype)->ref.length() - 1)) // i.e. we're done with this input alignment
+				{
+					if(inner_open_haplotypes_keys.size() == 0)
+					{
+						for(const openHaplotype& haplotype : open_haplotypes)
+						{
+							std::stringstream haplotype_key_str;
+							haplotype_key_str << 	std::get<0>(haplotype) << ";" <<
 												std::get<1>(haplotype) << ";" <<
 												std::get<2>(haplotype);
 							std::string haplotype_key = haplotype_key_str.str();
 							inner_open_haplotypes_keys.insert(haplotype_key);
 						}
 					}
-					
-					std::cerr << "Position " << posI << ", exit haplotype " << std::get<1>(haplotype)->query_name << " length " << std::get<0>(haplotype).length() << " (open haplotypes " << open_haplotypes.size() << ")\n" << std::flush;
-					// print "exit one\n";
+					
+					std::cerr << "Position " << posI << ", exit haplotype " << std::get<1>(haplotype)->query_name << " length " << std::get<0>(haplotype).length() << " (open haplotypes " << open_haplotypes.size() << ")\n" << std::flush;
+					if(profiling)
+					{
+						profiler.exit(std::get<1>(haplotype));
+					}
+					// print "exit one\n";
+
+					// recombine into the reference
+					std::get<1>(haplotype) = 0;
+					std::get<2>(haplotype) = -1;
+					exitedHaplotype.insert(outer_haplotype_I);
+
+					size_t expected_haplotype_length = std::get<0>(haplotype).length();
+					std::cerr << "\texpected_haplotype_length: " << expected_haplotype_length << "\n";
+					modifiedLastPos = true;
+					
+					if(open_haplotypes.size() <= running_haplotypes_limit)
+					{  
+				
+						for(unsigned int existingHaploI = 0; existingHaploI < (int)open_haplotypes_size; existingHaploI++)
+						{
+							openHaplotype& haplotype = open_haplotypes.at(outer_haplotype_I);
+							
+							if(posI > 7650000)
+							{
+								//std::cerr << "Outer haplotype " << outer_haplotype_I << " / inner haplotype " << existingHaploI << ": length of " << (&haplotype) << " " << std::get<0>(haplotype).length() << "\n" << std::flush;
+							}
+							//if(existingHaploI == existingHaploI) // this looks like a bug - nonsensical -- might be instead: existingHaploI == outer_haplotype_I
+							if(existingHaploI == outer_haplotype_I)
+							{
+								continue;
+							}
+
+							if(exitedHaplotype.count(existingHaploI))
+								continue;
+
+							// create and add a new recombination haplotype
+							if(std::get<0>(haplotype).length() != expected_haplotype_length)
+							{
+								std::cerr << "std::get<0>(haplotype).length() is " << std::get<0>(haplotype).length() << "\n" << std::flush;
+							}
+							assert(std::get<0>(haplotype).length() == expected_haplotype_length);
+							openHaplotype new_haplotype_copy_this = std::make_tuple(std::string(std::get<0>(haplotype)), std::get<1>(open_haplotypes.at(existingHaploI)), std::get<2>(open_haplotypes.at(existingHaploI)));
+							assert(std::get<0>(haplotype).length() == expected_haplotype_length);
+							assert(std::get<0>(new_haplotype_copy_this).length() == expected_haplotype_length);
+
+							// ... and of course the new haplotype must not be exhausted already
+							if((std::get<1>(new_haplotype_copy_this) == 0) || (std::get<2>(new_haplotype_copy_this) != ((int)std::get<1>(new_haplotype_copy_this)->ref.length() - 1)))
+							{
+								assert((std::get<1>(haplotype) == 0) || (std::get<2>(haplotype) != ((int)std::get<1>(haplotype)->ref.length() - 1)));
+								assert(std::get<0>(haplotype).length() == std::get<0>(new_haplotype_copy_this).length());
+								assert(std::get<0>(haplotype).length() == expected_haplotype_length);
+								assert(std::get<0>(new_haplotype_copy_this).length() == expected_haplotype_length);
+									
+								if(posI > 7650000)
+								{
+									//std::cerr << "A " << (&haplotype) << " vs " << &(open_haplotypes.at(outer_haplotype_I)) << "\n";
+								}
+								
+								// perhaps these checks are not a good idea
+								
+								std::stringstream new_haplotype_key_str;
+								new_haplotype_key_str << 	std::get<0>(new_haplotype_copy_this) << ";" <<
+													std::get<1>(new_haplotype_copy_this) << ";" << 
+													std::get<2>(new_haplotype_copy_this);
+								std::string new_haplotype_key = new_haplotype_key_str.str();
+							
+								if(inner_open_haplotypes_keys.count(new_haplotype_key) == 0)
+								{
+									if(open_haplotypes.size() <= running_haplotypes_limit)
+									{  
+										open_haplotypes.push_back(new_haplotype_copy_this);
+										inner_open_haplotypes_keys.insert(new_haplotype_key);
+									}
+								}
+								
+								if(posI > 7650000)
+								{
+									//std::cerr << "B " << (&haplotype) << " vs " << &(open_haplotypes.at(outer_haplotype_I)) << "\n";
+								}							
+							}
+							 
+							if(posI > 7650000)
+							{
+							// 	std::cerr << "C " << (&haplotype) << " vs " << &(open_haplotypes.at(outer_haplotype_I)) << "\n";
+							//	std::cerr << "Outer haplotype " << outer_haplotype_I << " / inner haplotype " << existingHaploI << ": length of " << (&haplotype) << " " << std::get<0>(haplotype).length() << "\n" << std::flush;
+							}						
+						}
+					}
+
+					openHaplotype& haplotype = open_haplotypes.at(outer_haplotype_I);					
+					assert((! checkPolicy::full) || (std::get<1>(haplotype) == 0) || known_haplotype_pointers.count(std::get<1>(haplotype)));
+
+					//assert(std::get<1>(haplotype) != 0);
+					//logStream << "Position " << posI << ", exit haplotype " << std::get<1>(haplotype)->query_name << " --> " << open_haplotypes.size() << " haplotypes.\n" << std::flush;
+				}
+			}
+		}
+
+
+		// can ignore
+		// print "\tLength ", assembled_h_length, "\n";
+		/*
+		if(1 == 0)
+		{
+			print "Haplotype info:\n";
+			for(existingHaploI = 0; existingHaploI <= #open_haplotypes; existingHaploI++)
+			{
+				print "\t", existingHaploI, "\n";
+				print "\t\t", open_haplotypes[existingHaploI][0], "\n";
+				print "\t\t", open_haplotypes[existingHaploI][2], "\n";
+				if(open_haplotypes[existingHaploI][1])
+				{
+					ref_str = open_haplotypes[existingHaploI][1][0];
+					haplo_str = open_haplotypes[existingHaploI][1][1];
+					print "\t\t", open_haplotypes[existingHaploI][1][2], "\n";
+					printFrom = open_haplotypes[existingHaploI][2];
+					printFrom = 0 if(printFrom < 0);
+					print "\t\t", substr(ref_str, printFrom, 10), "\n";
+					print "\t\t", substr(haplo_str, printFrom, 10), "\n";
+				}
+				else
+				{
+					print "\t\tREF\n";
+				}
+			}
+			print "\n";
+		}
+		*/
+
+		// the extension step: by now all members of open_haplotypes are extensible (otherwise they were exited already)
+		// we extend the first element of each haplotype with the sequence of the alignment (or the reference) we're copying from
+
+		// ... but before we do this, make sure that everything works out length-wise
+		// i.e. we populate extensions_nonRef_length, and make sure that all potential extensions have the same length
+		// (and we also need this for the actual extension)
+		std::set<std::string> extensions_nonRef;
+		int extensions_nonRef_length = -1;
+		for(openHaplotype haplotype : open_haplotypes)
+		{
+			std::string extension;
+			int consumed_ref_start = -1;
+			int consumed_ref = 0;
+			std::string consumed_ref_sequence;
+
+				
+			if(std::get<1>(haplotype) == 0)
+			{
+
+			}
+			else
+			{
+				int addIndex = 0;
+				consumed_ref_start = std::get<2>(haplotype)+addIndex+1;
+				do {
+					int nextPosToConsume = std::get<2>(haplotype)+addIndex+1;
+					if(!(nextPosToConsume < (int)std::get<1>(haplotype)->ref.length()))
+					{
+						std::cerr << "nextPosToConsume" << ": " << nextPosToConsume << "\n";
+						std::cerr << "std::get<1>(haplotype)->ref.length()" << ": " << std::get<1>(haplotype)->ref.length() << "\n";
+						std::cerr << "extension" << ": " << extension << "\n";
+						std::cerr << std::flush;
+					}
+					assert(nextPosToConsume < (int)std::get<1>(haplotype)->ref.length());
+					unsigned char refC = std::get<1>(haplotype)->ref.at(nextPosToConsume);
+					consumed_ref_sequence.push_back(refC);
+					if((refC != '-') && (refC != '*'))
+					{
+						consumed_ref++;
+					}
+					unsigned char hapC = std::get<1>(haplotype)->query.at(nextPosToConsume);
+					extension.push_back(hapC);
+					addIndex++;
+				} while(consumed_ref < 1);
+			}
+
+			if(extension.length())
+			{
+				// push(@{extensions_nonRef{extension}}, [consumed_ref_start, consumed_ref, consumed_ref_sequence]);
+				extensions_nonRef.insert(extension);
+				if(extensions_nonRef_length == -1)
+				{
+					extensions_nonRef_length = extension.length();
+				}
+				assert((int)extension.length() == extensions_nonRef_length);
+				/*
+				unless(defined extensions_nonRef_length)
+				{
+					extensions_nonRef_length = length(extension);
+				}
+				die Dumper("Length mismatch", extension, \%extensions_nonRef, posI, "Length mismatch") unless(length(extension) == extensions_nonRef_length);
+				*/
+			}
+		}
+
+		// now carry out the actual extension
+		std::set<std::string> extensions;
+		for(openHaplotype& haplotype : open_haplotypes)
+		{
+			std::string extension;
+			if(std::get<1>(haplotype) == 0)
+			{
+				std::string refExt = {(char)refC};
+				if(extensions_nonRef_length != -1)
+				{
+					int missing = extensions_nonRef_length - refExt.length();
+					assert(missing >= 0);
+					std::string missingStr;
+					missingStr.resize(missing, '*');
+					assert((int)missingStr.length() == missing);
+					refExt.append(missingStr);
+				}
+				extension.append(refExt);
+			}
+			else
+			{
+				int consumed_ref = 0;
+				do {
+					int nextPosToConsume = std::get<2>(haplotype)+1;
+					assert(nextPosToConsume < (int)std::get<1>(haplotype)->ref.length());
+					unsigned char refC = std::get<1>(haplotype)->ref.at(nextPosToConsume);
+					if((refC != '-') && (refC != '*'))
+					{
+						consumed_ref++;
+					}
+					unsigned char hapC = std::get<1>(haplotype)->query.at(nextPosToConsume);
+					extension.push_back(hapC);
+					std::get<2>(haplotype)++;
+				} while(consumed_ref < 1);
+			}
+			assert(extension.length());
+			std::get<0>(haplotype).append(extension);
+			extensions.insert(extension);
+		}
+		assert(extensions.size());
+	
+		// debug stuff
+		// print "Extensions:\n", join("\n", map {"\t'"._."'"} keys %extensions), "\n\n";
+		//#this_all_equal = ( (scalar(keys %extensions) == 0) or ((scalar(keys %extensions) == 1) and (exists extensions{refC})) );
 
-					// recombine into the reference
-					std::get<1>(haplotype) = 0;
-					std::get<2>(haplotype) = -1;
-					exitedHaplotype.insert(outer_haplotype_I);
+		// IF all extensions made represent the same character
+		// AND IF this charactter is equal to the reference
+		// THEN we can close and output a list of variant alleles to the output VCF
+		
+		std::string refC_string = {(char)refC};
+		bool this_all_equal = ((extensions.size() == 1) && (extensions.count(refC_string)));
+		if(posI == 0)
+		{
+			assert(this_all_equal);
+		}
 
-					size_t expected_haplotype_length = std::get<0>(haplotype).length();
-					std::cerr << "\texpected_haplotype_length: " << expected_haplotype_length << "\n";
-					modifiedLastPos = true;
-					
-					if(open_haplotypes.size() <= max_running_haplotypes_before_add)
-					{  
-				
-						for(unsigned int existingHaploI = 0; existingHaploI < (int)open_haplotypes_size; existingHaploI++)
-						{
-							openHaplotype& haplotype = open_haplotypes.at(outer_haplotype_I);
-							
-							if(posI > 7650000)
-							{
-								//std::cerr << "Outer haplotype " << outer_haplotype_I << " / inner haplotype " << existingHaploI << ": length of " << (&haplotype) << " " << std::get<0>(haplotype).length() << "\n" << std::flush;
-							}
-							//if(existingHaploI == existingHaploI) // this looks like a bug - nonsensical -- might be instead: existingHaploI == outer_haplotype_I
-							if(existingHaploI == outer_haplotype_I)
-							{
-								continue;
-							}
+		// debug stuff
+		/*
+		if(open_haplotypes.size() > 100)
+		{
+			logStream << "Open haplotypes position " << posI << "\n";
+			for(auto e : extensions)
+			{
+				logStream << "\t" << e << "\n" << std::flush;
+			}
+ 		}*/
 
-							if(exitedHaplotype.count(existingHaploI))
-								continue;
+		if(profiling)
+		{
+			profiler.observe(open_haplotypes);
+		}
 
-							// create and add a new recombination haplotype
-							if(std::get<0>(haplotype).length() != expected_haplotype_length)
-							{
-								std::cerr << "std::get<0>(haplotype).length() is " << std::get<0>(haplotype).length() << "\n" << std::flush;
-							}
-							assert(std::get<0>(haplotype).length() == expected_haplotype_length);
-							openHaplotype new_haplotype_copy_this = std::make_tuple(std::string(std::get<0>(haplotype)), std::get<1>(open_haplotypes.at(existingHaploI)), std::get<2>(open_haplotypes.at(existingHaploI)));
-							assert(std::get<0>(haplotype).length() == expected_haplotype_length);
-							assert(std::get<0>(new_haplotype_copy_this).length() == expected_haplotype_length);
+		// carry out the closing and print to VCF
+		if(this_all_equal && (posI > 0))
+		{
+			// close
+			int ref_span = posI - start_open_haplotypes;
+			assert(ref_span > 0);
+			std::string reference_sequence = referenceSequence.substr(start_open_haplotypes, ref_span);
+			std::set<std::string> alternativeSequences;
+			std::set<std::string> uniqueRemainers;
 
-							// ... and of course the new haplotype must not be exhausted already
-							if((std::get<1>(new_haplotype_copy_this) == 0) || (std::get<2>(new_haplotype_copy_this) != ((int)std::get<1>(new_haplotype_copy_this)->ref.length() - 1)))
-							{
-								assert((std::get<1>(haplotype) == 0) || (std::get<2>(haplotype) != ((int)std::get<1>(haplotype)->ref.length() - 1)));
-								assert(std::get<0>(haplotype).length() == std::get<0>(new_haplotype_copy_this).length());
-								if(posI == 7652900)
-								{
-									std::cerr << "Position " << posI << " add of length " << std::get<0>(new_haplotype_copy_this).length() << "\n"; // [@gap_structure[(posI-3) .. (posI+1)]]
-								}
-								assert(std::get<0>(haplotype).length() == expected_haplotype_length);
-								assert(std::get<0>(new_haplotype_copy_this).length() == expected_haplotype_length);
-									
-								if(posI > 7650000)
-								{
-									//std::cerr << "A " << (&haplotype) << " vs " << &(open_haplotypes.at(outer_haplotype_I)) << "\n";
-								}
-								
-								// perhaps these checks are not a good idea
-								
-								std::stringstream new_haplotype_key_str;
-								new_haplotype_key_str << 	std::get<0>(new_haplotype_copy_this) << ";" <<
-													std::get<1>(new_haplotype_copy_this) << ";" << 
-													std::get<2>(new_haplotype_copy_this);
-								std::string new_haplotype_key = new_haplotype_key_str.str();
-							
-								if(inner_open_haplotypes_keys.count(new_haplotype_key) == 0)
-								{
-									if(open_haplotypes.size() <= max_running_haplotypes_before_add)
-									{  
-										open_haplotypes.push_back(new_haplotype_copy_this);
-										inner_open_haplotypes_keys.insert(new_haplotype_key);
-									}
-								}
-								
-								if(posI > 7650000)
-								{
-									//std::cerr << "B " << (&haplotype) << " vs " << &(open_haplotypes.at(outer_haplotype_I)) << "\n";
-								}							
-							}
-							 
-							if(posI > 7650000)
-							{
-							// 	std::cerr << "C " << (&haplotype) << " vs " << &(open_haplotypes.at(outer_haplotype_I)) << "\n";
-							//	std::cerr << "Outer haplotype " << outer_haplotype_I << " / inner haplotype " << existingHaploI << ": length of " << (&haplotype) << " " << std::get<0>(haplotype).length() << "\n" << std::flush;
-							}						
-						}
+			std::vector<openHaplotype> new_open_haplotypes;
+			int open_haplotypes_before = open_haplotypes.size();
+			for(openHaplotype& haplotype : open_haplotypes)
+			{
+				assert((int)std::get<0>(haplotype).length() >= (ref_span + 1)); // Ignore this comment: Perl pseudocoder. die Dumper("Length mismatch II", ref_span+1, length(std::get<0>(haplotype)), "Length mismatch II") unless(length(std::get<0>(haplotype)) >= (ref_span + 1));
+				std::string haplotype_coveredSequence = std::get<0>(haplotype).substr(0, std::get<0>(haplotype).length()-1);
+				haplotype_coveredSequence = removeGaps(haplotype_coveredSequence);
+				if(haplotype_coveredSequence != reference_sequence)
+				{
+					alternativeSequences.insert(haplotype_coveredSequence);
+				}
+
+				// set the running component of the haplotype to the last character
+				std::get<0>(haplotype) = std::get<0>(haplotype).substr(std::get<0>(haplotype).length()-1);
+				assert(std::get<0>(haplotype).length() == 1);
+
+				// unique key for this remaining haplotype to make sure we're not storing anything identical
+				std::stringstream uniqueRemainerKey;
+				uniqueRemainerKey << std::get<0>(haplotype) << "//" << (void*)std::get<1>(haplotype) << "//" << std::get<2>(haplotype);
+
+				std::string k = uniqueRemainerKey.str();
+				if(open_haplotypes.size() > 100)
+				{
+					// logStream << k << "\n";
+				}
+
+				if(uniqueRemainers.count(k) == 0)
+				{
+					new_open_haplotypes.push_back(haplotype);
+					uniqueRemainers.insert(k);
+				}
+			}
+
+			open_haplotypes = new_open_haplotypes;
+			int open_haplotypes_after = open_haplotypes.size();
+
+			// only output to VCF if there are alternative sequences
+			long long record_POS = 0;
+			if(alternativeSequences.size())
+			{
+				writeSymbolicDeletions(start_open_haplotypes);
+
+				bool all_alternativeAlleles_length_2 = true;
+				for(auto a : alternativeSequences)
+				{
+					if(a.length() != 2)
+						all_alternativeAlleles_length_2 = false;
+				}
+
+				// print "Starting at position start_open_haplotypes, have REF reference_sequence and alternative sequences " . join(' / ', @alternativeAlleles) . "\n";
+
+				if((reference_sequence.length() == 2) and all_alternativeAlleles_length_2)
+				{
+					for(auto a : alternativeSequences)
+					{
+						assert(a.substr(0, 1) == reference_sequence.substr(0, 1)); // die Dumper("Some problem with supposed SNP", posI, reference_sequence, \@alternativeAlleles, "Some problem with supposed SNP") unless(substr(alt, 0, 1) eq firstRefChar);
 					}
 
-					openHaplotype& haplotype = open_haplotypes.at(outer_haplotype_I);					
-					assert((std::get<1>(haplotype) == 0) || known_haplotype_pointers.count(std::get<1>(haplotype)));
+					std::vector<std::string> alternativeAlleles_reduced;
+					for(auto a : alternativeSequences)
+					{
+						alternativeAlleles_reduced.push_back(a.substr(1,1));
+					}
 
-					//assert(std::get<1>(haplotype) != 0);
-					//std::cout << "Position " << posI << ", exit haplotype " << std::get<1>(haplotype)->query_name << " --> " << open_haplotypes.size() << " haplotypes.\n" << std::flush;
+					record_POS = start_open_haplotypes+2;
+					outputStream <<
+							referenceSequenceID << "\t" <<
+							start_open_haplotypes+2 << "\t" <<
+							"." << "\t" <<
+							reference_sequence.substr(1,1) << "\t" <<
+							join(alternativeAlleles_reduced, ",") << "\t" <<
+							'.' << "\t" <<
+							"PASS" << "\t" <<
+							'.'
+					<< "\n";
+				}
+				else
+				{
+					record_POS = start_open_haplotypes+1;
+					outputStream <<
+							referenceSequenceID << "\t" <<
+							start_open_haplotypes+1 << "\t" <<
+							"." << "\t" <<
+							reference_sequence << "\t" <<
+							join(std::vector<std::string>(alternativeSequences.begin(), alternativeSequences.end()), ",") << "\t" <<
+							'.' << "\t" <<
+							"PASS" << "\t" <<
+							'.'
+					<< "\n";
 				}
+				statistics.n_records++;
+				passOutput(false);
+			}
+			if(annotate_paths)
+			{
+				std::vector<std::string> alleles = {reference_sequence};
+				alleles.insert(alleles.end(), alternativeSequences.begin(), alternativeSequences.end());
+				bool resolved = paths.close(open_haplotypes, record_POS, alleles);
+				assert((! checkPolicy::full) || resolved);
+			}
+			start_open_haplotypes = posI;
+			if(profiling)
+			{
+				profiler.close(posI);
+			}
+
+			if((n_alignments == opened_alignments) and (open_haplotypes_after == 1))
+			{
+				//
 			}
+			// logStream << "Went from " << open_haplotypes_before << " to " << open_haplotypes_after << "\n";
 		}
 
+		// last_all_equal = this_all_equal;
+	}
+	
+	writeSymbolicDeletions(referenceSequence.length());
+
+	passOutput(true);
+	if(pipeline)
+	{
+		outputBuffers.close();
+		writerThread.join();
+	}
+	outputFileStream.close();
+	if(! outputFileStream)
+	{
+		throw std::runtime_error("Error writing " + outputFn);
+	}
+
+	if(eventDriven)
+	{
+		logStream << "Event-driven sweep: skipped " << skipped_positions << " of " << referenceSequence.length() << " reference positions.\n";
+	}
+	logStream << "Done.\n" << std::flush;
+
+	if(annotate_paths)
+	{
+		paths.finish(logStream);
+	}
 
-		if(posI == 7652900)
+	if(profiling)
+	{
+		if(start_open_haplotypes < ((int)referenceSequence.length() - 1))
 		{
-			std::cerr << "Post-exit haplotype lengths " << posI << "\n"; // [@gap_structure[(posI-3) .. (posI+1)]]
-			for(openHaplotype oH2 : open_haplotypes)
-			{
-				std::cerr << "\t" << std::get<0>(oH2).length() << "\tconsumed until: " << std::get<2>(oH2) << ", of length " << ((std::get<1>(oH2) == 0) ? "REF" : ("nonRef " + std::get<1>(oH2)->query_name + " / length " + ItoStr(std::get<1>(oH2)->ref.length()))) << "\n";
-			}
+			profiler.close(referenceSequence.length());
 		}
+		profiler.write(outputFn, referenceSequence.length(), logStream);
+	}
 
-		// can ignore
-		// print "\tLength ", assembled_h_length, "\n";
-		/*
-		if(1 == 0)
+	statistics.skipped_positions = skipped_positions;
+	return statistics;
+}
+
+
+
+template<typename checkPolicy>
+void computeGapStructure(const ReferenceSequence& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, std::vector<int>& gap_structure, std::vector<int>& coverage_structure)
+{
+	gap_structure.clear();
+	coverage_structure.clear();
+	gap_structure.resize(referenceSequence.length(), -1);
+	coverage_structure.resize(referenceSequence.length(), 0);
+	int examine_gaps_n_alignment = 0;
+	for(auto startPos : alignments_starting_at)
+	{
+		for(startingHaplotype* alignment : startPos.second)
 		{
-			print "Haplotype info:\n";
-			for(existingHaploI = 0; existingHaploI <= #open_haplotypes; existingHaploI++)
+			assert(startPos.first == alignment->aligment_start_pos);
+
+			long long start_pos = (int)startPos.first - 1;
+			long long ref_pos = start_pos;
+			int running_gaps = 0;
+
+			for(unsigned int i = 0; i < alignment->ref.length(); i++)
 			{
-				print "\t", existingHaploI, "\n";
-				print "\t\t", open_haplotypes[existingHaploI][0], "\n";
-				print "\t\t", open_haplotypes[existingHaploI][2], "\n";
-				if(open_haplotypes[existingHaploI][1])
+				unsigned char c_ref = alignment->ref.at(i);
+				if((c_ref == '-') or (c_ref == '*'))
 				{
-					ref_str = open_haplotypes[existingHaploI][1][0];
-					haplo_str = open_haplotypes[existingHaploI][1][1];
-					print "\t\t", open_haplotypes[existingHaploI][1][2], "\n";
-					printFrom = open_haplotypes[existingHaploI][2];
-					printFrom = 0 if(printFrom < 0);
-					print "\t\t", substr(ref_str, printFrom, 10), "\n";
-					print "\t\t", substr(haplo_str, printFrom, 10), "\n";
+					running_gaps++;
 				}
 				else
 				{
-					print "\t\tREF\n";
+					if(ref_pos != start_pos)
+					{
+						if(gap_structure.at(ref_pos) == -1)
+						{
+							gap_structure.at(ref_pos) = running_gaps;
+						}
+						else
+						{
+							if(gap_structure.at(ref_pos) != running_gaps)
+							{
+								std::cerr << "Gap structure mismatch at position " << ref_pos << " - this is alignment " << examine_gaps_n_alignment << " / " << alignment->query_name << ", have existing value " << gap_structure.at(ref_pos) << ", want to set " << running_gaps << "\n" << std::flush;
+								std::cerr << "Alignment start " << alignment->aligment_start_pos << "\n";
+								std::cerr << "Alignment stop " << alignment->alignment_last_pos << "\n";
+								std::cerr << std::flush;
+								throw std::runtime_error("Gap structure mismatch");
+							}
+
+						}
+					}
+					
+					ref_pos++;
+					running_gaps = 0;
+					coverage_structure.at(ref_pos)++; 
+					
+					assert((! checkPolicy::full) || (c_ref == referenceSequence.at(ref_pos)));
 				}
 			}
-			print "\n";
+
+			examine_gaps_n_alignment++;
+			assert(ref_pos == alignment->alignment_last_pos);
 		}
-		*/
+	}
+}
 
-		// the extension step: by now all members of open_haplotypes are extensible (otherwise they were exited already)
-		// we extend the first element of each haplotype with the sequence of the alignment (or the reference) we're copying from
+void estimateComplexity(const std::string referenceSequenceID, const ReferenceSequence& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, std::string outputFn)
+{
+	/*
+	    Cheap pre-pass over the loaded alignments: for each window of complexity_window_length reference positions,
+	    collect the quantities that drive the cost of STEP 3 (open haplotypes are created at alignment starts and ends,
+	    multiplied by local coverage, and kept alive across deletions and gap columns) and combine them into a single
+	    estimated cost. The launcher uses the per-window costs to order jobs and to assign per-region values for
+	    max_running_haplotypes_before_add (--regionBudgets).
+	*/
 
-		// ... but before we do this, make sure that everything works out length-wise
-		// i.e. we populate extensions_nonRef_length, and make sure that all potential extensions have the same length
-		// (and we also need this for the actual extension)
-		std::set<std::string> extensions_nonRef;
-		int extensions_nonRef_length = -1;
-		for(openHaplotype haplotype : open_haplotypes)
-		{
-			std::string extension;
-			int consumed_ref_start = -1;
-			int consumed_ref = 0;
-			std::string consumed_ref_sequence;
+	std::vector<int> gap_structure;
+	std::vector<int> coverage_structure;
+	computeGapStructure<engineChecks>(referenceSequence, alignments_starting_at, gap_structure, coverage_structure);
 
-				
-			if(std::get<1>(haplotype) == 0)
-			{
+	unsigned int n_windows = (referenceSequence.length() + complexity_window_length - 1) / complexity_window_length;
+	std::vector<long long> window_starts(n_windows, 0);
+	std::vector<long long> window_ends(n_windows, 0);
+	std::vector<int> window_max_deletion_span(n_windows, 0);
 
-			}
-			else
-			{
-				int addIndex = 0;
-				consumed_ref_start = std::get<2>(haplotype)+addIndex+1;
-				do {
-					int nextPosToConsume = std::get<2>(haplotype)+addIndex+1;
-					if(!(nextPosToConsume < (int)std::get<1>(haplotype)->ref.length()))
-					{
-						std::cerr << "nextPosToConsume" << ": " << nextPosToConsume << "\n";
-						std::cerr << "std::get<1>(haplotype)->ref.length()" << ": " << std::get<1>(haplotype)->ref.length() << "\n";
-						std::cerr << "extension" << ": " << extension << "\n";
-						std::cerr << std::flush;
-					}
-					assert(nextPosToConsume < (int)std::get<1>(haplotype)->ref.length());
-					unsigned char refC = std::get<1>(haplotype)->ref.at(nextPosToConsume);
-					consumed_ref_sequence.push_back(refC);
-					if((refC != '-') && (refC != '*'))
-					{
-						consumed_ref++;
-					}
-					unsigned char hapC = std::get<1>(haplotype)->query.at(nextPosToConsume);
-					extension.push_back(hapC);
-					addIndex++;
-				} while(consumed_ref < 1);
-			}
+	for(auto startPos : alignments_starting_at)
+	{
+		for(startingHaplotype* alignment : startPos.second)
+		{
+			window_starts.at(alignment->aligment_start_pos / complexity_window_length)++;
+			window_ends.at(alignment->alignment_last_pos / complexity_window_length)++;
 
-			if(extension.length())
+			// longest run of query gaps (deleted reference characters), attributed to the window in which it starts
+			long long ref_pos = (int)startPos.first - 1;
+			long long deletion_start = -1;
+			int deletion_span = 0;
+			for(unsigned int i = 0; i < alignment->ref.length(); i++)
 			{
-				// push(@{extensions_nonRef{extension}}, [consumed_ref_start, consumed_ref, consumed_ref_sequence]);
-				extensions_nonRef.insert(extension);
-				if(extensions_nonRef_length == -1)
+				unsigned char c_ref = alignment->ref.at(i);
+				if((c_ref == '-') or (c_ref == '*'))
+					continue;
+
+				ref_pos++;
+				unsigned char c_query = alignment->query.at(i);
+				if((c_query == '-') or (c_query == '*'))
 				{
-					extensions_nonRef_length = extension.length();
+					if(deletion_span == 0)
+						deletion_start = ref_pos;
+					deletion_span++;
 				}
-				assert((int)extension.length() == extensions_nonRef_length);
-				/*
-				unless(defined extensions_nonRef_length)
+				else
 				{
-					extensions_nonRef_length = length(extension);
+					deletion_span = 0;
 				}
-				die Dumper("Length mismatch", extension, \%extensions_nonRef, posI, "Length mismatch") unless(length(extension) == extensions_nonRef_length);
-				*/
-			}
-		}
 
-		// now carry out the actual extension
-		std::set<std::string> extensions;
-		for(openHaplotype& haplotype : open_haplotypes)
-		{
-			std::string extension;
-			if(std::get<1>(haplotype) == 0)
-			{
-				std::string refExt = {(char)refC};
-				if(extensions_nonRef_length != -1)
+				if(deletion_span)
 				{
-					int missing = extensions_nonRef_length - refExt.length();
-					assert(missing >= 0);
-					std::string missingStr;
-					missingStr.resize(missing, '*');
-					assert((int)missingStr.length() == missing);
-					refExt.append(missingStr);
+					unsigned int wI = deletion_start / complexity_window_length;
+					if(deletion_span > window_max_deletion_span.at(wI))
+						window_max_deletion_span.at(wI) = deletion_span;
 				}
-				extension.append(refExt);
-			}
-			else
-			{
-				int consumed_ref = 0;
-				do {
-					int nextPosToConsume = std::get<2>(haplotype)+1;
-					assert(nextPosToConsume < (int)std::get<1>(haplotype)->ref.length());
-					unsigned char refC = std::get<1>(haplotype)->ref.at(nextPosToConsume);
-					if((refC != '-') && (refC != '*'))
-					{
-						consumed_ref++;
-					}
-					unsigned char hapC = std::get<1>(haplotype)->query.at(nextPosToConsume);
-					extension.push_back(hapC);
-					std::get<2>(haplotype)++;
-				} while(consumed_ref < 1);
 			}
-			assert(extension.length());
-			std::get<0>(haplotype).append(extension);
-			extensions.insert(extension);
 		}
-		assert(extensions.size());
-	
-		// debug stuff
-		// print "Extensions:\n", join("\n", map {"\t'"._."'"} keys %extensions), "\n\n";
-		//#this_all_equal = ( (scalar(keys %extensions) == 0) or ((scalar(keys %extensions) == 1) and (exists extensions{refC})) );
+	}
 
-		// IF all extensions made represent the same character
-		// AND IF this charactter is equal to the reference
-		// THEN we can close and output a list of variant alleles to the output VCF
-		
-		std::string refC_string = {(char)refC};
-		bool this_all_equal = ((extensions.size() == 1) && (extensions.count(refC_string)));
-		if(posI == 0)
+	std::ofstream complexityStream;
+	complexityStream.open(outputFn.c_str());
+	if(! complexityStream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + outputFn + " for writing!");
+	}
+	complexityStream << "#chrom\tstart\tend\testimated_cost\tstarts\tends\tavg_coverage\tmax_coverage\tgap_columns\tmax_deletion_span\tbudget\n";
+
+	double total_cost = 0;
+	for(unsigned int wI = 0; wI < n_windows; wI++)
+	{
+		unsigned int first_window_pos = wI * complexity_window_length;
+		unsigned int last_window_pos = first_window_pos + complexity_window_length - 1;
+		if(last_window_pos > (referenceSequence.length() - 1))
+			last_window_pos = referenceSequence.length() - 1;
+
+		long long coverage_in_window = 0;
+		int max_coverage = 0;
+		long long gap_columns = 0;
+		for(unsigned int j = first_window_pos; j <= last_window_pos; j++)
+		{
+			coverage_in_window += coverage_structure.at(j);
+			if(coverage_structure.at(j) > max_coverage)
+				max_coverage = coverage_structure.at(j);
+			if(gap_structure.at(j) > 0)
+				gap_columns += gap_structure.at(j);
+		}
+		double avg_coverage = (double) coverage_in_window / (double)(last_window_pos - first_window_pos + 1);
+
+		double estimated_cost =
+			(double)coverage_in_window +
+			(double)(window_starts.at(wI) + window_ends.at(wI)) * (double)(max_coverage + 1) * (double)(max_coverage + 1) +
+			(double)window_max_deletion_span.at(wI) * (avg_coverage + 1) +
+			(double)gap_columns * (avg_coverage + 1);
+		total_cost += estimated_cost;
+
+		complexityStream <<
+			referenceSequenceID << "\t" <<
+			first_window_pos << "\t" <<
+			(last_window_pos + 1) << "\t" <<
+			(long long)estimated_cost << "\t" <<
+			window_starts.at(wI) << "\t" <<
+			window_ends.at(wI) << "\t" <<
+			avg_coverage << "\t" <<
+			max_coverage << "\t" <<
+			gap_columns << "\t" <<
+			window_max_deletion_span.at(wI) << "\t" <<
+			max_running_haplotypes_before_add << "\n";
+	}
+	complexityStream.close();
+
+	std::cout << "Estimated complexity for " << n_windows << " windows of length " << complexity_window_length << ", total estimated cost " << (long long)total_cost << " - written to " << outputFn << "\n" << std::flush;
+}
+
+std::vector<std::tuple<unsigned int, unsigned int, int>> readRegionBudgets(const std::string referenceSequenceID, std::string regionBudgetsFn)
+{
+	// BED-like: chrom, start (0-based), end (exclusive), budget - with any further columns ignored.
+	// Budgets override max_running_haplotypes_before_add for positions in [start, end).
+	std::vector<std::tuple<unsigned int, unsigned int, int>> forReturn;
+
+	std::ifstream budgetsStream;
+	budgetsStream.open(regionBudgetsFn.c_str());
+	if(! budgetsStream.is_open())
+	{
+		throw std::runtime_error("Could not open file " + regionBudgetsFn);
+	}
+
+	std::string line;
+	while(budgetsStream.good())
+	{
+		std::getline(budgetsStream, line);
+		eraseNL(line);
+		if((line.length() == 0) || (line.at(0) == '#'))
+			continue;
+
+		std::vector<std::string> line_fields = split(line, "\t");
+		if(line_fields.size() < 4)
+		{
+			throw std::runtime_error("Region budgets file " + regionBudgetsFn + " has a line with less than 4 fields: " + line);
+		}
+		if(line_fields.at(0) != referenceSequenceID)
+			continue;
+
+		unsigned int start = StrtoUI(line_fields.at(1));
+		unsigned int end = StrtoUI(line_fields.at(2));
+		int budget = StrtoI(line_fields.at(3));
+		assert(start < end);
+		assert(budget > 0);
+		forReturn.push_back(std::make_tuple(start, end, budget));
+	}
+
+	std::sort(forReturn.begin(), forReturn.end());
+	for(unsigned int i = 1; i < forReturn.size(); i++)
+	{
+		if(std::get<0>(forReturn.at(i)) < std::get<1>(forReturn.at(i-1)))
+		{
+			throw std::runtime_error("Region budgets file " + regionBudgetsFn + " has overlapping regions for " + referenceSequenceID);
+		}
+	}
+
+	return forReturn;
+}
+
+std::vector<engineParameters> readParameterSweep(std::string parameterSweepFn)
+{
+	// tab-separated: label, max_gap_length, max_running_haplotypes_before_add - lines starting with '#' are ignored.
+	std::vector<engineParameters> forReturn;
+
+	std::ifstream sweepStream;
+	sweepStream.open(parameterSweepFn.c_str());
+	if(! sweepStream.is_open())
+	{
+		throw std::runtime_error("Could not open file " + parameterSweepFn);
+	}
+
+	std::set<std::string> labels;
+	std::string line;
+	while(sweepStream.good())
+	{
+		std::getline(sweepStream, line);
+		eraseNL(line);
+		if((line.length() == 0) || (line.at(0) == '#'))
+			continue;
+
+		std::vector<std::string> line_fields = split(line, "\t");
+		if(line_fields.size() < 3)
 		{
-			assert(this_all_equal);
+			throw std::runtime_error("Parameter sweep file " + parameterSweepFn + " has a line with less than 3 fields: " + line);
 		}
 
-		// debug stuff
-		/*
-		if(open_haplotypes.size() > 100)
+		engineParameters parameters;
+		parameters.label = line_fields.at(0);
+		parameters.max_gap_length = StrtoI(line_fields.at(1));
+		parameters.max_running_haplotypes_before_add = StrtoI(line_fields.at(2));
+		if((parameters.label.length() == 0) || (parameters.label.find('/') != std::string::npos) || labels.count(parameters.label))
 		{
-			std::cout << "Open haplotypes position " << posI << "\n";
-			for(auto e : extensions)
-			{
-				std::cout << "\t" << e << "\n" << std::flush;
-			}
- 		}*/
+			throw std::runtime_error("Parameter sweep file " + parameterSweepFn + ": labels must be non-empty, unique and must not contain '/': " + line);
+		}
+		assert(parameters.max_gap_length >= 0);
+		assert(parameters.max_running_haplotypes_before_add > 0);
+		labels.insert(parameters.label);
+		forReturn.push_back(parameters);
+	}
 
-		// carry out the closing and print to VCF
-		if(this_all_equal && (posI > 0))
+	if(forReturn.size() == 0)
+	{
+		throw std::runtime_error("Parameter sweep file " + parameterSweepFn + " does not specify any parameter sets");
+	}
+
+	return forReturn;
+}
+
+void runParameterSweep(const std::vector<engineParameters>& sweepParameters, std::vector<startingHaplotype*>& rawAlignments, const std::string referenceSequenceID, const ReferenceSequence& referenceSequence, std::string outputFn, std::string regionBudgetsFn, bool eventDriven, bool deduplicateAlignments, long long symbolicDeletionLength, bool pipeline)
+{
+	/*
+	    The parsed input alignments and the reference sequence are shared (read-only) between all parameter sets,
+	    which run concurrently: each set references the input alignments it does not split, and only allocates the
+	    parts of those it splits. Once all sets have loaded their alignments, input alignments that no set references
+	    are freed; the others when all sets are done. Takes ownership of rawAlignments. The log of each set goes to
+	    <input>.VCF.<label>.log; an exception in one set is rethrown when all sets have finished.
+	*/
+
+	std::vector<loadedAlignments> loaded(sweepParameters.size());
+	std::vector<sweepStatistics> statistics(sweepParameters.size());
+	std::vector<long long> seconds(sweepParameters.size());
+	std::vector<std::exception_ptr> errors(sweepParameters.size());
+
+	std::mutex loadingMutex;
+	unsigned int n_sets_loaded = 0;
+	// called once per set, when it has loaded its alignments (or failed); the last call frees the unreferenced input
+	auto setLoaded = [&]() -> void {
+		std::lock_guard<std::mutex> lock(loadingMutex);
+		if(++n_sets_loaded < sweepParameters.size())
 		{
-			// close
-			int ref_span = posI - start_open_haplotypes;
-			assert(ref_span > 0);
-			std::string reference_sequence = referenceSequence.substr(start_open_haplotypes, ref_span);
-			std::set<std::string> alternativeSequences;
-			std::set<std::string> uniqueRemainers;
+			return;
+		}
+		size_t n_freed = 0;
+		for(startingHaplotype*& h : rawAlignments)
+		{
+			if(std::none_of(loaded.begin(), loaded.end(), [&](const loadedAlignments& l){ return l.shared.count(h); }))
+			{
+				delete(h);
+				h = 0;
+				n_freed++;
+			}
+		}
+		std::cout << "Parameter sweep: all sets loaded, freed " << n_freed << " of " << rawAlignments.size() << " input alignments.\n" << std::flush;
+	};
 
-			std::vector<openHaplotype> new_open_haplotypes;
-			int open_haplotypes_before = open_haplotypes.size();
-			for(openHaplotype& haplotype : open_haplotypes)
+	std::vector<std::thread> workers;
+	for(unsigned int parametersI = 0; parametersI < sweepParameters.size(); parametersI++)
+	{
+		workers.push_back(std::thread([&, parametersI]() {
+			bool counted_as_loaded = false;
+			try
 			{
-				assert((int)std::get<0>(haplotype).length() >= (ref_span + 1)); // Ignore this comment: Perl pseudocoder. die Dumper("Length mismatch II", ref_span+1, length(std::get<0>(haplotype)), "Length mismatch II") unless(length(std::get<0>(haplotype)) >= (ref_span + 1));
-				std::string haplotype_coveredSequence = std::get<0>(haplotype).substr(0, std::get<0>(haplotype).length()-1);
-				haplotype_coveredSequence = removeGaps(haplotype_coveredSequence);
-				if(haplotype_coveredSequence != reference_sequence)
+				const engineParameters& parameters = sweepParameters.at(parametersI);
+				std::string outputFn_parameters = outputFn + "." + parameters.label;
+				std::ofstream logStream;
+				logStream.open((outputFn_parameters + ".log").c_str());
+				if(! logStream.is_open())
 				{
-					alternativeSequences.insert(haplotype_coveredSequence);
+					throw std::runtime_error("Cannot open " + outputFn_parameters + ".log for writing!");
 				}
 
-				// set the running component of the haplotype to the last character
-				std::get<0>(haplotype) = std::get<0>(haplotype).substr(std::get<0>(haplotype).length()-1);
-				assert(std::get<0>(haplotype).length() == 1);
-
-				// unique key for this remaining haplotype to make sure we're not storing anything identical
-				std::stringstream uniqueRemainerKey;
-				uniqueRemainerKey << std::get<0>(haplotype) << "//" << (void*)std::get<1>(haplotype) << "//" << std::get<2>(haplotype);
-
-				std::string k = uniqueRemainerKey.str();
-				if(open_haplotypes.size() > 100)
+				time_t startTime = time(NULL);
+				for(startingHaplotype* h : rawAlignments)
 				{
-					// std::cout << k << "\n";
+					loadAlignment<engineChecks>(h, true, parameters, deduplicateAlignments, symbolicDeletionLength, loaded.at(parametersI));
 				}
+				loaded.at(parametersI).printStatistics(logStream, parameters, deduplicateAlignments, symbolicDeletionLength);
+				counted_as_loaded = true;
+				setLoaded();
 
-				if(uniqueRemainers.count(k) == 0)
-				{
-					new_open_haplotypes.push_back(haplotype);
-					uniqueRemainers.insert(k);
-				}
+				statistics.at(parametersI) = produceVCF<engineChecks>(referenceSequenceID, referenceSequence, loaded.at(parametersI).alignments_starting_at, outputFn_parameters, regionBudgetsFn, eventDriven, loaded.at(parametersI).symbolicDeletions, pipeline, parameters, logStream, nullptr);
+				seconds.at(parametersI) = time(NULL) - startTime;
 			}
-
-			open_haplotypes = new_open_haplotypes;
-			int open_haplotypes_after = open_haplotypes.size();
-
-			// only output to VCF if there are alternative sequences
-			if(alternativeSequences.size())
+			catch(std::exception& e)
 			{
-				bool all_alternativeAlleles_length_2 = true;
-				for(auto a : alternativeSequences)
-				{
-					if(a.length() != 2)
-						all_alternativeAlleles_length_2 = false;
-				}
-
-				// print "Starting at position start_open_haplotypes, have REF reference_sequence and alternative sequences " . join(' / ', @alternativeAlleles) . "\n";
-
-				if((reference_sequence.length() == 2) and all_alternativeAlleles_length_2)
+				errors.at(parametersI) = std::make_exception_ptr(std::runtime_error("Parameter set " + sweepParameters.at(parametersI).label + ": " + e.what()));
+				if(! counted_as_loaded)
 				{
-					for(auto a : alternativeSequences)
-					{
-						assert(a.substr(0, 1) == reference_sequence.substr(0, 1)); // die Dumper("Some problem with supposed SNP", posI, reference_sequence, \@alternativeAlleles, "Some problem with supposed SNP") unless(substr(alt, 0, 1) eq firstRefChar);
-					}
-
-					std::vector<std::string> alternativeAlleles_reduced;
-					for(auto a : alternativeSequences)
-					{
-						alternativeAlleles_reduced.push_back(a.substr(1,1));
-					}
-
-					outputStream <<
-							referenceSequenceID << "\t" <<
-							start_open_haplotypes+2 << "\t" <<
-							"." << "\t" <<
-							reference_sequence.substr(1,1) << "\t" <<
-							join(alternativeAlleles_reduced, ",") << "\t" <<
-							'.' << "\t" <<
-							"PASS" << "\t" <<
-							'.'
-					<< "\n";
+					setLoaded();
 				}
-				else
+			}
+			catch(...)
+			{
+				errors.at(parametersI) = std::current_exception();
+				if(! counted_as_loaded)
 				{
-					outputStream <<
-							referenceSequenceID << "\t" <<
-							start_open_haplotypes+1 << "\t" <<
-							"." << "\t" <<
-							reference_sequence << "\t" <<
-							join(std::vector<std::string>(alternativeSequences.begin(), alternativeSequences.end()), ",") << "\t" <<
-							'.' << "\t" <<
-							"PASS" << "\t" <<
-							'.'
-					<< "\n";
+					setLoaded();
 				}
 			}
-			start_open_haplotypes = posI;
+		}));
+	}
+	for(std::thread& t : workers)
+	{
+		t.join();
+	}
 
-			if((n_alignments == opened_alignments) and (open_haplotypes_after == 1))
+	for(loadedAlignments& l : loaded)
+	{
+		for(auto& alignmentsAtStart : l.alignments_starting_at)
+		{
+			for(startingHaplotype* h : alignmentsAtStart.second)
 			{
-				//
+				if(! l.shared.count(h))
+				{
+					delete(h);
+				}
 			}
-			// std::cout << "Went from " << open_haplotypes_before << " to " << open_haplotypes_after << "\n";
 		}
+		l.alignments_starting_at.clear();
+	}
+	for(startingHaplotype* h : rawAlignments)
+	{
+		delete(h);
+	}
+	rawAlignments.clear();
 
-		// debug stuff
-		if(posI == 7652900)
+	for(const std::exception_ptr& error : errors)
+	{
+		if(error)
 		{
-			std::cerr << "Haplotype lengths " << posI << "\n"; // [@gap_structure[(posI-3) .. (posI+1)]]
-			for(openHaplotype oH2 : open_haplotypes)
-			{
-				std::cerr << "\t" << std::get<0>(oH2).length() << "\tconsumed until: " << std::get<2>(oH2) << ", of length " << ((std::get<1>(oH2) == 0) ? "REF" : ("nonRef " + std::get<1>(oH2)->query_name + " / length " + ItoStr(std::get<1>(oH2)->ref.length()))) << "\n";
-			}
+			std::rethrow_exception(error);
 		}
+	}
 
-		// last_all_equal = this_all_equal;
+	std::string summaryFn = outputFn + ".parameterSweep";
+	std::ofstream summaryStream;
+	summaryStream.open(summaryFn.c_str());
+	if(! summaryStream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + summaryFn + " for writing!");
 	}
-	
-	std::cout << "Done.\n" << std::flush;
+	std::vector<std::string> header = {"label", "max_gap_length", "max_running_haplotypes_before_add", "n_alignments_loaded", "n_alignments_split", "n_alignments_sub", "n_alignments_collapsed", "n_deletions_symbolic", "n_records", "n_symbolic_records", "n_haplotypes_skipped", "max_open_haplotypes", "seconds", "output"};
+	summaryStream << join(header, "\t") << "\n";
+	std::cout << "Parameter sweep over " << sweepParameters.size() << " parameter sets:\n";
+	for(unsigned int parametersI = 0; parametersI < sweepParameters.size(); parametersI++)
+	{
+		const engineParameters& parameters = sweepParameters.at(parametersI);
+		const loadedAlignments& l = loaded.at(parametersI);
+		const sweepStatistics& s = statistics.at(parametersI);
+		summaryStream <<
+				parameters.label << "\t" <<
+				parameters.max_gap_length << "\t" <<
+				parameters.max_running_haplotypes_before_add << "\t" <<
+				l.n_alignments_loaded << "\t" <<
+				l.n_alignments_split << "\t" <<
+				l.n_alignments_sub << "\t" <<
+				l.n_alignments_collapsed << "\t" <<
+				l.n_deletions_symbolic << "\t" <<
+				s.n_records << "\t" <<
+				s.n_symbolic_records << "\t" <<
+				s.n_haplotypes_skipped << "\t" <<
+				s.max_open_haplotypes << "\t" <<
+				seconds.at(parametersI) << "\t" <<
+				outputFn + "." + parameters.label
+		<< "\n";
+		std::cout << "\t" << parameters.label << " (max. gap length " << parameters.max_gap_length << ", max. running haplotypes " << parameters.max_running_haplotypes_before_add << "): " << s.n_records << " records, " << s.n_haplotypes_skipped << " haplotypes skipped, max. " << s.max_open_haplotypes << " open haplotypes, " << seconds.at(parametersI) << "s\n";
+	}
+	summaryStream.close();
+	std::cout << "Comparison written to " << summaryFn << "\n" << std::flush;
 }
 
-
-
-void printHaplotypesAroundPosition(const std::string& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, int posI)
+void printHaplotypesAroundPosition(const ReferenceSequence& referenceSequence, const std::map<unsigned int, std::vector<startingHaplotype*>>& alignments_starting_at, int posI)
 {
 	std::cout << "Positions plot around " << posI << "\n" << std::flush;
 
@@ -1361,110 +2658,330 @@ void printHaplotypesAroundPosition(const std::string& referenceSequence, const s
 	std::cout << " -- end positions plot.\n" << std::flush;
 }
 
-vector<string> split(string input, string delimiter)
+// identical alignments would each enter the haplotype sweep in produceVCF (where recombinations are only deduplicated
+// by pointer), multiplying its state space - keep one record per (start, ref, query) that lists all contributing query names.
+// A shared h (see loadAlignment) already lists its own names, and is neither modified nor deleted; a shared alignment
+// that another one is collapsed into is replaced by a copy owned by 'loaded' first.
+void storeAlignment(startingHaplotype* h, bool shared, bool deduplicateAlignments, loadedAlignments& loaded)
 {
-	vector<string> output;
-	if(input.length() == 0)
-	{
-		return output;
-	}
-
-	if(delimiter == "")
+	std::vector<startingHaplotype*>& alignments_this_start = loaded.alignments_starting_at[h->aligment_start_pos];
+	if(deduplicateAlignments)
 	{
-		output.reserve(input.size());
-		for(unsigned int i = 0; i < input.length(); i++)
+		for(startingHaplotype*& existing : alignments_this_start)
 		{
-			output.push_back(input.substr(i, 1));
+			if((existing->alignment_last_pos == h->alignment_last_pos) && (existing->ref == h->ref) && (existing->query == h->query))
+			{
+				if(loaded.shared.count(existing))
+				{
+					loaded.shared.erase(existing);
+					existing = new startingHaplotype(*existing);
+				}
+				if(shared)
+				{
+					existing->query_names.insert(existing->query_names.end(), h->query_names.begin(), h->query_names.end());
+					existing->contig_names.insert(existing->contig_names.end(), h->contig_names.begin(), h->contig_names.end());
+				}
+				else
+				{
+					existing->query_names.push_back(h->query_name);
+					existing->contig_names.push_back(h->contig_name);
+					delete(h);
+				}
+				loaded.n_alignments_collapsed++;
+				return;
+			}
 		}
 	}
+	if(shared)
+	{
+		loaded.shared.insert(h);
+	}
 	else
 	{
-		if(input.find(delimiter) == string::npos)
-		{
-			output.push_back(input);
-		}
-		else
-		{
-			int s = 0;
-			int p = input.find(delimiter);
-
-			do {
-				output.push_back(input.substr(s, p - s));
-				s = p + delimiter.size();
-				p = input.find(delimiter, s);
-			} while (p != (int)string::npos);
-			output.push_back(input.substr(s));
-		}
+		h->query_names.push_back(h->query_name);
+		h->contig_names.push_back(h->contig_name);
 	}
-
-	return output;
+	alignments_this_start.push_back(h);
 }
 
-void eraseNL(string& s)
+// this is a hack - if this is ever violated, carry out proper scan for the first match in the alignment
+void normalizeAlignmentStart(startingHaplotype* h)
 {
-	if (!s.empty() && s[s.length()-1] == '\r') {
-	    s.erase(s.length()-1);
-	}
-	if (!s.empty() && s[s.length()-1] == '\n') {
-	    s.erase(s.length()-1);
+	if(h->aligment_start_pos == 0)
+	{
+		assert(h->ref.at(1) != '-');
+		assert(h->query.at(1) != '-');
+		h->aligment_start_pos = 1;
+		h->ref = h->ref.substr(1);
+		h->query = h->query.substr(1);
 	}
 }
 
-int StrtoI(string s)
-{
-	  stringstream ss(s);
-	  int i;
-	  ss >> i;
-	  return i;
-}
-
-unsigned int StrtoUI(string s)
-{
-	  stringstream ss(s);
-	  unsigned int i;
-	  ss >> i;
-	  return i;
-}
-
-string ItoStr(int i)
-{
-	std::stringstream sstm;
-	sstm << i;
-	return sstm.str();
-}
-
-string join(vector<string> parts, string delim)
+// Splits an input alignment at gap runs longer than parameters.max_gap_length (and at symbolic deletions) and stores the
+// parts in 'loaded'. Takes ownership of h, unless h is shared: then it stays with the caller (who has normalized its start
+// and filled in its query_names) and is only referenced by 'loaded' if it is not split.
+template<typename checkPolicy>
+void loadAlignment(startingHaplotype* h, bool shared, const engineParameters& parameters, bool deduplicateAlignments, long long symbolicDeletionLength, loadedAlignments& loaded)
 {
-	if(parts.size() == 0)
-		return "";
-
-	string ret = parts.at(0);
-
-	for(unsigned int i = 1; i < parts.size(); i++)
+	if(shared)
 	{
-		ret.append(delim);
-		ret.append(parts.at(i));
+		assert(h->aligment_start_pos != 0);
 	}
+	else
+	{
+		normalizeAlignmentStart(h);
+	}
+	
+	long long lastPos_control = (long long)h->aligment_start_pos - 1;
+	long long firstMatchPos_reference = -1;
+	long long lastMatchPos_reference = -1;
+	
+	std::string running_ref;
+	std::string running_query;
+	
+	long long runningNonMatchPositions = 0;
+	long long runningRefGapCharacters = 0;
+	long long runningQueryGapCharacters = 0;
+	long long runningRefPos = (long long)h->aligment_start_pos - 1;
+	//long long total_removedGappyRegions = 0;
+	std::vector<startingHaplotype*> haplotype_parts;
+	
+	std::string reconstituted_ref;
+	std::string reconstituted_query;
+	
+	for(unsigned int i = 0; i < h->ref.length(); i++)
+	{
+		unsigned char c_ref = h->ref.at(i);	
+		unsigned char c_query = h->query.at(i);	
+		
+		if((c_ref != '-') && (c_ref != '*'))
+		{
+			runningRefPos++;
+		}
+		
+		bool isMatchOrMismatch = ((c_ref != '-') && (c_ref != '*') && (c_query != '-') && (c_query != '*'));
+		bool isRefGap = ((c_ref == '-') || (c_ref == '*'));  
+		bool isQueryGap = ((c_query == '-') || (c_query == '*'));
+		
+		if((i == 0) || (i == (h->ref.length() - 1)))
+		{
+			assert(isMatchOrMismatch);					
+		}
+	
+		if(isMatchOrMismatch)
+		{
+			bool isSymbolicDeletion = (symbolicDeletionLength > 0) && (runningRefGapCharacters == 0) && (runningQueryGapCharacters >= symbolicDeletionLength);
+			if(isSymbolicDeletion)
+			{
+				assert(firstMatchPos_reference != -1);
+				assert((runningRefPos - lastMatchPos_reference - 1) == runningQueryGapCharacters);
+				loaded.symbolicDeletions[std::make_pair(lastMatchPos_reference, runningRefPos - 1)]++;
+				loaded.n_deletions_symbolic++;
+			}
 
-	return ret;
-}
-
-
+			if((runningQueryGapCharacters > parameters.max_gap_length) || isSymbolicDeletion)
+			{
+				// we have a match, but too many gaps, so we want to close!
+				
+				assert(firstMatchPos_reference != -1);
+				long long remainingCharacters = running_ref.length() - runningNonMatchPositions;
+				assert(remainingCharacters >= 0);
+				std::string removeRef;
+				std::string removeQuery;
+				if(runningNonMatchPositions > 0)
+				{
+						assert(running_ref.length() > remainingCharacters);
+						removeRef = running_ref.substr(remainingCharacters);
+						removeQuery = running_query.substr(remainingCharacters);
+				}
+				running_ref = running_ref.substr(0, remainingCharacters);
+				running_query = running_query.substr(0, remainingCharacters);
+				assert(running_ref.length() == remainingCharacters);
+				assert(running_query.length() == remainingCharacters);
+				//total_removedGappyRegions += runningNonMatchPositions;
+				
+				if(checkPolicy::full)
+				{
+					reconstituted_ref.append(running_ref);
+					reconstituted_query.append(running_query);
+					
+					reconstituted_ref.append(removeRef);
+					reconstituted_query.append(removeQuery);
+				}
 
+				if(running_ref.length())
+				{
+					startingHaplotype* h_part = new startingHaplotype();
+					h_part->ref = running_ref;
+					h_part->query = running_query;
+					h_part->query_name = h->query_name + "_part" + std::to_string(haplotype_parts.size());
+					h_part->contig_name = h->contig_name;
+					h_part->aligment_start_pos = firstMatchPos_reference;
+					h_part->alignment_last_pos = lastMatchPos_reference;
+					haplotype_parts.push_back(h_part);
+					/*
+					std::cerr << "New alignment from " << h->query_name << "\n";
+					std::cerr << "\tLength: " << running_ref.length() << "\n";
+					std::cerr << "\tR Start : " << h_part->aligment_start_pos << "\n";
+					std::cerr << "\tR Stop  : " << h_part->alignment_last_pos << "\n";
+					std::cerr << "\trunningRefGapCharacters  : " << runningRefGapCharacters << "\n";
+					std::cerr << "\trunningNonMatchPositions  : " << runningNonMatchPositions << "\n";
+					std::cerr << "\trunningQueryGapCharacters  : " << runningQueryGapCharacters << "\n";
+					
+					//std::cerr << "\tC Start : " << h_part->aligment_start_pos << "\n";
+					//std::cerr << "\tC Stop  : " << h_part->alignment_last_pos << "\n";
+					//std::cerr << "\tRef    : " << running_ref << "\n";
+					//std::cerr << "\tQuery  : " << running_query << "\n";
+					std::cerr << std::flush;
+					*/
+
+					assert(!((h_part->aligment_start_pos == 46398487) && (h_part->alignment_last_pos == 46398489)));
+				}
+				
+				running_ref.clear();
+				running_query.clear();
+				firstMatchPos_reference = -1;
+			}		
+			
+			if(firstMatchPos_reference == -1)
+			{
+				firstMatchPos_reference = runningRefPos;
+			}
+			
+			lastMatchPos_reference = runningRefPos;
+			
+			runningNonMatchPositions = 0;
+			runningRefGapCharacters = 0;
+			runningQueryGapCharacters = 0;
+		}
+		else
+		{
+			runningNonMatchPositions++;
+			if(isRefGap && !isQueryGap)
+				runningRefGapCharacters++;
+			if(isQueryGap && !isRefGap)
+				runningQueryGapCharacters++;					
+		}
+		
+		running_ref.push_back(c_ref);
+		running_query.push_back(c_query);
+		
+		if((c_ref != '-') and (c_ref != '*'))
+		{
+			lastPos_control++;
+		}
+	}
+	//std::cerr << "lastPos_control: " << lastPos_control << "\n";
+	//std::cerr << "h->alignment_last_pos: " << h->alignment_last_pos << "\n" << std::flush;
+	if(lastPos_control != ((long long)h->alignment_last_pos))
+	{
+		std::cerr << "h->aligment_start_pos: " << h->aligment_start_pos << "\n";
+		std::cerr << "lastPos_control: " << lastPos_control << "\n";
+		std::cerr << "h->alignment_last_pos: " << h->alignment_last_pos << "\n";
+		std::cerr << std::flush;
+	}
+	assert(lastPos_control == ((long long)h->alignment_last_pos));
+	if(lastPos_control != (lastMatchPos_reference))
+	{
+		std::cerr << "h->aligment_start_pos: " << h->aligment_start_pos << "\n";
+		std::cerr << "lastPos_control: " << lastPos_control << "\n";
+		std::cerr << "h->alignment_last_pos: " << h->alignment_last_pos << "\n";
+		std::cerr << "lastMatchPos_reference: " << lastMatchPos_reference << "\n";
+		std::cerr << std::flush;
+	}
+	assert(lastPos_control == lastMatchPos_reference);
+	assert(runningNonMatchPositions <= parameters.max_gap_length);
 
-std::string removeGaps(std::string in)
-{
-	std::string out;
-	out.reserve(in.size());
-	for(size_t i = 0; i < in.size(); i++)
+	if(running_ref.length())
 	{
-		if((in.at(i) != '_') && (in.at(i) != '-') && (in.at(i) != '*'))
+		startingHaplotype* h_part = new startingHaplotype();
+		h_part->ref = running_ref;
+		h_part->query = running_query;
+		h_part->query_name = h->query_name + "_part" + std::to_string(haplotype_parts.size());
+		h_part->contig_name = h->contig_name;
+		h_part->aligment_start_pos = firstMatchPos_reference;
+		h_part->alignment_last_pos = lastMatchPos_reference;
+		if(checkPolicy::full)
 		{
-			out.push_back(in.at(i));
+			reconstituted_ref.append(running_ref);
+			reconstituted_query.append(running_query);
 		}
+		haplotype_parts.push_back(h_part);
 	}
-	return out;
-}
-
+				
+	assert((! checkPolicy::full) || (reconstituted_ref == h->ref));
+	assert((! checkPolicy::full) || (reconstituted_query == h->query));
+							
+	if(haplotype_parts.size() > 1)
+	{
+		/*
+		std::cerr << "Split " << h->query_name << " into multiple parts -- removed " << total_removedGappyRegions << "gaps.\n";		
+		h->print();
+		for(unsigned int pI = 0; pI < haplotype_parts.size(); pI++)
+		{
+			std::cerr << "Part " << pI << " ";
+			haplotype_parts.at(pI)->print();
+		}
+		assert(1 == 0);
+		*/
+		loaded.n_alignments_split++;
+		if(! shared)
+		{
+			delete(h);
+		}
+		for(auto hP : haplotype_parts)
+		{
+			storeAlignment(hP, false, deduplicateAlignments, loaded);
+			loaded.n_alignments_sub++;
+		}
+		// std::cerr << "\t\tSubalignments: " << n_alignments_sub << "\n" << std::flush;
+	}
+	else
+	{
+		delete(haplotype_parts.at(0));
+		storeAlignment(h, shared, deduplicateAlignments, loaded);
+		loaded.n_alignments_loaded++;					
+	}
+	
 
+	
+	/*
+	int running_gap_length = 0;
+	int max_running_gap_length = 0;
+	std::vector<std::string>
+	for(unsigned int i = 0; i < h->ref.length(); i++)
+	{
+		unsigned char c_ref = h->ref.at(i);
+		unsigned char c_q = h->query.at(i);
+		if((c_ref == '-') or (c_ref == '*'))
+		{
+			running_gap_length++;
+		}
+		else
+		{
+			if(running_gap_length)
+			{
+				if(running_gap_length > max_running_gap_length)
+					max_running_gap_length = running_gap_length;
+				
+				if(max_running_gap_length > parameters.max_gap_length)
+				{
+					
+				}
+			}
+			running_gap_length = 0;
+		}
+	}
+	assert(running_gap_length == 0);
 
+	if(max_running_gap_length <= parameters.max_gap_length)
+	{
+		alignments_starting_at[h->aligment_start_pos].push_back(h);
+		loaded.n_alignments_loaded++;
+	}
+	else
+	{
+		
+	}
+	*/
+}
@@ -0,0 +1,375 @@
+//============================================================================
+// Name        : FAS2BAM.cpp
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+/*
+
+   Native implementation of scripts/fas2bam.pl (requires htslib - build with 'make htslib HTSLIB_DIR=...').
+
+   Converts many window MSAs (MAFFT output, including a reference entry) into window BAMs in one invocation -
+   either a single --input / --output pair, or an --inputList file with one tab-separated 'input output' pair
+   per line. The reference header (--bamheader, the same 'name<tab>length' file that fas2bam.pl passes to
+   'samtools view -t') is parsed once, and records are encoded directly with bam_set1, so there is no process,
+   no interpreter and no SAM text round trip per window.
+
+   The records are the same as those written by fas2bam.pl: one record per non-reference entry, in sorted order
+   of entry names, with flag 0, mapping quality 0, the '_FIRST' suffix removed from the read name, the reference
+   entry '<ref>' or '<ref>_FIRST' and the CIGAR string built column by column from the padded alignment
+   (leading D and P operations are dropped for '_FIRST' entries, and entries without aligned bases are written
+   at position 0). The CIGAR is run-length encoded while walking the alignment columns, so each row is processed
+   in a single pass.
+
+   A window that cannot be converted (missing reference entry, unequal lengths, illegal characters) is reported
+   on stderr and its output is removed; the remaining windows are still converted, and the exit status is
+   non-zero if any window failed.
+
+*/
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <assert.h>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <cstdio>
+#include <cctype>
+
+#include <htslib/sam.h>
+
+#include "Utilities.h"
+
+class windowAlignment
+{
+public:
+	std::string readName;
+	hts_pos_t pos;
+	std::vector<uint32_t> cigar;
+	std::string seq;
+};
+
+std::map<std::string, std::string> readMSA(const std::string& fn);
+std::vector<windowAlignment> encodeMSA(const std::map<std::string, std::string>& MSA, const std::string& refID, const std::string& fn);
+void writeWindowBAM(const std::string& fn, sam_hdr_t* header, int32_t tid, const std::vector<windowAlignment>& alignments);
+
+int main(int argc, char *argv[]) {
+	std::vector<std::string> ARG (argv + 1, argv + argc + !argc);
+	std::map<std::string, std::string> arguments;
+
+	for(unsigned int i = 0; i < ARG.size(); i++)
+	{
+		if((ARG.at(i).length() > 2) && (ARG.at(i).substr(0, 2) == "--"))
+		{
+			std::string argname = ARG.at(i).substr(2);
+			std::string argvalue = ARG.at(i+1);
+			arguments[argname] = argvalue;
+		}
+	}
+
+	if(!(arguments.count("bamheader") && ((arguments.count("input") && arguments.count("output")) || arguments.count("inputList"))))
+	{
+		std::cerr << "Usage: FAS2BAM --bamheader <reference names and lengths> (--input <window.mfa> --output <window.bam> | --inputList <file with one 'input<tab>output' pair per line>) [--ref ref]\n";
+		return 1;
+	}
+
+	std::string refID = "ref";
+	if(arguments.count("ref"))
+	{
+		refID = arguments.at("ref");
+	}
+
+	std::vector<std::pair<std::string, std::string>> windows;
+	if(arguments.count("input"))
+	{
+		windows.push_back(make_pair(arguments.at("input"), arguments.at("output")));
+	}
+	if(arguments.count("inputList"))
+	{
+		std::ifstream listStream;
+		listStream.open(arguments.at("inputList").c_str());
+		if(!listStream.is_open())
+		{
+			throw std::runtime_error("Cannot open file " + arguments.at("inputList"));
+		}
+		std::string line;
+		while(listStream.good())
+		{
+			std::getline(listStream, line);
+			eraseNL(line);
+			if(line.length() == 0)
+				continue;
+			std::vector<std::string> fields = split(line, "\t");
+			if(fields.size() != 2)
+			{
+				throw std::runtime_error("Expected 'input<tab>output' in " + arguments.at("inputList") + ", got: " + line);
+			}
+			windows.push_back(make_pair(fields.at(0), fields.at(1)));
+		}
+	}
+
+	std::string headerText;
+	{
+		std::ifstream headerStream;
+		headerStream.open(arguments.at("bamheader").c_str());
+		if(!headerStream.is_open())
+		{
+			throw std::runtime_error("Cannot open file " + arguments.at("bamheader"));
+		}
+		std::string line;
+		while(headerStream.good())
+		{
+			std::getline(headerStream, line);
+			eraseNL(line);
+			if(line.length() == 0)
+				continue;
+			std::vector<std::string> fields = split(line, "\t");
+			if(fields.size() < 2)
+			{
+				throw std::runtime_error("Expected 'name<tab>length' in " + arguments.at("bamheader") + ", got: " + line);
+			}
+			headerText += "@SQ\tSN:" + fields.at(0) + "\tLN:" + fields.at(1) + "\n";
+		}
+	}
+
+	sam_hdr_t* header = sam_hdr_init();
+	if((header == 0) || (sam_hdr_add_lines(header, headerText.c_str(), headerText.length()) != 0))
+	{
+		throw std::runtime_error("Cannot create header from " + arguments.at("bamheader"));
+	}
+	int32_t tid = sam_hdr_name2tid(header, refID.c_str());
+	if(tid < 0)
+	{
+		throw std::runtime_error("Reference " + refID + " not present in " + arguments.at("bamheader"));
+	}
+
+	size_t n_failed = 0;
+	for(const std::pair<std::string, std::string>& window : windows)
+	{
+		try
+		{
+			std::map<std::string, std::string> MSA = readMSA(window.first);
+			std::vector<windowAlignment> alignments = encodeMSA(MSA, refID, window.first);
+			writeWindowBAM(window.second, header, tid, alignments);
+		}
+		catch(std::exception& e)
+		{
+			std::cerr << "FAS2BAM: cannot convert " << window.first << ": " << e.what() << "\n";
+			std::remove(window.second.c_str());
+			n_failed++;
+		}
+	}
+
+	sam_hdr_destroy(header);
+
+	std::cout << "FAS2BAM: converted " << (windows.size() - n_failed) << " of " << windows.size() << " windows.\n" << std::flush;
+
+	return (n_failed ? 1 : 0);
+}
+
+std::map<std::string, std::string> readMSA(const std::string& fn)
+{
+	std::ifstream inputStream;
+	inputStream.open(fn.c_str());
+	if(!inputStream.is_open())
+	{
+		throw std::runtime_error("Cannot open file " + fn);
+	}
+	std::stringstream buffer;
+	buffer << inputStream.rdbuf();
+	const std::string contents = buffer.str();
+
+	// Like read_fas_file in fas2bam.pl: later entries with the same ID replace earlier ones, and entries without sequence are ignored
+	std::map<std::string, std::string> MSA;
+	std::string currentID;
+	std::string currentSequence;
+	size_t lineStart = 0;
+	while(lineStart < contents.length())
+	{
+		size_t lineEnd = contents.find('\n', lineStart);
+		if(lineEnd == std::string::npos)
+			lineEnd = contents.length();
+		std::string line = contents.substr(lineStart, lineEnd - lineStart);
+		lineStart = lineEnd + 1;
+		eraseNL(line);
+
+		if((line.length() > 0) && (line.at(0) == '>'))
+		{
+			size_t idStart = line.find_first_not_of(" \t", 1);
+			if(idStart != std::string::npos)
+			{
+				if(currentID.length() && currentSequence.length())
+				{
+					MSA[currentID] = currentSequence;
+				}
+				size_t idEnd = line.find_first_of(" \t", idStart);
+				currentID = line.substr(idStart, (idEnd == std::string::npos) ? std::string::npos : (idEnd - idStart));
+				currentSequence.clear();
+				continue;
+			}
+		}
+
+		if(currentID.length() == 0)
+		{
+			throw std::runtime_error("Illegal format (no entry definition line)");
+		}
+		for(char c : line)
+		{
+			switch(c)
+			{
+				case 'A': case 'C': case 'G': case 'T': case 'N': case 'R': case 'Y': case 'S': case 'W': case 'K': case 'M': case 'B':
+				case 'a': case 'c': case 'g': case 't': case 'n': case 'r': case 'y': case 's': case 'w': case 'k': case 'm': case 'b':
+				case '-':
+					break;
+				default:
+					throw std::runtime_error("Illegal character '" + std::string(1, c) + "' in entry " + currentID);
+			}
+		}
+		currentSequence += line;
+	}
+	if(currentID.length() && currentSequence.length())
+	{
+		MSA[currentID] = currentSequence;
+	}
+
+	return MSA;
+}
+
+std::vector<windowAlignment> encodeMSA(const std::map<std::string, std::string>& MSA, const std::string& refID, const std::string& fn)
+{
+	std::string refEntry = refID;
+	if(!MSA.count(refEntry))
+	{
+		refEntry += "_FIRST";
+	}
+	if(!MSA.count(refEntry))
+	{
+		throw std::runtime_error("No entry for reference " + refEntry + " in " + fn);
+	}
+	const std::string& refSequence = MSA.at(refEntry);
+
+	std::vector<windowAlignment> alignments;
+	alignments.reserve(MSA.size() - 1);
+	for(const std::pair<const std::string, std::string>& entry : MSA)
+	{
+		if(entry.first == refEntry)
+			continue;
+
+		const std::string& entrySequence = entry.second;
+		if(entrySequence.length() != refSequence.length())
+		{
+			throw std::runtime_error(entry.first + " and " + refEntry + " have unequal lengths (" + ItoStr(entrySequence.length()) + ", " + ItoStr(refSequence.length()) + ")");
+		}
+
+		bool isFirst = ((entry.first.length() >= 6) && (entry.first.substr(entry.first.length() - 6) == "_FIRST"));
+
+		windowAlignment alignment;
+		alignment.readName = isFirst ? entry.first.substr(0, entry.first.length() - 6) : entry.first;
+		alignment.seq.reserve(entrySequence.length());
+
+		hts_pos_t startPos = 1;
+		bool matchSeenYet = false;
+		int currentOp = -1;
+		uint32_t currentOpLength = 0;
+		for(size_t columnI = 0; columnI < refSequence.length(); columnI++)
+		{
+			bool entryGap = (entrySequence[columnI] == '-');
+			bool refGap = (refSequence[columnI] == '-');
+
+			int op;
+			if(!entryGap && !refGap)
+			{
+				matchSeenYet = true;
+				op = BAM_CMATCH;
+				alignment.seq.push_back(toupper(entrySequence[columnI]));
+			}
+			else if(entryGap && !refGap)
+			{
+				if(!matchSeenYet)
+				{
+					startPos++;
+				}
+				op = BAM_CDEL;
+				if(isFirst && !matchSeenYet)
+					continue;
+			}
+			else if(!entryGap && refGap)
+			{
+				op = BAM_CINS;
+				alignment.seq.push_back(toupper(entrySequence[columnI]));
+			}
+			else
+			{
+				op = BAM_CPAD;
+				if(isFirst && !matchSeenYet)
+					continue;
+			}
+
+			if(op == currentOp)
+			{
+				currentOpLength++;
+			}
+			else
+			{
+				if(currentOpLength)
+				{
+					alignment.cigar.push_back(bam_cigar_gen(currentOpLength, currentOp));
+				}
+				currentOp = op;
+				currentOpLength = 1;
+			}
+		}
+		if(currentOpLength)
+		{
+			alignment.cigar.push_back(bam_cigar_gen(currentOpLength, currentOp));
+		}
+
+		// 1-based like the SAM text written by fas2bam.pl (which uses position 0 if there are no aligned bases)
+		alignment.pos = matchSeenYet ? startPos : 0;
+		alignments.push_back(alignment);
+	}
+
+	return alignments;
+}
+
+void writeWindowBAM(const std::string& fn, sam_hdr_t* header, int32_t tid, const std::vector<windowAlignment>& alignments)
+{
+	std::string mode = ((fn.length() > 4) && (fn.substr(fn.length() - 4) == ".bam")) ? "wb" : "w";
+	samFile* output = sam_open(fn.c_str(), mode.c_str());
+	if(output == 0)
+	{
+		throw std::runtime_error("Cannot open " + fn + " for writing");
+	}
+	if(sam_hdr_write(output, header) != 0)
+	{
+		sam_close(output);
+		throw std::runtime_error("Cannot write header to " + fn);
+	}
+
+	bam1_t* record = bam_init1();
+	for(const windowAlignment& alignment : alignments)
+	{
+		if(bam_set1(record, alignment.readName.length(), alignment.readName.c_str(), 0, tid, alignment.pos - 1, 0, alignment.cigar.size(), alignment.cigar.data(), -1, -1, 0, alignment.seq.length(), alignment.seq.c_str(), 0, 0) < 0)
+		{
+			bam_destroy1(record);
+			sam_close(output);
+			throw std::runtime_error("Cannot encode alignment for " + alignment.readName);
+		}
+		if(sam_write1(output, header, record) < 0)
+		{
+			bam_destroy1(record);
+			sam_close(output);
+			throw std::runtime_error("Cannot write to " + fn);
+		}
+	}
+	bam_destroy1(record);
+
+	if(sam_close(output) != 0)
+	{
+		throw std::runtime_error("Cannot close " + fn);
+	}
+}
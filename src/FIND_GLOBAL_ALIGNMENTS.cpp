@@ -0,0 +1,1018 @@
+//============================================================================
+// Name        : FIND_GLOBAL_ALIGNMENTS.cpp
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+/*
+
+   Native implementation of the chain scoring / traversal in scripts/FIND_GLOBAL_ALIGNMENTS.pl.
+
+   Input is the *.sortedWithHeader file produced by BAM2ALIGNMENT.pl (one line per local alignment, sorted by read ID),
+   output are <outputFile>.sam.unfiltered, the truncated reads file and the read lengths file - in the same format
+   as the Perl implementation, which then takes care of CIGAR filtering, BAM conversion and sorting.
+
+   The Perl implementation finds, for each chain, the best predecessor by looking at all previous chains (quadratic
+   in the number of chains per read, chromosome and strand). Here chains are sorted by reference start and the
+   predecessor score is written as
+
+       out_j + S_gap * (delta_read + delta_reference) = [out_j - S_gap * (lastPos_read_j + lastPos_reference_j)] + S_gap * (firstPos_read_i + firstPos_reference_i - 2)
+
+   so that the best predecessor is a prefix maximum (over lastPos_read_j < firstPos_read_i) of the bracketed term,
+   restricted to the chains with lastPos_reference_j < firstPos_reference_i. The latter are inserted into a Fenwick
+   tree in order of lastPos_reference, giving O(n log n) per read. Ties are broken exactly like which_max() in the
+   Perl implementation: the start of the read wins, then the chain with the smallest index.
+
+   Reads are processed in parallel (--threads), output is written in input order.
+
+   The only intended difference to the Perl implementation: where several chromosome/strand combinations reach the
+   same maximum score, Perl picks the first one in (random) hash order - we pick the first one in input order.
+
+*/
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <assert.h>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+#include <thread>
+
+#include "Utilities.h"
+
+int S_match = 1;
+int S_mismatch = -1;
+int S_gap = -1;
+bool endsFree_reference = true;
+
+class alignmentLine
+{
+public:
+	std::string readID;
+	std::string chromosome;
+	int firstPos_reference;
+	int lastPos_reference;
+	int firstPos_read;
+	int lastPos_read;
+	std::string strand;
+	int n_matches;
+	int n_mismatches;
+	int n_gaps;
+	std::string alignment_reference;
+	std::string alignment_read;
+};
+
+class chain
+{
+public:
+	const alignmentLine* source;
+	size_t alignment_columns; // chains created during enrichment use a prefix of the source alignment
+
+	int firstPos_reference;
+	int lastPos_reference;
+	int firstPos_read;
+	int lastPos_read;
+	int n_matches;
+	int n_mismatches;
+	int n_gaps;
+	bool enrich;
+
+	long long chainTraversalScore;
+	long long chainOutputScore;
+	int chainOutputScoreOrigin; // -1 means start of the read
+
+	std::string alignment_reference() const { return source->alignment_reference.substr(0, alignment_columns); }
+	std::string alignment_read() const { return source->alignment_read.substr(0, alignment_columns); }
+};
+
+class readResult
+{
+public:
+	bool haveAlignment;
+	std::string SAMline;
+	std::string readID;
+	int alignment_length;
+	int n_chains;
+	bool removed_front;
+	bool removed_back;
+
+	readResult() : haveAlignment(false), alignment_length(0), n_chains(0), removed_front(false), removed_back(false) {}
+};
+
+class prefixMaxima
+{
+	// Fenwick tree over compressed lastPos_read values, storing (key, chain index) - larger key wins, then smaller index
+	std::vector<long long> keys;
+	std::vector<int> indices;
+
+	static bool better(long long key1, int index1, long long key2, int index2)
+	{
+		if(index2 == -1)
+			return (index1 != -1);
+		if(index1 == -1)
+			return false;
+		return ((key1 > key2) || ((key1 == key2) && (index1 < index2)));
+	}
+
+public:
+	prefixMaxima(size_t n) : keys(n + 1, 0), indices(n + 1, -1) {}
+
+	void insert(size_t position, long long key, int index)
+	{
+		for(size_t i = position + 1; i < keys.size(); i += (i & (-i)))
+		{
+			if(better(key, index, keys.at(i), indices.at(i)))
+			{
+				keys.at(i) = key;
+				indices.at(i) = index;
+			}
+		}
+	}
+
+	// best entry among positions [0, n_positions)
+	std::pair<long long, int> query(size_t n_positions) const
+	{
+		long long best_key = 0;
+		int best_index = -1;
+		for(size_t i = n_positions; i > 0; i -= (i & (-i)))
+		{
+			if(better(keys.at(i), indices.at(i), best_key, best_index))
+			{
+				best_key = keys.at(i);
+				best_index = indices.at(i);
+			}
+		}
+		return std::make_pair(best_key, best_index);
+	}
+};
+
+std::string safeSubstr(const std::string& s, long long start, long long length);
+std::string removeDashes(const std::string& s);
+std::vector<chain> enrichChains(const std::vector<const alignmentLine*>& chainsIn, const std::string& completeReadSequence_plus, const std::string& completeReadSequence_minus, const std::string& referenceSequence);
+readResult processRead(const std::vector<std::string>& lines_current_read, const std::vector<std::string>& alignments_headerFields, const std::map<std::string, std::string>& reference);
+
+int main(int argc, char *argv[]) {
+	std::vector<std::string> ARG (argv + 1, argv + argc + !argc);
+	std::map<std::string, std::string> arguments;
+
+	for(unsigned int i = 0; i < ARG.size(); i++)
+	{
+		if((ARG.at(i).length() > 2) && (ARG.at(i).substr(0, 2) == "--"))
+		{
+			std::string argname = ARG.at(i).substr(2);
+			std::string argvalue = ARG.at(i+1);
+			arguments[argname] = argvalue;
+		}
+	}
+
+	if(!(arguments.count("alignmentsFile") && arguments.count("referenceFasta") && arguments.count("outputFile") && arguments.count("outputTruncatedReads") && arguments.count("outputReadLengths")))
+	{
+		std::cerr << "Usage: FIND_GLOBAL_ALIGNMENTS --alignmentsFile <*.sortedWithHeader> --referenceFasta <FASTA> --outputFile <output prefix; writes <output prefix>.sam.unfiltered> --outputTruncatedReads <file> --outputReadLengths <file> [--threads N] [--S_match 1] [--S_mismatch -1] [--S_gap -1] [--endsFreeReference 1]\n";
+		return 1;
+	}
+
+	int threads = 1;
+	if(arguments.count("threads"))
+	{
+		threads = StrtoI(arguments.at("threads"));
+		assert(threads > 0);
+	}
+	if(arguments.count("S_match"))
+		S_match = StrtoI(arguments.at("S_match"));
+	if(arguments.count("S_mismatch"))
+		S_mismatch = StrtoI(arguments.at("S_mismatch"));
+	if(arguments.count("S_gap"))
+		S_gap = StrtoI(arguments.at("S_gap"));
+	if(arguments.count("endsFreeReference"))
+		endsFree_reference = (StrtoI(arguments.at("endsFreeReference")) != 0);
+
+	std::cout << "Read " << arguments.at("referenceFasta") << "\n" << std::flush;
+	std::map<std::string, std::string> reference;
+	std::vector<std::string> referenceIDs;
+	readFASTA(arguments.at("referenceFasta"), reference, referenceIDs);
+	std::cout << "\tdone.\n" << std::flush;
+
+	std::string outputFile_sam = arguments.at("outputFile") + ".sam.unfiltered";
+	std::ofstream SAMoutputStream;
+	SAMoutputStream.open(outputFile_sam.c_str());
+	if(! SAMoutputStream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + outputFile_sam + " for writing!");
+	}
+	SAMoutputStream << "@HD\tVN:1.5" << "\n";
+	for(auto refChromosome : referenceIDs)
+	{
+		SAMoutputStream << "@SQ\tSN:" << refChromosome << "\tLN:" << reference.at(refChromosome).length() << "\n";
+	}
+
+	std::ifstream inputStream;
+	inputStream.open(arguments.at("alignmentsFile").c_str());
+	if(! inputStream.is_open())
+	{
+		throw std::runtime_error("Could not open file " + arguments.at("alignmentsFile"));
+	}
+	std::string alignments_headerLine;
+	std::getline(inputStream, alignments_headerLine);
+	eraseNL(alignments_headerLine);
+	std::vector<std::string> alignments_headerFields = split(alignments_headerLine, "\t");
+	if(!(alignments_headerFields.size() && (alignments_headerFields.at(0) == "readID")))
+	{
+		throw std::runtime_error("File " + arguments.at("alignmentsFile") + " does not start with the expected header line");
+	}
+
+	std::ofstream truncatedStream;
+	truncatedStream.open(arguments.at("outputTruncatedReads").c_str());
+	if(! truncatedStream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + arguments.at("outputTruncatedReads") + " for writing!");
+	}
+	std::ofstream lengthsStream;
+	lengthsStream.open(arguments.at("outputReadLengths").c_str());
+	if(! lengthsStream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + arguments.at("outputReadLengths") + " for writing!");
+	}
+
+	long long n_output_alignments = 0;
+	long long n_chains_sum = 0;
+	long long n_alignments_leftGapsRemoved = 0;
+	long long n_alignments_rightGapsRemoved = 0;
+	long long n_alignments_leftAndRightGapsRemoved = 0;
+
+	std::set<std::string> processed_readIDs;
+	size_t reads_per_batch = 1000 * threads;
+	std::vector<std::vector<std::string>> batch;
+
+	auto processBatch = [&]() {
+		std::vector<readResult> results(batch.size());
+		std::vector<std::exception_ptr> exceptions(threads);
+		std::vector<std::thread> workers;
+		for(int threadI = 0; threadI < threads; threadI++)
+		{
+			workers.push_back(std::thread([&, threadI]() {
+				try
+				{
+					for(size_t readI = threadI; readI < batch.size(); readI += threads)
+					{
+						results.at(readI) = processRead(batch.at(readI), alignments_headerFields, reference);
+					}
+				}
+				catch(...)
+				{
+					exceptions.at(threadI) = std::current_exception();
+				}
+			}));
+		}
+		for(auto& worker : workers)
+		{
+			worker.join();
+		}
+		for(auto e : exceptions)
+		{
+			if(e)
+			{
+				std::rethrow_exception(e);
+			}
+		}
+
+		for(const readResult& result : results)
+		{
+			if(! result.haveAlignment)
+				continue;
+
+			SAMoutputStream << result.SAMline << "\n";
+
+			n_chains_sum += result.n_chains;
+			n_output_alignments++;
+
+			if(result.removed_front && result.removed_back)
+			{
+				n_alignments_leftAndRightGapsRemoved++;
+			}
+			else if(result.removed_front)
+			{
+				n_alignments_leftGapsRemoved++;
+			}
+			else if(result.removed_back)
+			{
+				n_alignments_rightGapsRemoved++;
+			}
+			if(result.removed_front || result.removed_back)
+			{
+				truncatedStream << result.readID << "\n";
+			}
+
+			lengthsStream << result.readID << "\t" << result.alignment_length << "\n";
+		}
+		batch.clear();
+	};
+
+	std::string line;
+	std::string currentReadID;
+	std::vector<std::string> lines_current_read;
+	long long lineNumber = 1;
+	while(inputStream.good())
+	{
+		std::getline(inputStream, line);
+		lineNumber++;
+		if((lineNumber % 10000) == 0)
+		{
+			std::cout << "Read line " << lineNumber << "\n" << std::flush;
+		}
+
+		eraseNL(line);
+		if(line.length() == 0)
+			continue;
+
+		size_t firstTab = line.find("\t");
+		if((firstTab == std::string::npos) || (firstTab == 0))
+		{
+			throw std::runtime_error("Line " + ItoStr(lineNumber) + " of " + arguments.at("alignmentsFile") + " does not start with a read ID");
+		}
+		std::string readID = line.substr(0, firstTab);
+		if(readID != currentReadID)
+		{
+			if(lines_current_read.size())
+			{
+				batch.push_back(lines_current_read);
+				if(batch.size() >= reads_per_batch)
+				{
+					processBatch();
+				}
+			}
+			lines_current_read.clear();
+			currentReadID = readID;
+
+			if(processed_readIDs.count(readID))
+			{
+				throw std::runtime_error("Read ID " + readID + " has been seen already - are you using a sorted input file?");
+			}
+			processed_readIDs.insert(readID);
+		}
+
+		lines_current_read.push_back(line);
+	}
+	if(lines_current_read.size())
+	{
+		batch.push_back(lines_current_read);
+	}
+	processBatch();
+
+	SAMoutputStream.close();
+	truncatedStream.close();
+	lengthsStream.close();
+
+	std::cout << "\nDone.\n\nStatistics:\n";
+	std::cout << "\tAlignments: " << n_output_alignments << "\n";
+	std::cout << "\tAvg chains per alignment: " << ((n_output_alignments > 0) ? ((double)n_chains_sum / (double)n_output_alignments) : 0) << "\n";
+	std::cout << "\tAlignments with both ends trimmed: " << n_alignments_leftAndRightGapsRemoved << "\n";
+	std::cout << "\tAlignments with left end trimmed: " << n_alignments_leftGapsRemoved << "\n";
+	std::cout << "\tAlignments with right end trimmed: " << n_alignments_rightGapsRemoved << "\n";
+
+	std::cout << "\n\nDone. Produced SAM file " << outputFile_sam << "\n\n" << std::flush;
+
+	return 0;
+}
+
+readResult processRead(const std::vector<std::string>& lines_current_read, const std::vector<std::string>& alignments_headerFields, const std::map<std::string, std::string>& reference)
+{
+	assert(lines_current_read.size());
+
+	std::map<std::string, size_t> field_index;
+	for(size_t fieldI = 0; fieldI < alignments_headerFields.size(); fieldI++)
+	{
+		field_index[alignments_headerFields.at(fieldI)] = fieldI;
+	}
+	for(std::string requiredField : {"readID", "chromosome", "firstPos_reference", "lastPos_reference", "firstPos_read", "lastPos_read", "strand", "n_matches", "n_mismatches", "n_gaps", "alignment_reference", "alignment_read", "completeReadSequence_plus", "completeReadSequence_minus"})
+	{
+		if(! field_index.count(requiredField))
+		{
+			throw std::runtime_error("Alignments file header is missing field " + requiredField);
+		}
+	}
+
+	std::string readID;
+	std::string completeReadSequence_plus;
+	std::string completeReadSequence_minus;
+	bool haveCompleteReadSequence = false;
+
+	std::vector<alignmentLine> alignments;
+	alignments.reserve(lines_current_read.size());
+	for(size_t lineI = 0; lineI < lines_current_read.size(); lineI++)
+	{
+		std::vector<std::string> line_fields = split(lines_current_read.at(lineI), "\t");
+		if(line_fields.size() != alignments_headerFields.size())
+		{
+			throw std::runtime_error("Wrong number of fields in alignments file line: " + lines_current_read.at(lineI));
+		}
+
+		alignmentLine l;
+		l.readID = line_fields.at(field_index.at("readID"));
+		l.chromosome = line_fields.at(field_index.at("chromosome"));
+		l.firstPos_reference = StrtoI(line_fields.at(field_index.at("firstPos_reference")));
+		l.lastPos_reference = StrtoI(line_fields.at(field_index.at("lastPos_reference")));
+		l.firstPos_read = StrtoI(line_fields.at(field_index.at("firstPos_read")));
+		l.lastPos_read = StrtoI(line_fields.at(field_index.at("lastPos_read")));
+		l.strand = line_fields.at(field_index.at("strand"));
+		l.n_matches = StrtoI(line_fields.at(field_index.at("n_matches")));
+		l.n_mismatches = StrtoI(line_fields.at(field_index.at("n_mismatches")));
+		l.n_gaps = StrtoI(line_fields.at(field_index.at("n_gaps")));
+		l.alignment_reference = line_fields.at(field_index.at("alignment_reference"));
+		l.alignment_read = line_fields.at(field_index.at("alignment_read"));
+
+		if(lineI == 0)
+		{
+			readID = l.readID;
+		}
+		else if(readID != l.readID)
+		{
+			throw std::runtime_error("Read ID mismatch for " + readID + " / " + l.readID);
+		}
+
+		const std::string& plus = line_fields.at(field_index.at("completeReadSequence_plus"));
+		const std::string& minus = line_fields.at(field_index.at("completeReadSequence_minus"));
+		if(plus.length() && (plus != "0"))
+		{
+			if(!(minus.length() && (minus != "0")))
+			{
+				throw std::runtime_error("Read " + readID + " has completeReadSequence_plus, but no completeReadSequence_minus");
+			}
+			if(haveCompleteReadSequence)
+			{
+				throw std::runtime_error("Read " + readID + " has more than one complete read sequence");
+			}
+			completeReadSequence_plus = plus;
+			completeReadSequence_minus = minus;
+			haveCompleteReadSequence = true;
+		}
+
+		alignments.push_back(l);
+	}
+
+	if(! haveCompleteReadSequence)
+	{
+		throw std::runtime_error("No complete sequences for read " + readID);
+	}
+
+	// group by chromosome and strand, in order of first appearance
+	std::vector<std::pair<std::string, std::string>> chromosomes_and_strands;
+	std::map<std::pair<std::string, std::string>, std::vector<const alignmentLine*>> alignments_perChr_perStrand;
+	for(const alignmentLine& l : alignments)
+	{
+		std::pair<std::string, std::string> k = std::make_pair(l.chromosome, l.strand);
+		if(! alignments_perChr_perStrand.count(k))
+		{
+			chromosomes_and_strands.push_back(k);
+		}
+		alignments_perChr_perStrand[k].push_back(&l);
+	}
+
+	long long readLength = completeReadSequence_plus.length();
+
+	bool haveFinalScore = false;
+	long long maxFinalScore = 0;
+	std::string maxFinalScore_chromosome;
+	std::string maxFinalScore_strand;
+	std::vector<chain> maxFinalScore_chains;
+	int maxFinalScore_origin = -1;
+
+	for(auto chromosome_and_strand : chromosomes_and_strands)
+	{
+		const std::string& chromosome = chromosome_and_strand.first;
+		const std::string& strand = chromosome_and_strand.second;
+		if(! reference.count(chromosome))
+		{
+			throw std::runtime_error("Chromosome " + chromosome + " (read " + readID + ") not in reference");
+		}
+		const std::string& referenceSequence = reference.at(chromosome);
+
+		std::vector<chain> chains = enrichChains(alignments_perChr_perStrand.at(chromosome_and_strand), completeReadSequence_plus, completeReadSequence_minus, referenceSequence);
+		assert(chains.size());
+
+		for(chain& c : chains)
+		{
+			c.chainTraversalScore = (long long)S_match * c.n_matches + (long long)S_mismatch * c.n_mismatches + (long long)S_gap * c.n_gaps;
+		}
+
+		std::stable_sort(chains.begin(), chains.end(), [](const chain& a, const chain& b) {
+			if(a.firstPos_reference == b.firstPos_reference)
+			{
+				return (a.firstPos_read < b.firstPos_read);
+			}
+			else
+			{
+				return (a.firstPos_reference < b.firstPos_reference);
+			}
+		});
+
+		std::vector<int> lastPos_read_values;
+		lastPos_read_values.reserve(chains.size());
+		std::vector<size_t> chains_by_lastPos_reference;
+		chains_by_lastPos_reference.reserve(chains.size());
+		for(size_t chainI = 0; chainI < chains.size(); chainI++)
+		{
+			if(chains.at(chainI).lastPos_reference < chains.at(chainI).firstPos_reference)
+			{
+				throw std::runtime_error("Chain with lastPos_reference < firstPos_reference for read " + readID);
+			}
+			lastPos_read_values.push_back(chains.at(chainI).lastPos_read);
+			chains_by_lastPos_reference.push_back(chainI);
+		}
+		std::sort(lastPos_read_values.begin(), lastPos_read_values.end());
+		lastPos_read_values.erase(std::unique(lastPos_read_values.begin(), lastPos_read_values.end()), lastPos_read_values.end());
+		std::stable_sort(chains_by_lastPos_reference.begin(), chains_by_lastPos_reference.end(), [&](size_t a, size_t b) {
+			return (chains.at(a).lastPos_reference < chains.at(b).lastPos_reference);
+		});
+
+		prefixMaxima predecessors(lastPos_read_values.size());
+		size_t next_insertion = 0;
+		for(size_t chainI = 0; chainI < chains.size(); chainI++)
+		{
+			chain& c = chains.at(chainI);
+
+			// all chains ending before c on the reference become available - they start before c, so their output score is known
+			while((next_insertion < chains_by_lastPos_reference.size()) && (chains.at(chains_by_lastPos_reference.at(next_insertion)).lastPos_reference < c.firstPos_reference))
+			{
+				size_t chainII = chains_by_lastPos_reference.at(next_insertion);
+				const chain& c2 = chains.at(chainII);
+				assert(chainII < chainI);
+				size_t position = std::lower_bound(lastPos_read_values.begin(), lastPos_read_values.end(), c2.lastPos_read) - lastPos_read_values.begin();
+				predecessors.insert(position, c2.chainOutputScore - (long long)S_gap * ((long long)c2.lastPos_read + c2.lastPos_reference), chainII);
+				next_insertion++;
+			}
+
+			long long bestInputScore = (endsFree_reference) ? ((long long)S_gap * c.firstPos_read) : ((long long)S_gap * ((long long)c.firstPos_read + c.firstPos_reference));
+			int bestInputScore_origin = -1;
+
+			size_t n_positions = std::lower_bound(lastPos_read_values.begin(), lastPos_read_values.end(), c.firstPos_read) - lastPos_read_values.begin();
+			std::pair<long long, int> bestPredecessor = predecessors.query(n_positions);
+			if(bestPredecessor.second != -1)
+			{
+				long long predecessorScore = bestPredecessor.first + (long long)S_gap * ((long long)c.firstPos_read + c.firstPos_reference - 2);
+				if(predecessorScore > bestInputScore)
+				{
+					bestInputScore = predecessorScore;
+					bestInputScore_origin = bestPredecessor.second;
+				}
+			}
+
+			c.chainOutputScore = bestInputScore + c.chainTraversalScore;
+			c.chainOutputScoreOrigin = bestInputScore_origin;
+		}
+
+		long long finalScore = (endsFree_reference) ? ((long long)S_gap * readLength) : ((long long)S_gap * (readLength + (long long)referenceSequence.length()));
+		int finalScore_origin = -1;
+		for(size_t chainI = 0; chainI < chains.size(); chainI++)
+		{
+			const chain& c = chains.at(chainI);
+			long long final_delta_read = readLength - c.lastPos_read - 1;
+			long long final_delta_ref = (long long)referenceSequence.length() - c.lastPos_reference - 1;
+			long long score = (endsFree_reference) ? (c.chainOutputScore + (long long)S_gap * final_delta_read) : (c.chainOutputScore + (long long)S_gap * (final_delta_read + final_delta_ref));
+			if(score > finalScore)
+			{
+				finalScore = score;
+				finalScore_origin = chainI;
+			}
+		}
+
+		if((! haveFinalScore) || (finalScore > maxFinalScore))
+		{
+			haveFinalScore = true;
+			maxFinalScore = finalScore;
+			maxFinalScore_chromosome = chromosome;
+			maxFinalScore_strand = strand;
+			maxFinalScore_origin = finalScore_origin;
+			maxFinalScore_chains.swap(chains);
+		}
+	}
+
+	assert(haveFinalScore);
+
+	const std::string& chromosome = maxFinalScore_chromosome;
+	const std::string& strand = maxFinalScore_strand;
+	const std::string& referenceSequence = reference.at(chromosome);
+	const std::vector<chain>& chains = maxFinalScore_chains;
+	if(!((strand == "+") || (strand == "-")))
+	{
+		throw std::runtime_error("Invalid strand " + strand + " for read " + readID);
+	}
+	const std::string& useReadSequence = (strand == "+") ? completeReadSequence_plus : completeReadSequence_minus;
+
+	// backtrace - collect the chains from right to left, then build the alignment from left to right
+	std::vector<int> backtrace_chains;
+	int next_bt_position = maxFinalScore_origin;
+	long long last_emitted_read_position = useReadSequence.length();
+	long long last_emitted_reference_position = -1;
+	while((last_emitted_read_position > 0) && (next_bt_position != -1))
+	{
+		const chain& c = chains.at(next_bt_position);
+		if(!((c.lastPos_read < last_emitted_read_position) && (c.firstPos_read <= last_emitted_read_position)))
+		{
+			throw std::runtime_error("Backtrace inconsistency (read positions) for read " + readID);
+		}
+		if((last_emitted_reference_position != -1) && (!((c.lastPos_reference < last_emitted_reference_position) && (c.firstPos_reference <= last_emitted_reference_position))))
+		{
+			throw std::runtime_error("Backtrace inconsistency (reference positions) for read " + readID);
+		}
+		backtrace_chains.push_back(next_bt_position);
+		last_emitted_read_position = c.firstPos_read;
+		last_emitted_reference_position = c.firstPos_reference;
+		next_bt_position = c.chainOutputScoreOrigin;
+	}
+	std::reverse(backtrace_chains.begin(), backtrace_chains.end());
+
+	std::string bt_contig;
+	std::string bt_reference;
+	bt_contig.reserve(2 * useReadSequence.length());
+	bt_reference.reserve(2 * useReadSequence.length());
+
+	long long leftOut_delta_reference = 0;
+	if(backtrace_chains.size())
+	{
+		const chain& firstChain = chains.at(backtrace_chains.front());
+		const chain& lastChain = chains.at(backtrace_chains.back());
+		leftOut_delta_reference += firstChain.firstPos_reference;
+		leftOut_delta_reference += ((long long)referenceSequence.length() - lastChain.lastPos_reference - 1);
+
+		bt_contig.append(useReadSequence.substr(0, firstChain.firstPos_read));
+		bt_reference.append(firstChain.firstPos_read, '-');
+
+		for(size_t btI = 0; btI < backtrace_chains.size(); btI++)
+		{
+			const chain& c = chains.at(backtrace_chains.at(btI));
+			bt_contig.append(c.source->alignment_read, 0, c.alignment_columns);
+			bt_reference.append(c.source->alignment_reference, 0, c.alignment_columns);
+
+			long long next_read_position = (btI == (backtrace_chains.size() - 1)) ? (long long)useReadSequence.length() : chains.at(backtrace_chains.at(btI + 1)).firstPos_read;
+			long long delta_read = next_read_position - c.lastPos_read - 1;
+			assert(delta_read >= 0);
+			bt_contig.append(safeSubstr(useReadSequence, c.lastPos_read + 1, delta_read));
+			bt_reference.append(delta_read, '-');
+
+			if(btI != (backtrace_chains.size() - 1))
+			{
+				long long delta_reference = chains.at(backtrace_chains.at(btI + 1)).firstPos_reference - c.lastPos_reference - 1;
+				std::string jumpedOverReference_reference = safeSubstr(referenceSequence, c.lastPos_reference + 1, delta_reference);
+				if((long long)jumpedOverReference_reference.length() != delta_reference)
+				{
+					throw std::runtime_error("Backtrace inconsistency (reference length) for read " + readID);
+				}
+				bt_contig.append(delta_reference, '-');
+				bt_reference.append(jumpedOverReference_reference);
+			}
+		}
+	}
+	else
+	{
+		bt_contig = useReadSequence;
+		bt_reference = std::string(useReadSequence.length(), '-');
+	}
+
+	if(removeDashes(bt_contig) != useReadSequence)
+	{
+		throw std::runtime_error("Backtraced alignment does not reproduce the sequence of read " + readID);
+	}
+
+	readResult forReturn;
+	forReturn.readID = readID;
+
+	std::string bt_reference_noGaps = removeDashes(bt_reference);
+	if(bt_reference_noGaps.length() == 0)
+	{
+		return forReturn;
+	}
+
+	int min_emitted_reference_position = chains.at(backtrace_chains.front()).firstPos_reference;
+	for(int chainI : backtrace_chains)
+	{
+		if(chains.at(chainI).firstPos_reference < min_emitted_reference_position)
+			min_emitted_reference_position = chains.at(chainI).firstPos_reference;
+	}
+	int max_emitted_reference_position = chains.at(backtrace_chains.back()).lastPos_reference;
+	assert(min_emitted_reference_position <= max_emitted_reference_position);
+
+	std::string reference_extract = safeSubstr(referenceSequence, min_emitted_reference_position, max_emitted_reference_position - min_emitted_reference_position + 1);
+	if((long long)reference_extract.length() != ((long long)max_emitted_reference_position - min_emitted_reference_position + 1))
+	{
+		throw std::runtime_error("Reference extract out of bounds for read " + readID);
+	}
+	bool reference_extract_noN = (reference_extract.find('N') == std::string::npos);
+	if(reference_extract_noN && (bt_reference_noGaps != reference_extract))
+	{
+		throw std::runtime_error("Reference sequence mismatch for read " + readID);
+	}
+
+	assert(bt_contig.length() == bt_reference.length());
+	long long score_reconstructed = 0;
+	for(size_t i = 0; i < bt_contig.length(); i++)
+	{
+		char c1 = bt_contig.at(i);
+		char c2 = bt_reference.at(i);
+		if((c1 == '-') || (c2 == '-'))
+		{
+			score_reconstructed += S_gap;
+		}
+		else if(c1 == c2)
+		{
+			score_reconstructed += S_match;
+		}
+		else
+		{
+			score_reconstructed += S_mismatch;
+		}
+	}
+	if(! endsFree_reference)
+	{
+		score_reconstructed += (leftOut_delta_reference * S_gap);
+	}
+	if(score_reconstructed != maxFinalScore)
+	{
+		throw std::runtime_error("Score mismatch for read " + readID + ": " + std::to_string(score_reconstructed) + " vs " + std::to_string(maxFinalScore));
+	}
+
+	size_t remove_columns_front = 0;
+	while(bt_reference.at(remove_columns_front) == '-')
+	{
+		remove_columns_front++;
+	}
+	size_t remove_columns_back = 0;
+	while(bt_reference.at(bt_reference.length() - remove_columns_back - 1) == '-')
+	{
+		remove_columns_back++;
+	}
+
+	std::string alignment_reference_forSAM = bt_reference.substr(remove_columns_front, bt_reference.length() - remove_columns_front - remove_columns_back);
+	std::string alignment_contig_forSAM = bt_contig.substr(remove_columns_front, bt_contig.length() - remove_columns_front - remove_columns_back);
+	assert(alignment_reference_forSAM.length() == alignment_contig_forSAM.length());
+	if(reference_extract_noN)
+	{
+		assert(removeDashes(alignment_reference_forSAM) == reference_extract);
+	}
+
+	std::string alignment_contig_forSAM_noGaps = removeDashes(alignment_contig_forSAM);
+
+	// this is what the Perl implementation computes (max - max + 1) - kept for identical output
+	int tlen = max_emitted_reference_position - max_emitted_reference_position + 1;
+
+	std::string CIGAR;
+	char running_CIGAR_character = 0;
+	int running_CIGAR_length = 0;
+	for(size_t i = 0; i < alignment_reference_forSAM.length(); i++)
+	{
+		char c_ref = alignment_reference_forSAM.at(i);
+		char c_read = alignment_contig_forSAM.at(i);
+		if((c_ref == '-') && (c_read == '-'))
+		{
+			throw std::runtime_error("Double-gap column in alignment for read " + readID);
+		}
+
+		char CIGAR_character = (c_ref == '-') ? 'I' : ((c_read == '-') ? 'D' : 'M');
+		if(CIGAR_character != running_CIGAR_character)
+		{
+			if(running_CIGAR_length)
+			{
+				CIGAR.append(ItoStr(running_CIGAR_length));
+				CIGAR.push_back(running_CIGAR_character);
+			}
+			running_CIGAR_character = CIGAR_character;
+			running_CIGAR_length = 0;
+		}
+		running_CIGAR_length++;
+	}
+	if(running_CIGAR_length)
+	{
+		CIGAR.append(ItoStr(running_CIGAR_length));
+		CIGAR.push_back(running_CIGAR_character);
+	}
+
+	std::vector<std::string> fields_for_output = {
+		readID,
+		ItoStr(2 | 64),
+		chromosome,
+		ItoStr(min_emitted_reference_position + 1),
+		"255",
+		CIGAR,
+		"*",
+		"0",
+		ItoStr(tlen),
+		alignment_contig_forSAM_noGaps,
+		"*"
+	};
+
+	forReturn.haveAlignment = true;
+	forReturn.SAMline = join(fields_for_output, "\t");
+	forReturn.alignment_length = alignment_contig_forSAM_noGaps.length();
+	forReturn.n_chains = backtrace_chains.size();
+	forReturn.removed_front = (remove_columns_front > 0);
+	forReturn.removed_back = (remove_columns_back > 0);
+
+	return forReturn;
+}
+
+std::vector<chain> enrichChains(const std::vector<const alignmentLine*>& chainsIn, const std::string& completeReadSequence_plus, const std::string& completeReadSequence_minus, const std::string& referenceSequence)
+{
+	/*
+	   For every position in a chain at which another chain begins (on the reference or on the read), we also add the
+	   prefix of the chain up to that position as a separate chain - so that chains overlapping their successors
+	   can still be used.
+	*/
+
+	std::set<int> beginCoordinates_reference;
+	std::set<int> beginCoordinates_read;
+	for(const alignmentLine* l : chainsIn)
+	{
+		beginCoordinates_reference.insert(l->firstPos_reference);
+		beginCoordinates_read.insert(l->firstPos_read);
+	}
+
+	std::vector<chain> chainsOut;
+	for(const alignmentLine* l : chainsIn)
+	{
+		std::set<int> createdEndPointForReferenceCoordinate;
+		std::set<int> createdEndPointForReadCoordinate;
+
+		const std::string& useReadSequence = (l->strand == "+") ? completeReadSequence_plus : completeReadSequence_minus;
+
+		{
+			std::string supposedReferenceSequence = safeSubstr(referenceSequence, l->firstPos_reference, (long long)l->lastPos_reference - l->firstPos_reference + 1);
+			if(supposedReferenceSequence.find('N') == std::string::npos)
+			{
+				if(supposedReferenceSequence != removeDashes(l->alignment_reference))
+				{
+					throw std::runtime_error("Reference sequence mismatch for chain of read " + l->readID);
+				}
+			}
+		}
+
+		chain original;
+		original.source = l;
+		original.alignment_columns = l->alignment_reference.length();
+		original.firstPos_reference = l->firstPos_reference;
+		original.lastPos_reference = l->lastPos_reference;
+		original.firstPos_read = l->firstPos_read;
+		original.lastPos_read = l->lastPos_read;
+		original.n_matches = l->n_matches;
+		original.n_mismatches = l->n_mismatches;
+		original.n_gaps = l->n_gaps;
+		original.enrich = false;
+		chainsOut.push_back(original);
+
+		if(l->alignment_read.length() < l->alignment_reference.length())
+		{
+			throw std::runtime_error("Alignment strings of different length for read " + l->readID);
+		}
+
+		int n_matches = 0;
+		int n_mismatches = 0;
+		int n_gaps = 0;
+		bool defined_lastPos_reference = false;
+		bool defined_lastPos_read = false;
+		int lastPos_reference = 0;
+		int lastPos_read = 0;
+
+		// prefix checks are maintained incrementally instead of comparing substrings at every end point
+		bool reference_prefix_ACGT = true;
+		bool reference_prefix_mismatch = false;
+		bool read_prefix_mismatch = false;
+
+		for(size_t alignmentPos = 0; alignmentPos < l->alignment_reference.length(); alignmentPos++)
+		{
+			char character_reference = l->alignment_reference.at(alignmentPos);
+			char character_read = l->alignment_read.at(alignmentPos);
+
+			if(character_reference == character_read)
+			{
+				n_matches++;
+			}
+			else
+			{
+				if((character_reference == '-') || (character_read == '-'))
+				{
+					n_gaps++;
+				}
+				else
+				{
+					n_mismatches++;
+				}
+			}
+
+			if(character_reference != '-')
+			{
+				if(defined_lastPos_reference)
+				{
+					lastPos_reference++;
+				}
+				else
+				{
+					lastPos_reference = l->firstPos_reference;
+					defined_lastPos_reference = true;
+				}
+
+				if((lastPos_reference >= 0) && (lastPos_reference < (int)referenceSequence.length()))
+				{
+					char c_reference = referenceSequence.at(lastPos_reference);
+					if(!((c_reference == 'A') || (c_reference == 'C') || (c_reference == 'G') || (c_reference == 'T') || (c_reference == 'a') || (c_reference == 'c') || (c_reference == 'g') || (c_reference == 't')))
+					{
+						reference_prefix_ACGT = false;
+					}
+					if(c_reference != character_reference)
+					{
+						reference_prefix_mismatch = true;
+					}
+				}
+				else
+				{
+					reference_prefix_mismatch = true;
+				}
+			}
+			if(character_read != '-')
+			{
+				if(defined_lastPos_read)
+				{
+					lastPos_read++;
+				}
+				else
+				{
+					lastPos_read = l->firstPos_read;
+					defined_lastPos_read = true;
+				}
+
+				if(!((lastPos_read >= 0) && (lastPos_read < (int)useReadSequence.length()) && (useReadSequence.at(lastPos_read) == character_read)))
+				{
+					read_prefix_mismatch = true;
+				}
+			}
+
+			bool includeCurrentPositionAsEndpoint = false;
+			if(defined_lastPos_reference && defined_lastPos_read)
+			{
+				if(beginCoordinates_reference.count(lastPos_reference + 1) && (! createdEndPointForReferenceCoordinate.count(lastPos_reference + 1)))
+				{
+					includeCurrentPositionAsEndpoint = true;
+				}
+				if(beginCoordinates_read.count(lastPos_read + 1) && (! createdEndPointForReadCoordinate.count(lastPos_read + 1)))
+				{
+					includeCurrentPositionAsEndpoint = true;
+				}
+			}
+
+			if(includeCurrentPositionAsEndpoint)
+			{
+				createdEndPointForReferenceCoordinate.insert(lastPos_reference + 1);
+				createdEndPointForReadCoordinate.insert(lastPos_read + 1);
+
+				if(reference_prefix_ACGT && reference_prefix_mismatch)
+				{
+					throw std::runtime_error("Sequence mismatch (reference) in chain enrichment for read " + l->readID);
+				}
+				if(read_prefix_mismatch)
+				{
+					throw std::runtime_error("Sequence mismatch (read) in chain enrichment for read " + l->readID);
+				}
+
+				chain enriched;
+				enriched.source = l;
+				enriched.alignment_columns = alignmentPos + 1;
+				enriched.firstPos_reference = l->firstPos_reference;
+				enriched.lastPos_reference = lastPos_reference;
+				enriched.firstPos_read = l->firstPos_read;
+				enriched.lastPos_read = lastPos_read;
+				enriched.n_matches = n_matches;
+				enriched.n_mismatches = n_mismatches;
+				enriched.n_gaps = n_gaps;
+				enriched.enrich = true;
+				chainsOut.push_back(enriched);
+			}
+		}
+	}
+
+	return chainsOut;
+}
+
+std::string safeSubstr(const std::string& s, long long start, long long length)
+{
+	// like Perl's substr: positions outside of the string give an empty / truncated result instead of an exception
+	if((start < 0) || (start >= (long long)s.length()) || (length <= 0))
+		return "";
+	return s.substr(start, length);
+}
+
+std::string removeDashes(const std::string& s)
+{
+	std::string out;
+	out.reserve(s.size());
+	for(size_t i = 0; i < s.size(); i++)
+	{
+		if(s.at(i) != '-')
+		{
+			out.push_back(s.at(i));
+		}
+	}
+	return out;
+}
@@ -0,0 +1,503 @@
+//============================================================================
+// Name        : GLOBALIZE_WINDOWBAMS.cpp
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+/*
+
+   Native implementation of scripts/globalize_windowbams.pl (requires htslib - build with 'make htslib HTSLIB_DIR=...').
+
+   Combines the per-window MAFFT BAMs into one global alignment file, stitching contigs that span several windows,
+   and writes it coordinate-sorted (and indexed, for BAM/CRAM output) in a single pass - this replaces
+   globalize_windowbams.pl followed by 'samtools view -h', 'samtools sort' and the CRAM conversion.
+
+   Windows are read in reference order. All alignments that start in a window have global start positions that are
+   not smaller than the window start, so the only alignments that can be emitted out of order are contigs that span
+   several windows - they keep the start position of their first window, but are complete only in their last window.
+   Completed alignments are therefore kept in a min-heap and written as soon as their start position is not larger
+   than the start of the next window and of every still incomplete contig.
+
+   The stitching itself is the same as in globalize_windowbams.pl: CIGAR strings and sequences of consecutive windows
+   are concatenated, the first window determines flag, position, mapping quality and quality string, and an
+   alignment is complete once its sequence has the length given in --contigs.
+
+   The header is built from the reference FASTA index (reference order), and only reference sequences that have
+   windows in _windowsInfo are processed.
+
+*/
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <queue>
+#include <assert.h>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+#include <climits>
+#include <sys/stat.h>
+
+#include <htslib/sam.h>
+#include <htslib/faidx.h>
+
+#include "Utilities.h"
+
+class windowInfo
+{
+public:
+	std::string BAM;
+	long long offset;
+};
+
+class stitchedAlignment
+{
+public:
+	std::string contig;
+	int flag;
+	long long pos;
+	int mapq;
+	std::string cigar;
+	std::string seq;
+	std::string qual;
+	long long serial;
+};
+
+class stitchedAlignmentLater
+{
+public:
+	bool operator()(const stitchedAlignment* a, const stitchedAlignment* b) const
+	{
+		if(a->pos != b->pos)
+			return (a->pos > b->pos);
+		return (a->serial > b->serial);
+	}
+};
+
+std::map<std::string, std::vector<windowInfo>> readWindowsInfo(std::string fastadir, std::string msadir);
+std::map<std::string, long long> readContigLengths(std::string contigsFile);
+std::vector<stitchedAlignment> readWindowBAM(const windowInfo& window);
+bool fileExists(const std::string& fn);
+
+int main(int argc, char *argv[]) {
+	std::vector<std::string> ARG (argv + 1, argv + argc + !argc);
+	std::map<std::string, std::string> arguments;
+
+	for(unsigned int i = 0; i < ARG.size(); i++)
+	{
+		if((ARG.at(i).length() > 2) && (ARG.at(i).substr(0, 2) == "--"))
+		{
+			std::string argname = ARG.at(i).substr(2);
+			std::string argvalue = ARG.at(i+1);
+			arguments[argname] = argvalue;
+		}
+	}
+
+	if(!(arguments.count("fastadir") && arguments.count("msadir") && arguments.count("contigs") && arguments.count("referenceFasta") && arguments.count("output")))
+	{
+		std::cerr << "Usage: GLOBALIZE_WINDOWBAMS --fastadir <directory with inputs for MAFFT> --msadir <directory with outputs from MAFFT> --contigs <contig lengths> --referenceFasta <FASTA> --output <combined.cram|.bam|.sam> [--threads N]\n";
+		return 1;
+	}
+
+	int threads = 1;
+	if(arguments.count("threads"))
+	{
+		threads = StrtoI(arguments.at("threads"));
+		assert(threads > 0);
+	}
+
+	std::string outputFn = arguments.at("output");
+	std::string mode = "w";
+	bool buildIndex = false;
+	if((outputFn.length() > 5) && (outputFn.substr(outputFn.length() - 5) == ".cram"))
+	{
+		mode = "wc";
+		buildIndex = true;
+	}
+	else if((outputFn.length() > 4) && (outputFn.substr(outputFn.length() - 4) == ".bam"))
+	{
+		mode = "wb";
+		buildIndex = true;
+	}
+
+	std::map<std::string, std::vector<windowInfo>> windows_per_entry = readWindowsInfo(arguments.at("fastadir"), arguments.at("msadir"));
+	std::map<std::string, long long> contig_length = readContigLengths(arguments.at("contigs"));
+
+	faidx_t* reference = fai_load(arguments.at("referenceFasta").c_str());
+	if(reference == 0)
+	{
+		throw std::runtime_error("Cannot load FASTA index for " + arguments.at("referenceFasta"));
+	}
+
+	std::string headerText = "@HD\tVN:1.4\tSO:coordinate\n";
+	std::vector<std::string> entries;
+	for(int sequenceI = 0; sequenceI < faidx_nseq(reference); sequenceI++)
+	{
+		std::string sequenceID = faidx_iseq(reference, sequenceI);
+		headerText += "@SQ\tSN:" + sequenceID + "\tLN:" + ItoStr(faidx_seq_len(reference, sequenceID.c_str())) + "\n";
+		if(windows_per_entry.count(sequenceID))
+		{
+			entries.push_back(sequenceID);
+		}
+	}
+	if(entries.size() != windows_per_entry.size())
+	{
+		for(auto entry : windows_per_entry)
+		{
+			if(! faidx_has_seq(reference, entry.first.c_str()))
+			{
+				throw std::runtime_error("Reference sequence " + entry.first + " from _windowsInfo not present in " + arguments.at("referenceFasta"));
+			}
+		}
+	}
+	fai_destroy(reference);
+
+	sam_hdr_t* header = sam_hdr_init();
+	if((header == 0) || (sam_hdr_add_lines(header, headerText.c_str(), headerText.length()) != 0))
+	{
+		throw std::runtime_error("Cannot create output header");
+	}
+
+	samFile* output = sam_open(outputFn.c_str(), mode.c_str());
+	if(output == 0)
+	{
+		throw std::runtime_error("Cannot open " + outputFn + " for writing");
+	}
+	if(mode == "wc")
+	{
+		if(hts_set_fai_filename(output, arguments.at("referenceFasta").c_str()) != 0)
+		{
+			throw std::runtime_error("Cannot set CRAM reference " + arguments.at("referenceFasta"));
+		}
+	}
+	if(threads > 1)
+	{
+		hts_set_threads(output, threads);
+	}
+	if(sam_hdr_write(output, header) != 0)
+	{
+		throw std::runtime_error("Cannot write header to " + outputFn);
+	}
+
+	bam1_t* outputRecord = bam_init1();
+	auto writeAlignment = [&](const std::string& entry, const stitchedAlignment* alignment) {
+		for(char c : alignment->cigar)
+		{
+			if(!(isdigit(c) || (c == 'M') || (c == 'I') || (c == 'D') || (c == 'S') || (c == 'H') || (c == 'P')))
+			{
+				throw std::runtime_error("Invalid cigar string " + alignment->cigar);
+			}
+		}
+		std::string line = alignment->contig + "\t" + ItoStr(alignment->flag) + "\t" + entry + "\t" + std::to_string(alignment->pos) + "\t" + ItoStr(alignment->mapq) + "\t" + alignment->cigar + "\t*\t0\t0\t" + (alignment->seq.length() ? alignment->seq : "*") + "\t" + alignment->qual;
+		std::vector<char> buffer(line.begin(), line.end());
+		buffer.push_back(0);
+		kstring_t ks;
+		ks.l = line.length();
+		ks.m = buffer.size();
+		ks.s = buffer.data();
+		if(sam_parse1(&ks, header, outputRecord) < 0)
+		{
+			throw std::runtime_error("Cannot convert combined alignment for " + alignment->contig);
+		}
+		if(sam_write1(output, header, outputRecord) < 0)
+		{
+			throw std::runtime_error("Cannot write to " + outputFn);
+		}
+	};
+
+	long long total_printed_alignments = 0;
+	long long missed_alignments = 0;
+	long long serial = 0;
+	size_t max_buffered = 0;
+	std::set<std::string> already_processed_contigs;
+	for(const std::string& entry : entries)
+	{
+		const std::vector<windowInfo>& windows = windows_per_entry.at(entry);
+
+		std::map<std::string, stitchedAlignment*> current_contigs;
+		std::map<long long, int> current_contigs_starts;
+		std::priority_queue<stitchedAlignment*, std::vector<stitchedAlignment*>, stitchedAlignmentLater> completed;
+
+		auto emitUpTo = [&](long long maxPos) {
+			while(completed.size() && (completed.top()->pos <= maxPos))
+			{
+				stitchedAlignment* alignment = completed.top();
+				completed.pop();
+				writeAlignment(entry, alignment);
+				total_printed_alignments++;
+				delete(alignment);
+			}
+		};
+
+		for(size_t windowI = 0; windowI < windows.size(); windowI++)
+		{
+			std::vector<stitchedAlignment> window_alignments = readWindowBAM(windows.at(windowI));
+			for(stitchedAlignment& windowAlignment : window_alignments)
+			{
+				const std::string& contig = windowAlignment.contig;
+				stitchedAlignment* current;
+				if(current_contigs.count(contig))
+				{
+					current = current_contigs.at(contig);
+					current->cigar += windowAlignment.cigar;
+					current->seq += windowAlignment.seq;
+				}
+				else
+				{
+					if(already_processed_contigs.count(contig))
+					{
+						throw std::runtime_error("Duplicate contig? " + contig);
+					}
+					current = new stitchedAlignment(windowAlignment);
+					current->serial = serial++;
+					current_contigs[contig] = current;
+					current_contigs_starts[current->pos]++;
+				}
+
+				if(! contig_length.count(contig))
+				{
+					throw std::runtime_error("Don't have length for " + contig);
+				}
+				long long expected_contig_length = contig_length.at(contig);
+				long long current_contig_length = current->seq.length();
+				if(current_contig_length > expected_contig_length)
+				{
+					throw std::runtime_error("Error - contig " + contig + " too long! " + std::to_string(current_contig_length) + " vs " + std::to_string(expected_contig_length));
+				}
+				if(expected_contig_length == current_contig_length)
+				{
+					if(current->cigar != "*")
+					{
+						current_contigs.erase(contig);
+						if(--current_contigs_starts.at(current->pos) == 0)
+						{
+							current_contigs_starts.erase(current->pos);
+						}
+						completed.push(current);
+						already_processed_contigs.insert(contig);
+					}
+					else
+					{
+						std::cerr << "Skipping alignment for " << contig << "--no cigar string\n";
+					}
+				}
+			}
+
+			// nothing that is read from now on can start before the next window or before an incomplete contig
+			long long watermark = (windowI < (windows.size() - 1)) ? (windows.at(windowI + 1).offset + 1) : -1;
+			if(current_contigs_starts.size())
+			{
+				long long firstOpenStart = current_contigs_starts.begin()->first;
+				if((watermark == -1) || (firstOpenStart < watermark))
+				{
+					watermark = firstOpenStart;
+				}
+			}
+			if(watermark != -1)
+			{
+				emitUpTo(watermark);
+			}
+			max_buffered = std::max(max_buffered, completed.size());
+		}
+
+		emitUpTo(LLONG_MAX);
+
+		missed_alignments += current_contigs.size();
+		if(current_contigs.size())
+		{
+			std::cerr << current_contigs.size() << " contigs left over for " << entry << "!\n";
+		}
+		for(auto contig : current_contigs)
+		{
+			delete(contig.second);
+		}
+	}
+
+	bam_destroy1(outputRecord);
+	if(sam_close(output) != 0)
+	{
+		throw std::runtime_error("Cannot close " + outputFn);
+	}
+	sam_hdr_destroy(header);
+
+	if(buildIndex)
+	{
+		if(sam_index_build(outputFn.c_str(), 0) != 0)
+		{
+			throw std::runtime_error("Cannot index " + outputFn);
+		}
+	}
+
+	std::cout << "Finished successfully\n\n";
+	std::cout << "Non-finished alignments: " << missed_alignments << " \n\n";
+	std::cout << "Printed alignments: " << total_printed_alignments << " \n\n";
+	std::cout << "Max. buffered alignments: " << max_buffered << " \n\n";
+
+	return 0;
+}
+
+std::map<std::string, std::vector<windowInfo>> readWindowsInfo(std::string fastadir, std::string msadir)
+{
+	std::map<std::string, std::vector<windowInfo>> forReturn;
+
+	std::string fn = fastadir + "/_windowsInfo";
+	std::ifstream windowsStream;
+	windowsStream.open(fn.c_str());
+	if(! windowsStream.is_open())
+	{
+		throw std::runtime_error("Couldn't open " + fn);
+	}
+
+	std::string lastEntry;
+	long long lastStart = -1;
+	std::string line;
+	while(windowsStream.good())
+	{
+		std::getline(windowsStream, line);
+		eraseNL(line);
+		if((line.length() == 0) || (line.substr(0, 17) == "referenceContigID"))
+			continue;
+
+		std::vector<std::string> line_fields = split(line, "\t");
+		if(line_fields.size() < 5)
+		{
+			throw std::runtime_error("Illegal format in _windowsInfo file:\n" + line);
+		}
+		std::string entry = line_fields.at(0);
+		std::string chrDir = line_fields.at(1);
+		std::string windowID = line_fields.at(2);
+		long long start = std::stoll(line_fields.at(3));
+
+		windowInfo window;
+		window.BAM = msadir + "/" + chrDir + "/" + entry + "_" + windowID + ".bam";
+		window.offset = start;
+		if(! fileExists(window.BAM))
+		{
+			std::cerr << "BAM file " << window.BAM << " not present\n";
+		}
+		if((entry == lastEntry) && (start < lastStart))
+		{
+			throw std::runtime_error("Windows in _windowInfo are unsorted! (" + entry + ":" + std::to_string(start) + " is less than " + std::to_string(lastStart) + ")");
+		}
+		forReturn[entry].push_back(window);
+		lastEntry = entry;
+		lastStart = start;
+	}
+
+	return forReturn;
+}
+
+std::map<std::string, long long> readContigLengths(std::string contigsFile)
+{
+	std::map<std::string, long long> forReturn;
+
+	std::ifstream contigsStream;
+	contigsStream.open(contigsFile.c_str());
+	if(! contigsStream.is_open())
+	{
+		throw std::runtime_error("Couldn't open .contigs file " + contigsFile);
+	}
+
+	std::string line;
+	while(contigsStream.good())
+	{
+		std::getline(contigsStream, line);
+		eraseNL(line);
+		if(line.length() == 0)
+			continue;
+
+		std::istringstream lineStream(line);
+		std::string contig;
+		long long length;
+		if(!(lineStream >> contig >> length))
+		{
+			throw std::runtime_error("Illegal format in contigs file:\n" + line);
+		}
+		forReturn[contig] = length;
+	}
+
+	return forReturn;
+}
+
+std::vector<stitchedAlignment> readWindowBAM(const windowInfo& window)
+{
+	std::vector<stitchedAlignment> forReturn;
+	if(! fileExists(window.BAM))
+		return forReturn;
+
+	samFile* BAM = sam_open(window.BAM.c_str(), "r");
+	if(BAM == 0)
+	{
+		throw std::runtime_error("Cannot open " + window.BAM);
+	}
+	bam_hdr_t* header = sam_hdr_read(BAM);
+	if(header == 0)
+	{
+		throw std::runtime_error("Cannot read header of " + window.BAM);
+	}
+
+	std::set<std::string> saw_contigs;
+	bam1_t* alignment = bam_init1();
+	while(sam_read1(BAM, header, alignment) >= 0)
+	{
+		stitchedAlignment windowAlignment;
+		windowAlignment.contig = bam_get_qname(alignment);
+		windowAlignment.flag = alignment->core.flag;
+		windowAlignment.pos = alignment->core.pos + 1 + window.offset;
+		windowAlignment.mapq = alignment->core.qual;
+		windowAlignment.serial = 0;
+
+		const uint32_t* cigar = bam_get_cigar(alignment);
+		if(alignment->core.n_cigar == 0)
+		{
+			windowAlignment.cigar = "*";
+		}
+		for(unsigned int cigarI = 0; cigarI < alignment->core.n_cigar; cigarI++)
+		{
+			windowAlignment.cigar += ItoStr(bam_cigar_oplen(cigar[cigarI]));
+			windowAlignment.cigar.push_back(bam_cigar_opchr(cigar[cigarI]));
+		}
+
+		const uint8_t* seq = bam_get_seq(alignment);
+		const uint8_t* qual = bam_get_qual(alignment);
+		windowAlignment.seq.reserve(alignment->core.l_qseq);
+		for(int i = 0; i < alignment->core.l_qseq; i++)
+		{
+			windowAlignment.seq.push_back(seq_nt16_str[bam_seqi(seq, i)]);
+		}
+		if((alignment->core.l_qseq == 0) || (qual[0] == 0xff))
+		{
+			windowAlignment.qual = "*";
+		}
+		else
+		{
+			for(int i = 0; i < alignment->core.l_qseq; i++)
+			{
+				windowAlignment.qual.push_back((char)(qual[i] + 33));
+			}
+		}
+
+		if(saw_contigs.count(windowAlignment.contig))
+		{
+			throw std::runtime_error("Contig " + windowAlignment.contig + " present more than once in " + window.BAM);
+		}
+		saw_contigs.insert(windowAlignment.contig);
+		forReturn.push_back(windowAlignment);
+	}
+	bam_destroy1(alignment);
+	bam_hdr_destroy(header);
+	sam_close(BAM);
+
+	return forReturn;
+}
+
+bool fileExists(const std::string& fn)
+{
+	struct stat buffer;
+	return (stat(fn.c_str(), &buffer) == 0);
+}
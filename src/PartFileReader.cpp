@@ -0,0 +1,332 @@
+//============================================================================
+// Name        : PartFileReader.cpp
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+#include "PartFileReader.h"
+
+#include <stdexcept>
+#include <assert.h>
+#include <zlib.h>
+
+// BGZF blocks per batch (a block holds up to 64kB of uncompressed data)
+static const size_t blocks_per_batch = 16;
+
+// read little-endian integers from a BGZF block
+static unsigned int read_uint16(const std::string& s, size_t pos)
+{
+	return (unsigned char)s.at(pos) | ((unsigned int)(unsigned char)s.at(pos+1) << 8);
+}
+
+static unsigned int read_uint32(const std::string& s, size_t pos)
+{
+	return read_uint16(s, pos) | (read_uint16(s, pos+2) << 16);
+}
+
+PartFileReader::PartFileReader() : compressed(false), n_threads(0), chunk_pos(0), n_batches_read(0), next_batch(0), reader_done(false), stopping(false)
+{
+}
+
+PartFileReader::~PartFileReader()
+{
+	stop();
+}
+
+void PartFileReader::open(const std::string& fn, unsigned int n_threads)
+{
+	assert(! inputStream.is_open());
+	this->fn = fn;
+	this->n_threads = n_threads;
+
+	inputStream.open(fn.c_str(), std::ios::binary);
+	if(! inputStream.is_open())
+	{
+		throw std::runtime_error("Could not open file " + fn);
+	}
+
+	char magic[4] = {0, 0, 0, 0};
+	inputStream.read(magic, 4);
+	compressed = ((inputStream.gcount() == 4) && ((unsigned char)magic[0] == 0x1f) && ((unsigned char)magic[1] == 0x8b));
+	if(compressed && (((unsigned char)magic[2] != 8) || (((unsigned char)magic[3] & 4) == 0)))
+	{
+		throw std::runtime_error(fn + " is gzip-compressed, but not in BGZF format - please compress it with bgzip or CRAM2VCF.pl --compressPartFiles 1");
+	}
+	inputStream.clear();
+	inputStream.seekg(0);
+
+	if(compressed && (n_threads > 0))
+	{
+		readerThread = std::thread(&PartFileReader::readBatches, this);
+		for(unsigned int threadI = 0; threadI < n_threads; threadI++)
+		{
+			inflateThreads.push_back(std::thread(&PartFileReader::inflateBatches, this));
+		}
+	}
+}
+
+bool PartFileReader::getline(std::string& line)
+{
+	if(! compressed)
+	{
+		return (bool)std::getline(inputStream, line);
+	}
+
+	line.clear();
+	bool haveData = false;
+	while(true)
+	{
+		if(chunk_pos < chunk.length())
+		{
+			haveData = true;
+			size_t newline = chunk.find('\n', chunk_pos);
+			if(newline != std::string::npos)
+			{
+				line.append(chunk, chunk_pos, newline - chunk_pos);
+				chunk_pos = newline + 1;
+				return true;
+			}
+			line.append(chunk, chunk_pos, std::string::npos);
+			chunk_pos = chunk.length();
+		}
+		if(! nextChunk())
+		{
+			return haveData;
+		}
+	}
+}
+
+// reads the next (up to) blocks_per_batch complete BGZF blocks; false at the end of the file
+bool PartFileReader::readBatch(std::string& batch)
+{
+	batch.clear();
+	for(size_t blockI = 0; blockI < blocks_per_batch; blockI++)
+	{
+		std::string header(12, 0);
+		inputStream.read(&header[0], 12);
+		if(inputStream.gcount() == 0)
+		{
+			break;
+		}
+		if((inputStream.gcount() != 12) || ((unsigned char)header.at(0) != 0x1f) || ((unsigned char)header.at(1) != 0x8b) || (((unsigned char)header.at(3) & 4) == 0))
+		{
+			throw std::runtime_error("Invalid BGZF block header in " + fn);
+		}
+
+		unsigned int xlen = read_uint16(header, 10);
+		std::string extra(xlen, 0);
+		inputStream.read(&extra[0], xlen);
+		if(inputStream.gcount() != xlen)
+		{
+			throw std::runtime_error("Truncated BGZF block in " + fn);
+		}
+
+		// the BC subfield holds the total block size - 1
+		long long block_size = -1;
+		for(size_t extraPos = 0; (extraPos + 4) <= extra.length(); )
+		{
+			unsigned int subfield_length = read_uint16(extra, extraPos + 2);
+			if((extra.at(extraPos) == 'B') && (extra.at(extraPos+1) == 'C') && (subfield_length == 2))
+			{
+				block_size = read_uint16(extra, extraPos + 4) + 1;
+			}
+			extraPos += 4 + subfield_length;
+		}
+		if(block_size < (long long)(12 + xlen + 8))
+		{
+			throw std::runtime_error("No valid BGZF block size in " + fn + " - please compress it with bgzip or CRAM2VCF.pl --compressPartFiles 1");
+		}
+
+		size_t remaining = block_size - 12 - xlen;
+		size_t batch_length = batch.length();
+		batch.append(header);
+		batch.append(extra);
+		batch.resize(batch_length + block_size);
+		inputStream.read(&batch[batch_length + 12 + xlen], remaining);
+		if((size_t)inputStream.gcount() != remaining)
+		{
+			throw std::runtime_error("Truncated BGZF block in " + fn);
+		}
+	}
+	return (batch.length() > 0);
+}
+
+// inflates the blocks of a batch and checks their CRC32 and length
+void PartFileReader::inflateBatch(const std::string& batch, std::string& output) const
+{
+	output.clear();
+	size_t blockStart = 0;
+	while(blockStart < batch.length())
+	{
+		unsigned int xlen = read_uint16(batch, blockStart + 10);
+		size_t block_size = 0;
+		for(size_t extraPos = blockStart + 12; (extraPos + 4) <= (blockStart + 12 + xlen); )
+		{
+			unsigned int subfield_length = read_uint16(batch, extraPos + 2);
+			if((batch.at(extraPos) == 'B') && (batch.at(extraPos+1) == 'C') && (subfield_length == 2))
+			{
+				block_size = read_uint16(batch, extraPos + 4) + 1;
+			}
+			extraPos += 4 + subfield_length;
+		}
+		assert(block_size > 0);
+
+		size_t cdata_start = blockStart + 12 + xlen;
+		size_t cdata_length = block_size - 12 - xlen - 8;
+		unsigned int expected_crc = read_uint32(batch, blockStart + block_size - 8);
+		unsigned int isize = read_uint32(batch, blockStart + block_size - 4);
+
+		size_t output_start = output.length();
+		output.resize(output_start + isize);
+		if(isize > 0)
+		{
+			z_stream zs;
+			zs.zalloc = Z_NULL;
+			zs.zfree = Z_NULL;
+			zs.opaque = Z_NULL;
+			zs.next_in = (Bytef*)(batch.data() + cdata_start);
+			zs.avail_in = cdata_length;
+			zs.next_out = (Bytef*)(&output[output_start]);
+			zs.avail_out = isize;
+			if(inflateInit2(&zs, -15) != Z_OK)
+			{
+				throw std::runtime_error("Cannot initialize zlib");
+			}
+			int status = inflate(&zs, Z_FINISH);
+			inflateEnd(&zs);
+			if((status != Z_STREAM_END) || (zs.avail_out != 0))
+			{
+				throw std::runtime_error("Corrupt BGZF block in " + fn);
+			}
+			if(crc32(crc32(0L, Z_NULL, 0), (const Bytef*)(output.data() + output_start), isize) != expected_crc)
+			{
+				throw std::runtime_error("CRC32 mismatch in BGZF block in " + fn);
+			}
+		}
+		blockStart += block_size;
+	}
+}
+
+// reader thread: hands batches of compressed blocks to the inflate threads, at most 2 * n_threads at a time
+void PartFileReader::readBatches()
+{
+	try
+	{
+		while(true)
+		{
+			std::string batch;
+			if(! readBatch(batch))
+			{
+				break;
+			}
+			std::unique_lock<std::mutex> lock(m);
+			jobsChanged.wait(lock, [&](){ return (jobs.size() < (2 * n_threads)) || stopping; });
+			if(stopping)
+			{
+				return;
+			}
+			jobs.push_back(std::make_pair(n_batches_read++, std::move(batch)));
+			jobsChanged.notify_all();
+		}
+	}
+	catch(std::exception& e)
+	{
+		std::unique_lock<std::mutex> lock(m);
+		error = e.what();
+	}
+	std::unique_lock<std::mutex> lock(m);
+	reader_done = true;
+	jobsChanged.notify_all();
+	resultsChanged.notify_all();
+}
+
+// inflate threads: a batch is only taken on if it is at most 4 * n_threads batches ahead of getline(), which bounds memory
+void PartFileReader::inflateBatches()
+{
+	while(true)
+	{
+		std::pair<size_t, std::string> job;
+		{
+			std::unique_lock<std::mutex> lock(m);
+			jobsChanged.wait(lock, [&](){ return (jobs.size() && (jobs.front().first < (next_batch + 4 * n_threads))) || (reader_done && (jobs.size() == 0)) || stopping; });
+			if(stopping || (jobs.size() == 0))
+			{
+				return;
+			}
+			job = std::move(jobs.front());
+			jobs.pop_front();
+			jobsChanged.notify_all();
+		}
+
+		std::string output;
+		std::string inflateError;
+		try
+		{
+			inflateBatch(job.second, output);
+		}
+		catch(std::exception& e)
+		{
+			inflateError = e.what();
+		}
+
+		std::unique_lock<std::mutex> lock(m);
+		if(inflateError.length())
+		{
+			error = inflateError;
+		}
+		results[job.first] = std::move(output);
+		resultsChanged.notify_all();
+	}
+}
+
+bool PartFileReader::nextChunk()
+{
+	chunk.clear();
+	chunk_pos = 0;
+
+	if(n_threads == 0)
+	{
+		std::string batch;
+		if(! readBatch(batch))
+		{
+			return false;
+		}
+		inflateBatch(batch, chunk);
+		return true;
+	}
+
+	std::unique_lock<std::mutex> lock(m);
+	resultsChanged.wait(lock, [&](){ return results.count(next_batch) || (reader_done && (next_batch == n_batches_read)) || error.length(); });
+	if(error.length())
+	{
+		throw std::runtime_error(error);
+	}
+	if(! results.count(next_batch))
+	{
+		return false;
+	}
+	chunk = std::move(results.at(next_batch));
+	results.erase(next_batch);
+	next_batch++;
+	jobsChanged.notify_all();
+	return true;
+}
+
+void PartFileReader::stop()
+{
+	{
+		std::unique_lock<std::mutex> lock(m);
+		stopping = true;
+		jobsChanged.notify_all();
+		resultsChanged.notify_all();
+	}
+	if(readerThread.joinable())
+	{
+		readerThread.join();
+	}
+	for(std::thread& inflateThread : inflateThreads)
+	{
+		inflateThread.join();
+	}
+	inflateThreads.clear();
+}
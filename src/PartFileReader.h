@@ -0,0 +1,73 @@
+//============================================================================
+// Name        : PartFileReader.h
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+#ifndef PARTFILEREADER_H_
+#define PARTFILEREADER_H_
+
+#include <string>
+#include <fstream>
+#include <map>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// Line-by-line reader for the .part files written by CRAM2VCF.pl, which are either plain text or BGZF
+// (CRAM2VCF.pl --compressPartFiles 1, or bgzip). The format is detected from the first bytes of the file.
+// BGZF blocks are read in batches by a reader thread and inflated by n_threads worker threads; the
+// decompressed batches are handed to getline() in file order, with a bounded number of batches held in
+// memory. With n_threads == 0, batches are read and inflated by the thread that calls getline().
+class PartFileReader
+{
+public:
+	PartFileReader();
+	~PartFileReader();
+
+	void open(const std::string& fn, unsigned int n_threads);
+	bool isCompressed() const
+	{
+		return compressed;
+	}
+
+	// the next line without the newline character; false at the end of the file
+	bool getline(std::string& line);
+
+private:
+	PartFileReader(const PartFileReader&);
+	PartFileReader& operator=(const PartFileReader&);
+
+	std::string fn;
+	std::ifstream inputStream;
+	bool compressed;
+	unsigned int n_threads;
+
+	// decompressed data not yet returned by getline()
+	std::string chunk;
+	size_t chunk_pos;
+
+	std::thread readerThread;
+	std::vector<std::thread> inflateThreads;
+	std::mutex m;
+	std::condition_variable jobsChanged;
+	std::condition_variable resultsChanged;
+	std::deque<std::pair<size_t, std::string>> jobs;
+	std::map<size_t, std::string> results;
+	size_t n_batches_read;
+	size_t next_batch;
+	bool reader_done;
+	bool stopping;
+	std::string error;
+
+	bool readBatch(std::string& batch);
+	void inflateBatch(const std::string& batch, std::string& output) const;
+	void readBatches();
+	void inflateBatches();
+	bool nextChunk();
+	void stop();
+};
+
+#endif /* PARTFILEREADER_H_ */
@@ -0,0 +1,152 @@
+//============================================================================
+// Name        : ReferenceSequence.cpp
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+#include "ReferenceSequence.h"
+
+#include <fstream>
+#include <vector>
+#include <cstdlib>
+#include <algorithm>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Utilities.h"
+
+ReferenceSequence::ReferenceSequence() : sequence_length(0), mapping(0), mapping_length(0), mapped_sequence(0), line_bases(0), line_width(0)
+{
+}
+
+ReferenceSequence::~ReferenceSequence()
+{
+	if(mapping != 0)
+	{
+		munmap(mapping, mapping_length);
+	}
+}
+
+void ReferenceSequence::fromString(std::string& sequence)
+{
+	assert(mapping == 0);
+	in_memory_sequence.swap(sequence);
+	sequence_length = in_memory_sequence.length();
+}
+
+void ReferenceSequence::fromFASTA(const std::string& FASTAfn, const std::string& sequenceID)
+{
+	assert(mapping == 0);
+
+	// .fai: name, length, offset of the first base, bases per line, bytes per line
+	std::string faiFn = FASTAfn + ".fai";
+	std::ifstream faiStream;
+	faiStream.open(faiFn.c_str());
+	if(! faiStream.is_open())
+	{
+		throw std::runtime_error("Cannot open FASTA index " + faiFn + " - please run 'samtools faidx " + FASTAfn + "'");
+	}
+
+	bool found = false;
+	long long offset = 0;
+	std::string line;
+	while(faiStream.good())
+	{
+		std::getline(faiStream, line);
+		eraseNL(line);
+		if(line.length() == 0)
+			continue;
+		std::vector<std::string> fields = split(line, "\t");
+		if(fields.size() < 5)
+		{
+			throw std::runtime_error("Unexpected line in " + faiFn + ": " + line);
+		}
+		if(fields.at(0) == sequenceID)
+		{
+			sequence_length = strtoull(fields.at(1).c_str(), 0, 10);
+			offset = strtoll(fields.at(2).c_str(), 0, 10);
+			line_bases = strtoull(fields.at(3).c_str(), 0, 10);
+			line_width = strtoull(fields.at(4).c_str(), 0, 10);
+			found = true;
+			break;
+		}
+	}
+	if(! found)
+	{
+		throw std::runtime_error("Sequence " + sequenceID + " not in FASTA index " + faiFn);
+	}
+	if((sequence_length > 0) && ((line_bases == 0) || (line_width < line_bases)))
+	{
+		throw std::runtime_error("Invalid line lengths for " + sequenceID + " in " + faiFn);
+	}
+
+	if(sequence_length == 0)
+	{
+		return;
+	}
+
+	int fd = open(FASTAfn.c_str(), O_RDONLY);
+	if(fd == -1)
+	{
+		throw std::runtime_error("Cannot open " + FASTAfn);
+	}
+	struct stat fileInfo;
+	if(fstat(fd, &fileInfo) != 0)
+	{
+		close(fd);
+		throw std::runtime_error("Cannot stat " + FASTAfn);
+	}
+
+	// map only the part of the file that contains the sequence (page-aligned start)
+	size_t lastBaseOffset = offset + ((sequence_length - 1) / line_bases) * line_width + ((sequence_length - 1) % line_bases);
+	if(lastBaseOffset >= (size_t)fileInfo.st_size)
+	{
+		close(fd);
+		throw std::runtime_error("FASTA index " + faiFn + " does not match " + FASTAfn + " (is the index outdated?)");
+	}
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t mappingStart = (offset / pageSize) * pageSize;
+	mapping_length = lastBaseOffset + 1 - mappingStart;
+	mapping = mmap(0, mapping_length, PROT_READ, MAP_SHARED, fd, mappingStart);
+	close(fd);
+	if(mapping == MAP_FAILED)
+	{
+		mapping = 0;
+		throw std::runtime_error("Cannot mmap " + FASTAfn);
+	}
+	madvise(mapping, mapping_length, MADV_SEQUENTIAL);
+
+	mapped_sequence = (const char*)mapping + (offset - mappingStart);
+}
+
+std::string ReferenceSequence::substr(size_t pos, size_t len) const
+{
+	if(pos > sequence_length)
+	{
+		throw std::out_of_range("ReferenceSequence::substr");
+	}
+	if((len == std::string::npos) || (pos + len > sequence_length))
+	{
+		len = sequence_length - pos;
+	}
+	if(mapped_sequence == 0)
+	{
+		return in_memory_sequence.substr(pos, len);
+	}
+
+	std::string out;
+	out.reserve(len);
+	size_t refI = pos;
+	while(refI < pos + len)
+	{
+		// copy up to the end of the current FASTA line
+		size_t inLine = refI % line_bases;
+		size_t n = std::min(line_bases - inLine, pos + len - refI);
+		out.append(mapped_sequence + (refI / line_bases) * line_width + inLine, n);
+		refI += n;
+	}
+	return out;
+}
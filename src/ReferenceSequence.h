@@ -0,0 +1,60 @@
+//============================================================================
+// Name        : ReferenceSequence.h
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+#ifndef REFERENCESEQUENCE_H_
+#define REFERENCESEQUENCE_H_
+
+#include <string>
+#include <stdexcept>
+
+// One reference sequence, either held in memory (fromString) or read through a read-only memory mapping of the
+// slice of an indexed FASTA file (.fai) that contains it (fromFASTA) - the mapped pages are shared between
+// processes that use the same FASTA.
+class ReferenceSequence
+{
+public:
+	ReferenceSequence();
+	~ReferenceSequence();
+
+	void fromString(std::string& sequence);
+	void fromFASTA(const std::string& FASTAfn, const std::string& sequenceID);
+
+	size_t length() const
+	{
+		return sequence_length;
+	}
+
+	char at(size_t pos) const
+	{
+		if(pos >= sequence_length)
+		{
+			throw std::out_of_range("ReferenceSequence::at");
+		}
+		if(mapped_sequence == 0)
+		{
+			return in_memory_sequence[pos];
+		}
+		return mapped_sequence[(pos / line_bases) * line_width + (pos % line_bases)];
+	}
+
+	std::string substr(size_t pos, size_t len = std::string::npos) const;
+
+private:
+	ReferenceSequence(const ReferenceSequence&);
+	ReferenceSequence& operator=(const ReferenceSequence&);
+
+	std::string in_memory_sequence;
+	size_t sequence_length;
+
+	// mapping of the FASTA file; mapped_sequence points to the first base of the sequence within it
+	void* mapping;
+	size_t mapping_length;
+	const char* mapped_sequence;
+	size_t line_bases;
+	size_t line_width;
+};
+
+#endif /* REFERENCESEQUENCE_H_ */
@@ -0,0 +1,406 @@
+//============================================================================
+// Name        : SequenceStore.cpp
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+#include "SequenceStore.h"
+
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+#include <cctype>
+#include <assert.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Utilities.h"
+
+namespace {
+
+const char* storeMagic = "NGSTORE1";
+
+bool hostIsLittleEndian()
+{
+	uint16_t v = 1;
+	return (*((const unsigned char*)&v) == 1);
+}
+
+uint64_t readUInt64(const unsigned char* p)
+{
+	uint64_t v;
+	std::memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+// index of the first run in runs (sorted, non-overlapping (start, length) pairs) that ends after pos
+uint64_t firstRunEndingAfter(const uint64_t* runs, uint64_t n_runs, uint64_t pos)
+{
+	uint64_t lo = 0;
+	uint64_t hi = n_runs;
+	while(lo < hi)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+		if(runs[2*mid] + runs[2*mid+1] > pos)
+		{
+			hi = mid;
+		}
+		else
+		{
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+}
+
+SequenceStore::SequenceStore(const std::string& storeFn) : fn(storeFn), mapping(0), mapping_length(0)
+{
+	if(! hostIsLittleEndian())
+	{
+		throw std::runtime_error("SequenceStore: sequence stores can only be read on little-endian machines");
+	}
+
+	int fd = open(fn.c_str(), O_RDONLY);
+	if(fd == -1)
+	{
+		throw std::runtime_error("Cannot open sequence store " + fn);
+	}
+	struct stat fileInfo;
+	if(fstat(fd, &fileInfo) != 0)
+	{
+		close(fd);
+		throw std::runtime_error("Cannot stat " + fn);
+	}
+	mapping_length = fileInfo.st_size;
+	if(mapping_length < 24)
+	{
+		close(fd);
+		throw std::runtime_error("Sequence store " + fn + " is truncated");
+	}
+	mapping = mmap(0, mapping_length, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED)
+	{
+		mapping = 0;
+		throw std::runtime_error("Cannot mmap " + fn);
+	}
+
+	// the destructor does not run if the constructor throws
+	try
+	{
+		const unsigned char* data = (const unsigned char*)mapping;
+		if(std::memcmp(data, storeMagic, 8) != 0)
+		{
+			throw std::runtime_error(fn + " is not a sequence store - please (re-)build it with BUILD_SEQUENCESTORE");
+		}
+		uint64_t n_sequences = readUInt64(data + 8);
+		uint64_t indexOffset = readUInt64(data + 16);
+
+		// only the index is read up front - records are accessed on demand
+		size_t p = indexOffset;
+		for(uint64_t sequenceI = 0; sequenceI < n_sequences; sequenceI++)
+		{
+			if(p + 4 > mapping_length)
+			{
+				throw std::runtime_error("Sequence store " + fn + " is truncated");
+			}
+			uint32_t ID_length;
+			std::memcpy(&ID_length, data + p, sizeof(ID_length));
+			p += 4;
+			if(p + ID_length + 16 > mapping_length)
+			{
+				throw std::runtime_error("Sequence store " + fn + " is truncated");
+			}
+			std::string ID((const char*)(data + p), ID_length);
+			p += ID_length;
+			uint64_t sequence_length = readUInt64(data + p);
+			uint64_t recordOffset = readUInt64(data + p + 8);
+			p += 16;
+
+			index[ID] = std::make_pair(sequence_length, recordOffset);
+			IDs_in_order.push_back(ID);
+		}
+	}
+	catch(...)
+	{
+		munmap(mapping, mapping_length);
+		mapping = 0;
+		throw;
+	}
+}
+
+SequenceStore::~SequenceStore()
+{
+	if(mapping != 0)
+	{
+		munmap(mapping, mapping_length);
+	}
+}
+
+bool SequenceStore::hasSequence(const std::string& sequenceID) const
+{
+	return (index.count(sequenceID) > 0);
+}
+
+uint64_t SequenceStore::length(const std::string& sequenceID) const
+{
+	if(! index.count(sequenceID))
+	{
+		throw std::runtime_error("Sequence " + sequenceID + " not in sequence store " + fn);
+	}
+	return index.at(sequenceID).first;
+}
+
+SequenceStore::recordView SequenceStore::getRecord(const std::string& sequenceID) const
+{
+	if(! index.count(sequenceID))
+	{
+		throw std::runtime_error("Sequence " + sequenceID + " not in sequence store " + fn);
+	}
+
+	const unsigned char* data = (const unsigned char*)mapping;
+	uint64_t p = index.at(sequenceID).second;
+	assert(p % 8 == 0);
+
+	recordView r;
+	r.length = index.at(sequenceID).first;
+	r.n_NRuns = readUInt64(data + p);
+	r.NRuns = (const uint64_t*)(data + p + 8);
+	p += 8 + 16 * r.n_NRuns;
+	r.n_lowerCaseRuns = readUInt64(data + p);
+	r.lowerCaseRuns = (const uint64_t*)(data + p + 8);
+	p += 8 + 16 * r.n_lowerCaseRuns;
+	r.n_exceptions = readUInt64(data + p);
+	r.exceptions = (const uint64_t*)(data + p + 8);
+	p += 8 + 16 * r.n_exceptions;
+	r.packed = data + p;
+	if(p + (r.length + 3) / 4 > mapping_length)
+	{
+		throw std::runtime_error("Sequence store " + fn + " is truncated");
+	}
+	return r;
+}
+
+std::string SequenceStore::substr(const std::string& sequenceID, uint64_t first, uint64_t length, bool reverseComplement) const
+{
+	recordView r = getRecord(sequenceID);
+	if(first > r.length)
+	{
+		throw std::out_of_range("SequenceStore::substr");
+	}
+	if(length > r.length - first)
+	{
+		length = r.length - first;
+	}
+	uint64_t end = first + length;
+
+	static const char bases[4] = {'A', 'C', 'G', 'T'};
+	std::string out(length, 'A');
+	for(uint64_t pos = first; pos < end; pos++)
+	{
+		out[pos - first] = bases[(r.packed[pos >> 2] >> (6 - 2 * (pos & 3))) & 3];
+	}
+
+	for(uint64_t runI = firstRunEndingAfter(r.NRuns, r.n_NRuns, first); (runI < r.n_NRuns) && (r.NRuns[2*runI] < end); runI++)
+	{
+		uint64_t runStart = std::max(r.NRuns[2*runI], first);
+		uint64_t runEnd = std::min(r.NRuns[2*runI] + r.NRuns[2*runI+1], end);
+		out.replace(runStart - first, runEnd - runStart, runEnd - runStart, 'N');
+	}
+
+	// exceptions are single positions, i.e. runs of length 1 - the position doubles as the run start
+	uint64_t exceptionI = 0;
+	{
+		uint64_t lo = 0;
+		uint64_t hi = r.n_exceptions;
+		while(lo < hi)
+		{
+			uint64_t mid = lo + (hi - lo) / 2;
+			if(r.exceptions[2*mid] >= first)
+			{
+				hi = mid;
+			}
+			else
+			{
+				lo = mid + 1;
+			}
+		}
+		exceptionI = lo;
+	}
+	for(; (exceptionI < r.n_exceptions) && (r.exceptions[2*exceptionI] < end); exceptionI++)
+	{
+		out[r.exceptions[2*exceptionI] - first] = (char)r.exceptions[2*exceptionI+1];
+	}
+
+	for(uint64_t runI = firstRunEndingAfter(r.lowerCaseRuns, r.n_lowerCaseRuns, first); (runI < r.n_lowerCaseRuns) && (r.lowerCaseRuns[2*runI] < end); runI++)
+	{
+		uint64_t runStart = std::max(r.lowerCaseRuns[2*runI], first);
+		uint64_t runEnd = std::min(r.lowerCaseRuns[2*runI] + r.lowerCaseRuns[2*runI+1], end);
+		for(uint64_t pos = runStart; pos < runEnd; pos++)
+		{
+			out[pos - first] = std::tolower(out[pos - first]);
+		}
+	}
+
+	if(reverseComplement)
+	{
+		return ::reverseComplement(out);
+	}
+	return out;
+}
+
+std::string SequenceStore::sequence(const std::string& sequenceID, bool reverseComplement) const
+{
+	return substr(sequenceID, 0, length(sequenceID), reverseComplement);
+}
+
+SequenceStoreWriter::SequenceStoreWriter(const std::string& storeFn) : fn(storeFn), offset(0), closed(false)
+{
+	if(! hostIsLittleEndian())
+	{
+		throw std::runtime_error("SequenceStoreWriter: sequence stores can only be written on little-endian machines");
+	}
+
+	output.open(fn.c_str(), std::ios::binary);
+	if(! output.is_open())
+	{
+		throw std::runtime_error("Cannot open " + fn + " for writing");
+	}
+
+	// number of sequences and index offset are filled in by close()
+	output.write(storeMagic, 8);
+	offset += 8;
+	writeUInt64(0);
+	writeUInt64(0);
+}
+
+SequenceStoreWriter::~SequenceStoreWriter()
+{
+	if(! closed)
+	{
+		output.close();
+	}
+}
+
+void SequenceStoreWriter::writeUInt64(uint64_t v)
+{
+	output.write((const char*)&v, sizeof(v));
+	offset += sizeof(v);
+}
+
+void SequenceStoreWriter::writeUInt32(uint32_t v)
+{
+	output.write((const char*)&v, sizeof(v));
+	offset += sizeof(v);
+}
+
+void SequenceStoreWriter::addSequence(const std::string& sequenceID, const std::string& sequence)
+{
+	assert(! closed);
+	assert(offset % 8 == 0);
+
+	std::vector<uint64_t> NRuns;
+	std::vector<uint64_t> lowerCaseRuns;
+	std::vector<uint64_t> exceptions;
+	std::string packed((sequence.length() + 3) / 4, (char)0);
+
+	for(size_t pos = 0; pos < sequence.length(); pos++)
+	{
+		char c = sequence.at(pos);
+		if(std::islower(c))
+		{
+			if(lowerCaseRuns.size() && (lowerCaseRuns.at(lowerCaseRuns.size() - 2) + lowerCaseRuns.back() == pos))
+			{
+				lowerCaseRuns.back()++;
+			}
+			else
+			{
+				lowerCaseRuns.push_back(pos);
+				lowerCaseRuns.push_back(1);
+			}
+			c = std::toupper(c);
+		}
+
+		int code = -1;
+		switch(c)
+		{
+			case 'A': code = 0; break;
+			case 'C': code = 1; break;
+			case 'G': code = 2; break;
+			case 'T': code = 3; break;
+			case 'N':
+				if(NRuns.size() && (NRuns.at(NRuns.size() - 2) + NRuns.back() == pos))
+				{
+					NRuns.back()++;
+				}
+				else
+				{
+					NRuns.push_back(pos);
+					NRuns.push_back(1);
+				}
+				break;
+			default:
+				exceptions.push_back(pos);
+				exceptions.push_back((unsigned char)c);
+				break;
+		}
+		if(code > 0)
+		{
+			packed[pos >> 2] |= (char)(code << (6 - 2 * (pos & 3)));
+		}
+	}
+
+	IDs.push_back(sequenceID);
+	lengths.push_back(sequence.length());
+	recordOffsets.push_back(offset);
+
+	writeUInt64(NRuns.size() / 2);
+	for(size_t i = 0; i < NRuns.size(); i++)
+		writeUInt64(NRuns.at(i));
+	writeUInt64(lowerCaseRuns.size() / 2);
+	for(size_t i = 0; i < lowerCaseRuns.size(); i++)
+		writeUInt64(lowerCaseRuns.at(i));
+	writeUInt64(exceptions.size() / 2);
+	for(size_t i = 0; i < exceptions.size(); i++)
+		writeUInt64(exceptions.at(i));
+
+	packed.append((8 - packed.length() % 8) % 8, (char)0);
+	output.write(packed.data(), packed.length());
+	offset += packed.length();
+
+	if(! output.good())
+	{
+		throw std::runtime_error("Error writing to " + fn);
+	}
+}
+
+void SequenceStoreWriter::close()
+{
+	assert(! closed);
+
+	uint64_t indexOffset = offset;
+	for(size_t sequenceI = 0; sequenceI < IDs.size(); sequenceI++)
+	{
+		writeUInt32(IDs.at(sequenceI).length());
+		output.write(IDs.at(sequenceI).data(), IDs.at(sequenceI).length());
+		offset += IDs.at(sequenceI).length();
+		writeUInt64(lengths.at(sequenceI));
+		writeUInt64(recordOffsets.at(sequenceI));
+	}
+
+	output.seekp(8);
+	uint64_t n_sequences = IDs.size();
+	output.write((const char*)&n_sequences, sizeof(n_sequences));
+	output.write((const char*)&indexOffset, sizeof(indexOffset));
+	output.close();
+	closed = true;
+
+	if(output.fail())
+	{
+		throw std::runtime_error("Error writing to " + fn);
+	}
+}
@@ -0,0 +1,106 @@
+//============================================================================
+// Name        : SequenceStore.h
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+#ifndef SEQUENCESTORE_H_
+#define SEQUENCESTORE_H_
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <stdint.h>
+
+/*
+   Packed, indexed sequence store (<FASTA>.seqstore), built by BUILD_SEQUENCESTORE and read by the C++ tools
+   (SequenceStore) and the Perl scripts (scripts/SequenceStore.pm). All integers are little-endian.
+
+   "NGSTORE1"                                  magic
+   uint64 number of sequences
+   uint64 offset of the index
+   one record per sequence:
+     uint64 n, n x (uint64 start, uint64 length)     runs of N/n
+     uint64 n, n x (uint64 start, uint64 length)     runs of lower-case characters
+     uint64 n, n x (uint64 position, uint64 char)    other characters (IUPAC codes etc.), upper case
+     ceil(length / 4) bytes                          2 bits per position (A=0, C=1, G=2, T=3), first base in the high bits
+     padding to a multiple of 8 bytes
+   index, in input order:
+     uint32 length of the ID, ID, uint64 sequence length, uint64 offset of the record
+
+   Sequence IDs are the FASTA header up to the first whitespace (like samtools faidx).
+*/
+
+class SequenceStore
+{
+public:
+	SequenceStore(const std::string& storeFn);
+	~SequenceStore();
+
+	bool hasSequence(const std::string& sequenceID) const;
+	uint64_t length(const std::string& sequenceID) const;
+	const std::vector<std::string>& sequenceIDs() const
+	{
+		return IDs_in_order;
+	}
+
+	// [first, first + length) of a sequence; with reverseComplement, the reverse complement of that interval
+	std::string substr(const std::string& sequenceID, uint64_t first, uint64_t length, bool reverseComplement = false) const;
+	std::string sequence(const std::string& sequenceID, bool reverseComplement = false) const;
+
+	static std::string storeFilename(const std::string& FASTAfn)
+	{
+		return FASTAfn + ".seqstore";
+	}
+
+private:
+	SequenceStore(const SequenceStore&);
+	SequenceStore& operator=(const SequenceStore&);
+
+	// a record, read directly from the mapping - the run and exception tables are arrays of (uint64, uint64) pairs
+	class recordView
+	{
+	public:
+		uint64_t length;
+		const uint64_t* NRuns;
+		uint64_t n_NRuns;
+		const uint64_t* lowerCaseRuns;
+		uint64_t n_lowerCaseRuns;
+		const uint64_t* exceptions;
+		uint64_t n_exceptions;
+		const unsigned char* packed;
+	};
+
+	recordView getRecord(const std::string& sequenceID) const;
+
+	std::string fn;
+	void* mapping;
+	size_t mapping_length;
+	std::map<std::string, std::pair<uint64_t, uint64_t>> index; // ID -> (length, record offset)
+	std::vector<std::string> IDs_in_order;
+};
+
+class SequenceStoreWriter
+{
+public:
+	SequenceStoreWriter(const std::string& storeFn);
+	~SequenceStoreWriter();
+
+	void addSequence(const std::string& sequenceID, const std::string& sequence);
+	void close();
+
+private:
+	void writeUInt64(uint64_t v);
+	void writeUInt32(uint32_t v);
+
+	std::string fn;
+	std::ofstream output;
+	uint64_t offset;
+	bool closed;
+	std::vector<std::string> IDs;
+	std::vector<uint64_t> lengths;
+	std::vector<uint64_t> recordOffsets;
+};
+
+#endif /* SEQUENCESTORE_H_ */
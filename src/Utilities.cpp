@@ -0,0 +1,185 @@
+//============================================================================
+// Name        : Utilities.cpp
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+#include "Utilities.h"
+
+using namespace std;
+
+vector<string> split(string input, string delimiter)
+{
+	vector<string> output;
+	if(input.length() == 0)
+	{
+		return output;
+	}
+
+	if(delimiter == "")
+	{
+		output.reserve(input.size());
+		for(unsigned int i = 0; i < input.length(); i++)
+		{
+			output.push_back(input.substr(i, 1));
+		}
+	}
+	else
+	{
+		if(input.find(delimiter) == string::npos)
+		{
+			output.push_back(input);
+		}
+		else
+		{
+			int s = 0;
+			int p = input.find(delimiter);
+
+			do {
+				output.push_back(input.substr(s, p - s));
+				s = p + delimiter.size();
+				p = input.find(delimiter, s);
+			} while (p != (int)string::npos);
+			output.push_back(input.substr(s));
+		}
+	}
+
+	return output;
+}
+
+void eraseNL(string& s)
+{
+	if (!s.empty() && s[s.length()-1] == '\r') {
+	    s.erase(s.length()-1);
+	}
+	if (!s.empty() && s[s.length()-1] == '\n') {
+	    s.erase(s.length()-1);
+	}
+}
+
+int StrtoI(string s)
+{
+	  stringstream ss(s);
+	  int i;
+	  ss >> i;
+	  return i;
+}
+
+unsigned int StrtoUI(string s)
+{
+	  stringstream ss(s);
+	  unsigned int i;
+	  ss >> i;
+	  return i;
+}
+
+string ItoStr(int i)
+{
+	std::stringstream sstm;
+	sstm << i;
+	return sstm.str();
+}
+
+string join(vector<string> parts, string delim)
+{
+	if(parts.size() == 0)
+		return "";
+
+	string ret = parts.at(0);
+
+	for(unsigned int i = 1; i < parts.size(); i++)
+	{
+		ret.append(delim);
+		ret.append(parts.at(i));
+	}
+
+	return ret;
+}
+
+
+
+
+std::string removeGaps(std::string in)
+{
+	std::string out;
+	out.reserve(in.size());
+	for(size_t i = 0; i < in.size(); i++)
+	{
+		if((in.at(i) != '_') && (in.at(i) != '-') && (in.at(i) != '*'))
+		{
+			out.push_back(in.at(i));
+		}
+	}
+	return out;
+}
+
+std::string reverseComplement(const std::string& kMer)
+{
+	// like reverseComplement() in the Perl scripts: only upper-case ACGT are complemented
+	std::string out;
+	out.reserve(kMer.size());
+	for(std::string::const_reverse_iterator it = kMer.rbegin(); it != kMer.rend(); it++)
+	{
+		char c = *it;
+		switch(c)
+		{
+			case 'A': c = 'T'; break;
+			case 'C': c = 'G'; break;
+			case 'G': c = 'C'; break;
+			case 'T': c = 'A'; break;
+		}
+		out.push_back(c);
+	}
+	return out;
+}
+
+void readFASTA(std::string file, std::map<std::string, std::string>& sequences, std::vector<std::string>& sequenceIDs, bool keepCompleteIdentifier)
+{
+	// identifiers are truncated at the first whitespace unless keepCompleteIdentifier is set; sequenceIDs keeps the file order
+	std::ifstream FASTAstream;
+	FASTAstream.open(file.c_str());
+	if(! FASTAstream.is_open())
+	{
+		throw std::runtime_error("Cannot open " + file);
+	}
+
+	std::string line;
+	std::string* currentSequence = 0;
+	while(FASTAstream.good())
+	{
+		std::getline(FASTAstream, line);
+		eraseNL(line);
+		if(line.length() && (line.at(0) == '>'))
+		{
+			std::string sequenceID = line.substr(1);
+			if(! keepCompleteIdentifier)
+			{
+				size_t whitespace_pos = sequenceID.find_first_of(" \t");
+				if(whitespace_pos != std::string::npos)
+				{
+					sequenceID = sequenceID.substr(0, whitespace_pos);
+				}
+			}
+			if(! sequences.count(sequenceID))
+			{
+				sequenceIDs.push_back(sequenceID);
+			}
+			currentSequence = &(sequences[sequenceID]);
+		}
+		else if(line.length())
+		{
+			if(currentSequence == 0)
+			{
+				throw std::runtime_error("FASTA file " + file + " does not start with a header line");
+			}
+			currentSequence->append(line);
+		}
+	}
+}
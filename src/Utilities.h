@@ -0,0 +1,24 @@
+//============================================================================
+// Name        : Utilities.h
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+#ifndef UTILITIES_H_
+#define UTILITIES_H_
+
+#include <string>
+#include <vector>
+#include <map>
+
+std::vector<std::string> split(std::string input, std::string delimiter);
+std::string join(std::vector<std::string> parts, std::string delim);
+void eraseNL(std::string& s);
+int StrtoI(std::string s);
+std::string ItoStr(int i);
+unsigned int StrtoUI(std::string s);
+std::string removeGaps(std::string in);
+std::string reverseComplement(const std::string& kMer);
+void readFASTA(std::string file, std::map<std::string, std::string>& sequences, std::vector<std::string>& sequenceIDs, bool keepCompleteIdentifier = false);
+
+#endif /* UTILITIES_H_ */
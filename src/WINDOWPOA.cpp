@@ -0,0 +1,927 @@
+//============================================================================
+// Name        : WINDOWPOA.cpp
+// Author      : Alexander Dilthey (HHU/UKD, NHGRI-NIH), Evan Biederstedt (NYGC), Nathan Dunn (LBNL), Nancy Hansen (NIH), Aarti Jajoo (Baylor), Jeff Oliver (Arizona), Andrew Olsen (CSHL)
+// License     : The MIT License, https://github.com/NCBI-Hackathons/Graph_Genomes_CSHL/blob/master/LICENSE
+//============================================================================
+
+/*
+
+   Native multiple aligner for the MAFFT windows produced by BAM2MAFFT(.pl) - an in-process alternative to the
+   MAFFT call in scripts/CALLMAFFT.pl.
+
+   Each window (<chromosome>_<windowI>.fa) is aligned by banded partial-order alignment (POA): the graph is
+   initialized with the reference entry ('ref' or 'ref_FIRST'), and the other sequences are aligned to the graph
+   one by one (affine gaps, global in the sequence, free start and end in the graph) and then merged into it.
+   The band is placed around the reference anchor: unique k-mers shared between a sequence and the reference are
+   chained, and each graph node is given the band of sequence positions that the chain predicts for its reference
+   coordinate, widened by --bandWidth and by the indel between the two neighbouring anchors. The inner loops over
+   the band work on contiguous int arrays with a precomputed substitution profile, so that they are vectorized by
+   the compiler.
+
+   The output (<chromosome>_<windowI>.mfa, next to the input) is the padded MSA that CALLMAFFT.pl would write:
+   all entries of the input in input order, '-' and '_' removed before alignment, sequences without any bases as
+   all-gap rows.
+
+   Windows that do not pass the quality checks are not written and are listed in --failedList, so that they can
+   be aligned by MAFFT instead:
+     - no reference entry, or characters that fas2bam.pl would not accept,
+     - a sequence without reference anchors that is too long for a full DP, or a DP larger than --maxCells,
+     - an alignment path that touches the band boundary (the band was probably too narrow),
+     - a sequence with less than --minIdentity of its bases aligned to identical graph bases.
+
+   Usage: WINDOWPOA (--input <window.fa> [--output <window.mfa>] | --inputList <file with one window.fa per line>)
+                    [--failedList <file>] [--threads N] [--bandWidth 100] [--minIdentity 0.8] [--maxCells 10000000]
+
+*/
+
+#include <iostream>
+#include <vector>
+#include <map>
+#include <set>
+#include <assert.h>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <exception>
+#include <stdexcept>
+#include <utility>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <cctype>
+#include <climits>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+
+#include "Utilities.h"
+
+int bandWidth = 100;
+double minIdentity = 0.8;
+long long maxCells = 10000000;
+
+const int kMerSize = 15;
+const int scoreMatch = 2;
+const int scoreMismatch = -4;
+const int scoreGapOpen = 4;
+const int scoreGapExtend = 2;
+const int NEG_INF = INT_MIN / 4;
+
+class poaNode
+{
+public:
+	char base;
+	int coordinate;
+	std::vector<int> in;
+	std::vector<int> out;
+	std::vector<int> alignedTo;
+};
+
+class poaGraph
+{
+public:
+	std::vector<poaNode> nodes;
+
+	int addNode(char base, int coordinate)
+	{
+		poaNode n;
+		n.base = base;
+		n.coordinate = coordinate;
+		nodes.push_back(n);
+		return nodes.size() - 1;
+	}
+
+	void addEdge(int from, int to)
+	{
+		if(std::find(nodes.at(from).out.begin(), nodes.at(from).out.end(), to) == nodes.at(from).out.end())
+		{
+			nodes.at(from).out.push_back(to);
+			nodes.at(to).in.push_back(from);
+		}
+	}
+
+	std::vector<int> topologicalOrder() const
+	{
+		std::vector<int> inDegree(nodes.size());
+		std::vector<int> order;
+		order.reserve(nodes.size());
+		for(size_t nodeI = 0; nodeI < nodes.size(); nodeI++)
+		{
+			inDegree.at(nodeI) = nodes.at(nodeI).in.size();
+			if(inDegree.at(nodeI) == 0)
+				order.push_back(nodeI);
+		}
+		for(size_t orderI = 0; orderI < order.size(); orderI++)
+		{
+			for(int successor : nodes.at(order.at(orderI)).out)
+			{
+				if(--inDegree.at(successor) == 0)
+					order.push_back(successor);
+			}
+		}
+		if(order.size() != nodes.size())
+		{
+			throw std::runtime_error("POA graph is not acyclic");
+		}
+		return order;
+	}
+};
+
+// one DP row per graph node, covering the sequence positions [lo, hi] (positions are 1-based: j sequence characters consumed)
+class bandRow
+{
+public:
+	int lo;
+	int hi;
+	std::vector<int> H;
+	std::vector<int> E;
+	std::vector<int> F;
+
+	inline int at(const std::vector<int>& v, int j) const
+	{
+		return ((j >= lo) && (j <= hi)) ? v[j - lo] : NEG_INF;
+	}
+};
+
+class windowResult
+{
+public:
+	bool ok;
+	std::string message;
+};
+
+bool allowedCharacter(char c);
+int baseIndex(char c);
+std::vector<std::pair<int, int>> chainedAnchors(const std::unordered_map<unsigned long long, int>& referenceKMers, const std::string& sequence);
+std::vector<int> alignToGraph(const poaGraph& graph, const std::string& sequence, const std::vector<std::pair<int, int>>& anchors, std::string& failure);
+std::vector<int> mergeIntoGraph(poaGraph& graph, const std::string& sequence, const std::vector<int>& alignedNodes);
+windowResult alignWindow(const std::string& inputFile, const std::string& outputFile);
+
+int main(int argc, char *argv[]) {
+	std::vector<std::string> ARG (argv + 1, argv + argc + !argc);
+	std::map<std::string, std::string> arguments;
+
+	for(unsigned int i = 0; i < ARG.size(); i++)
+	{
+		if((ARG.at(i).length() > 2) && (ARG.at(i).substr(0, 2) == "--"))
+		{
+			std::string argname = ARG.at(i).substr(2);
+			std::string argvalue = ARG.at(i+1);
+			arguments[argname] = argvalue;
+		}
+	}
+
+	if(!(arguments.count("input") || arguments.count("inputList")))
+	{
+		std::cerr << "Usage: WINDOWPOA (--input <window.fa> [--output <window.mfa>] | --inputList <file with one window.fa per line>) [--failedList <file>] [--threads N] [--bandWidth 100] [--minIdentity 0.8] [--maxCells 10000000]\n";
+		return 1;
+	}
+
+	int threads = 1;
+	if(arguments.count("threads"))
+	{
+		threads = StrtoI(arguments.at("threads"));
+		assert(threads > 0);
+	}
+	if(arguments.count("bandWidth"))
+	{
+		bandWidth = StrtoI(arguments.at("bandWidth"));
+		assert(bandWidth > 0);
+	}
+	if(arguments.count("minIdentity"))
+	{
+		minIdentity = atof(arguments.at("minIdentity").c_str());
+		assert((minIdentity >= 0) && (minIdentity <= 1));
+	}
+	if(arguments.count("maxCells"))
+	{
+		maxCells = atoll(arguments.at("maxCells").c_str());
+		assert(maxCells > 0);
+	}
+
+	auto outputForInput = [](const std::string& inputFile) -> std::string {
+		if(!((inputFile.length() > 3) && (inputFile.substr(inputFile.length() - 3) == ".fa")))
+		{
+			throw std::runtime_error("File weird name: " + inputFile);
+		}
+		return inputFile.substr(0, inputFile.length() - 3) + ".mfa";
+	};
+
+	std::vector<std::pair<std::string, std::string>> windows;
+	if(arguments.count("input"))
+	{
+		windows.push_back(std::make_pair(arguments.at("input"), arguments.count("output") ? arguments.at("output") : outputForInput(arguments.at("input"))));
+	}
+	if(arguments.count("inputList"))
+	{
+		std::ifstream listStream;
+		listStream.open(arguments.at("inputList").c_str());
+		if(!listStream.is_open())
+		{
+			throw std::runtime_error("Cannot open file " + arguments.at("inputList"));
+		}
+		std::string line;
+		while(listStream.good())
+		{
+			std::getline(listStream, line);
+			eraseNL(line);
+			if(line.length() == 0)
+				continue;
+			windows.push_back(std::make_pair(line, outputForInput(line)));
+		}
+	}
+
+	std::vector<windowResult> results(windows.size());
+	std::atomic<size_t> nextWindow(0);
+	auto worker = [&]() {
+		while(true)
+		{
+			size_t windowI = nextWindow++;
+			if(windowI >= windows.size())
+				break;
+			results.at(windowI) = alignWindow(windows.at(windowI).first, windows.at(windowI).second);
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for(int threadI = 0; threadI < threads; threadI++)
+	{
+		workers.push_back(std::thread(worker));
+	}
+	for(std::thread& t : workers)
+	{
+		t.join();
+	}
+
+	std::ofstream failedStream;
+	if(arguments.count("failedList"))
+	{
+		failedStream.open(arguments.at("failedList").c_str());
+		if(!failedStream.is_open())
+		{
+			throw std::runtime_error("Cannot open file " + arguments.at("failedList") + " for writing");
+		}
+	}
+
+	size_t n_failed = 0;
+	for(size_t windowI = 0; windowI < windows.size(); windowI++)
+	{
+		if(!results.at(windowI).ok)
+		{
+			std::cerr << "WINDOWPOA: " << windows.at(windowI).first << " left for MAFFT: " << results.at(windowI).message << "\n";
+			if(failedStream.is_open())
+			{
+				failedStream << windows.at(windowI).first << "\n";
+			}
+			n_failed++;
+		}
+	}
+
+	std::cout << "WINDOWPOA: aligned " << (windows.size() - n_failed) << " of " << windows.size() << " windows, " << n_failed << " failed the quality checks.\n" << std::flush;
+
+	return ((n_failed && !failedStream.is_open()) ? 1 : 0);
+}
+
+windowResult alignWindow(const std::string& inputFile, const std::string& outputFile)
+{
+	windowResult result;
+	result.ok = false;
+
+	try
+	{
+		std::remove(outputFile.c_str());
+
+		std::map<std::string, std::string> sequences;
+		std::vector<std::string> sequenceIDs;
+		readFASTA(inputFile, sequences, sequenceIDs);
+		if(sequenceIDs.size() == 0)
+		{
+			result.message = "no sequences";
+			return result;
+		}
+
+		std::string referenceID = sequences.count("ref") ? "ref" : "ref_FIRST";
+		if(!sequences.count(referenceID))
+		{
+			result.message = "no reference entry";
+			return result;
+		}
+
+		for(const std::string& sequenceID : sequenceIDs)
+		{
+			std::string withoutGaps;
+			withoutGaps.reserve(sequences.at(sequenceID).length());
+			for(char c : sequences.at(sequenceID))
+			{
+				if((c == '-') || (c == '_'))
+					continue;
+				if(!allowedCharacter(c))
+				{
+					result.message = "illegal character '" + std::string(1, c) + "' in " + sequenceID;
+					return result;
+				}
+				withoutGaps.push_back(c);
+			}
+			sequences.at(sequenceID) = withoutGaps;
+		}
+
+		const std::string& reference = sequences.at(referenceID);
+		if(reference.length() == 0)
+		{
+			result.message = "empty reference";
+			return result;
+		}
+
+		poaGraph graph;
+		std::map<std::string, std::vector<int>> paths;
+		{
+			std::vector<int>& referencePath = paths[referenceID];
+			for(size_t refI = 0; refI < reference.length(); refI++)
+			{
+				referencePath.push_back(graph.addNode(toupper(reference.at(refI)), refI));
+				if(refI > 0)
+				{
+					graph.addEdge(referencePath.at(refI - 1), referencePath.at(refI));
+				}
+			}
+		}
+
+		std::unordered_map<unsigned long long, int> referenceKMers;
+		if((int)reference.length() >= kMerSize)
+		{
+			std::unordered_map<unsigned long long, int> kMerCount;
+			std::vector<std::pair<unsigned long long, int>> kMers;
+			for(int refI = 0; refI + kMerSize <= (int)reference.length(); refI++)
+			{
+				unsigned long long kMer = 0;
+				bool valid = true;
+				for(int kI = 0; kI < kMerSize; kI++)
+				{
+					int b = baseIndex(reference.at(refI + kI));
+					if(b > 3)
+					{
+						valid = false;
+						break;
+					}
+					kMer = (kMer << 2) | b;
+				}
+				if(valid)
+				{
+					kMerCount[kMer]++;
+					kMers.push_back(std::make_pair(kMer, refI));
+				}
+			}
+			for(const std::pair<unsigned long long, int>& kMer : kMers)
+			{
+				if(kMerCount.at(kMer.first) == 1)
+				{
+					referenceKMers[kMer.first] = kMer.second;
+				}
+			}
+		}
+
+		for(const std::string& sequenceID : sequenceIDs)
+		{
+			if(sequenceID == referenceID)
+				continue;
+			const std::string& sequence = sequences.at(sequenceID);
+			if(sequence.length() == 0)
+				continue;
+
+			std::vector<std::pair<int, int>> anchors = chainedAnchors(referenceKMers, sequence);
+			std::string failure;
+			std::vector<int> alignedNodes = alignToGraph(graph, sequence, anchors, failure);
+			if(failure.length())
+			{
+				result.message = sequenceID + ": " + failure;
+				return result;
+			}
+
+			size_t n_identical = 0;
+			for(size_t seqI = 0; seqI < sequence.length(); seqI++)
+			{
+				if((alignedNodes.at(seqI) != -1) && (graph.nodes.at(alignedNodes.at(seqI)).base == toupper(sequence.at(seqI))))
+					n_identical++;
+			}
+			if(n_identical < minIdentity * sequence.length())
+			{
+				result.message = sequenceID + ": identity " + std::to_string((double)n_identical / sequence.length()) + " below --minIdentity";
+				return result;
+			}
+
+			paths[sequenceID] = mergeIntoGraph(graph, sequence, alignedNodes);
+		}
+
+		// columns: aligned nodes (same column, different bases) are grouped, and groups are sorted topologically
+		std::vector<int> group(graph.nodes.size());
+		for(size_t nodeI = 0; nodeI < graph.nodes.size(); nodeI++)
+		{
+			int representative = nodeI;
+			for(int other : graph.nodes.at(nodeI).alignedTo)
+			{
+				representative = std::min(representative, other);
+			}
+			group.at(nodeI) = representative;
+		}
+		std::vector<std::vector<int>> groupSuccessors(graph.nodes.size());
+		std::vector<int> groupInDegree(graph.nodes.size(), 0);
+		for(size_t nodeI = 0; nodeI < graph.nodes.size(); nodeI++)
+		{
+			for(int successor : graph.nodes.at(nodeI).out)
+			{
+				int from = group.at(nodeI);
+				int to = group.at(successor);
+				if(std::find(groupSuccessors.at(from).begin(), groupSuccessors.at(from).end(), to) == groupSuccessors.at(from).end())
+				{
+					groupSuccessors.at(from).push_back(to);
+					groupInDegree.at(to)++;
+				}
+			}
+		}
+		// among the groups that are ready, the one with the smallest reference coordinate comes first
+		std::vector<int> groupOrder;
+		std::set<std::pair<int, int>> readyGroups;
+		size_t n_groups = 0;
+		for(size_t nodeI = 0; nodeI < graph.nodes.size(); nodeI++)
+		{
+			if(group.at(nodeI) == (int)nodeI)
+			{
+				n_groups++;
+				if(groupInDegree.at(nodeI) == 0)
+					readyGroups.insert(std::make_pair(graph.nodes.at(nodeI).coordinate, (int)nodeI));
+			}
+		}
+		while(readyGroups.size())
+		{
+			int readyGroup = readyGroups.begin()->second;
+			readyGroups.erase(readyGroups.begin());
+			groupOrder.push_back(readyGroup);
+			for(int successor : groupSuccessors.at(readyGroup))
+			{
+				if(--groupInDegree.at(successor) == 0)
+					readyGroups.insert(std::make_pair(graph.nodes.at(successor).coordinate, successor));
+			}
+		}
+		if(groupOrder.size() != n_groups)
+		{
+			result.message = "aligned nodes form a cycle";
+			return result;
+		}
+		std::vector<int> groupColumn(graph.nodes.size(), -1);
+		for(size_t orderI = 0; orderI < groupOrder.size(); orderI++)
+		{
+			groupColumn.at(groupOrder.at(orderI)) = orderI;
+		}
+
+		std::ofstream outputStream;
+		outputStream.open(outputFile.c_str());
+		if(!outputStream.is_open())
+		{
+			throw std::runtime_error("Cannot open " + outputFile + " for writing");
+		}
+		for(const std::string& sequenceID : sequenceIDs)
+		{
+			std::string row(n_groups, '-');
+			if(paths.count(sequenceID))
+			{
+				const std::vector<int>& path = paths.at(sequenceID);
+				const std::string& sequence = sequences.at(sequenceID);
+				assert(path.size() == sequence.length());
+				for(size_t seqI = 0; seqI < path.size(); seqI++)
+				{
+					int column = groupColumn.at(group.at(path.at(seqI)));
+					assert(row.at(column) == '-');
+					row.at(column) = sequence.at(seqI);
+				}
+			}
+			outputStream << ">" << sequenceID << "\n" << row << "\n";
+		}
+		outputStream.close();
+		if(!outputStream)
+		{
+			throw std::runtime_error("Cannot write " + outputFile);
+		}
+
+		result.ok = true;
+	}
+	catch(std::exception& e)
+	{
+		std::remove(outputFile.c_str());
+		result.ok = false;
+		result.message = e.what();
+	}
+
+	return result;
+}
+
+bool allowedCharacter(char c)
+{
+	// the characters accepted by read_fas_file in fas2bam.pl
+	switch(toupper(c))
+	{
+		case 'A': case 'C': case 'G': case 'T': case 'N': case 'R': case 'Y': case 'S': case 'W': case 'K': case 'M': case 'B':
+			return true;
+		default:
+			return false;
+	}
+}
+
+int baseIndex(char c)
+{
+	switch(toupper(c))
+	{
+		case 'A': return 0;
+		case 'C': return 1;
+		case 'G': return 2;
+		case 'T': return 3;
+		default: return 4;
+	}
+}
+
+std::vector<std::pair<int, int>> chainedAnchors(const std::unordered_map<unsigned long long, int>& referenceKMers, const std::string& sequence)
+{
+	// (reference position, sequence position) of shared unique k-mers, longest chain increasing in both coordinates
+	std::vector<std::pair<int, int>> hits;
+	if(referenceKMers.size() == 0)
+		return hits;
+
+	unsigned long long mask = (1ULL << (2 * kMerSize)) - 1;
+	unsigned long long kMer = 0;
+	int validLength = 0;
+	for(int seqI = 0; seqI < (int)sequence.length(); seqI++)
+	{
+		int b = baseIndex(sequence.at(seqI));
+		if(b > 3)
+		{
+			validLength = 0;
+			kMer = 0;
+			continue;
+		}
+		kMer = ((kMer << 2) | b) & mask;
+		validLength++;
+		if(validLength >= kMerSize)
+		{
+			auto found = referenceKMers.find(kMer);
+			if(found != referenceKMers.end())
+			{
+				hits.push_back(std::make_pair(found->second, seqI - kMerSize + 1));
+			}
+		}
+	}
+
+	std::sort(hits.begin(), hits.end());
+	std::vector<int> tailIndex;
+	std::vector<int> previous(hits.size(), -1);
+	for(int hitI = 0; hitI < (int)hits.size(); hitI++)
+	{
+		int sequencePosition = hits.at(hitI).second;
+		int lower = 0;
+		int upper = tailIndex.size();
+		while(lower < upper)
+		{
+			int middle = (lower + upper) / 2;
+			if(hits.at(tailIndex.at(middle)).second < sequencePosition)
+				lower = middle + 1;
+			else
+				upper = middle;
+		}
+		if(lower > 0)
+			previous.at(hitI) = tailIndex.at(lower - 1);
+		if(lower == (int)tailIndex.size())
+			tailIndex.push_back(hitI);
+		else
+			tailIndex.at(lower) = hitI;
+	}
+
+	std::vector<std::pair<int, int>> chain;
+	for(int hitI = (tailIndex.size() ? tailIndex.back() : -1); hitI != -1; hitI = previous.at(hitI))
+	{
+		chain.push_back(hits.at(hitI));
+	}
+	std::reverse(chain.begin(), chain.end());
+	return chain;
+}
+
+std::vector<int> alignToGraph(const poaGraph& graph, const std::string& sequence, const std::vector<std::pair<int, int>>& anchors, std::string& failure)
+{
+	int L = sequence.length();
+	std::vector<int> order = graph.topologicalOrder();
+	std::vector<int> orderIndex(graph.nodes.size());
+	for(size_t orderI = 0; orderI < order.size(); orderI++)
+	{
+		orderIndex.at(order.at(orderI)) = orderI;
+	}
+
+	// bands
+	bool fullBand = (anchors.size() == 0) || (L <= 2 * bandWidth + 1);
+	std::vector<bandRow> rows(order.size());
+	long long n_cells = 0;
+	for(size_t orderI = 0; orderI < order.size(); orderI++)
+	{
+		const poaNode& node = graph.nodes.at(order.at(orderI));
+		bandRow& row = rows.at(orderI);
+		if(fullBand)
+		{
+			row.lo = 1;
+			row.hi = L;
+		}
+		else
+		{
+			// anchors around the node's reference coordinate: expected sequence position is coordinate - diagonal
+			auto next = std::upper_bound(anchors.begin(), anchors.end(), std::make_pair(node.coordinate, INT_MAX));
+			const std::pair<int, int>& after = (next == anchors.end()) ? anchors.back() : *next;
+			const std::pair<int, int>& before = (next == anchors.begin()) ? anchors.front() : *(next - 1);
+			int expected_before = node.coordinate - (before.first - before.second) + 1;
+			int expected_after = node.coordinate - (after.first - after.second) + 1;
+			row.lo = std::max(1, std::min(expected_before, expected_after) - bandWidth);
+			row.hi = std::min(L, std::max(expected_before, expected_after) + bandWidth);
+		}
+		if(row.hi >= row.lo)
+		{
+			n_cells += row.hi - row.lo + 1;
+		}
+	}
+	if(fullBand && (anchors.size() == 0) && (L > 2 * bandWidth + 1) && (n_cells > maxCells))
+	{
+		failure = "no reference anchors and too long for a full DP";
+		return std::vector<int>();
+	}
+	if(n_cells > maxCells)
+	{
+		failure = "DP with " + std::to_string(n_cells) + " cells exceeds --maxCells";
+		return std::vector<int>();
+	}
+
+	// substitution profile per base: profile[b][j] = score of node base b against sequence character j (1-based)
+	std::vector<std::vector<int>> profile(5, std::vector<int>(L + 1, 0));
+	for(int b = 0; b < 5; b++)
+	{
+		for(int j = 1; j <= L; j++)
+		{
+			int s = baseIndex(sequence.at(j - 1));
+			profile[b][j] = ((b == 4) || (s == 4)) ? 0 : ((b == s) ? scoreMatch : scoreMismatch);
+		}
+	}
+
+	// virtual start: any node can be the first node of the alignment, preceded by inserted sequence characters
+	auto startScore = [&](int j) -> int {
+		return (j == 0) ? 0 : -(scoreGapOpen + scoreGapExtend * j);
+	};
+
+	std::vector<int> M;
+	for(size_t orderI = 0; orderI < order.size(); orderI++)
+	{
+		const poaNode& node = graph.nodes.at(order.at(orderI));
+		bandRow& row = rows.at(orderI);
+		if(row.hi < row.lo)
+			continue;
+		int width = row.hi - row.lo + 1;
+		row.H.assign(width, NEG_INF);
+		row.E.assign(width, NEG_INF);
+		row.F.assign(width, NEG_INF);
+		M.assign(width, NEG_INF);
+		const int* p = profile[baseIndex(node.base)].data() + row.lo;
+
+		int* Mp = M.data();
+		int* Fp = row.F.data();
+		for(int k = 0; k < width; k++)
+		{
+			Mp[k] = startScore(row.lo + k - 1) + p[k];
+			Fp[k] = startScore(row.lo + k) - scoreGapOpen - scoreGapExtend;
+		}
+
+		for(int predecessor : node.in)
+		{
+			const bandRow& predecessorRow = rows.at(orderIndex.at(predecessor));
+			if(predecessorRow.hi < predecessorRow.lo)
+				continue;
+
+			// match: H[pred][j-1], j in [max(lo, predLo + 1), min(hi, predHi + 1)]
+			int first = std::max(row.lo, predecessorRow.lo + 1);
+			int last = std::min(row.hi, predecessorRow.hi + 1);
+			if(first <= last)
+			{
+				const int* Hpred = predecessorRow.H.data() + (first - 1 - predecessorRow.lo);
+				int* Mk = Mp + (first - row.lo);
+				const int* pk = p + (first - row.lo);
+				int n = last - first + 1;
+				for(int k = 0; k < n; k++)
+				{
+					Mk[k] = std::max(Mk[k], Hpred[k] + pk[k]);
+				}
+			}
+
+			// deletion of this node: H[pred][j], F[pred][j], j in [max(lo, predLo), min(hi, predHi)]
+			first = std::max(row.lo, predecessorRow.lo);
+			last = std::min(row.hi, predecessorRow.hi);
+			if(first <= last)
+			{
+				const int* Hpred = predecessorRow.H.data() + (first - predecessorRow.lo);
+				const int* Fpred = predecessorRow.F.data() + (first - predecessorRow.lo);
+				int* Fk = Fp + (first - row.lo);
+				int n = last - first + 1;
+				for(int k = 0; k < n; k++)
+				{
+					Fk[k] = std::max(Fk[k], std::max(Hpred[k] - scoreGapOpen - scoreGapExtend, Fpred[k] - scoreGapExtend));
+				}
+			}
+		}
+
+		int* Hp = row.H.data();
+		for(int k = 0; k < width; k++)
+		{
+			Hp[k] = std::max(Mp[k], Fp[k]);
+		}
+
+		// insertions after this node depend on the previous column of the same row
+		int* Ep = row.E.data();
+		for(int k = 1; k < width; k++)
+		{
+			Ep[k] = std::max(Hp[k - 1] - scoreGapOpen - scoreGapExtend, Ep[k - 1] - scoreGapExtend);
+			Hp[k] = std::max(Hp[k], Ep[k]);
+		}
+	}
+
+	// best end: any node, all sequence characters consumed
+	int bestOrderI = -1;
+	int bestScore = NEG_INF;
+	for(size_t orderI = 0; orderI < order.size(); orderI++)
+	{
+		const bandRow& row = rows.at(orderI);
+		if((row.hi == L) && (row.lo <= L) && (row.H.at(L - row.lo) > bestScore))
+		{
+			bestScore = row.H.at(L - row.lo);
+			bestOrderI = orderI;
+		}
+	}
+	if(bestOrderI == -1)
+	{
+		failure = "no alignment within the band";
+		return std::vector<int>();
+	}
+
+	// traceback
+	std::vector<int> alignedNodes(L, -1);
+	int orderI = bestOrderI;
+	int j = L;
+	char state = 'H';
+	auto touchesBand = [&](const bandRow& row, int j) -> bool {
+		return (!fullBand) && (((j == row.lo) && (row.lo > 1)) || ((j == row.hi) && (row.hi < L)));
+	};
+	while(j > 0)
+	{
+		if(orderI == -1)
+		{
+			// sequence characters before the first node are inserted
+			break;
+		}
+		const bandRow& row = rows.at(orderI);
+		const poaNode& node = graph.nodes.at(order.at(orderI));
+		if(touchesBand(row, j))
+		{
+			failure = "alignment touches the band boundary";
+			return std::vector<int>();
+		}
+		int p = profile[baseIndex(node.base)][j];
+
+		if(state == 'H')
+		{
+			int h = row.at(row.H, j);
+			if(h == row.at(row.E, j))
+			{
+				state = 'E';
+				continue;
+			}
+			if(h == row.at(row.F, j))
+			{
+				state = 'F';
+				continue;
+			}
+			// match from the virtual start or from a predecessor
+			alignedNodes.at(j - 1) = order.at(orderI);
+			if(h == startScore(j - 1) + p)
+			{
+				orderI = -1;
+				j--;
+				continue;
+			}
+			bool found = false;
+			for(int predecessor : node.in)
+			{
+				const bandRow& predecessorRow = rows.at(orderIndex.at(predecessor));
+				if(predecessorRow.at(predecessorRow.H, j - 1) + p == h)
+				{
+					orderI = orderIndex.at(predecessor);
+					found = true;
+					break;
+				}
+			}
+			assert(found);
+			j--;
+		}
+		else if(state == 'E')
+		{
+			int e = row.at(row.E, j);
+			state = (e == row.at(row.H, j - 1) - scoreGapOpen - scoreGapExtend) ? 'H' : 'E';
+			j--;
+		}
+		else
+		{
+			assert(state == 'F');
+			int f = row.at(row.F, j);
+			if(f == startScore(j) - scoreGapOpen - scoreGapExtend)
+			{
+				orderI = -1;
+				continue;
+			}
+			bool found = false;
+			for(int predecessor : node.in)
+			{
+				const bandRow& predecessorRow = rows.at(orderIndex.at(predecessor));
+				if(predecessorRow.at(predecessorRow.H, j) - scoreGapOpen - scoreGapExtend == f)
+				{
+					orderI = orderIndex.at(predecessor);
+					state = 'H';
+					found = true;
+					break;
+				}
+				if(predecessorRow.at(predecessorRow.F, j) - scoreGapExtend == f)
+				{
+					orderI = orderIndex.at(predecessor);
+					state = 'F';
+					found = true;
+					break;
+				}
+			}
+			assert(found);
+		}
+	}
+
+	return alignedNodes;
+}
+
+std::vector<int> mergeIntoGraph(poaGraph& graph, const std::string& sequence, const std::vector<int>& alignedNodes)
+{
+	// returns the graph node of each sequence character
+	std::vector<int> path(sequence.length(), -1);
+
+	// coordinates for inserted characters: the coordinate of the preceding aligned node (or of the first aligned node)
+	int coordinate = 0;
+	for(int node : alignedNodes)
+	{
+		if(node != -1)
+		{
+			coordinate = graph.nodes.at(node).coordinate;
+			break;
+		}
+	}
+
+	for(size_t seqI = 0; seqI < sequence.length(); seqI++)
+	{
+		char base = toupper(sequence.at(seqI));
+		int alignedNode = alignedNodes.at(seqI);
+		int node = -1;
+		if(alignedNode == -1)
+		{
+			node = graph.addNode(base, coordinate);
+		}
+		else
+		{
+			coordinate = graph.nodes.at(alignedNode).coordinate;
+			if(graph.nodes.at(alignedNode).base == base)
+			{
+				node = alignedNode;
+			}
+			else
+			{
+				for(int other : graph.nodes.at(alignedNode).alignedTo)
+				{
+					if(graph.nodes.at(other).base == base)
+					{
+						node = other;
+						break;
+					}
+				}
+				if(node == -1)
+				{
+					node = graph.addNode(base, coordinate);
+					std::vector<int> group = graph.nodes.at(alignedNode).alignedTo;
+					group.push_back(alignedNode);
+					for(int other : group)
+					{
+						graph.nodes.at(other).alignedTo.push_back(node);
+						graph.nodes.at(node).alignedTo.push_back(other);
+					}
+				}
+			}
+		}
+		if(seqI > 0)
+		{
+			graph.addEdge(path.at(seqI - 1), node);
+		}
+		path.at(seqI) = node;
+	}
+
+	return path;
+}